@@ -15,12 +15,14 @@
  */
 
 #include <assert.h>
+#include <arpa/inet.h>
 #include <uv.h>
 #include <contrib/cleanup.h>
 #include <libknot/descriptor.h>
 
 #include "lib/cache.h"
 #include "lib/cdb.h"
+#include "lib/dnssec.h"
 #include "daemon/bindings.h"
 #include "daemon/worker.h"
 
@@ -330,6 +332,57 @@ static int net_pipeline(lua_State *L)
 	return 1;
 }
 
+/** @internal Set rate limiting parameter from table field. */
+static void net_ratelimit_field(lua_State *L, const char *name, unsigned max, void *dst, size_t size)
+{
+	lua_getfield(L, 1, name);
+	if (lua_isnumber(L, -1)) {
+		lua_Integer val = lua_tointeger(L, -1);
+		if (val < 0 || val > max) {
+			format_error(L, "ratelimit value out of range");
+			lua_error(L);
+		}
+		if (size == sizeof(uint8_t)) {
+			*(uint8_t *)dst = val;
+		} else {
+			*(uint32_t *)dst = val;
+		}
+	}
+	lua_pop(L, 1);
+}
+
+/** Get/set response rate limiting. */
+static int net_ratelimit(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	struct rrl *rrl = &worker->rrl;
+	if (lua_istable(L, 1)) {
+		net_ratelimit_field(L, "rate", UINT16_MAX * 16, &rrl->rate, sizeof(rrl->rate));
+		net_ratelimit_field(L, "qps", UINT16_MAX * 16, &rrl->qps, sizeof(rrl->qps));
+		net_ratelimit_field(L, "v4", 32, &rrl->v4_mask, sizeof(rrl->v4_mask));
+		net_ratelimit_field(L, "v6", 128, &rrl->v6_mask, sizeof(rrl->v6_mask));
+		net_ratelimit_field(L, "slip", UINT8_MAX, &rrl->slip, sizeof(rrl->slip));
+	} else if (lua_gettop(L) > 0) {
+		format_error(L, "expected 'ratelimit({ rate = n, qps = n, v4 = len, v6 = len, slip = n })'");
+		lua_error(L);
+	}
+	lua_newtable(L);
+	lua_pushnumber(L, rrl->rate);
+	lua_setfield(L, -2, "rate");
+	lua_pushnumber(L, rrl->qps);
+	lua_setfield(L, -2, "qps");
+	lua_pushnumber(L, rrl->v4_mask);
+	lua_setfield(L, -2, "v4");
+	lua_pushnumber(L, rrl->v6_mask);
+	lua_setfield(L, -2, "v6");
+	lua_pushnumber(L, rrl->slip);
+	lua_setfield(L, -2, "slip");
+	return 1;
+}
+
 int lib_net(lua_State *L)
 {
 	static const luaL_Reg lib[] = {
@@ -339,6 +392,7 @@ int lib_net(lua_State *L)
 		{ "interfaces",   net_interfaces },
 		{ "bufsize",      net_bufsize },
 		{ "tcp_pipeline", net_pipeline },
+		{ "ratelimit",    net_ratelimit },
 		{ NULL, NULL }
 	};
 	register_lib(L, "net", lib);
@@ -597,6 +651,10 @@ static int cache_clear(lua_State *L)
 	lru_deinit(engine->resolver.cache_rep);
 	lru_init(engine->resolver.cache_rtt, LRU_RTT_SIZE);
 	lru_init(engine->resolver.cache_rep, LRU_REP_SIZE);
+	/* Clear delegation cache */
+	lru_deinit(engine->resolver.cache_cut);
+	lru_init(engine->resolver.cache_cut, LRU_CUT_SIZE);
+	engine->resolver.cache_cut->evict = kr_zonecut_lru_evict;
 	lua_pushboolean(L, true);
 	return 1;
 }
@@ -1025,6 +1083,57 @@ static int wrk_stats(lua_State *L)
 	lua_setfield(L, -2, "dropped");
 	lua_pushnumber(L, worker->stats.timeout);
 	lua_setfield(L, -2, "timeout");
+	lua_pushnumber(L, worker->stats.retransmit);
+	lua_setfield(L, -2, "retransmit");
+	lua_pushnumber(L, worker->stats.retransmit_spurious);
+	lua_setfield(L, -2, "retransmit_spurious");
+	lua_pushnumber(L, worker->stats.sidequeries);
+	lua_setfield(L, -2, "sidequeries");
+	lua_pushnumber(L, worker->stats.throttled);
+	lua_setfield(L, -2, "throttled");
+	lua_pushnumber(L, worker->stats.queued);
+	lua_setfield(L, -2, "queued");
+	lua_pushnumber(L, worker->stats.queue_wait);
+	lua_setfield(L, -2, "queue_wait");
+	lua_pushnumber(L, worker->stats.race);
+	lua_setfield(L, -2, "race");
+	lua_pushnumber(L, worker->rrl.stats.slipped);
+	lua_setfield(L, -2, "rrl_slip");
+	lua_pushnumber(L, worker->rrl.stats.dropped);
+	lua_setfield(L, -2, "rrl_drop");
+	static const char *rrl_classes[RRL_CLASS_COUNT] = {
+		"rrl_query", "rrl_answer", "rrl_nodata", "rrl_nxdomain", "rrl_error", "rrl_large"
+	};
+	for (unsigned i = 0; i < RRL_CLASS_COUNT; ++i) {
+		lua_pushnumber(L, worker->rrl.stats.classes[i]);
+		lua_setfield(L, -2, rrl_classes[i]);
+	}
+	lua_pushnumber(L, worker->stats.shed);
+	lua_setfield(L, -2, "shed");
+	lua_pushnumber(L, worker->stats.paused);
+	lua_setfield(L, -2, "paused");
+	lua_pushnumber(L, worker->stats.recv_delay);
+	lua_setfield(L, -2, "recv_delay");
+	/* Add DNSSEC validation cache counters. */
+	struct kr_dnssec_stats *dnssec_stats = kr_dnssec_stats();
+	lua_pushnumber(L, dnssec_stats->sig_hit);
+	lua_setfield(L, -2, "sig_hit");
+	lua_pushnumber(L, dnssec_stats->sig_miss);
+	lua_setfield(L, -2, "sig_miss");
+	lua_pushnumber(L, dnssec_stats->sig_offload);
+	lua_setfield(L, -2, "sig_offload");
+	lua_pushnumber(L, dnssec_stats->key_hit);
+	lua_setfield(L, -2, "key_hit");
+	lua_pushnumber(L, dnssec_stats->key_miss);
+	lua_setfield(L, -2, "key_miss");
+	lua_pushnumber(L, dnssec_stats->trust_hit);
+	lua_setfield(L, -2, "trust_hit");
+	lua_pushnumber(L, dnssec_stats->nsec3_hit);
+	lua_setfield(L, -2, "nsec3_hit");
+	lua_pushnumber(L, dnssec_stats->nsec3_miss);
+	lua_setfield(L, -2, "nsec3_miss");
+	lua_pushnumber(L, dnssec_stats->nsec3_over_limit);
+	lua_setfield(L, -2, "nsec3_over_limit");
 	/* Add subset of rusage that represents counters. */
 	uv_rusage_t rusage;
 	if (uv_getrusage(&rusage) == 0) {
@@ -1048,11 +1157,224 @@ static int wrk_stats(lua_State *L)
 	return 1;
 }
 
+/** Get/set per-upstream limits. */
+static int wrk_upstream_limit(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	if (lua_isnumber(L, 1)) {
+		int inflight = lua_tointeger(L, 1);
+		int qps = lua_isnumber(L, 2) ? lua_tointeger(L, 2) : (int)worker->upstreams.qps_max;
+		if (inflight < 0 || inflight > UINT16_MAX || qps < 0 || qps > 1000000) {
+			format_error(L, "expected 'upstream_limit(inflight <0, 65535>, qps <0, 1000000>)'");
+			lua_error(L);
+		}
+		worker->upstreams.inflight_max = inflight;
+		worker->upstreams.qps_max = qps;
+	}
+	lua_newtable(L);
+	lua_pushnumber(L, worker->upstreams.inflight_max);
+	lua_setfield(L, -2, "inflight");
+	lua_pushnumber(L, worker->upstreams.qps_max);
+	lua_setfield(L, -2, "qps");
+	return 1;
+}
+
+/** Get/set overload watermarks. */
+static int wrk_overload(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	if (lua_istable(L, 1)) {
+		static const char *keys[] = { "soft", "hard", "memory_soft", "memory_hard" };
+		size_t *vals[] = { &worker->overload.soft, &worker->overload.hard,
+		                   &worker->overload.memory_soft, &worker->overload.memory_hard };
+		for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+			lua_getfield(L, 1, keys[i]);
+			if (lua_isnumber(L, -1)) {
+				lua_Number val = lua_tonumber(L, -1);
+				if (val < 0) {
+					format_error(L, "overload watermarks must be positive (or 0 to disable)");
+					lua_error(L);
+				}
+				*vals[i] = (size_t)val;
+			}
+			lua_pop(L, 1);
+		}
+		lua_getfield(L, 1, "drop");
+		if (lua_isboolean(L, -1)) {
+			worker->overload.drop = lua_toboolean(L, -1);
+		}
+		lua_pop(L, 1);
+	} else if (lua_gettop(L) > 0) {
+		format_error(L, "expected 'overload({ soft = n, hard = n, memory_soft = bytes, memory_hard = bytes, drop = bool })'");
+		lua_error(L);
+	}
+	lua_newtable(L);
+	lua_pushnumber(L, worker->overload.soft);
+	lua_setfield(L, -2, "soft");
+	lua_pushnumber(L, worker->overload.hard);
+	lua_setfield(L, -2, "hard");
+	lua_pushnumber(L, worker->overload.memory_soft);
+	lua_setfield(L, -2, "memory_soft");
+	lua_pushnumber(L, worker->overload.memory_hard);
+	lua_setfield(L, -2, "memory_hard");
+	lua_pushboolean(L, worker->overload.drop);
+	lua_setfield(L, -2, "drop");
+	lua_pushboolean(L, worker->overload.paused);
+	lua_setfield(L, -2, "paused");
+	return 1;
+}
+
+/** Return state of the upstream addresses affected by limits. */
+static int wrk_upstreams(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker || !worker->upstreams.table) {
+		return 0;
+	}
+	char addr_str[INET6_ADDRSTRLEN];
+	upstream_lru_t *table = worker->upstreams.table;
+	lua_newtable(L);
+	for (uint32_t i = 0; i < table->size; ++i) {
+		struct upstream *up = &table->slots[i].data;
+		if (!table->slots[i].key || (up->inflight == 0 && up->queued == 0 && up->throttled == 0)) {
+			continue;
+		}
+		int family = table->slots[i].len == sizeof(struct in6_addr) ? AF_INET6 : AF_INET;
+		if (!inet_ntop(family, table->slots[i].key, addr_str, sizeof(addr_str))) {
+			continue;
+		}
+		lua_newtable(L);
+		lua_pushnumber(L, up->srtt);
+		lua_setfield(L, -2, "srtt");
+		lua_pushnumber(L, up->inflight);
+		lua_setfield(L, -2, "inflight");
+		lua_pushnumber(L, up->queued);
+		lua_setfield(L, -2, "queued");
+		lua_pushnumber(L, up->throttled);
+		lua_setfield(L, -2, "throttled");
+		lua_pushnumber(L, up->wait);
+		lua_setfield(L, -2, "wait");
+		lua_setfield(L, -2, addr_str);
+	}
+	return 1;
+}
+
+/** @internal Parse mirroring target 'addr[@port]'. */
+static int mirror_addr(struct sockaddr_storage *ss, const char *target)
+{
+	auto_free char *addr_str = strdup(target);
+	if (!addr_str) {
+		return kr_error(ENOMEM);
+	}
+	int port = 53;
+	char *port_str = strchr(addr_str, '@');
+	if (port_str) {
+		*port_str = '\0';
+		port = atoi(port_str + 1);
+		if (port <= 0 || port > UINT16_MAX) {
+			return kr_error(EINVAL);
+		}
+	}
+	memset(ss, 0, sizeof(*ss));
+	int family = kr_straddr_family(addr_str);
+	if (family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		return inet_pton(AF_INET6, addr_str, &sin6->sin6_addr) == 1 ? 0 : kr_error(EINVAL);
+	}
+	struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(port);
+	return inet_pton(AF_INET, addr_str, &sin->sin_addr) == 1 ? 0 : kr_error(EINVAL);
+}
+
+/** Add query mirroring target, or list the targets. */
+static int wrk_mirror(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	if (lua_isstring(L, 1)) {
+		struct sockaddr_storage ss;
+		uint32_t sample = 1;
+		bool tcp = false;
+		if (lua_istable(L, 2)) {
+			lua_getfield(L, 2, "sample");
+			if (lua_isnumber(L, -1)) {
+				lua_Number val = lua_tonumber(L, -1);
+				if (val < 1 || val > UINT32_MAX) {
+					format_error(L, "mirror sampling must be at least 1 (mirror all queries)");
+					lua_error(L);
+				}
+				sample = val;
+			}
+			lua_pop(L, 1);
+			lua_getfield(L, 2, "tcp");
+			tcp = lua_toboolean(L, -1);
+			lua_pop(L, 1);
+		}
+		int ret = mirror_addr(&ss, lua_tostring(L, 1));
+		if (ret == 0) {
+			ret = mirror_add(&worker->mirror, worker->loop, (struct sockaddr *)&ss, sample, tcp);
+		}
+		if (ret < 0) {
+			format_error(L, kr_strerror(ret));
+			lua_error(L);
+		}
+		lua_pushnumber(L, ret);
+		return 1;
+	} else if (lua_gettop(L) > 0) {
+		format_error(L, "expected 'mirror(\"addr[@port]\", { sample = n, tcp = bool })'");
+		lua_error(L);
+	}
+	/* List targets in the order of their ids, ids start at 0 so the n-th target has id n - 1 */
+	char addr_str[INET6_ADDRSTRLEN];
+	lua_newtable(L);
+	for (unsigned i = 0; i < worker->mirror.count; ++i) {
+		struct mirror_target *target = worker->mirror.targets[i];
+		const struct sockaddr *addr = (const struct sockaddr *)&target->addr;
+		if (!inet_ntop(addr->sa_family, kr_inaddr(addr), addr_str, sizeof(addr_str))) {
+			addr_str[0] = '\0';
+		}
+		lua_newtable(L);
+		lua_pushnumber(L, i);
+		lua_setfield(L, -2, "id");
+		lua_pushstring(L, addr_str);
+		lua_setfield(L, -2, "addr");
+		lua_pushnumber(L, ntohs(((const struct sockaddr_in *)addr)->sin_port));
+		lua_setfield(L, -2, "port");
+		lua_pushboolean(L, target->tcp);
+		lua_setfield(L, -2, "tcp");
+		lua_pushnumber(L, target->sample);
+		lua_setfield(L, -2, "sample");
+		lua_pushnumber(L, target->stats.queued);
+		lua_setfield(L, -2, "queued");
+		lua_pushnumber(L, target->stats.sent);
+		lua_setfield(L, -2, "sent");
+		lua_pushnumber(L, target->stats.dropped);
+		lua_setfield(L, -2, "dropped");
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
 int lib_worker(lua_State *L)
 {
 	static const luaL_Reg lib[] = {
 		{ "resolve",  wrk_resolve },
 		{ "stats",    wrk_stats },
+		{ "upstream_limit", wrk_upstream_limit },
+		{ "upstreams", wrk_upstreams },
+		{ "overload", wrk_overload },
+		{ "mirror",   wrk_mirror },
 		{ NULL, NULL }
 	};
 	register_lib(L, "worker", lib);
@@ -3,6 +3,10 @@ kresd_SOURCES := \
 	daemon/network.c     \
 	daemon/engine.c      \
 	daemon/worker.c      \
+	daemon/rrl.c         \
+	daemon/upstream.c    \
+	daemon/overload.c    \
+	daemon/mirror.c      \
 	daemon/bindings.c    \
 	daemon/ffimodule.c   \
 	daemon/main.c
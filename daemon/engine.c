@@ -40,9 +40,6 @@
 /** @internal Annotate for static checkers. */
 KR_NORETURN int lua_error (lua_State *L);
 
-/* Cleanup engine state every 5 minutes */
-const size_t CLEANUP_TIMER = 5*60*1000;
-
 /*
  * Global bindings.
  */
@@ -449,6 +446,7 @@ static int init_resolver(struct engine *engine)
 	/* Open resolution context */
 	engine->resolver.trust_anchors = map_make();
 	engine->resolver.negative_anchors = map_make();
+	engine->resolver.forwarders = map_make();
 	engine->resolver.pool = engine->pool;
 	engine->resolver.modules = &engine->modules;
 	/* Create OPT RR */
@@ -461,7 +459,7 @@ static int init_resolver(struct engine *engine)
 	kr_zonecut_init(&engine->resolver.root_hints, (const uint8_t *)"", engine->pool);
 	kr_zonecut_set_sbelt(&engine->resolver, &engine->resolver.root_hints);
 	/* Open NS rtt + reputation cache */
-	engine->resolver.cache_rtt = mm_alloc(engine->pool, lru_size(kr_nsrep_lru_t, LRU_RTT_SIZE));
+	engine->resolver.cache_rtt = mm_alloc(engine->pool, lru_size(kr_nsrep_rtt_lru_t, LRU_RTT_SIZE));
 	if (engine->resolver.cache_rtt) {
 		lru_init(engine->resolver.cache_rtt, LRU_RTT_SIZE);
 	}
@@ -469,6 +467,12 @@ static int init_resolver(struct engine *engine)
 	if (engine->resolver.cache_rep) {
 		lru_init(engine->resolver.cache_rep, LRU_REP_SIZE);
 	}
+	/* Open delegation cache */
+	engine->resolver.cache_cut = mm_alloc(engine->pool, lru_size(kr_zonecut_lru_t, LRU_CUT_SIZE));
+	if (engine->resolver.cache_cut) {
+		lru_init(engine->resolver.cache_cut, LRU_CUT_SIZE);
+		engine->resolver.cache_cut->evict = kr_zonecut_lru_evict;
+	}
 
 	/* Load basic modules */
 	engine_register(engine, "iterate", NULL, NULL);
@@ -519,22 +523,6 @@ static int init_state(struct engine *engine)
 	return kr_ok();
 }
 
-static void update_state(uv_timer_t *handle)
-{
-	struct engine *engine = handle->data;
-
-	/* Walk RTT table, clearing all entries with bad score
-	 * to compensate for intermittent network issues or temporary bad behaviour. */
-	kr_nsrep_lru_t *table = engine->resolver.cache_rtt;
-	for (size_t i = 0; i < table->size; ++i) {
-		if (!table->slots[i].key)
-			continue;
-		if (table->slots[i].data > KR_NS_LONG) {
-			lru_evict(table, i);
-		}
-	}
-}
-
 int engine_init(struct engine *engine, knot_mm_t *pool)
 {
 	if (engine == NULL) {
@@ -587,6 +575,7 @@ void engine_deinit(struct engine *engine)
 	kr_cache_close(&engine->resolver.cache);
 	lru_deinit(engine->resolver.cache_rtt);
 	lru_deinit(engine->resolver.cache_rep);
+	lru_deinit(engine->resolver.cache_cut);
 
 	/* Clear IPC pipes */
 	for (size_t i = 0; i < engine->ipc_set.len; ++i) {
@@ -607,6 +596,7 @@ void engine_deinit(struct engine *engine)
 	array_clear(engine->ipc_set);
 	kr_ta_clear(&engine->resolver.trust_anchors);
 	kr_ta_clear(&engine->resolver.negative_anchors);
+	kr_nsrep_group_del(&engine->resolver, NULL);
 }
 
 int engine_pcall(lua_State *L, int argc)
@@ -711,22 +701,11 @@ int engine_start(struct engine *engine, const char *config_path)
 	lua_gc(engine->L, LUA_GCSETPAUSE, 400);
 	lua_gc(engine->L, LUA_GCRESTART, 0);
 
-	/* Set up periodic update function */
-	uv_timer_t *timer = malloc(sizeof(*timer));
-	if (timer) {
-		uv_timer_init(uv_default_loop(), timer);
-		timer->data = engine;
-		engine->updater = timer;
-		uv_timer_start(timer, update_state, CLEANUP_TIMER, CLEANUP_TIMER);
-	}
-
 	return kr_ok();
 }
 
 void engine_stop(struct engine *engine)
 {
-	uv_timer_stop(engine->updater);
-	uv_close((uv_handle_t *)engine->updater, (uv_close_cb) free);
 	uv_stop(uv_default_loop());
 }
 
@@ -23,6 +23,12 @@
 #ifndef LRU_REP_SIZE
 #define LRU_REP_SIZE (LRU_RTT_SIZE / 4) /**< NS reputation cache size */
 #endif
+#ifndef LRU_CUT_SIZE
+#define LRU_CUT_SIZE (LRU_RTT_SIZE / 16) /**< Delegation cache size */
+#endif
+#ifndef LRU_RTO_SIZE
+#define LRU_RTO_SIZE (LRU_RTT_SIZE / 4) /**< Upstream state (retransmit timer, limits) cache size */
+#endif
 #ifndef MP_FREELIST_SIZE
 #define MP_FREELIST_SIZE 64 /**< Maximum length of the worker mempool freelist */
 #endif
@@ -32,6 +38,9 @@
 #ifndef QUERY_RATE_THRESHOLD
 #define QUERY_RATE_THRESHOLD (2 * MP_FREELIST_SIZE) /**< Nr of parallel queries considered as high rate */
 #endif
+#ifndef SIDEQUERY_QUEUE_LEN
+#define SIDEQUERY_QUEUE_LEN 64 /**< Side queries waiting to be spawned from the event loop */
+#endif
 #ifndef MAX_PIPELINED
 #define MAX_PIPELINED 100
 #endif
@@ -55,7 +64,6 @@ struct engine {
     array_t(const struct kr_cdb_api *) backends;
     fd_array_t ipc_set;
     knot_mm_t *pool;
-    uv_timer_t *updater;
     struct lua_State *L;
 };
 
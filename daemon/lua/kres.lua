@@ -108,6 +108,8 @@ struct query_flag {
 	static const int ALWAYS_CUT  = 1 << 18;
 	static const int PERMISSIVE  = 1 << 20;
 	static const int STRICT      = 1 << 21;
+	static const int DNSSEC_ASYNC = 1 << 22;
+	static const int RACE        = 1 << 23;
 };
 
 /*
@@ -233,12 +235,72 @@ struct kr_context
 	map_t negative_anchors;
 	uint8_t _stub[]; /* Do not touch */
 };
+struct kr_nsrep_group {
+	struct {
+		size_t queries;
+		size_t answered;
+		size_t failover;
+		size_t servfail;
+	} stats;
+	size_t count;
+	uint8_t _stub[]; /* Do not touch */
+};
+enum kr_policy_type {
+	KR_POLICY_ALL = 0,
+	KR_POLICY_SUFFIX,
+	KR_POLICY_PATTERN,
+	KR_POLICY_RPZ,
+	KR_POLICY_EXTERN,
+	KR_POLICY_FILTER
+};
+struct kr_policy_query {
+	const knot_dname_t *qname;
+	const struct sockaddr *src;
+	const struct sockaddr *dst;
+	uint16_t qtype;
+	uint64_t stamp;
+};
+struct kr_policy_rule {
+	int type;
+	int action;
+	size_t count;
+	bool suspended;
+	size_t entries;
+	size_t mapped;
+	uint8_t _stub[]; /* Do not touch */
+};
+typedef struct {
+	struct kr_policy_rule **at;
+	size_t len;
+	size_t cap;
+} kr_policy_set_t;
+struct kr_policy_net;
+struct kr_policy_renumber;
+enum kr_policy_pred_type {
+	KR_POLICY_PRED_QNAME = 0,
+	KR_POLICY_PRED_QTYPE,
+	KR_POLICY_PRED_SRC,
+	KR_POLICY_PRED_DST
+};
+enum kr_policy_op {
+	KR_POLICY_OP_TEST = 0,
+	KR_POLICY_OP_AND,
+	KR_POLICY_OP_OR,
+	KR_POLICY_OP_NOT
+};
+struct kr_policy_pred {
+	int type;
+	size_t count;
+	uint8_t _stub[]; /* Do not touch */
+};
 
 /*
  * libc APIs
  */
 void free(void *ptr);
 int inet_pton(int af, const char *src, void *dst);
+char *strerror(int errnum);
+int gettimeofday(struct timeval *tv, void *tz);
 
 /*
  * libknot APIs
@@ -278,6 +340,40 @@ struct kr_query *kr_rplan_resolved(struct kr_rplan *rplan);
 struct kr_query *kr_rplan_next(struct kr_query *qry);
 /* Nameservers */
 int kr_nsrep_set(struct kr_query *qry, uint8_t *addr, size_t addr_len);
+int kr_nsrep_group_add(struct kr_context *ctx, const char *name, const char *addr, uint16_t port);
+int kr_nsrep_group_set(struct kr_context *ctx, const char *name, const char **addrs, const uint16_t *ports, size_t count);
+struct kr_nsrep_group *kr_nsrep_group_get(struct kr_context *ctx, const char *name);
+int kr_nsrep_forward(struct kr_query *qry, struct kr_context *ctx, const char *name);
+/* Policy rules */
+struct kr_policy_rule *kr_policy_rule_new(int type, int action);
+void kr_policy_rule_free(struct kr_policy_rule *rule);
+int kr_policy_rule_add(struct kr_policy_rule *rule, const char *name, size_t len, int action);
+int kr_policy_rule_common(struct kr_policy_rule *rule, const char *suffix, size_t len);
+int kr_policy_rule_pattern(struct kr_policy_rule *rule, const char *pattern, size_t len);
+int kr_policy_rule_del(struct kr_policy_rule *rule, const char *name, size_t len);
+int kr_policy_rule_load(struct kr_policy_rule *rule, const char *path);
+int kr_policy_rule_save(const struct kr_policy_rule *rule, const char *path);
+int kr_policy_rule_swap(struct kr_policy_rule *rule, struct kr_policy_rule *next);
+int kr_policy_rule_changed(struct kr_policy_rule *rule, const char *path);
+int kr_policy_rule_match(const struct kr_policy_rule *rule, const knot_dname_t *qname);
+int kr_policy_rule_eval(const struct kr_policy_rule *rule, const struct kr_policy_query *query);
+int kr_policy_rule_insn(struct kr_policy_rule *rule, int op, unsigned skip, struct kr_policy_pred *pred);
+struct kr_policy_pred *kr_policy_pred_new(int type, const void *match, uint16_t qtype);
+void kr_policy_pred_free(struct kr_policy_pred *pred);
+int kr_policy_set_push(kr_policy_set_t *set, struct kr_policy_rule *rule);
+void kr_policy_set_clear(kr_policy_set_t *set);
+int kr_policy_eval(kr_policy_set_t *set, size_t from, const struct kr_policy_query *query, int *action);
+struct kr_policy_net *kr_policy_net_new(void);
+void kr_policy_net_free(struct kr_policy_net *net);
+int kr_policy_net_add(struct kr_policy_net *net, const char *subnet, int value);
+int kr_policy_net_del(struct kr_policy_net *net, const char *subnet);
+int kr_policy_net_load(struct kr_policy_net *net, const char *path, int value);
+int kr_policy_net_match(const struct kr_policy_net *net, const struct sockaddr *addr);
+struct kr_policy_renumber *kr_policy_renumber_new(void);
+void kr_policy_renumber_free(struct kr_policy_renumber *tbl);
+int kr_policy_renumber_add(struct kr_policy_renumber *tbl, const char *subnet, const char *target);
+int kr_policy_renumber_name(struct kr_policy_renumber *tbl, const knot_dname_t *name, const char *target);
+int kr_policy_renumber_apply(const struct kr_policy_renumber *tbl, knot_pkt_t *pkt);
 /* Query */
 /* Utils */
 unsigned kr_rand_uint(unsigned max);
@@ -304,6 +400,9 @@ bool kr_dnssec_key_revoked(const uint8_t *dnskey_rdata);
 int kr_dnssec_key_tag(uint16_t rrtype, const uint8_t *rdata, size_t rdlen);
 int kr_dnssec_key_match(const uint8_t *key_a_rdata, size_t key_a_rdlen,
                         const uint8_t *key_b_rdata, size_t key_b_rdlen);
+/* Daemon */
+struct worker_ctx;
+int worker_mirror(struct worker_ctx *worker, int id, const uint8_t *wire, size_t len);
 ]]
 
 -- Metatype for sockaddr
@@ -418,6 +517,9 @@ ffi.metatype( kr_query_t, {
 			if ns ~= nil then C.kr_nsrep_set(qry, ffi.cast(ub_t, ns), #ns) end
 			-- @todo: Return list of NS entries, not possible ATM because the NSLIST is union and missing typedef
 		end,
+		forward = function(qry, group)
+			return C.kr_nsrep_forward(qry, ffi.cast('struct kr_context *', __engine), group) == 0
+		end,
 	},
 })
 -- Metatype for request
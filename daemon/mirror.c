@@ -0,0 +1,356 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <contrib/ucw/lib.h>
+
+#include "lib/defines.h"
+#include "lib/utils.h"
+#include "daemon/mirror.h"
+
+static inline uint8_t *slot_at(struct mirror_target *target, uint32_t i)
+{
+	return target->slots + ((target->head + i) % MIRROR_QUEUE_LEN) * MIRROR_MSG_MAX;
+}
+
+static inline uint16_t slot_len(struct mirror_target *target, uint32_t i)
+{
+	return target->lens[(target->head + i) % MIRROR_QUEUE_LEN];
+}
+
+static inline void queue_pop(struct mirror_target *target, uint32_t count)
+{
+	target->head = (target->head + count) % MIRROR_QUEUE_LEN;
+	target->len -= count;
+}
+
+static void queue_drop(struct mirror_target *target)
+{
+	target->stats.dropped += target->len;
+	queue_pop(target, target->len);
+}
+
+static void flush_udp(struct mirror_target *target)
+{
+#if __linux__
+	struct mmsghdr msgs[MIRROR_BATCH];
+	struct iovec iov[MIRROR_BATCH];
+	while (target->len > 0) {
+		const unsigned count = MIN(target->len, MIRROR_BATCH);
+		memset(msgs, 0, count * sizeof(msgs[0]));
+		for (unsigned i = 0; i < count; ++i) {
+			iov[i].iov_base = slot_at(target, i);
+			iov[i].iov_len = slot_len(target, i);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int ret = sendmmsg(target->fd, msgs, count, 0);
+#else
+	while (target->len > 0) {
+		int ret = send(target->fd, slot_at(target, 0), slot_len(target, 0), 0);
+		if (ret >= 0) {
+			ret = 1;
+		}
+#endif
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				break; /* Retry in the next loop iteration */
+			}
+			/* Drop the copy that couldn't be sent (i.e. ICMP unreachable) */
+			target->stats.dropped += 1;
+			queue_pop(target, 1);
+			continue;
+		}
+		target->stats.sent += ret;
+		queue_pop(target, ret);
+	}
+}
+
+static int addr_len(const struct sockaddr *addr)
+{
+	switch (addr->sa_family) {
+	case AF_INET:  return sizeof(struct sockaddr_in);
+	case AF_INET6: return sizeof(struct sockaddr_in6);
+	default:       return 0;
+	}
+}
+
+/** @internal Close TCP connection, reconnect is attempted after a delay. */
+static void tcp_close(struct mirror_target *target, uv_loop_t *loop)
+{
+	if (target->handle) {
+		target->handle->data = NULL;
+		uv_close((uv_handle_t *)target->handle, (uv_close_cb) free);
+		target->handle = NULL;
+	}
+	target->state = MIRROR_TCP_CLOSED;
+	target->retry = uv_now(loop) + MIRROR_TCP_RETRY;
+}
+
+static void tcp_on_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf)
+{
+	/* Target isn't expected to answer, the data is read only to notice the connection closing. */
+	static char discard[512];
+	*buf = uv_buf_init(discard, sizeof(discard));
+}
+
+static void tcp_on_read(uv_stream_t *handle, ssize_t nread, const uv_buf_t *buf)
+{
+	struct mirror_target *target = handle->data;
+	if (target && nread < 0) {
+		tcp_close(target, handle->loop);
+	}
+}
+
+static void tcp_on_connect(uv_connect_t *req, int status)
+{
+	uv_stream_t *handle = req->handle;
+	struct mirror_target *target = handle->data;
+	uv_loop_t *loop = handle->loop;
+	free(req);
+	if (!target) {
+		return; /* Closed meanwhile */
+	}
+	if (status != 0 || uv_read_start(handle, tcp_on_alloc, tcp_on_read) != 0) {
+		tcp_close(target, loop);
+		return;
+	}
+	target->state = MIRROR_TCP_CONNECTED;
+}
+
+static void tcp_connect(struct mirror_target *target, uv_loop_t *loop)
+{
+	uv_tcp_t *handle = malloc(sizeof(*handle));
+	uv_connect_t *req = malloc(sizeof(*req));
+	if (!handle || !req || uv_tcp_init(loop, handle) != 0) {
+		free(handle);
+		free(req);
+		target->retry = uv_now(loop) + MIRROR_TCP_RETRY;
+		return;
+	}
+	handle->data = target;
+	target->handle = handle;
+	target->state = MIRROR_TCP_CONNECTING;
+	if (uv_tcp_connect(req, handle, (struct sockaddr *)&target->addr, tcp_on_connect) != 0) {
+		free(req);
+		tcp_close(target, loop);
+	}
+}
+
+static void tcp_on_write(uv_write_t *req, int status)
+{
+	struct mirror_target *target = req->handle->data;
+	if (target && status != 0) {
+		tcp_close(target, req->handle->loop);
+	}
+	free(req);
+}
+
+static void flush_tcp(struct mirror_target *target, uv_loop_t *loop)
+{
+	switch (target->state) {
+	case MIRROR_TCP_CONNECTING:
+		return; /* Keep copies until connected */
+	case MIRROR_TCP_CLOSED:
+		queue_drop(target);
+		if (uv_now(loop) >= target->retry) {
+			tcp_connect(target, loop);
+		}
+		return;
+	default:
+		break;
+	}
+	/* Never buffer more than a bounded amount for a slow target */
+	if (target->handle->write_queue_size > MIRROR_TCP_PENDING) {
+		queue_drop(target);
+		return;
+	}
+	/* Write copies framed with the length in a single buffer, at most MIRROR_TCP_WRITE bytes */
+	size_t size = 0;
+	uint32_t count = 0;
+	for (; count < target->len; ++count) {
+		const size_t framed = sizeof(uint16_t) + slot_len(target, count);
+		if (size + framed > MIRROR_TCP_WRITE) {
+			break;
+		}
+		size += framed;
+	}
+	uv_write_t *req = malloc(sizeof(*req) + size);
+	if (!req) {
+		queue_drop(target);
+		return;
+	}
+	uint8_t *data = (uint8_t *)(req + 1);
+	uint8_t *pos = data;
+	for (uint32_t i = 0; i < count; ++i) {
+		const uint16_t len = slot_len(target, i);
+		pos[0] = len >> 8;
+		pos[1] = len & 0xff;
+		memcpy(pos + sizeof(uint16_t), slot_at(target, i), len);
+		pos += sizeof(uint16_t) + len;
+	}
+	uv_buf_t buf = uv_buf_init((char *)data, size);
+	if (uv_write(req, (uv_stream_t *)target->handle, &buf, 1, tcp_on_write) != 0) {
+		free(req);
+		queue_drop(target);
+		tcp_close(target, loop);
+		return;
+	}
+	target->stats.sent += count;
+	queue_pop(target, count);
+}
+
+static void mirror_flush(uv_check_t *check)
+{
+	struct mirror *mirror = check->data;
+	bool pending = false;
+	for (unsigned i = 0; i < mirror->count; ++i) {
+		struct mirror_target *target = mirror->targets[i];
+		if (target->len == 0) {
+			continue;
+		}
+		if (target->tcp) {
+			flush_tcp(target, mirror->loop);
+		} else {
+			flush_udp(target);
+		}
+		pending = pending || (target->len > 0);
+	}
+	if (!pending) {
+		uv_check_stop(check);
+	}
+}
+
+static void target_free(struct mirror_target *target)
+{
+	if (target->fd >= 0) {
+		close(target->fd);
+	}
+	if (target->handle) {
+		target->handle->data = NULL;
+		uv_close((uv_handle_t *)target->handle, (uv_close_cb) free);
+	}
+	free(target->slots);
+	free(target);
+}
+
+static struct mirror_target *target_new(const struct sockaddr *addr, bool tcp)
+{
+	struct mirror_target *target = calloc(1, sizeof(*target));
+	if (!target) {
+		return NULL;
+	}
+	target->fd = -1;
+	target->tcp = tcp;
+	memcpy(&target->addr, addr, addr_len(addr));
+	target->slots = malloc(MIRROR_QUEUE_LEN * MIRROR_MSG_MAX);
+	if (!target->slots) {
+		target_free(target);
+		return NULL;
+	}
+	if (!tcp) {
+		target->fd = socket(addr->sa_family, SOCK_DGRAM, 0);
+		if (target->fd < 0 ||
+		    fcntl(target->fd, F_SETFL, fcntl(target->fd, F_GETFL) | O_NONBLOCK) != 0 ||
+		    connect(target->fd, addr, addr_len(addr)) != 0) {
+			const int err = errno;
+			target_free(target);
+			errno = err;
+			return NULL;
+		}
+	}
+	return target;
+}
+
+int mirror_add(struct mirror *mirror, uv_loop_t *loop, const struct sockaddr *addr, uint32_t sample, bool tcp)
+{
+	if (!mirror || !loop || !addr || addr_len(addr) == 0) {
+		return kr_error(EINVAL);
+	}
+	/* Reuse target with the same address and transport */
+	for (unsigned i = 0; i < mirror->count; ++i) {
+		struct mirror_target *target = mirror->targets[i];
+		if (target->tcp == tcp && memcmp(&target->addr, addr, addr_len(addr)) == 0) {
+			target->sample = sample;
+			return i;
+		}
+	}
+	if (mirror->count >= MIRROR_TARGETS) {
+		return kr_error(ENOSPC);
+	}
+	if (!mirror->loop) {
+		uv_check_init(loop, &mirror->flush);
+		uv_unref((uv_handle_t *)&mirror->flush);
+		mirror->flush.data = mirror;
+		mirror->loop = loop;
+	}
+	struct mirror_target *target = target_new(addr, tcp);
+	if (!target) {
+		return kr_error(errno ? errno : ENOMEM);
+	}
+	target->sample = sample;
+	if (tcp) {
+		tcp_connect(target, loop);
+	}
+	mirror->targets[mirror->count] = target;
+	return mirror->count++;
+}
+
+void mirror_deinit(struct mirror *mirror)
+{
+	if (!mirror || !mirror->loop) {
+		return;
+	}
+	for (unsigned i = 0; i < mirror->count; ++i) {
+		target_free(mirror->targets[i]);
+		mirror->targets[i] = NULL;
+	}
+	mirror->count = 0;
+	uv_close((uv_handle_t *)&mirror->flush, NULL);
+	mirror->loop = NULL;
+}
+
+int mirror_push(struct mirror *mirror, int id, const uint8_t *wire, size_t len)
+{
+	if (!mirror || id < 0 || (unsigned)id >= mirror->count || !wire) {
+		return kr_error(EINVAL);
+	}
+	struct mirror_target *target = mirror->targets[id];
+	/* Sample 1 in N queries */
+	if (target->skip > 0) {
+		target->skip -= 1;
+		return kr_ok();
+	}
+	target->skip = (target->sample > 0) ? target->sample - 1 : 0;
+	if (target->len >= MIRROR_QUEUE_LEN || len > MIRROR_MSG_MAX) {
+		target->stats.dropped += 1;
+		return kr_error(ENOSPC);
+	}
+	memcpy(slot_at(target, target->len), wire, len);
+	target->lens[(target->head + target->len) % MIRROR_QUEUE_LEN] = len;
+	target->len += 1;
+	target->stats.queued += 1;
+	if (!uv_is_active((uv_handle_t *)&mirror->flush)) {
+		uv_check_start(&mirror->flush, mirror_flush);
+	}
+	return kr_ok();
+}
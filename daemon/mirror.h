@@ -0,0 +1,97 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <uv.h>
+
+/* Magic defaults */
+#ifndef MIRROR_QUEUE_LEN
+#define MIRROR_QUEUE_LEN 1024 /**< Queued copies per target */
+#endif
+#ifndef MIRROR_BATCH
+#define MIRROR_BATCH 64 /**< Datagrams sent in one sendmmsg() */
+#endif
+#define MIRROR_TARGETS 16       /**< Maximum number of targets */
+#define MIRROR_MSG_MAX 512      /**< Larger queries are not mirrored */
+#define MIRROR_TCP_PENDING 65536 /**< Drop copies when more bytes wait for the TCP target */
+#define MIRROR_TCP_WRITE 16384  /**< Bytes written to the TCP target in one flush, the rest waits for the next one */
+#define MIRROR_TCP_RETRY 1000   /**< Delay before reconnecting the TCP target (ms) */
+
+/** State of the TCP target connection. */
+enum mirror_tcp_state {
+	MIRROR_TCP_CLOSED = 0,
+	MIRROR_TCP_CONNECTING,
+	MIRROR_TCP_CONNECTED
+};
+
+/**
+ * Mirroring target with its queue of query copies.
+ * Copies are kept in fixed-size slots of a ring, so queuing is a single copy without allocation.
+ */
+struct mirror_target {
+	struct sockaddr_storage addr;
+	bool tcp;          /**< Send copies over TCP, framed with the 2B length */
+	int fd;            /**< Connected UDP socket */
+	uv_tcp_t *handle;  /**< TCP connection */
+	int state;         /**< TCP connection state, see enum mirror_tcp_state */
+	uint64_t retry;    /**< Time of the next connection attempt (ms) */
+	uint32_t sample;   /**< Mirror 1 in sample queries */
+	uint32_t skip;     /**< Queries left until the next sampled one */
+	uint8_t *slots;    /**< Ring of MIRROR_QUEUE_LEN slots of MIRROR_MSG_MAX bytes */
+	uint16_t lens[MIRROR_QUEUE_LEN];
+	uint32_t head;
+	uint32_t len;
+	struct {
+		size_t queued;
+		size_t sent;
+		size_t dropped;
+	} stats;
+};
+
+/**
+ * Query mirroring, owned by the worker.
+ * Copies are flushed after the I/O callbacks of each loop iteration, never in the query path.
+ */
+struct mirror {
+	uv_loop_t *loop;
+	uv_check_t flush;
+	struct mirror_target *targets[MIRROR_TARGETS];
+	unsigned count;
+};
+
+/**
+ * Add target or update sampling of the existing target.
+ * @param mirror mirroring
+ * @param loop   worker loop
+ * @param addr   target address
+ * @param sample mirror 1 in sample queries (0 or 1 mirrors all)
+ * @param tcp    send copies over TCP
+ * @return target id or an error code
+ */
+int mirror_add(struct mirror *mirror, uv_loop_t *loop, const struct sockaddr *addr, uint32_t sample, bool tcp);
+
+/** Close all targets, queued copies are discarded. */
+void mirror_deinit(struct mirror *mirror);
+
+/**
+ * Queue copy of the query for the target, the copy is dropped if the queue is full.
+ * @return 0, kr_error(ENOSPC) if dropped, or an error code
+ */
+int mirror_push(struct mirror *mirror, int id, const uint8_t *wire, size_t len);
@@ -0,0 +1,51 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <uv.h>
+
+#include "daemon/overload.h"
+
+/** @internal Return resident memory, sampled at most every OVERLOAD_RSS_INTERVAL. */
+static size_t overload_rss(struct overload *overload, uint64_t now)
+{
+	if (overload->rss_stamp == 0 || now - overload->rss_stamp >= OVERLOAD_RSS_INTERVAL) {
+		size_t rss = 0;
+		if (uv_resident_set_memory(&rss) == 0) {
+			overload->rss = rss;
+		}
+		overload->rss_stamp = now;
+	}
+	return overload->rss;
+}
+
+int overload_level(struct overload *overload, size_t concurrent, uint64_t now)
+{
+	const size_t rss = (overload->memory_soft || overload->memory_hard) ? overload_rss(overload, now) : 0;
+	if ((overload->hard && concurrent >= overload->hard) ||
+	    (overload->memory_hard && rss >= overload->memory_hard)) {
+		return 2;
+	}
+	if ((overload->soft && concurrent >= overload->soft) ||
+	    (overload->memory_soft && rss >= overload->memory_soft)) {
+		return 1;
+	}
+	return 0;
+}
+
+bool overload_admit(struct overload *overload, size_t concurrent, uint64_t now, bool admitted)
+{
+	return admitted || overload_level(overload, concurrent, now) == 0;
+}
@@ -0,0 +1,53 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Magic defaults */
+#ifndef OVERLOAD_RSS_INTERVAL
+#define OVERLOAD_RSS_INTERVAL 100 /**< Minimum interval between RSS samples (ms) */
+#endif
+
+/** Overload watermarks of the worker, all of them are disabled by default. */
+struct overload {
+	size_t soft;        /**< Shed cache-miss resolutions above this number of concurrent queries (0 disables) */
+	size_t hard;        /**< Pause reading UDP above this number of concurrent queries (0 disables) */
+	size_t memory_soft; /**< Shed cache-miss resolutions above this RSS (0 disables) */
+	size_t memory_hard; /**< Pause reading UDP above this RSS (0 disables) */
+	size_t rss;         /**< Last RSS sample */
+	uint64_t rss_stamp; /**< Time of the last RSS sample */
+	bool drop;          /**< Drop shed queries instead of answering SERVFAIL */
+	bool paused;        /**< Reading UDP is paused */
+};
+
+/**
+ * Return overload level, 0 if normal, 1 above the soft and 2 above the hard watermark.
+ * @param concurrent number of concurrent queries
+ * @param now        current time (ms), RSS is sampled at most every OVERLOAD_RSS_INTERVAL
+ */
+int overload_level(struct overload *overload, size_t concurrent, uint64_t now);
+
+/**
+ * Admit resolution that is about to go upstream, each resolution is admitted at most once.
+ * @note Admit the resolution before it announces side queries, so a shed resolution leaves nothing behind.
+ * @param admitted   true if the resolution was admitted before
+ * @return true if the resolution is admitted, false if it has to be shed
+ */
+bool overload_admit(struct overload *overload, size_t concurrent, uint64_t now, bool admitted);
@@ -0,0 +1,160 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <libknot/packet/wire.h>
+#include <contrib/ucw/lib.h>
+#include <contrib/murmurhash3/murmurhash3.h>
+
+#include "lib/defines.h"
+#include "lib/utils.h"
+#include "daemon/rrl.h"
+
+int rrl_init(struct rrl *rrl, uint32_t size)
+{
+	memset(rrl, 0, sizeof(*rrl));
+	/* Round number of lines down to power of 2 */
+	uint32_t lines = 1;
+	while (lines * 2 <= size / RRL_LINE_BUCKETS) {
+		lines *= 2;
+	}
+	if (posix_memalign((void **)&rrl->table, sizeof(struct rrl_line), lines * sizeof(struct rrl_line)) != 0) {
+		rrl->table = NULL;
+		return kr_error(ENOMEM);
+	}
+	memset(rrl->table, 0, lines * sizeof(struct rrl_line));
+	rrl->size = lines;
+	rrl->v4_mask = 24;
+	rrl->v6_mask = 56;
+	rrl->slip = 2;
+	return kr_ok();
+}
+
+void rrl_deinit(struct rrl *rrl)
+{
+	free(rrl->table);
+	rrl->table = NULL;
+	rrl->size = 0;
+}
+
+/** @internal Hash client prefix and class. */
+static uint32_t rrl_key(struct rrl *rrl, const struct sockaddr *addr, int cls)
+{
+	uint8_t buf[sizeof(struct in6_addr) + 1];
+	const int len = kr_inaddr_len(addr);
+	const int mask = addr->sa_family == AF_INET ? rrl->v4_mask : rrl->v6_mask;
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, kr_inaddr(addr), len);
+	/* Clear host bits */
+	for (int i = 0; i < len; ++i) {
+		const int bits = mask - i * 8;
+		if (bits <= 0) {
+			buf[i] = 0;
+		} else if (bits < 8) {
+			buf[i] &= 0xff << (8 - bits);
+		}
+	}
+	buf[len] = cls;
+	uint32_t key = hash((const char *)buf, len + 1);
+	return key != 0 ? key : 1; /* Zero is reserved for empty bucket */
+}
+
+/** @internal Find bucket for the key in its cache line, replace the least recently used if not found. */
+static struct rrl_bucket *rrl_bucket(struct rrl *rrl, uint32_t key, uint32_t now, uint32_t burst)
+{
+	struct rrl_line *line = &rrl->table[key & (rrl->size - 1)];
+	struct rrl_bucket *oldest = &line->bucket[0];
+	for (unsigned i = 0; i < RRL_LINE_BUCKETS; ++i) {
+		struct rrl_bucket *b = &line->bucket[i];
+		if (b->key == key) {
+			return b;
+		}
+		if (b->key == 0 || (uint32_t)(now - b->stamp) > (uint32_t)(now - oldest->stamp)) {
+			oldest = b;
+			if (b->key == 0) {
+				break;
+			}
+		}
+	}
+	oldest->key = key;
+	oldest->stamp = now;
+	oldest->tokens = burst;
+	oldest->limited = 0;
+	return oldest;
+}
+
+int rrl_check(struct rrl *rrl, const struct sockaddr *addr, int cls, uint64_t now)
+{
+	const uint32_t rate = (cls == RRL_QUERY) ? rrl->qps : rrl->rate;
+	if (!rrl->table || rate == 0 || !addr || cls >= RRL_CLASS_COUNT ||
+	    (addr->sa_family != AF_INET && addr->sa_family != AF_INET6)) {
+		return RRL_PASS;
+	}
+	/* Refill tokens for the elapsed time, burst is one second worth of responses. */
+	const uint32_t burst = MIN((uint64_t)rate * 1000, INT32_MAX);
+	struct rrl_bucket *b = rrl_bucket(rrl, rrl_key(rrl, addr, cls), now, burst);
+	const uint32_t elapsed = (uint32_t)now - b->stamp;
+	if (elapsed > 0) {
+		const uint64_t tokens = (uint64_t)MAX(b->tokens, 0) + (uint64_t)MIN(elapsed, 1000) * rate;
+		b->tokens = MIN(tokens, burst);
+		b->stamp = now;
+	}
+	if (b->tokens >= 1000) {
+		b->tokens -= 1000;
+		return RRL_PASS;
+	}
+	/* Over limit, truncate every n-th response so the legitimate client may retry over TCP. */
+	b->limited += 1;
+	rrl->stats.classes[cls] += 1;
+	if (rrl->slip > 0 && b->limited % rrl->slip == 0) {
+		rrl->stats.slipped += 1;
+		return RRL_SLIP;
+	}
+	rrl->stats.dropped += 1;
+	return RRL_DROP;
+}
+
+int rrl_classify(const knot_pkt_t *answer)
+{
+	if (answer->size > RRL_LARGE_SIZE) {
+		return RRL_LARGE;
+	}
+	switch (knot_wire_get_rcode(answer->wire)) {
+	case KNOT_RCODE_NOERROR:
+		return knot_wire_get_ancount(answer->wire) > 0 ? RRL_ANSWER : RRL_NODATA;
+	case KNOT_RCODE_NXDOMAIN:
+		return RRL_NXDOMAIN;
+	default:
+		return RRL_ERROR;
+	}
+}
+
+void rrl_truncate(knot_pkt_t *pkt)
+{
+	knot_wire_set_qr(pkt->wire);
+	knot_wire_set_tc(pkt->wire);
+	knot_wire_set_ancount(pkt->wire, 0);
+	knot_wire_set_nscount(pkt->wire, 0);
+	knot_wire_set_arcount(pkt->wire, 0);
+	if (pkt->qname_size > 0) {
+		pkt->size = KNOT_WIRE_HEADER_SIZE + pkt->qname_size + 2 * sizeof(uint16_t);
+	} else {
+		knot_wire_set_qdcount(pkt->wire, 0);
+		pkt->size = KNOT_WIRE_HEADER_SIZE;
+	}
+}
@@ -0,0 +1,106 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <libknot/packet/pkt.h>
+
+/* Magic defaults */
+#ifndef RRL_SIZE
+#define RRL_SIZE 65536 /**< Number of buckets (power of 2) */
+#endif
+#ifndef RRL_LARGE_SIZE
+#define RRL_LARGE_SIZE 1232 /**< Answers larger than this are limited as RRL_LARGE */
+#endif
+#define RRL_LINE_BUCKETS 4 /**< Number of buckets sharing a cache line */
+
+/** Class of the limited traffic, each class has own bucket for the client prefix.
+ *  A query is charged once as RRL_QUERY, and its answer once in the answer class. */
+enum rrl_class {
+	RRL_QUERY = 0, /**< Query, checked before the task is created */
+	RRL_ANSWER,    /**< Positive answer */
+	RRL_NODATA,    /**< Empty answer */
+	RRL_NXDOMAIN,  /**< Name error */
+	RRL_ERROR,     /**< Other error */
+	RRL_LARGE,     /**< Answer larger than RRL_LARGE_SIZE */
+	RRL_CLASS_COUNT
+};
+
+/** Rate limiting action. */
+enum rrl_action {
+	RRL_PASS = 0, /**< Under limit */
+	RRL_SLIP,     /**< Over limit, respond with TC=1 */
+	RRL_DROP      /**< Over limit, drop */
+};
+
+/** Token bucket of the client prefix and class. */
+struct rrl_bucket {
+	uint32_t key;     /**< Hash of the prefix and class, 0 if empty */
+	uint32_t stamp;   /**< Time of the last refill (ms) */
+	int32_t tokens;   /**< Remaining tokens (1/1000 of a response) */
+	uint32_t limited; /**< Number of limited responses */
+};
+
+/** @internal Buckets are grouped by cache line, the key selects line and the bucket is looked up in it. */
+struct rrl_line {
+	struct rrl_bucket bucket[RRL_LINE_BUCKETS];
+} __attribute__((aligned(64)));
+
+/**
+ * Response rate limiting.
+ * The table has fixed size and is owned by the worker, it's never resized or locked.
+ */
+struct rrl {
+	struct rrl_line *table;
+	uint32_t size;    /**< Number of lines (power of 2) */
+	uint32_t rate;    /**< Answers per second for the client prefix and class, 0 disables */
+	uint32_t qps;     /**< Queries per second for the client prefix, 0 disables */
+	uint8_t v4_mask;  /**< IPv4 client prefix length */
+	uint8_t v6_mask;  /**< IPv6 client prefix length */
+	uint8_t slip;     /**< Every n-th limited response is truncated, rest is dropped (0 drops all) */
+	struct {
+		size_t slipped;
+		size_t dropped;
+		size_t classes[RRL_CLASS_COUNT]; /**< Limited responses of each class */
+	} stats;
+};
+
+/**
+ * Initialize rate limiting with given number of buckets, it's disabled until the rates are set.
+ * @return 0 or an error code
+ */
+int rrl_init(struct rrl *rrl, uint32_t size);
+
+/** Free rate limiting table. */
+void rrl_deinit(struct rrl *rrl);
+
+/**
+ * Take token from the bucket of the client prefix and class.
+ * @param rrl  rate limiting
+ * @param addr client address
+ * @param cls  traffic class
+ * @param now  current time (ms)
+ * @return action to take, see enum rrl_action
+ */
+int rrl_check(struct rrl *rrl, const struct sockaddr *addr, int cls, uint64_t now);
+
+/** Return class of the answer. */
+int rrl_classify(const knot_pkt_t *answer);
+
+/** Strip the packet to the header and question, and set QR=1, TC=1. */
+void rrl_truncate(knot_pkt_t *pkt);
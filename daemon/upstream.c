@@ -0,0 +1,123 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <contrib/ucw/lib.h>
+
+#include "lib/defines.h"
+#include "lib/utils.h"
+#include "daemon/upstream.h"
+
+int upstreams_init(struct upstreams *upstreams, uint32_t size)
+{
+	memset(upstreams, 0, sizeof(*upstreams));
+	upstreams->table = malloc(lru_size(upstream_lru_t, size));
+	if (!upstreams->table) {
+		return kr_error(ENOMEM);
+	}
+	lru_init(upstreams->table, size);
+	upstreams->inflight_max = UPSTREAM_INFLIGHT_MAX;
+	upstreams->qps_max = UPSTREAM_QPS_MAX;
+	return kr_ok();
+}
+
+void upstreams_deinit(struct upstreams *upstreams)
+{
+	if (upstreams->table) {
+		lru_deinit(upstreams->table);
+		free(upstreams->table);
+		upstreams->table = NULL;
+	}
+}
+
+struct upstream *upstream_get(struct upstreams *upstreams, const struct sockaddr *addr, bool create)
+{
+	if (!upstreams->table) {
+		return NULL;
+	}
+	const char *key = kr_inaddr(addr);
+	const int len = kr_inaddr_len(addr);
+	struct upstream *up = lru_get(upstreams->table, key, len);
+	if (up || !create) {
+		return up;
+	}
+	/* Never replace an address that is still accounted in the limits. */
+	up = lru_peek(upstreams->table, key, len);
+	if (up && (up->inflight > 0 || up->queued > 0)) {
+		return NULL;
+	}
+	return lru_set(upstreams->table, key, len);
+}
+
+bool upstream_admit(struct upstreams *upstreams, const struct sockaddr *addr, uint64_t now)
+{
+	const bool limited = (upstreams->inflight_max > 0 || upstreams->qps_max > 0);
+	struct upstream *up = upstream_get(upstreams, addr, true);
+	if (!up) {
+		return !limited; /* Can't be accounted, wait unless the limits are disabled. */
+	}
+	if (upstreams->inflight_max > 0 && up->inflight >= upstreams->inflight_max) {
+		return false;
+	}
+	/* Refill the pacing bucket lazily, burst is limited to 1/10s worth of transmissions. */
+	if (upstreams->qps_max > 0) {
+		const uint64_t burst = MAX(upstreams->qps_max / 10, 1) * 1000;
+		if (now > up->refill) {
+			uint64_t tokens = up->tokens + MIN(now - up->refill, 1000) * upstreams->qps_max;
+			up->tokens = MIN(tokens, burst);
+			up->refill = now;
+		}
+		if (up->tokens < 1000) {
+			return false;
+		}
+		up->tokens -= 1000;
+	}
+	up->inflight += 1;
+	return true;
+}
+
+void upstream_release(struct upstreams *upstreams, const struct sockaddr *addr, unsigned count)
+{
+	struct upstream *up = upstream_get(upstreams, addr, false);
+	if (up) {
+		up->inflight -= MIN(up->inflight, count);
+	}
+}
+
+uint64_t upstream_wait(struct upstreams *upstreams, const struct sockaddr *addr)
+{
+	struct upstream *up = upstream_get(upstreams, addr, true);
+	if (!up) {
+		return UPSTREAM_RETRY; /* Slot is taken by another address in use. */
+	}
+	if (upstreams->inflight_max > 0 && up->inflight >= upstreams->inflight_max) {
+		return UPSTREAM_WAKE;
+	}
+	/* Time until the bucket has a whole transmission, it was refilled by the last upstream_admit(). */
+	if (upstreams->qps_max > 0 && up->tokens < 1000) {
+		return MAX((1000 - up->tokens + upstreams->qps_max - 1) / upstreams->qps_max, 1);
+	}
+	return 0;
+}
+
+bool upstream_rto_next(uint64_t rto, uint64_t elapsed, uint64_t deadline, uint64_t *timeout)
+{
+	const uint64_t left = elapsed < deadline ? deadline - elapsed : 0;
+	*timeout = MIN(rto, left);
+	return rto < left;
+}
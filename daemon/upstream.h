@@ -0,0 +1,103 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "lib/generic/lru.h"
+
+/* Magic defaults */
+#ifndef UPSTREAM_INFLIGHT_MAX
+#define UPSTREAM_INFLIGHT_MAX 0 /**< Outstanding transmissions to single upstream address (0 disables) */
+#endif
+#ifndef UPSTREAM_QPS_MAX
+#define UPSTREAM_QPS_MAX 0 /**< Transmissions per second to single upstream address (0 disables) */
+#endif
+#ifndef UPSTREAM_RETRY
+#define UPSTREAM_RETRY 20 /**< Retry interval (ms) for an address whose state can't be tracked at the moment */
+#endif
+#define UPSTREAM_WAKE UINT64_MAX /**< Waiting for a transmission to be released, see upstream_wait() */
+
+/** State of an upstream address, retransmit timer (RFC 6298) and transmission limits. */
+struct upstream {
+	uint16_t srtt;      /**< Smoothed RTT (ms), 0 if unknown. */
+	uint16_t rttvar;    /**< RTT variation (ms). */
+	uint16_t inflight;  /**< Number of outstanding transmissions. */
+	uint16_t queued;    /**< Number of queries waiting for this address. */
+	uint32_t tokens;    /**< Pacing bucket (1/1000 of a transmission). */
+	uint32_t throttled; /**< Number of queries delayed or diverted by the limits. */
+	uint64_t refill;    /**< Time of the last bucket refill. */
+	uint64_t wait;      /**< Total time the queries waited (ms). */
+};
+typedef lru_hash(struct upstream) upstream_lru_t;
+
+/**
+ * Upstream addresses of the worker and their transmission limits.
+ * Addresses with transmissions in flight or queries waiting are never evicted from the table,
+ * so the limits can't be bypassed by a colliding address.
+ */
+struct upstreams {
+	upstream_lru_t *table;
+	unsigned inflight_max; /**< Outstanding transmissions to single address, 0 disables */
+	unsigned qps_max;      /**< Transmissions per second to single address, 0 disables */
+};
+
+/**
+ * Initialize table of upstream addresses, the limits are disabled by default.
+ * @return 0 or an error code
+ */
+int upstreams_init(struct upstreams *upstreams, uint32_t size);
+
+/** Free table of upstream addresses. */
+void upstreams_deinit(struct upstreams *upstreams);
+
+/**
+ * Find state of the upstream address.
+ * @param upstreams table of upstream addresses
+ * @param addr      upstream address
+ * @param create    create the state if it doesn't exist
+ * @return state or NULL if it doesn't exist, or it can't be created without evicting an address in use
+ */
+struct upstream *upstream_get(struct upstreams *upstreams, const struct sockaddr *addr, bool create);
+
+/**
+ * Take one transmission from the limits of the upstream address.
+ * @param now current time (ms)
+ * @return true if the address is under its limits, false if the transmission has to wait
+ */
+bool upstream_admit(struct upstreams *upstreams, const struct sockaddr *addr, uint64_t now);
+
+/** Return transmissions to the limits of the upstream address. */
+void upstream_release(struct upstreams *upstreams, const struct sockaddr *addr, unsigned count);
+
+/**
+ * Return time until the upstream address may be under its limits again.
+ * @return delay (ms), or UPSTREAM_WAKE if it has to wait for a released transmission
+ */
+uint64_t upstream_wait(struct upstreams *upstreams, const struct sockaddr *addr);
+
+/**
+ * Time until the next retransmit, limited by the deadline of the query.
+ * @param rto      retransmit interval (ms)
+ * @param elapsed  time since the first transmission of the query (ms)
+ * @param deadline time the query waits for an answer since the first transmission (ms)
+ * @param timeout  set to the time until the next retransmit, or until the deadline
+ * @return true if the query retransmits after the timeout, false if it times out
+ */
+bool upstream_rto_next(uint64_t rto, uint64_t elapsed, uint64_t deadline, uint64_t *timeout);
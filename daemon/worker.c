@@ -65,6 +65,8 @@ struct req
 /* Forward decls */
 static void qr_task_free(struct qr_task *task);
 static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_source, knot_pkt_t *packet);
+static int qr_task_produce(struct qr_task *task, int state, const struct sockaddr *packet_source, knot_pkt_t *packet);
+static void on_retransmit(uv_timer_t *req);
 
 /** @internal Get singleton worker. */
 static inline struct worker_ctx *get_worker(void)
@@ -207,6 +209,42 @@ static int subreq_key(char *dst, knot_pkt_t *pkt)
 	return kr_rrkey(dst, knot_pkt_qname(pkt), knot_pkt_qtype(pkt), knot_pkt_qclass(pkt));
 }
 
+/** @internal Return overload level, 0 if normal, 1 above the soft and 2 above the hard watermark. */
+static int worker_overload(struct worker_ctx *worker)
+{
+	return overload_level(&worker->overload, worker->stats.concurrent, uv_now(worker->loop));
+}
+
+static int pause_endpoints(const char *k, void *v, void *baton)
+{
+	endpoint_array_t *endpoints = v;
+	const bool *pause = baton;
+	for (size_t i = 0; i < endpoints->len; ++i) {
+		uv_handle_t *handle = (uv_handle_t *)endpoints->at[i]->udp;
+		if (handle && !uv_is_closing(handle)) {
+			if (*pause) {
+				io_stop_read(handle);
+			} else {
+				io_start_read(handle);
+			}
+		}
+	}
+	return 0;
+}
+
+/** @internal Pause or resume reading from the UDP listeners. */
+static void worker_pause(struct worker_ctx *worker, bool pause)
+{
+	if (worker->overload.paused == pause) {
+		return;
+	}
+	worker->overload.paused = pause;
+	map_walk(&worker->engine->net.endpoints, pause_endpoints, &pause);
+	if (pause) {
+		worker->stats.paused += 1;
+	}
+}
+
 static struct qr_task *qr_task_create(struct worker_ctx *worker, uv_handle_t *handle, const struct sockaddr *addr)
 {
 	/* How much can client handle? */
@@ -244,9 +282,13 @@ static struct qr_task *qr_task_create(struct worker_ctx *worker, uv_handle_t *ha
 	task->bytes_remaining = 0;
 	task->iter_count = 0;
 	task->timeouts = 0;
+	task->offloaded = 0;
+	memset(&task->sent, 0, sizeof(task->sent));
 	task->refs = 1;
 	task->finished = false;
 	task->leading = false;
+	task->race = false;
+	task->admitted = false;
 	task->worker = worker;
 	task->session = NULL;
 	task->source.handle = handle;
@@ -281,6 +323,9 @@ static struct qr_task *qr_task_create(struct worker_ctx *worker, uv_handle_t *ha
 		}
 	}
 	worker->stats.concurrent += 1;
+	if (handle && worker_overload(worker) > 1) {
+		worker_pause(worker, true);
+	}
 	return task;
 }
 
@@ -309,6 +354,10 @@ static void qr_task_free(struct qr_task *task)
 	/* Update stats */
 	struct worker_ctx *worker = task->worker;
 	worker->stats.concurrent -= 1;
+	/* Resume reading below the hard watermark, or if there's nothing left to wait for. */
+	if (worker->overload.paused && (worker->stats.concurrent == 0 || worker_overload(worker) < 2)) {
+		worker_pause(worker, false);
+	}
 	/* Return mempool to ring or free it if it's full */
 	pool_release(worker, task->req.pool.ctx);
 	/* @note The 'task' is invalidated from now on. */
@@ -506,17 +555,37 @@ static void on_timer_close(uv_handle_t *handle)
 	qr_task_unref(task);
 }
 
+/** @internal Return true if the addresses are equal, ports are not compared. */
+static bool addr_equal(const struct sockaddr *a, const struct sockaddr *b)
+{
+	return a->sa_family == b->sa_family &&
+	       memcmp(kr_inaddr(a), kr_inaddr(b), kr_inaddr_len(a)) == 0;
+}
+
+/** @internal Return true if the query was sent to the address at given index of the address list. */
+static bool qr_task_sent_to(struct qr_task *task, uint16_t i)
+{
+	/* UDP transmissions are recorded, TCP connects to the first address. */
+	if (task->sent.total > 0) {
+		return task->sent.count[i] > 0;
+	}
+	return i == 0;
+}
+
 /* This is called when I/O timeouts */
 static void on_timeout(uv_timer_t *req)
 {
 	struct qr_task *task = req->data;
 
-	/* Penalize all tried nameservers with a timeout. */
+	/* Penalize all nameservers the query was sent to with a timeout. */
 	struct worker_ctx *worker = task->worker;
 	if (task->leading && task->pending_count > 0) {
 		struct kr_query *qry = array_tail(task->req.rplan.pending);
 		struct sockaddr_in6 *addrlist = (struct sockaddr_in6 *)task->addrlist;
-		for (uint16_t i = 0; i < MIN(task->pending_count, task->addrlist_count); ++i) {
+		for (uint16_t i = 0; i < task->addrlist_count; ++i) {
+			if (!qr_task_sent_to(task, i)) {
+				continue;
+			}
 			struct sockaddr *choice = (struct sockaddr *)(&addrlist[i]);
 			WITH_DEBUG {
 				char addr_str[INET6_ADDRSTRLEN];
@@ -536,19 +605,250 @@ static void on_timeout(uv_timer_t *req)
 	qr_task_step(task, NULL, NULL);
 }
 
-static bool retransmit(struct qr_task *task)
+/** @internal Retransmit timeout for given address, fixed interval if the address is not known yet. */
+static uint64_t rto_get(struct worker_ctx *worker, const struct sockaddr *addr)
 {
-	if (task && task->addrlist && task->addrlist_count > 0) {
-		uv_handle_t *subreq = ioreq_spawn(task, SOCK_DGRAM);
-		if (subreq) { /* Create connection for iterative query */
-			struct sockaddr_in6 *choice = &((struct sockaddr_in6 *)task->addrlist)[task->addrlist_turn];
-			if (qr_task_send(task, subreq, (struct sockaddr *)choice, task->pktbuf) == 0) {
-				task->addrlist_turn = (task->addrlist_turn + 1) % task->addrlist_count; /* Round robin */
-				return true;
+	struct upstream *rto = upstream_get(&worker->upstreams, addr, false);
+	if (!rto || rto->srtt == 0) {
+		return KR_CONN_RETRY;
+	}
+	uint64_t timeout = rto->srtt + MAX(KR_CONN_RTO_MIN, 4 * rto->rttvar);
+	return MIN(MAX(timeout, KR_CONN_RTO_MIN), KR_CONN_RTO_MAX);
+}
+
+/** @internal Return true if there is RTT measured for given address. */
+static bool rto_known(struct worker_ctx *worker, const struct sockaddr *addr)
+{
+	struct upstream *rto = upstream_get(&worker->upstreams, addr, false);
+	return rto && rto->srtt != 0;
+}
+
+/** @internal Update smoothed RTT and its variation with new measurement (RFC 6298). */
+static void rto_update(struct worker_ctx *worker, const struct sockaddr *addr, uint64_t rtt)
+{
+	struct upstream *rto = upstream_get(&worker->upstreams, addr, true);
+	if (!rto) {
+		return;
+	}
+	rtt = MIN(rtt, KR_CONN_RTT_MAX);
+	if (rto->srtt == 0) {
+		rto->srtt = rtt;
+		rto->rttvar = rtt / 2;
+	} else {
+		const uint64_t delta = rto->srtt > rtt ? rto->srtt - rtt : rtt - rto->srtt;
+		rto->rttvar = (3 * rto->rttvar + delta) / 4;
+		rto->srtt = (7 * rto->srtt + rtt) / 8;
+	}
+	rto->srtt = MAX(rto->srtt, 1); /* Zero is reserved for unknown */
+}
+
+/** @internal Measure RTT of the answered transmission, and count transmissions it made useless. */
+static void qr_task_sample(struct qr_task *task, const struct sockaddr *packet_source)
+{
+	struct worker_ctx *worker = task->worker;
+	struct sockaddr_in6 *addrlist = (struct sockaddr_in6 *)task->addrlist;
+	if (!addrlist || !packet_source || task->sent.total == 0) {
+		return;
+	}
+	const uint64_t now = uv_now(worker->loop);
+	for (uint16_t i = 0; i < task->addrlist_count; ++i) {
+		const struct sockaddr *addr = (struct sockaddr *)&addrlist[i];
+		if (task->sent.count[i] == 0 || !addr_equal(addr, packet_source)) {
+			continue;
+		}
+		/* Answers to retransmitted queries are ambiguous (Karn's algorithm). */
+		if (task->sent.count[i] == 1) {
+			rto_update(worker, addr, now - task->sent.first[i]);
+			worker->stats.retransmit_spurious += task->sent.total - task->sent.order[i];
+		}
+		break;
+	}
+	/* Racing, the other transmissions are cancelled and their answers never read.
+	 * The time they have been outstanding is a lower bound of their RTT, addresses
+	 * without a measured RTT are ranked as unknown so the winner stays preferred. */
+	if (task->race) {
+		struct kr_query *qry = array_tail(task->req.rplan.pending);
+		for (uint16_t i = 0; i < task->addrlist_count; ++i) {
+			const struct sockaddr *addr = (struct sockaddr *)&addrlist[i];
+			if (task->sent.count[i] == 0 || addr_equal(addr, packet_source)) {
+				continue;
 			}
+			kr_nsrep_update_rtt(&qry->ns, addr, now - task->sent.first[i],
+			                    worker->engine->resolver.cache_rtt, KR_NS_MAX);
 		}
 	}
-	return false;
+}
+
+/** @internal Retransmit interval after the last transmission, with backoff for repeated address. */
+static uint64_t qr_task_rto(struct qr_task *task)
+{
+	const uint8_t i = task->sent.last;
+	const struct sockaddr *addr = (struct sockaddr *)&((struct sockaddr_in6 *)task->addrlist)[i];
+	uint64_t timeout = rto_get(task->worker, addr) << MIN(task->sent.count[i] - 1, 4);
+	/* Racing, send to the next address shortly if this one has no RTT measured yet. */
+	if (task->race && task->sent.total < task->addrlist_count && !rto_known(task->worker, addr)) {
+		timeout = KR_CONN_STAGGER;
+	}
+	return MIN(timeout, KR_CONN_RTO_MAX);
+}
+
+/** @internal Return address the query waits for, or NULL. */
+static const struct sockaddr *qr_task_queued(struct qr_task *task)
+{
+	if (task->sent.queued == 0) {
+		return NULL;
+	}
+	return (struct sockaddr *)&((struct sockaddr_in6 *)task->addrlist)[task->sent.queued - 1];
+}
+
+/** @internal Wake the longest waiting query for the address, it transmits in the next loop iteration. */
+static void upstream_wake(struct worker_ctx *worker, const struct sockaddr *addr)
+{
+	for (size_t i = 0; i < worker->upstream_waiting.len; ++i) {
+		struct qr_task *task = worker->upstream_waiting.at[i];
+		const struct sockaddr *queued = qr_task_queued(task);
+		if (task->timeout && queued && addr_equal(queued, addr)) {
+			uv_timer_start(task->timeout, on_retransmit, 0, 0);
+			return;
+		}
+	}
+}
+
+/** @internal Return transmissions to the upstream limits, and let a waiting query use them. */
+static void upstream_return(struct worker_ctx *worker, const struct sockaddr *addr, unsigned count)
+{
+	upstream_release(&worker->upstreams, addr, count);
+	upstream_wake(worker, addr);
+}
+
+/** @internal Stop waiting for the upstream limits and account the time spent waiting. */
+static void qr_task_dequeue(struct qr_task *task)
+{
+	struct worker_ctx *worker = task->worker;
+	const struct sockaddr *addr = qr_task_queued(task);
+	if (!addr) {
+		return;
+	}
+	const uint64_t wait = uv_now(worker->loop) - task->sent.queued_at;
+	struct upstream *up = upstream_get(&worker->upstreams, addr, false);
+	if (up) {
+		up->queued -= MIN(up->queued, 1);
+		up->wait += wait;
+	}
+	worker->stats.queued -= MIN(worker->stats.queued, 1);
+	worker->stats.queue_wait += wait;
+	task->sent.queued = 0;
+	/* Remove from the waiting queries, keep the order. */
+	for (size_t i = 0; i < worker->upstream_waiting.len; ++i) {
+		if (worker->upstream_waiting.at[i] == task) {
+			worker->upstream_waiting.len -= 1;
+			memmove(&worker->upstream_waiting.at[i], &worker->upstream_waiting.at[i + 1],
+			        (worker->upstream_waiting.len - i) * sizeof(task));
+			break;
+		}
+	}
+}
+
+/** @internal Release all transmissions of the current query to the upstream limits. */
+static void qr_task_release(struct qr_task *task)
+{
+	struct sockaddr_in6 *addrlist = (struct sockaddr_in6 *)task->addrlist;
+	if (!addrlist) {
+		return;
+	}
+	qr_task_dequeue(task);
+	for (uint16_t i = 0; i < task->addrlist_count; ++i) {
+		if (task->sent.count[i] > 0) {
+			upstream_return(task->worker, (struct sockaddr *)&addrlist[i], task->sent.count[i]);
+			task->sent.count[i] = 0;
+		}
+	}
+}
+
+/** @internal Hold the query back until the preferred address is under its limits. */
+static void qr_task_enqueue(struct qr_task *task)
+{
+	struct worker_ctx *worker = task->worker;
+	if (task->sent.queued != 0) {
+		return;
+	}
+	const uint16_t turn = task->addrlist_turn;
+	const struct sockaddr *addr = (struct sockaddr *)&((struct sockaddr_in6 *)task->addrlist)[turn];
+	if (array_push(worker->upstream_waiting, task) < 0) {
+		return; /* Retried with the next retransmit. */
+	}
+	struct upstream *up = upstream_get(&worker->upstreams, addr, false);
+	if (up) {
+		up->queued += 1;
+		up->throttled += 1;
+	}
+	worker->stats.queued += 1;
+	worker->stats.throttled += 1;
+	task->sent.queued = turn + 1;
+	task->sent.queued_at = uv_now(worker->loop);
+}
+
+/** @internal Delay before the next attempt when all addresses are over the upstream limits.
+ *  Queries waiting for a released transmission are woken earlier, see upstream_wake(). */
+static uint64_t qr_task_retry(struct qr_task *task, uint64_t timeout)
+{
+	struct worker_ctx *worker = task->worker;
+	uint64_t retry = task->sent.total > 0 ? qr_task_rto(task) : timeout;
+	struct sockaddr_in6 *addrlist = (struct sockaddr_in6 *)task->addrlist;
+	for (uint16_t i = 0; i < task->addrlist_count; ++i) {
+		retry = MIN(retry, upstream_wait(&worker->upstreams, (struct sockaddr *)&addrlist[i]));
+	}
+	return MIN(retry, timeout);
+}
+
+/**
+ * Transmit query to the next address in round robin order, addresses over the
+ * upstream limits are skipped.
+ * @return 0, kr_error(EAGAIN) if all addresses are over limit or other error
+ */
+static int retransmit(struct qr_task *task)
+{
+	if (!task || !task->addrlist || task->addrlist_count == 0) {
+		return kr_error(EINVAL);
+	}
+	struct worker_ctx *worker = task->worker;
+	const uint64_t now = uv_now(worker->loop);
+	if (task->sent.start == 0) {
+		task->sent.start = now;
+	}
+	/* Find next address under the limits. */
+	struct sockaddr_in6 *addrlist = (struct sockaddr_in6 *)task->addrlist;
+	uint16_t turn = task->addrlist_turn;
+	uint16_t tried = 0;
+	while (!upstream_admit(&worker->upstreams, (struct sockaddr *)&addrlist[turn], now)) {
+		if (++tried == task->addrlist_count) {
+			qr_task_enqueue(task);
+			return kr_error(EAGAIN);
+		}
+		turn = (turn + 1) % task->addrlist_count;
+	}
+	if (tried > 0 && task->sent.queued == 0) {
+		worker->stats.throttled += 1; /* Diverted to next-best address */
+	}
+	struct sockaddr *choice = (struct sockaddr *)&addrlist[turn];
+	uv_handle_t *subreq = ioreq_spawn(task, SOCK_DGRAM);
+	if (!subreq || qr_task_send(task, subreq, choice, task->pktbuf) != 0) {
+		upstream_return(worker, choice, 1);
+		return kr_error(EIO);
+	}
+	qr_task_dequeue(task);
+	task->addrlist_turn = (turn + 1) % task->addrlist_count; /* Round robin */
+	/* Remember transmission for RTT measurement. */
+	if (task->sent.total > 0) {
+		worker->stats.retransmit += 1;
+	}
+	task->sent.total += 1;
+	if (task->sent.count[turn]++ == 0) {
+		task->sent.first[turn] = now;
+		task->sent.order[turn] = task->sent.total;
+	}
+	task->sent.last = turn;
+	return kr_ok();
 }
 
 static void on_retransmit(uv_timer_t *req)
@@ -558,12 +858,20 @@ static void on_retransmit(uv_timer_t *req)
 	assert(task->timeout != NULL);
 
 	uv_timer_stop(req);
-	if (!retransmit(req->data)) {
-		/* Not possible to spawn request, start timeout timer with remaining deadline. */
-		uint64_t timeout = KR_CONN_RTT_MAX - task->pending_count * KR_CONN_RETRY;
-		uv_timer_start(req, on_timeout, timeout, 0);
+	const uint64_t elapsed = uv_now(task->worker->loop) - task->sent.start;
+	uint64_t timeout = elapsed < KR_CONN_RTT_MAX ? KR_CONN_RTT_MAX - elapsed : 0;
+	/* Nothing is transmitted past the deadline, e.g. after waiting over the upstream limits. */
+	int ret = timeout > 0 ? retransmit(task) : kr_error(ETIMEDOUT);
+	if (ret == 0 && upstream_rto_next(qr_task_rto(task), elapsed, KR_CONN_RTT_MAX, &timeout)) {
+		uv_timer_start(req, on_retransmit, timeout, 0);
+	} else if (ret == kr_error(EAGAIN)) {
+		/* Over the upstream limits, wait for a released transmission or the pacing. */
+		uv_timer_start(req, on_retransmit, qr_task_retry(task, timeout), 0);
 	} else {
-		uv_timer_start(req, on_retransmit, KR_CONN_RETRY, 0);
+		/* Deadline comes before the next retransmit, or not possible to spawn request,
+		 * start timeout timer with remaining deadline. */
+		qr_task_dequeue(task);
+		uv_timer_start(req, on_timeout, timeout, 0);
 	}
 }
 
@@ -599,6 +907,7 @@ static void subreq_finalize(struct qr_task *task, const struct sockaddr *packet_
 		task->timeout = NULL;
 	}
 	ioreq_killall(task);
+	qr_task_release(task);
 	/* Clear from outgoing table. */
 	if (!task->leading)
 		return;
@@ -661,11 +970,165 @@ static int qr_task_finalize(struct qr_task *task, int state)
 	assert(task && task->leading == false);
 	kr_resolve_finish(&task->req, state);
 	task->finished = true;
+	/* Rate limit answers over UDP, truncated answer makes the client retry over TCP.
+	 * The answer class has its own budget, the query was charged to the 'qps' budget only. */
+	uv_handle_t *handle = task->source.handle;
+	struct sockaddr *addr = (struct sockaddr *)&task->source.addr;
+	if (handle && handle->type == UV_UDP) {
+		struct worker_ctx *worker = task->worker;
+		int action = rrl_check(&worker->rrl, addr, rrl_classify(task->req.answer), uv_now(worker->loop));
+		if (action == RRL_DROP) {
+			(void) qr_task_on_send(task, NULL, kr_ok());
+			return kr_error(EBUSY);
+		} else if (action == RRL_SLIP) {
+			rrl_truncate(task->req.answer);
+		}
+	}
 	/* Send back answer */
-	(void) qr_task_send(task, task->source.handle, (struct sockaddr *)&task->source.addr, task->req.answer);
+	(void) qr_task_send(task, handle, addr, task->req.answer);
 	return state == KNOT_STATE_DONE ? 0 : kr_error(EIO);
 }
 
+/** @internal Finish shed resolution with SERVFAIL, or drop it silently. */
+static int qr_task_shed(struct qr_task *task)
+{
+	if (!task->worker->overload.drop) {
+		(void) qr_task_finalize(task, KNOT_STATE_FAIL);
+		return kr_error(EBUSY);
+	}
+	kr_resolve_finish(&task->req, KNOT_STATE_FAIL);
+	task->finished = true;
+	(void) qr_task_on_send(task, NULL, kr_ok());
+	return kr_error(EBUSY);
+}
+
+/** @internal Signature verification offloaded to the thread pool. */
+struct sigwork {
+	uv_work_t req;
+	struct qr_task *task;
+	struct kr_sigjob *job;
+};
+
+/* This is called in the thread pool, it must not touch anything but the job. */
+static void on_sigwork(uv_work_t *req)
+{
+	struct sigwork *work = (struct sigwork *)req;
+	(void) kr_sigjob_verify(work->job);
+}
+
+static void on_sigwork_done(uv_work_t *req, int status)
+{
+	struct sigwork *work = (struct sigwork *)req;
+	struct qr_task *task = work->task;
+	if (status == 0) {
+		kr_sigjob_commit(work->job);
+	}
+	/* Resume the validator when the last verdict arrives. */
+	assert(task->offloaded > 0);
+	task->offloaded -= 1;
+	if (task->offloaded == 0 && !task->finished) {
+		qr_task_produce(task, KNOT_STATE_PRODUCE, NULL, NULL);
+	}
+	qr_task_unref(task);
+}
+
+/** @internal Verify signatures collected by the validator in the thread pool.
+ *  @return true if the task waits for the results. */
+static bool qr_task_offload(struct qr_task *task)
+{
+	kr_sigjobs_t *jobs = &task->req.sigjobs;
+	for (size_t i = 0; i < jobs->len; ++i) {
+		struct sigwork *work = mm_alloc(&task->req.pool, sizeof(*work));
+		if (!work) {
+			break;
+		}
+		work->task = task;
+		work->job = jobs->at[i];
+		if (uv_queue_work(task->worker->loop, &work->req, on_sigwork, on_sigwork_done) != 0) {
+			break;
+		}
+		qr_task_ref(task); /* Pending work on current task */
+		task->offloaded += 1;
+	}
+	/* Jobs that couldn't be offloaded are verified inline when the validator resumes. */
+	jobs->len = 0;
+	return task->offloaded > 0;
+}
+
+/** @internal Spawn the waiting side queries, the tasks that announced them are not on the stack. */
+static void sidequeries_spawn(uv_idle_t *handle)
+{
+	struct worker_ctx *worker = handle->data;
+	while (worker->sidequeries.len > 0) {
+		/* Pop a copy, the queue may change while the query is resolved. */
+		worker->sidequeries.len -= 1;
+		struct worker_sidequery side = worker->sidequeries.at[worker->sidequeries.len];
+		if (worker->stats.concurrent >= QUERY_RATE_THRESHOLD || worker_overload(worker) > 0) {
+			worker->sidequeries.len = 0; /* The plans resolve them on their own. */
+			break;
+		}
+		knot_pkt_t *pkt = knot_pkt_new(NULL, KNOT_WIRE_MIN_PKTSIZE, NULL);
+		if (!pkt) {
+			continue;
+		}
+		knot_pkt_put_question(pkt, side.qname, KNOT_CLASS_IN, side.qtype);
+		knot_wire_set_rd(pkt->wire);
+		if (worker_resolve(worker, pkt, side.options, NULL, NULL) == 0) {
+			worker->stats.sidequeries += 1;
+		}
+		knot_pkt_free(&pkt);
+	}
+	uv_idle_stop(handle);
+}
+
+static bool sidequery_queued(struct worker_ctx *worker, const struct kr_sidequery *side)
+{
+	for (unsigned i = 0; i < worker->sidequeries.len; ++i) {
+		const struct worker_sidequery *queued = &worker->sidequeries.at[i];
+		if (queued->qtype == side->qtype && knot_dname_is_equal(queued->qname, side->qname)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** @internal Queue queries independent of the task plan, the plan finds their results in cache.
+ *  Each side query is charged to the task iteration budget and to the worker concurrent queries. */
+static void qr_task_sidequeries(struct qr_task *task, int state)
+{
+	struct worker_ctx *worker = task->worker;
+	kr_sidequeries_t *queries = &task->req.sidequeries;
+	/* Only client requests fan out, and only if the worker isn't under pressure. */
+	const bool fanout = task->source.handle && !(state & (KNOT_STATE_DONE|KNOT_STATE_FAIL));
+	for (size_t i = 0; fanout && i < queries->len; ++i) {
+		if (task->iter_count + 1 >= KR_ITER_LIMIT ||
+		    worker->sidequeries.len >= SIDEQUERY_QUEUE_LEN ||
+		    worker->stats.concurrent + worker->sidequeries.len >= QUERY_RATE_THRESHOLD ||
+		    worker_overload(worker) > 0) {
+			break;
+		}
+		const struct kr_sidequery *side = &queries->at[i];
+		if (sidequery_queued(worker, side)) {
+			continue;
+		}
+		struct worker_sidequery *queued = &worker->sidequeries.at[worker->sidequeries.len];
+		memcpy(queued->qname, side->qname, knot_dname_size(side->qname));
+		queued->qtype = side->qtype;
+		queued->options = side->options;
+		worker->sidequeries.len += 1;
+		task->iter_count += 1;
+	}
+	queries->len = 0;
+	if (worker->sidequeries.len == 0 || uv_is_active((uv_handle_t *)&worker->sidequeries.spawn)) {
+		return;
+	}
+	if (!worker->sidequeries.spawn.loop) {
+		uv_idle_init(worker->loop, &worker->sidequeries.spawn);
+		worker->sidequeries.spawn.data = worker;
+	}
+	uv_idle_start(&worker->sidequeries.spawn, sidequeries_spawn);
+}
+
 static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_source, knot_pkt_t *packet)
 {
 	/* No more steps after we're finished. */
@@ -673,24 +1136,50 @@ static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_sour
 		return kr_error(ESTALE);
 	}
 	/* Close pending I/O requests */
+	if (packet) {
+		qr_task_sample(task, packet_source);
+	}
 	subreq_finalize(task, packet_source, packet);
 	/* Consume input and produce next query */
-	int sock_type = -1;
 	task->addrlist = NULL;
 	task->addrlist_count = 0;
 	task->addrlist_turn = 0;
+	memset(&task->sent, 0, sizeof(task->sent));
 	int state = kr_resolve_consume(&task->req, packet_source, packet);
+	return qr_task_produce(task, state, packet_source, packet);
+}
+
+static int qr_task_produce(struct qr_task *task, int state, const struct sockaddr *packet_source, knot_pkt_t *packet)
+{
+	int sock_type = -1;
 	while (state == KNOT_STATE_PRODUCE) {
+		/* Validator yielded for signature verification, continue when it's done. */
+		if (task->req.sigjobs.len > 0 && qr_task_offload(task)) {
+			return kr_ok();
+		}
 		state = kr_resolve_produce(&task->req, &task->addrlist, &sock_type, task->pktbuf);
 		if (unlikely(++task->iter_count > KR_ITER_LIMIT || task->timeouts >= KR_TIMEOUT_LIMIT)) {
 			return qr_task_finalize(task, KNOT_STATE_FAIL);
 		}
 	}
 
+	/* Shed new resolutions that would go upstream under overload, cache hits are answered below.
+	 * The decision is made before the side queries are announced, shed resolution leaves none behind. */
+	const bool outbound = !(state & (KNOT_STATE_DONE|KNOT_STATE_FAIL)) && task->addrlist && sock_type >= 0;
+	if (outbound && task->source.handle) {
+		struct worker_ctx *worker = task->worker;
+		if (!overload_admit(&worker->overload, worker->stats.concurrent, uv_now(worker->loop), task->admitted)) {
+			worker->stats.shed += 1;
+			return qr_task_shed(task);
+		}
+		task->admitted = true;
+	}
+	qr_task_sidequeries(task, state);
+
 	/* We're done, no more iterations needed */
 	if (state & (KNOT_STATE_DONE|KNOT_STATE_FAIL)) {
 		return qr_task_finalize(task, state);
-	} else if (!task->addrlist || sock_type < 0) {
+	} else if (!outbound) {
 		return qr_task_step(task, NULL, NULL);
 	}
 
@@ -700,6 +1189,11 @@ static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_sour
 		task->addrlist_count += 1;
 		choice += 1;
 	}
+	struct kr_query *qry = array_tail(task->req.rplan.pending);
+	task->race = (qry->flags & QUERY_RACE) && task->addrlist_count > 1;
+	if (task->race) {
+		task->worker->stats.race += 1;
+	}
 
 	/* Start fast retransmit with UDP, otherwise connect. */
 	int ret = 0;
@@ -708,9 +1202,12 @@ static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_sour
 		if (subreq_enqueue(task)) {
 			return kr_ok(); /* Will be notified when outgoing query finishes. */
 		}
-		/* Start transmitting */
-		if (retransmit(task)) {
-			ret = timer_start(task, on_retransmit, KR_CONN_RETRY, 0);
+		/* Start transmitting, or wait if all addresses are over the upstream limits. */
+		ret = retransmit(task);
+		if (ret == 0) {
+			ret = timer_start(task, on_retransmit, qr_task_rto(task), 0);
+		} else if (ret == kr_error(EAGAIN)) {
+			ret = timer_start(task, on_retransmit, qr_task_retry(task, KR_CONN_RTT_MAX), 0);
 		} else {
 			return qr_task_step(task, NULL, NULL);
 		}
@@ -785,6 +1282,23 @@ int worker_submit(struct worker_ctx *worker, uv_handle_t *handle, knot_pkt_t *ms
 			if (msg) worker->stats.dropped += 1;
 			return kr_error(EINVAL); /* Ignore. */
 		}
+		/* Measure how long the query waited in the event loop iteration. */
+		uint64_t delay = uv_hrtime() / 1000 - uv_now(worker->loop) * 1000;
+		if (delay < (uint64_t)KR_CONN_RTT_MAX * 1000) {
+			worker->stats.recv_delay += delay;
+		}
+		/* Rate limit queries from the client prefix before creating task. */
+		if (handle->type == UV_UDP) {
+			int action = rrl_check(&worker->rrl, addr, RRL_QUERY, uv_now(worker->loop));
+			if (action != RRL_PASS) {
+				if (action == RRL_SLIP) {
+					rrl_truncate(msg);
+					uv_buf_t buf = { (char *)msg->wire, msg->size };
+					(void) uv_udp_try_send((uv_udp_t *)handle, &buf, 1, addr);
+				}
+				return kr_error(EBUSY); /* Counted by the rate limiting */
+			}
+		}
 		task = qr_task_create(worker, handle, addr);
 		if (!task) {
 			return kr_error(ENOMEM);
@@ -973,6 +1487,14 @@ int worker_resolve(struct worker_ctx *worker, knot_pkt_t *query, unsigned option
 	return qr_task_step(task, NULL, query);
 }
 
+int worker_mirror(struct worker_ctx *worker, int id, const uint8_t *wire, size_t len)
+{
+	if (!worker) {
+		return kr_error(EINVAL);
+	}
+	return mirror_push(&worker->mirror, id, wire, len);
+}
+
 int worker_reserve(struct worker_ctx *worker, size_t ring_maxlen)
 {
 	array_init(worker->pool_mp);
@@ -987,7 +1509,12 @@ int worker_reserve(struct worker_ctx *worker, size_t ring_maxlen)
 	worker->pkt_pool.alloc = (knot_mm_alloc_t) mp_alloc;
 	worker->outgoing = map_make();
 	worker->tcp_pipeline_max = MAX_PIPELINED;
-	return kr_ok();
+	array_init(worker->upstream_waiting);
+	int ret = upstreams_init(&worker->upstreams, LRU_RTO_SIZE);
+	if (ret != 0) {
+		return ret;
+	}
+	return rrl_init(&worker->rrl, RRL_SIZE);
 }
 
 #define reclaim_freelist(list, type, cb) \
@@ -1006,6 +1533,14 @@ void worker_reclaim(struct worker_ctx *worker)
 	mp_delete(worker->pkt_pool.ctx);
 	worker->pkt_pool.ctx = NULL;
 	map_clear(&worker->outgoing);
+	upstreams_deinit(&worker->upstreams);
+	array_clear(worker->upstream_waiting);
+	if (worker->sidequeries.spawn.loop) {
+		uv_close((uv_handle_t *)&worker->sidequeries.spawn, NULL);
+	}
+	worker->sidequeries.len = 0;
+	rrl_deinit(&worker->rrl);
+	mirror_deinit(&worker->mirror);
 }
 
 #undef DEBUG_MSG
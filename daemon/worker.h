@@ -17,7 +17,12 @@
 #pragma once
 
 #include "daemon/engine.h"
+#include "daemon/rrl.h"
+#include "daemon/mirror.h"
+#include "daemon/upstream.h"
+#include "daemon/overload.h"
 #include "lib/generic/array.h"
+#include "lib/generic/lru.h"
 #include "lib/generic/map.h"
 
 /** @internal Number of request within timeout window. */
@@ -26,6 +31,13 @@
 /** @cond internal Freelist of available mempools. */
 typedef array_t(void *) mp_freelist_t;
 
+/** Side query waiting to be spawned from the event loop. */
+struct worker_sidequery {
+	uint8_t qname[KNOT_DNAME_MAXLEN];
+	uint16_t qtype;
+	uint32_t options;
+};
+
 /**
  * Query resolution worker.
  */
@@ -49,7 +61,27 @@ struct worker_ctx {
 		size_t queries;
 		size_t dropped;
 		size_t timeout;
+		size_t retransmit;
+		size_t retransmit_spurious;
+		size_t sidequeries;
+		size_t throttled;
+		size_t queued;
+		size_t queue_wait;
+		size_t race;
+		size_t shed;
+		size_t paused;
+		size_t recv_delay;
 	} stats;
+	struct overload overload;
+	struct {
+		uv_idle_t spawn; /**< Spawns the waiting side queries outside of the tasks that announced them */
+		struct worker_sidequery at[SIDEQUERY_QUEUE_LEN];
+		unsigned len;
+	} sidequeries;
+	struct upstreams upstreams;
+	array_t(struct qr_task *) upstream_waiting; /**< Queries waiting for the upstream limits, oldest first */
+	struct rrl rrl;
+	struct mirror mirror;
 	map_t outgoing;
 	mp_freelist_t pool_mp;
 	mp_freelist_t pool_ioreq;
@@ -74,6 +106,17 @@ struct qr_task
 	uint16_t addrlist_turn;
 	uint16_t timeouts;
 	uint16_t iter_count;
+	uint16_t offloaded;
+	struct {
+		uint64_t start;                    /* Time of the first transmission. */
+		uint64_t first[KR_NSREP_MAXADDR];  /* Time of the first transmission to each address. */
+		uint8_t count[KR_NSREP_MAXADDR];   /* Number of transmissions to each address. */
+		uint8_t order[KR_NSREP_MAXADDR];   /* Order of the first transmission to each address. */
+		uint8_t total;                     /* Number of transmissions. */
+		uint8_t last;                      /* Last address transmitted to. */
+		uint8_t queued;                    /* Address waiting for the limits (index + 1), 0 if none. */
+		uint64_t queued_at;                /* Time the query started waiting for the limits. */
+	} sent;
 	uint16_t bytes_remaining;
 	struct sockaddr *addrlist;
 	uv_timer_t *timeout;
@@ -93,6 +136,8 @@ struct qr_task
 	uint32_t refs;
 	bool finished : 1;
 	bool leading  : 1;
+	bool race     : 1;
+	bool admitted : 1;
 };
 /* @endcond */
 
@@ -123,6 +168,13 @@ int worker_end_tcp(struct worker_ctx *worker, uv_handle_t *handle);
  */
 int worker_resolve(struct worker_ctx *worker, knot_pkt_t *query, unsigned options, worker_cb_t on_complete, void *baton);
 
+/**
+ * Queue copy of the query for the mirroring target, it's sent asynchronously.
+ * @note Called from the policy module through FFI.
+ * @return 0 or an error code
+ */
+int worker_mirror(struct worker_ctx *worker, int id, const uint8_t *wire, size_t len);
+
 /** Reserve worker buffers */
 int worker_reserve(struct worker_ctx *worker, size_t ring_maxlen);
 
@@ -52,10 +52,15 @@ static inline int __attribute__((__cold__)) kr_error(int x) {
  */
 #define KR_CONN_RTT_MAX 3000 /* Timeout for network activity */
 #define KR_CONN_RETRY 300    /* Retry interval for network activity */
+#define KR_CONN_RTO_MIN 50   /* Minimum adaptive retry interval */
+#define KR_CONN_RTO_MAX (KR_CONN_RTT_MAX / 2) /* Maximum adaptive retry interval */
+#define KR_CONN_STAGGER 50   /* Interval between racing transmissions to unknown servers */
 #define KR_ITER_LIMIT 50     /* Built-in iterator limit */
 #define KR_CNAME_CHAIN_LIMIT 40 /* Built-in maximum CNAME chain length */
 #define KR_TIMEOUT_LIMIT 4   /* Maximum number of retries after timeout. */
+#define KR_SIDEQUERY_MAX 4   /* Maximum number of queries resolved concurrently with the plan. */
 #define KR_QUERY_NSRETRY_LIMIT 4 /* Maximum number of retries per query. */
+#define KR_CUT_TTL_MAX 60    /* Maximum lifetime of a materialized delegation (seconds). */
 
 /*
  * Defines.
@@ -34,6 +34,26 @@
 #include "lib/dnssec/nsec3.h"
 #include "lib/dnssec/signature.h"
 #include "lib/dnssec.h"
+#include "lib/generic/lru.h"
+#include "lib/utils.h"
+
+#ifndef KEYCACHE_SIZE
+#define KEYCACHE_SIZE 1024 /**< Number of remembered parsed keys */
+#endif
+#ifndef TRUSTCACHE_SIZE
+#define TRUSTCACHE_SIZE 1024 /**< Number of remembered authenticated DNSKEY sets */
+#endif
+#define KEYCACHE_KEY_MAX 4096 /**< Larger keys and key sets are not remembered */
+
+/** @internal Parsed DNSKEYs ready for verification, keyed by owner and key RDATA. */
+typedef lru_hash(struct dseckey *) keycache_t;
+/** @internal Chain of trust state, keyed by owner, DS RDATA set and DNSKEY RDATA set.
+ *  The value is position of the DNSKEY authenticated by DS (plus one). */
+typedef lru_hash(uint16_t) trustcache_t;
+
+/* @warning _NOT_ thread-safe */
+static keycache_t *keycache = NULL;
+static trustcache_t *trustcache = NULL;
 
 #define DEBUG_MSG(fmt...) fprintf(stderr, fmt)
 
@@ -42,8 +62,31 @@ void kr_crypto_init(void)
 	dnssec_crypto_init();
 }
 
+static void keycache_evict(void *baton, void *data)
+{
+	kr_dnssec_key_free((struct dseckey **)data);
+}
+
+/** @internal Free remembered keys and chain of trust state. */
+static void keycache_clear(void)
+{
+	if (keycache) {
+		lru_deinit(keycache);
+		free(keycache);
+		keycache = NULL;
+	}
+	if (trustcache) {
+		lru_deinit(trustcache);
+		free(trustcache);
+		trustcache = NULL;
+	}
+}
+
 void kr_crypto_cleanup(void)
 {
+	kr_signature_cache_clear();
+	kr_nsec3_memo_clear();
+	keycache_clear();
 	dnssec_crypto_cleanup();
 }
 
@@ -52,6 +95,12 @@ void kr_crypto_reinit(void)
 	dnssec_crypto_reinit();
 }
 
+struct kr_dnssec_stats *kr_dnssec_stats(void)
+{
+	static struct kr_dnssec_stats stats;
+	return &stats;
+}
+
 #define FLG_WILDCARD_EXPANSION 0x01 /**< Possibly generated by using wildcard expansion. */
 
 /**
@@ -129,6 +178,90 @@ static int wildcard_radix_len_diff(const knot_dname_t *expanded,
 	return knot_dname_labels(expanded, NULL) - knot_rrsig_labels(&rrsigs->rrs, sig_pos);
 }
 
+/** @internal Append length-prefixed data to the cache key, return false if it doesn't fit. */
+static bool key_append(uint8_t *dst, size_t *len, const uint8_t *data, uint16_t data_len)
+{
+	if (*len + sizeof(data_len) + data_len > KEYCACHE_KEY_MAX) {
+		return false;
+	}
+	memcpy(dst + *len, &data_len, sizeof(data_len));
+	memcpy(dst + *len + sizeof(data_len), data, data_len);
+	*len += sizeof(data_len) + data_len;
+	return true;
+}
+
+/** @internal Append RDATA of the RR set to the cache key (without TTLs, which decay). */
+static bool key_append_rdataset(uint8_t *dst, size_t *len, const knot_rdataset_t *rrs)
+{
+	knot_rdata_t *rd = rrs->data;
+	for (uint16_t i = 0; i < rrs->rr_count; ++i) {
+		if (!key_append(dst, len, knot_rdata_data(rd), knot_rdata_rdlen(rd))) {
+			return false;
+		}
+		rd = kr_rdataset_next(rd);
+	}
+	return true;
+}
+
+/**
+ * Find parsed key for given DNSKEY RDATA.
+ * The key is borrowed from the key cache, it's valid until next call.
+ * If it can't be remembered, it's created in 'created' and must be freed by caller.
+ * @return 0 or the error from parsing the key
+ */
+static int key_cached(const struct dseckey **key_out, struct dseckey **created, const knot_dname_t *kown,
+                      const uint8_t *rdata, size_t rdlen)
+{
+	static uint8_t key[KEYCACHE_KEY_MAX];
+	size_t key_len = 0;
+	bool cacheable = kown && key_append(key, &key_len, kown, knot_dname_size(kown)) &&
+	                 key_append(key, &key_len, rdata, rdlen);
+	if (cacheable && !keycache) {
+		keycache = malloc(lru_size(keycache_t, KEYCACHE_SIZE));
+		if (keycache) {
+			lru_init(keycache, KEYCACHE_SIZE);
+			keycache->evict = keycache_evict;
+		}
+	}
+	if (cacheable && keycache) {
+		struct dseckey **cached = lru_get(keycache, (const char *)key, key_len);
+		if (cached && *cached) {
+			kr_dnssec_stats()->key_hit += 1;
+			*key_out = *cached;
+			return kr_ok();
+		}
+	}
+	kr_dnssec_stats()->key_miss += 1;
+	struct dseckey *new_key = NULL;
+	int ret = kr_dnssec_key_from_rdata(&new_key, kown, rdata, rdlen);
+	if (ret != 0) {
+		return ret;
+	}
+	*key_out = new_key;
+	if (cacheable && keycache) {
+		struct dseckey **slot = lru_set(keycache, (const char *)key, key_len);
+		if (slot) {
+			kr_dnssec_key_free(slot);
+			*slot = new_key;
+			return kr_ok();
+		}
+	}
+	*created = new_key;
+	return kr_ok();
+}
+
+/** @internal Make chain of trust cache key, return 0 if it doesn't fit. */
+static size_t trust_key(uint8_t *dst, const knot_rrset_t *keys, const knot_rrset_t *ta)
+{
+	size_t len = 0;
+	if (!key_append(dst, &len, keys->owner, knot_dname_size(keys->owner)) ||
+	    !key_append_rdataset(dst, &len, &ta->rrs) ||
+	    !key_append_rdataset(dst, &len, &keys->rrs)) {
+		return 0;
+	}
+	return len;
+}
+
 int kr_rrset_validate(kr_rrset_validation_ctx_t *vctx, const knot_rrset_t *covered)
 {
 	if (!vctx) {
@@ -161,13 +294,11 @@ int kr_rrset_validate_with_key(kr_rrset_validation_ctx_t *vctx,
 	struct dseckey *created_key = NULL;
 	if (key == NULL) {
 		const knot_rdata_t *krr = knot_rdataset_at(&keys->rrs, key_pos);
-		int ret = kr_dnssec_key_from_rdata(&created_key, keys->owner,
-			                       knot_rdata_data(krr), knot_rdata_rdlen(krr));
+		int ret = key_cached(&key, &created_key, keys->owner, knot_rdata_data(krr), knot_rdata_rdlen(krr));
 		if (ret != 0) {
 			vctx->result = ret;
 			return vctx->result;
 		}
-		key = created_key;
 	}
 	uint16_t keytag = dnssec_key_get_keytag((dnssec_key_t *)key);
 	int covered_labels = knot_dname_labels(covered->owner, NULL);
@@ -203,7 +334,7 @@ int kr_rrset_validate_with_key(kr_rrset_validation_ctx_t *vctx,
 					break;
 				}
 			}
-			if (kr_check_signature(rrsig, j, (dnssec_key_t *) key, covered, trim_labels) != 0) {
+			if (kr_check_signature(rrsig, j, (dnssec_key_t *) key, covered, trim_labels, timestamp) != 0) {
 				continue;
 			}
 			if (val_flgs & FLG_WILDCARD_EXPANSION) {
@@ -239,6 +370,24 @@ int kr_dnskeys_trusted(kr_rrset_validation_ctx_t *vctx, const knot_rrset_t *ta)
 		return kr_error(EINVAL);
 	}
 
+	/* Reuse the chain of trust if this DNSKEY set was already authenticated by the DS set,
+	 * the DNSKEY RRSIG from the packet is still checked. */
+	static uint8_t trust_buf[KEYCACHE_KEY_MAX];
+	size_t trust_len = trust_key(trust_buf, keys, ta);
+	if (trust_len > 0 && trustcache) {
+		uint16_t *cached = lru_get(trustcache, (const char *)trust_buf, trust_len);
+		if (cached && *cached > 0 && *cached <= keys->rrs.rr_count) {
+			const uint32_t flags = vctx->flags;
+			if (kr_rrset_validate_with_key(vctx, keys, *cached - 1, NULL) == 0) {
+				kr_dnssec_stats()->trust_hit += 1;
+				return vctx->result;
+			}
+			/* Fall through to the full check with a clean state. */
+			vctx->flags = flags;
+			vctx->result = 0;
+		}
+	}
+
 	/* RFC4035 5.2, bullet 1
 	 * The supplied DS record has been authenticated.
 	 * It has been validated or is part of a configured trust anchor.
@@ -251,20 +400,37 @@ int kr_dnskeys_trusted(kr_rrset_validation_ctx_t *vctx, const knot_rrset_t *ta)
 			continue;
 		}
 		
-		struct dseckey *key;
-		if (kr_dnssec_key_from_rdata(&key, keys->owner, key_data, knot_rdata_rdlen(krr)) != 0) {
+		struct dseckey *created_key = NULL;
+		const struct dseckey *key = NULL;
+		if (key_cached(&key, &created_key, keys->owner, key_data, knot_rdata_rdlen(krr)) != 0) {
 			continue;
 		}
 		if (kr_authenticate_referral(ta, (dnssec_key_t *) key) != 0) {
-			kr_dnssec_key_free(&key);
+			kr_dnssec_key_free(&created_key);
 			continue;
 		}
 		if (kr_rrset_validate_with_key(vctx, keys, i, key) != 0) {
-			kr_dnssec_key_free(&key);
+			kr_dnssec_key_free(&created_key);
 			continue;
 		}
-		kr_dnssec_key_free(&key);
+		kr_dnssec_key_free(&created_key);
 		assert (vctx->result == 0);
+		/* Remember the authenticated key (not on a dry run, the signature isn't verified yet). */
+		if (kr_signature_collecting()) {
+			return vctx->result;
+		}
+		if (trust_len > 0 && !trustcache) {
+			trustcache = malloc(lru_size(trustcache_t, TRUSTCACHE_SIZE));
+			if (trustcache) {
+				lru_init(trustcache, TRUSTCACHE_SIZE);
+			}
+		}
+		if (trust_len > 0 && trustcache) {
+			uint16_t *slot = lru_set(trustcache, (const char *)trust_buf, trust_len);
+			if (slot) {
+				*slot = i + 1;
+			}
+		}
 		return vctx->result;
 	}
 	/* No useable key found */
@@ -355,9 +521,9 @@ int kr_dnssec_key_from_rdata(struct dseckey **key, const knot_dname_t *kown, con
 		return kr_error(ENOMEM);
 	}
 	ret = dnssec_key_set_rdata(new_key, &binary_key);
-	if (ret != DNSSEC_EOK) {
+	if (ret != DNSSEC_EOK) { /* i.e. unsupported algorithm or malformed key */
 		dnssec_key_free(new_key);
-		return kr_error(ENOMEM);
+		return kr_error(ret);
 	}
 	if (kown) {
 		ret = dnssec_key_set_dname(new_key, kown);
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "lib/defines.h"
+#include "lib/generic/array.h"
 #include <libknot/packet/pkt.h>
 
 /**
@@ -38,6 +39,62 @@ void kr_crypto_cleanup(void);
 KR_EXPORT
 void kr_crypto_reinit(void);
 
+/** Statistics of the DNSSEC validation caches (per process). */
+struct kr_dnssec_stats {
+	uint32_t sig_hit;  /**< Signature verifications reused from cache. */
+	uint32_t sig_miss; /**< Signature verifications performed. */
+	uint32_t sig_offload; /**< Signature verifications performed in the thread pool. */
+	uint32_t key_hit;  /**< Parsed DNSKEYs reused from cache. */
+	uint32_t key_miss; /**< DNSKEYs parsed from RDATA. */
+	uint32_t trust_hit; /**< DNSKEY sets authenticated by remembered chain of trust. */
+	uint32_t nsec3_hit; /**< NSEC3 hashes reused from cache. */
+	uint32_t nsec3_miss; /**< NSEC3 hashes computed. */
+	uint32_t nsec3_over_limit; /**< Responses with NSEC3 iterations over the limit. */
+};
+
+/**
+ * Return statistics of the DNSSEC validation caches.
+ */
+KR_EXPORT
+struct kr_dnssec_stats *kr_dnssec_stats(void);
+
+/**
+ * Signature verification detached from the validator.
+ * The job is self-contained, so it can be verified outside of the resolver thread.
+ */
+struct kr_sigjob {
+	uint8_t *cache_key;      /**< Verification cache key. */
+	uint8_t *key;            /**< DNSKEY RDATA. */
+	uint8_t *data;           /**< Signed data (RRSIG RDATA without signature + covered RRs). */
+	uint8_t *signature;      /**< Signature. */
+	uint16_t cache_key_len;
+	uint16_t key_len;
+	uint32_t data_len;
+	uint32_t signature_len;
+	uint32_t expire;         /**< Signature expiration. */
+	int result;              /**< Output - 0 or error code. */
+};
+
+/** @cond internal Array of signature verifications. */
+typedef array_t(struct kr_sigjob *) kr_sigjobs_t;
+/* @endcond */
+
+/**
+ * Verify detached signature.
+ * @note This is the only thread-safe DNSSEC function, it doesn't touch any shared state.
+ * @param job Verification job, result is stored in it.
+ * @return    0 if signature valid, error code else.
+ */
+KR_EXPORT
+int kr_sigjob_verify(struct kr_sigjob *job);
+
+/**
+ * Remember result of the verified job, so the validator doesn't have to repeat it.
+ * @note Must be called from the resolver thread.
+ */
+KR_EXPORT
+void kr_sigjob_commit(const struct kr_sigjob *job);
+
 /** Opaque DNSSEC key pointer. */
 struct dseckey;
 
@@ -75,6 +132,7 @@ int kr_rrset_validate(kr_rrset_validation_ctx_t *vctx,
  *		  If NULL, then key from DNSKEY RRSet is used.
  * @return        0 or error code, same as vctx->result.
  */
+KR_EXPORT
 int kr_rrset_validate_with_key(kr_rrset_validation_ctx_t *vctx,
 				const knot_rrset_t *covered,
 				size_t key_pos, const struct dseckey *key);
@@ -84,6 +142,7 @@ int kr_rrset_validate_with_key(kr_rrset_validation_ctx_t *vctx,
  * @param ta   Trust anchor RRSet against which to validate the DNSKEY RRSet.
  * @return     0 or error code, same as vctx->result.
  */
+KR_EXPORT
 int kr_dnskeys_trusted(kr_rrset_validation_ctx_t *vctx, const knot_rrset_t *ta);
 
 /** Return true if the DNSKEY can be used as a ZSK.  */
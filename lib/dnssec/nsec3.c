@@ -26,10 +26,16 @@
 #include <libknot/rrtype/nsec3.h>
 
 #include "lib/defines.h"
+#include "lib/dnssec.h"
 #include "lib/dnssec/nsec.h"
 #include "lib/dnssec/nsec3.h"
+#include "lib/generic/lru.h"
 
 #define OPT_OUT_BIT 0x01
+#define MAX_HASH_BYTES 64
+#ifndef NSEC3_MEMO_SIZE
+#define NSEC3_MEMO_SIZE 1024 /**< Number of remembered NSEC3 hashes */
+#endif
 
 //#define FLG_CLOSEST_ENCLOSER (1 << 0)
 #define FLG_CLOSEST_PROVABLE_ENCLOSER (1 << 1)
@@ -67,12 +73,76 @@ static int nsec3_parameters(dnssec_nsec3_params_t *params, const knot_rrset_t *n
 	return kr_ok();
 }
 
+/** @internal Remembered NSEC3 hash. */
+struct hash_memo {
+	uint8_t len;
+	uint8_t data[MAX_HASH_BYTES];
+};
+typedef lru_hash(struct hash_memo) hash_memo_t;
+
+/* @warning _NOT_ thread-safe */
+static hash_memo_t *hash_memo = NULL;
+
+/** @internal Configured limit of NSEC3 iterations, it doesn't change between responses. */
+static unsigned max_iterations = KR_NSEC3_MAX_ITERATIONS;
+
+void kr_nsec3_iterations_set(unsigned limit)
+{
+	max_iterations = limit;
+}
+
+bool kr_nsec3_over_limit(const knot_pkt_t *pkt, knot_section_t section_id)
+{
+	if (!pkt) {
+		return false;
+	}
+	const knot_pktsection_t *sec = knot_pkt_section(pkt, section_id);
+	for (unsigned i = 0; i < sec->count; ++i) {
+		const knot_rrset_t *rr = knot_pkt_rr(sec, i);
+		if (rr->type != KNOT_RRTYPE_NSEC3) {
+			continue;
+		}
+		for (uint16_t j = 0; j < rr->rrs.rr_count; ++j) {
+			if (knot_nsec3_iterations(&rr->rrs, j) > max_iterations) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void kr_nsec3_memo_clear(void)
+{
+	if (hash_memo) {
+		lru_deinit(hash_memo);
+		free(hash_memo);
+		hash_memo = NULL;
+	}
+}
+
+/** @internal Make memo key from the hash parameters and name, return 0 if it doesn't fit. */
+static size_t hash_memo_key(uint8_t *dst, const dnssec_nsec3_params_t *params, const dnssec_binary_t *dname)
+{
+	const size_t len = 2 + sizeof(params->iterations) + params->salt.size + dname->size;
+	if (len > UINT16_MAX || params->salt.size > UINT8_MAX) {
+		return 0;
+	}
+	dst[0] = params->algorithm;
+	dst[1] = params->salt.size;
+	memcpy(dst + 2, &params->iterations, sizeof(params->iterations));
+	dst += 2 + sizeof(params->iterations);
+	memcpy(dst, params->salt.data, params->salt.size);
+	memcpy(dst + params->salt.size, dname->data, dname->size);
+	return len;
+}
+
 /**
  * Computes a hash of a given domain name.
+ * The hash is remembered for given parameters.
  * @param hash   Resulting hash, must be freed.
  * @param params NSEC3 parameters.
  * @param name   Domain name to be hashed.
- * @return       0 or error code.
+ * @return       0 or error code (E2BIG if the iterations are over the limit).
  */
 static int hash_name(dnssec_binary_t *hash, const dnssec_nsec3_params_t *params,
                      const knot_dname_t *name)
@@ -81,15 +151,52 @@ static int hash_name(dnssec_binary_t *hash, const dnssec_nsec3_params_t *params,
 	if (!name)
 		return kr_error(EINVAL);
 
+	/* Never hash with more iterations than allowed, see RFC 9276 3.2 */
+	if (params->iterations > max_iterations) {
+		return kr_error(E2BIG);
+	}
+
 	dnssec_binary_t dname = {0, };
 	dname.size = knot_dname_size(name);
 	dname.data = (uint8_t *) name;
 
+	/* Reuse remembered hash */
+	static uint8_t key[2 + sizeof(uint16_t) + UINT8_MAX + KNOT_DNAME_MAXLEN];
+	size_t key_len = hash_memo_key(key, params, &dname);
+	if (hash_memo && key_len > 0) {
+		struct hash_memo *memo = lru_get(hash_memo, (const char *)key, key_len);
+		if (memo && memo->len > 0) {
+			if (dnssec_binary_alloc(hash, memo->len) != DNSSEC_EOK) {
+				return kr_error(ENOMEM);
+			}
+			memcpy(hash->data, memo->data, memo->len);
+			kr_dnssec_stats()->nsec3_hit += 1;
+			return kr_ok();
+		}
+	}
+
+	kr_dnssec_stats()->nsec3_miss += 1;
+
 	int ret = dnssec_nsec3_hash(&dname, params, hash);
 	if (ret != DNSSEC_EOK) {
 		return kr_error(EINVAL);
 	}
 
+	/* Remember computed hash */
+	if (!hash_memo && key_len > 0) {
+		hash_memo = malloc(lru_size(hash_memo_t, NSEC3_MEMO_SIZE));
+		if (hash_memo) {
+			lru_init(hash_memo, NSEC3_MEMO_SIZE);
+		}
+	}
+	if (hash_memo && key_len > 0 && hash->size <= MAX_HASH_BYTES) {
+		struct hash_memo *memo = lru_set(hash_memo, (const char *)key, key_len);
+		if (memo) {
+			memo->len = hash->size;
+			memcpy(memo->data, hash->data, hash->size);
+		}
+	}
+
 	return kr_ok();
 }
 
@@ -114,7 +221,6 @@ static int read_owner_hash(dnssec_binary_t *hash, size_t max_hash_size, const kn
 	return kr_ok();
 }
 
-#define MAX_HASH_BYTES 64
 /**
  * Closest (provable) encloser match (RFC5155 7.2.1, bullet 1).
  * @param flags   Flags to be set according to check outcome.
@@ -341,7 +447,6 @@ fail:
 	}
 	return ret;
 }
-#undef MAX_HASH_BYTES
 
 /**
  * Prepends an asterisk label to given name.
@@ -785,3 +890,4 @@ int kr_nsec3_ref_to_unsigned(const knot_pkt_t *pkt)
 	return kr_error(EINVAL);
 }
 
+#undef MAX_HASH_BYTES
@@ -16,7 +16,34 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <libknot/packet/pkt.h>
+#include "lib/defines.h"
+
+/** Default limit of NSEC3 iterations, proofs with more iterations are insecure (RFC 9276 3.2). */
+#ifndef KR_NSEC3_MAX_ITERATIONS
+#define KR_NSEC3_MAX_ITERATIONS 150
+#endif
+
+/**
+ * Set the limit of NSEC3 iterations, names are never hashed with more iterations.
+ * @param limit      Maximum number of additional iterations in NSEC3 parameters.
+ */
+KR_EXPORT
+void kr_nsec3_iterations_set(unsigned limit);
+
+/**
+ * Return true if any NSEC3 record in the section has more iterations than the limit.
+ * @param pkt        Packet structure to be processed.
+ * @param section_id Packet section to be processed.
+ */
+KR_EXPORT
+bool kr_nsec3_over_limit(const knot_pkt_t *pkt, knot_section_t section_id);
+
+/**
+ * Free remembered NSEC3 hashes.
+ */
+void kr_nsec3_memo_clear(void);
 
 /**
  * Name error response check (RFC5155 7.2.2).
@@ -26,6 +53,7 @@
  * @param sname      Name to be checked.
  * @return           0 or error code.
  */
+KR_EXPORT
 int kr_nsec3_name_error_response_check(const knot_pkt_t *pkt, knot_section_t section_id,
                                        const knot_dname_t *sname);
 
@@ -31,6 +31,26 @@
 #include "lib/defines.h"
 #include "lib/utils.h"
 #include "lib/dnssec/signature.h"
+#include "lib/dnssec.h"
+#include "lib/generic/lru.h"
+
+#ifndef SIGCACHE_SIZE
+#define SIGCACHE_SIZE 4096 /**< Number of remembered verification results */
+#endif
+#define SIGCACHE_KEY_MAX 4096 /**< Larger signed data is always verified */
+
+/** @internal Remembered signature verification result. */
+struct sigcache_entry {
+	int result;      /**< Verification result. */
+	uint32_t expire; /**< Signature expiration. */
+};
+typedef lru_hash(struct sigcache_entry) sigcache_t;
+
+/* @warning _NOT_ thread-safe, same as the wire buffer below. */
+static sigcache_t *sigcache = NULL;
+/* Collected verifications, see kr_signature_collect(). */
+static kr_sigjobs_t *sig_collect = NULL;
+static knot_mm_t *sig_collect_pool = NULL;
 
 static int authenticate_ds(const dnssec_key_t *key, dnssec_binary_t *ds_rdata, uint8_t digest_type)
 {
@@ -158,20 +178,68 @@ static int sign_ctx_add_self(dnssec_sign_ctx_t *ctx, const uint8_t *rdata)
 
 	return result;
 }
+
+/** Append verification to the collected jobs, the data is copied so the job is self-contained. */
+static void sigjob_add(const uint8_t *cache_key, uint16_t cache_key_len, const dnssec_key_t *key,
+                       const uint8_t *rdata, const dnssec_binary_t *covered,
+                       const dnssec_binary_t *signature, uint32_t expire)
+{
+	/* The same signature may be checked more than once in a single pass. */
+	for (size_t i = 0; i < sig_collect->len; ++i) {
+		const struct kr_sigjob *job = sig_collect->at[i];
+		if (job->cache_key_len == cache_key_len &&
+		    memcmp(job->cache_key, cache_key, cache_key_len) == 0) {
+			return;
+		}
+	}
+	dnssec_binary_t key_rdata = { 0, };
+	if (dnssec_key_get_rdata(key, &key_rdata) != DNSSEC_EOK) {
+		return;
+	}
+	const uint8_t *signer = rdata + RRSIG_RDATA_SIGNER_OFFSET;
+	const size_t signer_len = knot_dname_size(signer);
+	const size_t data_len = RRSIG_RDATA_SIGNER_OFFSET + signer_len + covered->size;
+	struct kr_sigjob *job = mm_alloc(sig_collect_pool, sizeof(*job));
+	uint8_t *buf = mm_alloc(sig_collect_pool, cache_key_len + key_rdata.size + data_len + signature->size);
+	if (!job || !buf) {
+		return;
+	}
+	if (array_reserve_mm(*sig_collect, sig_collect->len + 1, kr_memreserve, sig_collect_pool) != 0) {
+		return;
+	}
+	job->cache_key = buf;
+	job->cache_key_len = cache_key_len;
+	memcpy(job->cache_key, cache_key, cache_key_len);
+	job->key = job->cache_key + cache_key_len;
+	job->key_len = key_rdata.size;
+	memcpy(job->key, key_rdata.data, key_rdata.size);
+	/* Same layout as sign_ctx_add_self() followed by the covered records. */
+	job->data = job->key + job->key_len;
+	job->data_len = data_len;
+	memcpy(job->data, rdata, RRSIG_RDATA_SIGNER_OFFSET);
+	memcpy(job->data + RRSIG_RDATA_SIGNER_OFFSET, signer, signer_len);
+	memcpy(job->data + RRSIG_RDATA_SIGNER_OFFSET + signer_len, covered->data, covered->size);
+	job->signature = job->data + data_len;
+	job->signature_len = signature->size;
+	memcpy(job->signature, signature->data, signature->size);
+	job->expire = expire;
+	job->result = kr_error(EAGAIN);
+	array_push(*sig_collect, job);
+}
 #undef RRSIG_RDATA_SIGNER_OFFSET
 
 /*!
- * \brief Add covered RRs to signing context.
+ * \brief Write covered RRs in the form that is signed.
  *
  * Requires all DNAMEs in canonical form and all RRs ordered canonically.
  *
- * \param ctx      Signing context.
+ * \param wire     Output, points to a static buffer.
  * \param covered  Covered RRs.
  *
  * \return Error code, KNOT_EOK if successful.
  */
-static int sign_ctx_add_records(dnssec_sign_ctx_t *ctx, const knot_rrset_t *covered,
-                                uint32_t orig_ttl, int trim_labels)
+static int covered_to_wire(dnssec_binary_t *wire, const knot_rrset_t *covered,
+                           uint32_t orig_ttl, int trim_labels)
 {
 	// huge block of rrsets can be optionally created
 	static uint8_t wire_buffer[KNOT_WIRE_MAX_PKTSIZE];
@@ -199,42 +267,135 @@ static int sign_ctx_add_records(dnssec_sign_ctx_t *ctx, const knot_rrset_t *cove
 		*(--beginp) = 1;
 	}
 
-	dnssec_binary_t wire_binary = {
-		.size = written - (beginp - wire_buffer),
-		.data = beginp
-	};
-	return dnssec_sign_add(ctx, &wire_binary);
+	wire->size = written - (beginp - wire_buffer);
+	wire->data = beginp;
+	return kr_ok();
 }
 
-/*!
- * \brief Add all data covered by signature into signing context.
- *
- * RFC 4034: The signature covers RRSIG RDATA field (excluding the signature)
- * and all matching RR records, which are ordered canonically.
- *
- * Requires all DNAMEs in canonical form and all RRs ordered canonically.
- *
- * \param ctx          Signing context.
- * \param rrsig_rdata  RRSIG RDATA with populated fields except signature.
- * \param covered      Covered RRs.
- *
- * \return Error code, KNOT_EOK if successful.
+/**
+ * Make verification cache key from the key RDATA, whole RRSIG RDATA and signed records.
+ * The key is compared as a whole, so there are no false positives even if the hashes collide.
+ * @return key length or 0 if it doesn't fit
  */
-/* TODO -- Taken from knot/src/knot/dnssec/rrset-sign.c. Re-write for better fit needed. */
-static int sign_ctx_add_data(dnssec_sign_ctx_t *ctx, const uint8_t *rrsig_rdata,
-                             const knot_rrset_t *covered, uint32_t orig_ttl, int trim_labels)
+static uint16_t sigcache_key(uint8_t *dst, const dnssec_key_t *key, const knot_rdata_t *rrsig,
+                             const dnssec_binary_t *covered)
 {
-	int result = sign_ctx_add_self(ctx, rrsig_rdata);
-	if (result != KNOT_EOK) {
-		return result;
+	dnssec_binary_t key_rdata = { 0, };
+	if (dnssec_key_get_rdata(key, &key_rdata) != DNSSEC_EOK) {
+		return 0;
+	}
+	const uint16_t rrsig_len = knot_rdata_rdlen(rrsig);
+	const size_t len = 2 * sizeof(uint16_t) + key_rdata.size + rrsig_len + covered->size;
+	if (len > SIGCACHE_KEY_MAX) {
+		return 0;
+	}
+	const uint16_t key_len = key_rdata.size;
+	memcpy(dst, &key_len, sizeof(key_len));
+	dst += sizeof(key_len);
+	memcpy(dst, key_rdata.data, key_len);
+	dst += key_len;
+	memcpy(dst, &rrsig_len, sizeof(rrsig_len));
+	dst += sizeof(rrsig_len);
+	memcpy(dst, knot_rdata_data(rrsig), rrsig_len);
+	dst += rrsig_len;
+	memcpy(dst, covered->data, covered->size);
+	return len;
+}
+
+/** Find remembered verification result (if the signature is not expired at the validation time). */
+static struct sigcache_entry *sigcache_get(const uint8_t *key, uint16_t len, uint32_t timestamp)
+{
+	if (!sigcache || len == 0) {
+		return NULL;
+	}
+	struct sigcache_entry *entry = lru_get(sigcache, (const char *)key, len);
+	if (entry && entry->expire >= timestamp) {
+		return entry;
+	}
+	return NULL;
+}
+
+/** Remember verification result until the signature expires. */
+static void sigcache_put(const uint8_t *key, uint16_t len, int result, uint32_t expire)
+{
+	if (len == 0) {
+		return;
+	}
+	if (!sigcache) {
+		sigcache = malloc(lru_size(sigcache_t, SIGCACHE_SIZE));
+		if (!sigcache) {
+			return;
+		}
+		lru_init(sigcache, SIGCACHE_SIZE);
+	}
+	struct sigcache_entry *entry = lru_set(sigcache, (const char *)key, len);
+	if (entry) {
+		entry->result = result;
+		entry->expire = expire;
+	}
+}
+
+void kr_signature_collect(kr_sigjobs_t *jobs, knot_mm_t *pool)
+{
+	sig_collect = jobs;
+	sig_collect_pool = pool;
+}
+
+bool kr_signature_collecting(void)
+{
+	return sig_collect != NULL;
+}
+
+int kr_sigjob_verify(struct kr_sigjob *job)
+{
+	if (!job) {
+		return kr_error(EINVAL);
+	}
+	/* Key is parsed again, shared keys and caches are not safe to touch here. */
+	dnssec_binary_t key_rdata = { .size = job->key_len, .data = job->key };
+	dnssec_binary_t data = { .size = job->data_len, .data = job->data };
+	dnssec_binary_t signature = { .size = job->signature_len, .data = job->signature };
+	dnssec_key_t *key = NULL;
+	dnssec_sign_ctx_t *sign_ctx = NULL;
+	int ret = kr_error(ENOMEM);
+	if (dnssec_key_new(&key) == DNSSEC_EOK &&
+	    dnssec_key_set_rdata(key, &key_rdata) == DNSSEC_EOK &&
+	    dnssec_key_can_verify(key) &&
+	    dnssec_sign_new(&sign_ctx, key) == DNSSEC_EOK &&
+	    dnssec_sign_add(sign_ctx, &data) == DNSSEC_EOK) {
+		if (dnssec_sign_verify(sign_ctx, &signature) != DNSSEC_EOK) {
+			ret = kr_error(EBADMSG);
+		} else {
+			ret = kr_ok();
+		}
 	}
+	dnssec_sign_free(sign_ctx);
+	dnssec_key_free(key);
+	job->result = ret;
+	return ret;
+}
 
-	return sign_ctx_add_records(ctx, covered, orig_ttl, trim_labels);
+void kr_sigjob_commit(const struct kr_sigjob *job)
+{
+	/* Only definite results are remembered, same as in kr_check_signature(). */
+	if (job && (job->result == kr_ok() || job->result == kr_error(EBADMSG))) {
+		sigcache_put(job->cache_key, job->cache_key_len, job->result, job->expire);
+		kr_dnssec_stats()->sig_offload += 1;
+	}
+}
+
+void kr_signature_cache_clear(void)
+{
+	if (sigcache) {
+		lru_deinit(sigcache);
+		free(sigcache);
+		sigcache = NULL;
+	}
 }
 
 int kr_check_signature(const knot_rrset_t *rrsigs, size_t pos,
                        const dnssec_key_t *key, const knot_rrset_t *covered,
-                       int trim_labels)
+                       int trim_labels, uint32_t timestamp)
 {
 	if (!rrsigs || !key || !dnssec_key_can_verify(key)) {
 		return kr_error(EINVAL);
@@ -250,26 +411,53 @@ int kr_check_signature(const knot_rrset_t *rrsigs, size_t pos,
 		goto fail;
 	}
 
-	if (dnssec_sign_new(&sign_ctx, key) != 0) {
+	uint32_t orig_ttl = knot_rrsig_original_ttl(&rrsigs->rrs, pos);
+	const knot_rdata_t *rr_data = knot_rdataset_at(&rrsigs->rrs, pos);
+	uint8_t *rdata = knot_rdata_data(rr_data);
+
+	/* RFC 4034: The signature covers RRSIG RDATA field (excluding the signature)
+	 * and all matching RR records, which are ordered canonically. */
+	dnssec_binary_t covered_wire = {0, };
+	if (covered_to_wire(&covered_wire, covered, orig_ttl, trim_labels) != 0) {
 		ret = kr_error(ENOMEM);
 		goto fail;
 	}
 
-	uint32_t orig_ttl = knot_rrsig_original_ttl(&rrsigs->rrs, pos);
-	const knot_rdata_t *rr_data = knot_rdataset_at(&rrsigs->rrs, pos);
-	uint8_t *rdata = knot_rdata_data(rr_data);
+	/* Reuse result if the same data was already verified with this key. */
+	static uint8_t cache_key[SIGCACHE_KEY_MAX];
+	uint16_t cache_key_len = sigcache_key(cache_key, key, rr_data, &covered_wire);
+	struct sigcache_entry *entry = sigcache_get(cache_key, cache_key_len, timestamp);
+	if (entry) {
+		kr_dnssec_stats()->sig_hit += 1;
+		return entry->result;
+	}
+	/* Dry run, defer verification and assume the signature is valid. */
+	if (sig_collect) {
+		if (cache_key_len > 0) {
+			sigjob_add(cache_key, cache_key_len, key, rdata, &covered_wire, &signature,
+			           knot_rrsig_sig_expiration(&rrsigs->rrs, pos));
+		}
+		return kr_ok();
+	}
+	kr_dnssec_stats()->sig_miss += 1;
 
-	if (sign_ctx_add_data(sign_ctx, rdata, covered, orig_ttl, trim_labels) != 0) {
+	if (dnssec_sign_new(&sign_ctx, key) != 0) {
 		ret = kr_error(ENOMEM);
 		goto fail;
 	}
 
-	if (dnssec_sign_verify(sign_ctx, &signature) != 0) {
-		ret = kr_error(EBADMSG);
+	if (sign_ctx_add_self(sign_ctx, rdata) != 0 ||
+	    dnssec_sign_add(sign_ctx, &covered_wire) != 0) {
+		ret = kr_error(ENOMEM);
 		goto fail;
 	}
 
-	ret = kr_ok();
+	if (dnssec_sign_verify(sign_ctx, &signature) != 0) {
+		ret = kr_error(EBADMSG);
+	} else {
+		ret = kr_ok();
+	}
+	sigcache_put(cache_key, cache_key_len, ret, knot_rrsig_sig_expiration(&rrsigs->rrs, pos));
 
 fail:
 	dnssec_sign_free(sign_ctx);
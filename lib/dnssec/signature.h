@@ -16,9 +16,12 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <dnssec/key.h>
 #include <libknot/rrset.h>
 
+#include "lib/dnssec.h"
+
 /**
  * Performs referral authentication according to RFC4035 5.2, bullet 2
  * @param ref Referral RRSet. Currently only DS can be used.
@@ -34,8 +37,28 @@ int kr_authenticate_referral(const knot_rrset_t *ref, const dnssec_key_t *key);
  * @param key         Key to be used to validate the signature.
  * @param covered     The covered RRSet.
  * @param trim_labels Number of the leftmost labels to be removed and replaced with '*.'.
+ * @param timestamp   Validation time, remembered results of signatures expired by then are not reused.
  * @return            0 if signature valid, error code else.
  */
 int kr_check_signature(const knot_rrset_t *rrsigs, size_t pos,
                        const dnssec_key_t *key, const knot_rrset_t *covered,
-                       int trim_labels);
+                       int trim_labels, uint32_t timestamp);
+
+/**
+ * Free remembered signature verification results.
+ */
+void kr_signature_cache_clear(void);
+
+/**
+ * Collect signature verifications instead of performing them.
+ * While collecting, each verification missing in the cache is appended to jobs and
+ * reported as valid, so that a dry run of the validator finds all signatures it would check.
+ * @param jobs Output array of jobs or NULL to stop collecting.
+ * @param pool Memory pool for the jobs.
+ */
+void kr_signature_collect(kr_sigjobs_t *jobs, knot_mm_t *pool);
+
+/**
+ * Return true if the verifications are being collected.
+ */
+bool kr_signature_collecting(void);
@@ -0,0 +1,249 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "lpm.h"
+
+ /* Exports */
+#define EXPORT __attribute__ ((visibility ("default")))
+
+/**
+ * Tree node, the prefix of each node is extended by the prefixes of its children.
+ * Node without value exists only where the tree branches.
+ */
+struct lpm_node {
+	struct lpm_node *child[2];
+	void *value;
+	uint8_t bits;
+	uint8_t key[LPM_KEY_MAX];
+};
+
+static inline int key_bit(const uint8_t *key, unsigned i)
+{
+	return (key[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+/** Returns length of the common prefix of the keys, starting at bit 'from' up to 'bits'. */
+static unsigned key_common(const uint8_t *a, const uint8_t *b, unsigned from, unsigned bits)
+{
+	unsigned i = from;
+	while (i < bits && (i & 7) != 0) {
+		if (key_bit(a, i) != key_bit(b, i)) {
+			return i;
+		}
+		++i;
+	}
+	while (i + 8 <= bits && a[i >> 3] == b[i >> 3]) {
+		i += 8;
+	}
+	while (i < bits && key_bit(a, i) == key_bit(b, i)) {
+		++i;
+	}
+	return i;
+}
+
+static struct lpm_node *node_make(const uint8_t *key, unsigned bits, void *val)
+{
+	struct lpm_node *node = calloc(1, sizeof(*node));
+	if (node != NULL) {
+		node->value = val;
+		node->bits = bits;
+		memcpy(node->key, key, (bits + 7) / 8);
+		if (bits & 7) {
+			node->key[bits >> 3] &= 0xff << (8 - (bits & 7));
+		}
+	}
+	return node;
+}
+
+EXPORT lpm_t lpm_make(void)
+{
+	lpm_t lpm;
+	lpm.root = NULL;
+	lpm.count = 0;
+	return lpm;
+}
+
+EXPORT int lpm_set(lpm_t *lpm, const uint8_t *key, unsigned bits, void *val)
+{
+	if (lpm == NULL || key == NULL || val == NULL || bits > LPM_KEY_MAX * 8) {
+		return EINVAL;
+	}
+	struct lpm_node **where = &lpm->root;
+	unsigned checked = 0;
+	while (*where != NULL) {
+		struct lpm_node *node = *where;
+		const unsigned common = key_common(node->key, key, checked, node->bits < bits ? node->bits : bits);
+		if (common < node->bits) {
+			/* Split the edge where the prefixes differ */
+			struct lpm_node *parent = node_make(key, common, common == bits ? val : NULL);
+			if (parent == NULL) {
+				return ENOMEM;
+			}
+			parent->child[key_bit(node->key, common)] = node;
+			if (common < bits) {
+				struct lpm_node *leaf = node_make(key, bits, val);
+				if (leaf == NULL) {
+					free(parent);
+					return ENOMEM;
+				}
+				parent->child[key_bit(key, common)] = leaf;
+			}
+			*where = parent;
+			lpm->count += 1;
+			return 0;
+		}
+		if (node->bits == bits) {
+			const int ret = (node->value != NULL) ? 1 : 0;
+			if (ret == 0) {
+				lpm->count += 1;
+			}
+			node->value = val;
+			return ret;
+		}
+		checked = node->bits;
+		where = &node->child[key_bit(key, node->bits)];
+	}
+	*where = node_make(key, bits, val);
+	if (*where == NULL) {
+		return ENOMEM;
+	}
+	lpm->count += 1;
+	return 0;
+}
+
+EXPORT void *lpm_get(const lpm_t *lpm, const uint8_t *key, unsigned bits)
+{
+	unsigned matched = 0;
+	void *val = lpm_match(lpm, key, bits, &matched);
+	return (matched == bits) ? val : NULL;
+}
+
+EXPORT void *lpm_match(const lpm_t *lpm, const uint8_t *key, unsigned bits, unsigned *matched)
+{
+	if (lpm == NULL || key == NULL || bits > LPM_KEY_MAX * 8) {
+		return NULL;
+	}
+	void *best = NULL;
+	unsigned checked = 0;
+	struct lpm_node *node = lpm->root;
+	while (node != NULL && node->bits <= bits) {
+		if (key_common(node->key, key, checked, node->bits) < node->bits) {
+			break;
+		}
+		if (node->value != NULL) {
+			best = node->value;
+			if (matched != NULL) {
+				*matched = node->bits;
+			}
+		}
+		if (node->bits == bits) {
+			break;
+		}
+		checked = node->bits;
+		node = node->child[key_bit(key, node->bits)];
+	}
+	return best;
+}
+
+EXPORT int lpm_del(lpm_t *lpm, const uint8_t *key, unsigned bits)
+{
+	if (lpm == NULL || key == NULL || bits > LPM_KEY_MAX * 8) {
+		return EINVAL;
+	}
+	struct lpm_node **parent_where = NULL;
+	struct lpm_node **where = &lpm->root;
+	unsigned checked = 0;
+	while (*where != NULL) {
+		struct lpm_node *node = *where;
+		if (node->bits > bits || key_common(node->key, key, checked, node->bits) < node->bits) {
+			return 1;
+		}
+		if (node->bits == bits) {
+			break;
+		}
+		checked = node->bits;
+		parent_where = where;
+		where = &node->child[key_bit(key, node->bits)];
+	}
+	struct lpm_node *node = *where;
+	if (node == NULL || node->value == NULL) {
+		return 1;
+	}
+	node->value = NULL;
+	lpm->count -= 1;
+	if (node->child[0] != NULL && node->child[1] != NULL) {
+		return 0; /* Still branches */
+	}
+	*where = (node->child[0] != NULL) ? node->child[0] : node->child[1];
+	free(node);
+	/* Parent without value doesn't have to branch anymore */
+	if (parent_where != NULL) {
+		struct lpm_node *parent = *parent_where;
+		if (parent->value == NULL && (parent->child[0] == NULL || parent->child[1] == NULL)) {
+			*parent_where = (parent->child[0] != NULL) ? parent->child[0] : parent->child[1];
+			free(parent);
+		}
+	}
+	return 0;
+}
+
+static void node_free(struct lpm_node *node)
+{
+	if (node != NULL) {
+		node_free(node->child[0]);
+		node_free(node->child[1]);
+		free(node);
+	}
+}
+
+EXPORT void lpm_clear(lpm_t *lpm)
+{
+	if (lpm != NULL) {
+		node_free(lpm->root);
+		lpm->root = NULL;
+		lpm->count = 0;
+	}
+}
+
+static int node_walk(struct lpm_node *node, int (*callback)(const uint8_t *, unsigned, void *, void *), void *baton)
+{
+	if (node == NULL) {
+		return 0;
+	}
+	if (node->value != NULL) {
+		int ret = callback(node->key, node->bits, node->value, baton);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	int ret = node_walk(node->child[0], callback, baton);
+	if (ret != 0) {
+		return ret;
+	}
+	return node_walk(node->child[1], callback, baton);
+}
+
+EXPORT int lpm_walk(lpm_t *lpm, int (*callback)(const uint8_t *, unsigned, void *, void *), void *baton)
+{
+	if (lpm == NULL || callback == NULL) {
+		return EINVAL;
+	}
+	return node_walk(lpm->root, callback, baton);
+}
@@ -0,0 +1,116 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lpm.h
+ * @brief Longest prefix match on bit strings (i.e. IP subnets),
+ *        implemented as a path-compressed binary radix tree.
+ *
+ * The key is a bit string given by bytes and number of bits, bits following the prefix are ignored.
+ * The lookup walks at most one node per bit of the key, but the path compression
+ * skips the bits without branching, so it's usually much less.
+ *
+ * # Example usage:
+ *
+ * @code{.c}
+ *      lpm_t lpm = lpm_make();
+ *
+ *      // Insert subnets
+ *      uint8_t net[4] = { 10, 0, 0, 0 };
+ *      uint8_t host[4] = { 10, 1, 2, 3 };
+ *      if (lpm_set(&lpm, net, 8, &values[0]) != 0) {
+ *          fail();
+ *      }
+ *
+ *      // Longest prefix match
+ *      unsigned bits = 0;
+ *      if (lpm_match(&lpm, host, 32, &bits) == &values[0]) {
+ *          printf("matched /%u\n", bits);
+ *      }
+ *
+ *      // Clear the tree
+ *      lpm_clear(&lpm);
+ * @endcode
+ *
+ * \addtogroup generics
+ * @{
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum key length in bytes (IPv6 address). */
+#define LPM_KEY_MAX 16
+
+struct lpm_node;
+
+/** Main data structure */
+typedef struct {
+	struct lpm_node *root;
+	size_t count; /**< Number of prefixes */
+} lpm_t;
+
+/** Creates an new, empty tree */
+lpm_t lpm_make(void);
+
+/**
+ * Inserts prefix into the tree, or replaces its value.
+ * @param lpm
+ * @param key  prefix bytes
+ * @param bits prefix length in bits
+ * @param val  value (must not be NULL)
+ * @return 0 if inserted, 1 if replaced, ENOMEM or EINVAL on failure
+ */
+int lpm_set(lpm_t *lpm, const uint8_t *key, unsigned bits, void *val);
+
+/** Returns value of the prefix or NULL */
+void *lpm_get(const lpm_t *lpm, const uint8_t *key, unsigned bits);
+
+/**
+ * Returns value of the longest prefix containing the key, or NULL.
+ * @param lpm
+ * @param key     key bytes (i.e. address)
+ * @param bits    key length in bits
+ * @param matched length of the matched prefix (optional)
+ */
+void *lpm_match(const lpm_t *lpm, const uint8_t *key, unsigned bits, unsigned *matched);
+
+/** Deletes prefix from the tree, returns 0 on success */
+int lpm_del(lpm_t *lpm, const uint8_t *key, unsigned bits);
+
+/** Clears the given tree */
+void lpm_clear(lpm_t *lpm);
+
+/**
+ * Calls callback for all prefixes in the tree, shorter prefixes first.
+ * @param lpm
+ * @param callback callback parameters are (key, bits, value, baton), non-zero return value stops the walk
+ * @param baton    passed uservalue
+ * @return 0 or the non-zero return value of the callback
+ */
+int lpm_walk(lpm_t *lpm, int (*callback)(const uint8_t *, unsigned, void *, void *), void *baton);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
@@ -142,6 +142,19 @@ static inline void *lru_slot_get(struct lru_hash_base *lru, const char *key, uin
 	return NULL;
 }
 
+static inline void *lru_slot_peek(struct lru_hash_base *lru, const char *key, uint16_t len, size_t offset)
+{
+	if (!lru || !key || len == 0) {
+		return NULL;
+	}
+	uint32_t id = hash(key, len) % lru->size;
+	struct lru_slot *slot = lru_slot_at(lru, id);
+	if (slot->key) {
+		return lru_slot_val(slot, offset);
+	}
+	return NULL;
+}
+
 static inline int lru_slot_evict(struct lru_hash_base *lru, uint32_t id, size_t offset)
 {
 	struct lru_slot *slot = lru_slot_at(lru, id);
@@ -232,6 +245,18 @@ static inline void *lru_slot_set(struct lru_hash_base *lru, const char *key, uin
 	(__typeof__(&(table)->slots[0].data)) \
 		lru_slot_get((struct lru_hash_base *)(table), (key_), (len_), lru_slot_offset(table))
 
+/**
+ * @brief Return pointer to value in the slot the key maps to, even if it holds a different key.
+ * This allows checking whether lru_set() would replace an entry that is still in use.
+ * @param table hash table
+ * @param key_ lookup key
+ * @param len_ key length
+ * @return pointer to data or NULL if the slot is empty
+ */
+#define lru_peek(table, key_, len_) \
+	(__typeof__(&(table)->slots[0].data)) \
+		lru_slot_peek((struct lru_hash_base *)(table), (key_), (len_), lru_slot_offset(table))
+
 /**
  * @brief Return pointer to value (create/replace if needed)
  * @param table hash table
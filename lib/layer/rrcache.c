@@ -71,7 +71,7 @@ static int loot_rr(struct kr_cache *cache, knot_pkt_t *pkt, const knot_dname_t *
 	}
 
 	/* Update packet question */
-	if (!knot_dname_is_equal(knot_pkt_qname(pkt), name)) {
+	if (!knot_dname_is_equal(knot_pkt_qname(pkt), qry->sname)) {
 		kr_pkt_recycle(pkt);
 		knot_pkt_put_question(pkt, qry->sname, qry->sclass, qry->stype);
 	}
@@ -88,12 +88,146 @@ static int loot_rr(struct kr_cache *cache, knot_pkt_t *pkt, const knot_dname_t *
 	return ret;
 }
 
+/** @internal Return CNAME target for given owner in the answer section (or NULL). */
+static const knot_dname_t *cname_target(knot_pkt_t *pkt, const knot_dname_t *owner)
+{
+	const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+	for (unsigned i = 0; i < an->count; ++i) {
+		const knot_rrset_t *rr = knot_pkt_rr(an, i);
+		if (rr->type == KNOT_RRTYPE_CNAME && knot_dname_is_equal(rr->owner, owner)) {
+			return knot_cname_name(&rr->rrs);
+		}
+	}
+	return NULL;
+}
+
+/** @internal Return true if the answer section already has records for given owner. */
+static bool has_owner(knot_pkt_t *pkt, const knot_dname_t *owner)
+{
+	const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+	for (unsigned i = 0; i < an->count; ++i) {
+		if (knot_dname_is_equal(knot_pkt_rr(an, i)->owner, owner)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** @internal Look up the chain step in cache, either the searched record or the next CNAME.
+ *  The step must not require wildcard proof. */
+static int peek_chain_step(struct kr_cache *cache, struct kr_query *qry, knot_rrset_t *cache_rr,
+                           const knot_dname_t *name, uint16_t *rrtype, uint8_t *rank, uint32_t *drift)
+{
+	uint8_t flags = 0;
+	*drift = qry->timestamp.tv_sec;
+	knot_rrset_init(cache_rr, (knot_dname_t *)name, *rrtype, qry->sclass);
+	int ret = kr_cache_peek_rr(cache, cache_rr, rank, &flags, drift);
+	if (ret != 0 && *rrtype != KNOT_RRTYPE_CNAME) { /* Chase CNAME if no direct hit */
+		*rrtype = KNOT_RRTYPE_CNAME;
+		*drift = qry->timestamp.tv_sec;
+		knot_rrset_init(cache_rr, (knot_dname_t *)name, *rrtype, qry->sclass);
+		ret = kr_cache_peek_rr(cache, cache_rr, rank, &flags, drift);
+	}
+	if (ret == 0 && (flags & KR_CACHE_FLAG_WCARD_PROOF)) {
+		ret = kr_error(ENOENT);
+	}
+	return ret;
+}
+
+/** @internal Answer the chain step from cache, with RRSIGs if the step is secure and DNSSEC is wanted.
+ *  The DNSSEC state is evaluated per step, an insecure step doesn't strip signatures from the others.
+ *  Nothing is added to the answer unless the whole step is found. */
+static int loot_chain_step(struct kr_cache *cache, knot_pkt_t *pkt, struct kr_query *qry,
+                           const knot_dname_t *name, uint16_t *rrtype, bool want_dnssec)
+{
+	uint8_t rank = 0;
+	uint32_t drift = 0;
+	knot_rrset_t cache_rr;
+	int ret = peek_chain_step(cache, qry, &cache_rr, name, rrtype, &rank, &drift);
+	if (ret != 0) {
+		return ret;
+	}
+	const bool insecure = (rank & KR_RANK_INSECURE);
+	if (want_dnssec && !insecure && !(rank & KR_RANK_SECURE)) {
+		return kr_error(ENOENT); /* Not validated yet */
+	}
+
+	/* Materialize the record before looking up its RRSIG, reuse the first lookup. */
+	knot_rrset_t rr_copy, sig_copy;
+	ret = kr_cache_materialize(&rr_copy, &cache_rr, drift, &pkt->mm);
+	if (ret != 0) {
+		return ret;
+	}
+	knot_rrset_init_empty(&sig_copy);
+	if (want_dnssec && !insecure) {
+		uint8_t flags = 0;
+		uint32_t sig_drift = qry->timestamp.tv_sec;
+		knot_rrset_t cache_sig;
+		knot_rrset_init(&cache_sig, (knot_dname_t *)name, *rrtype, qry->sclass);
+		ret = kr_cache_peek_rrsig(cache, &cache_sig, &rank, &flags, &sig_drift);
+		if (ret == 0) {
+			ret = kr_cache_materialize(&sig_copy, &cache_sig, sig_drift, &pkt->mm);
+		}
+		if (ret != 0) {
+			knot_rrset_clear(&rr_copy, &pkt->mm);
+			return ret;
+		}
+	}
+
+	if (is_expiring(&cache_rr, drift)) {
+		qry->flags |= QUERY_EXPIRING;
+	}
+	ret = knot_pkt_put(pkt, KNOT_COMPR_HINT_QNAME, &rr_copy, KNOT_PF_FREE);
+	if (ret != 0) {
+		knot_rrset_clear(&rr_copy, &pkt->mm);
+		knot_rrset_clear(&sig_copy, &pkt->mm);
+		return ret;
+	}
+	if (!knot_rrset_empty(&sig_copy)) {
+		ret = knot_pkt_put(pkt, KNOT_COMPR_HINT_QNAME, &sig_copy, KNOT_PF_FREE);
+		if (ret != 0) {
+			knot_rrset_clear(&sig_copy, &pkt->mm);
+			return ret;
+		}
+	}
+	/* The answer is only as secure as its least secure step. */
+	if (want_dnssec && insecure) {
+		qry->flags |= QUERY_DNSSEC_INSECURE;
+		qry->flags &= ~QUERY_DNSSEC_WANT;
+	}
+	return kr_ok();
+}
+
+/** @internal Follow the CNAME chain from cache as far as possible.
+ *  The chain ends at the first miss, the rest of it is going to be resolved by iteration. */
+static void loot_cname_chain(struct kr_cache *cache, knot_pkt_t *pkt, struct kr_query *qry, uint16_t rrtype,
+                             bool want_dnssec)
+{
+	const knot_dname_t *owner = qry->sname;
+	for (unsigned hops = 1; hops < KR_CNAME_CHAIN_LIMIT; ++hops) {
+		const knot_dname_t *target = cname_target(pkt, owner);
+		if (!target || has_owner(pkt, target)) {
+			break; /* End of chain or a loop */
+		}
+		uint16_t step_type = rrtype;
+		if (loot_chain_step(cache, pkt, qry, target, &step_type, want_dnssec) != 0) {
+			break;
+		}
+		if (step_type != KNOT_RRTYPE_CNAME) {
+			break; /* Found the target record */
+		}
+		owner = target;
+	}
+}
+
 /** @internal Try to find a shortcut directly to searched record. */
 static int loot_rrcache(struct kr_cache *cache, knot_pkt_t *pkt, struct kr_query *qry, uint16_t rrtype, bool dobit)
 {
 	/* Lookup direct match first */
 	uint8_t rank  = 0;
 	uint8_t flags = 0;
+	const uint16_t target_type = rrtype;
+	const bool want_dnssec = dobit;
 	int ret = loot_rr(cache, pkt, qry->sname, qry->sclass, rrtype, qry, &rank, &flags, 0);
 	if (ret != 0 && rrtype != KNOT_RRTYPE_CNAME) { /* Chase CNAME if no direct hit */
 		rrtype = KNOT_RRTYPE_CNAME;
@@ -103,10 +237,16 @@ static int loot_rrcache(struct kr_cache *cache, knot_pkt_t *pkt, struct kr_query
 	if (ret == 0 && (rank & KR_RANK_INSECURE)) {
 		qry->flags |= QUERY_DNSSEC_INSECURE;
 		qry->flags &= ~QUERY_DNSSEC_WANT;
+		dobit = false;
 	/* Record may have RRSIG, try to find it. */
 	} else if (ret == 0 && dobit) {
 		ret = loot_rr(cache, pkt, qry->sname, qry->sclass, rrtype, qry, &rank, &flags, true);
 	}
+	/* Follow the rest of the CNAME chain (not for ANY as it probes several types),
+	 * the DNSSEC state of each step is evaluated separately. */
+	if (ret == 0 && rrtype != target_type && qry->stype != KNOT_RRTYPE_ANY) {
+		loot_cname_chain(cache, pkt, qry, target_type, want_dnssec);
+	}
 	return ret;
 }
 
@@ -123,7 +263,7 @@ static int rrcache_peek(knot_layer_t *ctx, knot_pkt_t *pkt)
 
 	/* Reconstruct the answer from the cache,
 	 * it may either be a CNAME chain or direct answer.
-	 * Only one step of the chain is resolved at a time.
+	 * The chain is followed until the first miss, iterator resolves the rest of it.
 	 */
 	struct kr_cache *cache = &req->ctx->cache;
 	int ret = -1;
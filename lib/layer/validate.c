@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <libknot/packet/wire.h>
@@ -27,6 +28,7 @@
 
 #include "lib/dnssec/nsec.h"
 #include "lib/dnssec/nsec3.h"
+#include "lib/dnssec/signature.h"
 #include "lib/dnssec.h"
 #include "lib/layer.h"
 #include "lib/resolve.h"
@@ -138,9 +140,10 @@ fail:
 	return ret;
 }
 
-static int validate_records(struct kr_query *qry, knot_pkt_t *answer, knot_mm_t *pool, bool has_nsec3)
+static int validate_records(struct kr_query *qry, knot_pkt_t *answer, const knot_rrset_t *keys,
+                            knot_mm_t *pool, bool has_nsec3)
 {
-	if (!qry->zone_cut.key) {
+	if (!keys) {
 		DEBUG_MSG(qry, "<= no DNSKEY, can't validate\n");
 		return kr_error(EBADMSG);
 	}
@@ -148,7 +151,7 @@ static int validate_records(struct kr_query *qry, knot_pkt_t *answer, knot_mm_t
 	kr_rrset_validation_ctx_t vctx = {
 		.pkt		= answer,
 		.section_id	= KNOT_ANSWER,
-		.keys		= qry->zone_cut.key,
+		.keys		= keys,
 		.zone_name	= qry->zone_cut.name,
 		.timestamp	= qry->timestamp.tv_sec,
 		.has_nsec3	= has_nsec3,
@@ -294,6 +297,20 @@ static int update_parent_keys(struct kr_query *qry, uint16_t answer_type)
 	return kr_ok();
 }
 
+/** Check if the NSEC3 proof uses more iterations than the limit, go insecure in that case (RFC 9276 3.2).
+ *  The signatures of the NSEC3 records are still checked, forged records end bogus. */
+static bool nsec3_over_limit(struct kr_query *qry, const knot_pkt_t *pkt)
+{
+	if (!kr_nsec3_over_limit(pkt, KNOT_AUTHORITY)) {
+		return false;
+	}
+	DEBUG_MSG(qry, "<= NSEC3 iterations over limit, going insecure\n");
+	kr_dnssec_stats()->nsec3_over_limit += 1;
+	qry->flags &= ~QUERY_DNSSEC_WANT;
+	qry->flags |= QUERY_DNSSEC_INSECURE;
+	return true;
+}
+
 static int update_delegation(struct kr_request *req, struct kr_query *qry, knot_pkt_t *answer, bool has_nsec3)
 {
 	struct kr_zonecut *cut = &qry->zone_cut;
@@ -336,6 +353,9 @@ static int update_delegation(struct kr_request *req, struct kr_query *qry, knot_
 			if (ret == kr_error(DNSSEC_NOT_FOUND)) {
 				/* Not bogus, going insecure due to optout */
 				ret = 0;
+			} else if (ret != 0 && nsec3_over_limit(qry, answer)) {
+				/* Not bogus, going insecure due to too expensive proof */
+				ret = 0;
 			}
 		}
 		if (ret != 0) {
@@ -349,12 +369,55 @@ static int update_delegation(struct kr_request *req, struct kr_query *qry, knot_
 		return ret;
 	}
 
-	/* Extend trust anchor */
+	/* Extend trust anchor, the remembered delegation has the old DS. */
 	DEBUG_MSG(qry, "<= DS: OK\n");
 	cut->trust_anchor = new_ds;
+	kr_zonecut_invalidate(req->ctx, new_ds->owner);
 	return ret;
 }
 
+/**
+ * Dry run of the signature checks, collect the verifications missing in the cache.
+ * @return number of collected verifications
+ */
+static size_t collect_signatures(struct kr_request *req, struct kr_query *qry, knot_pkt_t *pkt, bool has_nsec3)
+{
+	const uint32_t flags = qry->flags;
+	const knot_rrset_t *keys = qry->zone_cut.key;
+	req->sigjobs.len = 0;
+	kr_signature_collect(&req->sigjobs, &req->pool);
+	/* Self-signed DNSKEY answer, same as in validate_keyset(). */
+	if (knot_wire_get_aa(pkt->wire) && knot_pkt_qtype(pkt) == KNOT_RRTYPE_DNSKEY) {
+		const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+		for (unsigned i = 0; i < an->count; ++i) {
+			const knot_rrset_t *rr = knot_pkt_rr(an, i);
+			if ((rr->type != KNOT_RRTYPE_DNSKEY) || !knot_dname_in(qry->zone_cut.name, rr->owner)) {
+				continue;
+			}
+			if (qry->zone_cut.trust_anchor) {
+				kr_rrset_validation_ctx_t vctx = {
+					.pkt		= pkt,
+					.section_id	= KNOT_ANSWER,
+					.keys		= rr,
+					.zone_name	= qry->zone_cut.name,
+					.timestamp	= qry->timestamp.tv_sec,
+					.has_nsec3	= has_nsec3,
+				};
+				kr_dnskeys_trusted(&vctx, qry->zone_cut.trust_anchor);
+			}
+			keys = rr;
+			break;
+		}
+	}
+	if (keys) {
+		validate_records(qry, pkt, keys, req->rplan.pool, has_nsec3);
+	}
+	kr_signature_collect(NULL, NULL);
+	/* Dry run must not leave any trace. */
+	qry->flags = flags;
+	return req->sigjobs.len;
+}
+
 static const knot_dname_t *signature_authority(knot_pkt_t *pkt)
 {
 	for (knot_section_t i = KNOT_ANSWER; i <= KNOT_AUTHORITY; ++i) {
@@ -426,6 +489,19 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 	uint8_t pkt_rcode = knot_wire_get_rcode(pkt->wire);
 	uint16_t qtype = knot_pkt_qtype(pkt);
 	bool has_nsec3 = pkt_has_type(pkt, KNOT_RRTYPE_NSEC3);
+
+	/* Hand over signatures missing in the cache and yield, the driver verifies them
+	 * in parallel and resumes the validator, which then finds the results in the cache.
+	 * Only fresh answers processed by the iterator (DONE, or PRODUCE for referrals) are offloaded,
+	 * resumed answers (YIELD) are verified inline, so the validator never yields twice. */
+	const bool fresh_answer = (ctx->state & (KNOT_STATE_DONE|KNOT_STATE_PRODUCE));
+	if ((qry->flags & QUERY_DNSSEC_ASYNC) && !(qry->flags & QUERY_CACHED) && fresh_answer) {
+		size_t pending = collect_signatures(req, qry, pkt, has_nsec3);
+		if (pending > 0) {
+			DEBUG_MSG(qry, ">< offloading %zu signature checks\n", pending);
+			return KNOT_STATE_YIELD;
+		}
+	}
 	if (knot_wire_get_aa(pkt->wire) && qtype == KNOT_RRTYPE_DNSKEY) {
 		ret = validate_keyset(qry, pkt, has_nsec3);
 		if (ret != 0) {
@@ -433,6 +509,10 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 			qry->flags |= QUERY_DNSSEC_BOGUS;
 			return KNOT_STATE_FAIL;
 		}
+		/* Fresh keys replace the remembered ones (i.e. on key rollover). */
+		if (!(qry->flags & QUERY_CACHED)) {
+			kr_zonecut_invalidate(req->ctx, qry->zone_cut.name);
+		}
 	}
 
 	/* Validate non-existence proof if not positive answer. */
@@ -443,6 +523,9 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 		} else {
 			ret = kr_nsec3_name_error_response_check(pkt, KNOT_AUTHORITY, qry->sname);
 		}
+		if (ret != 0 && has_nsec3 && nsec3_over_limit(qry, pkt)) {
+			ret = 0;
+		}
 		if (ret != 0) {
 			DEBUG_MSG(qry, "<= bad NXDOMAIN proof\n");
 			qry->flags |= QUERY_DNSSEC_BOGUS;
@@ -470,6 +553,8 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 					DEBUG_MSG(qry, "<= can't prove NODATA due to optout, going insecure\n");
 					qry->flags &= ~QUERY_DNSSEC_WANT;
 					qry->flags |= QUERY_DNSSEC_INSECURE;
+				} else if (has_nsec3 && nsec3_over_limit(qry, pkt)) {
+					/* Going insecure, proof is too expensive. */
 				} else {
 					DEBUG_MSG(qry, "<= bad NODATA proof\n");
 					qry->flags |= QUERY_DNSSEC_BOGUS;
@@ -482,7 +567,7 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 	/* Validate all records, fail as bogus if it doesn't match.
 	 * Do not revalidate data from cache, as it's already trusted. */
 	if (!(qry->flags & QUERY_CACHED)) {
-		ret = validate_records(qry, pkt, req->rplan.pool, has_nsec3);
+		ret = validate_records(qry, pkt, qry->zone_cut.key, req->rplan.pool, has_nsec3);
 		if (ret != 0) {
 			DEBUG_MSG(qry, "<= couldn't validate RRSIGs\n");
 			qry->flags |= QUERY_DNSSEC_BOGUS;
@@ -529,6 +614,22 @@ int validate_init(struct kr_module *module)
 	return kr_ok();
 }
 
+/** Configure limit of NSEC3 iterations. */
+int validate_config(struct kr_module *module, const char *conf)
+{
+	if (!conf || strlen(conf) < 1) {
+		kr_nsec3_iterations_set(KR_NSEC3_MAX_ITERATIONS);
+		return kr_ok();
+	}
+	char *end = NULL;
+	unsigned long limit = strtoul(conf, &end, 10);
+	if (end == conf || limit > UINT32_MAX) {
+		return kr_error(EINVAL);
+	}
+	kr_nsec3_iterations_set(limit);
+	return kr_ok();
+}
+
 KR_MODULE_EXPORT(validate)
 
 #undef DEBUG_MSG
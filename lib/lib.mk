@@ -1,5 +1,6 @@
 libkres_SOURCES := \
 	lib/generic/map.c      \
+	lib/generic/lpm.c      \
 	lib/layer/iterate.c    \
 	lib/layer/validate.c   \
 	lib/layer/rrcache.c    \
@@ -11,6 +12,7 @@ libkres_SOURCES := \
 	lib/dnssec.c           \
 	lib/utils.c            \
 	lib/nsrep.c            \
+	lib/policy.c           \
 	lib/module.c           \
 	lib/resolve.c          \
 	lib/zonecut.c          \
@@ -21,6 +23,7 @@ libkres_SOURCES := \
 libkres_HEADERS := \
 	lib/generic/array.h    \
 	lib/generic/map.h      \
+	lib/generic/lpm.h      \
 	lib/generic/set.h      \
 	lib/layer.h            \
 	lib/dnssec/nsec.h      \
@@ -30,6 +33,7 @@ libkres_HEADERS := \
 	lib/dnssec.h           \
 	lib/utils.h            \
 	lib/nsrep.h            \
+	lib/policy.h           \
 	lib/module.h           \
 	lib/resolve.h          \
 	lib/zonecut.h          \
@@ -18,11 +18,14 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <time.h>
+#include <arpa/inet.h>
 
 #include "lib/nsrep.h"
 #include "lib/rplan.h"
 #include "lib/resolve.h"
 #include "lib/defines.h"
+#include "lib/utils.h"
 #include "lib/generic/pack.h"
 #include "contrib/ucw/lib.h"
 
@@ -78,8 +81,41 @@ static void update_nsrep_set(struct kr_nsrep *ns, const knot_dname_t *name, uint
 
 #undef ADDR_SET
 
-static unsigned eval_addr_set(pack_t *addr_set, kr_nsrep_lru_t *rttcache, unsigned score, uint8_t *addr[], uint32_t opts)
+/** Return reputation flags, without the transport preference if it expired. */
+static unsigned rep_flags(const struct kr_nsrep_rep *rep, uint32_t now)
 {
+	if ((rep->flags & KR_NS_TCP) && rep->expire < now) {
+		return rep->flags & ~KR_NS_TCP;
+	}
+	return rep->flags;
+}
+
+/** Fetch NS reputation. */
+static unsigned rep_get(struct kr_context *ctx, const knot_dname_t *name)
+{
+	if (!ctx->cache_rep || !name) {
+		return 0;
+	}
+	struct kr_nsrep_rep *cached = lru_get(ctx->cache_rep, (const char *)name, knot_dname_size(name));
+	return cached ? rep_flags(cached, time(NULL)) : 0;
+}
+
+unsigned kr_nsrep_score(const struct kr_nsrep_rtt *rtt, uint32_t now)
+{
+	if (rtt->score <= KR_NS_UNKNOWN || now <= rtt->stamp) {
+		return rtt->score;
+	}
+	/* Halve the excess over KR_NS_UNKNOWN for each elapsed half-life. */
+	const uint32_t halvings = (now - rtt->stamp) / KR_NS_DECAY;
+	if (halvings >= sizeof(unsigned) * CHAR_BIT) {
+		return KR_NS_UNKNOWN;
+	}
+	return KR_NS_UNKNOWN + ((rtt->score - KR_NS_UNKNOWN) >> halvings);
+}
+
+static unsigned eval_addr_set(pack_t *addr_set, kr_nsrep_rtt_lru_t *rttcache, unsigned score, uint8_t *addr[], uint32_t opts)
+{
+	const uint32_t now = time(NULL);
 	/* Name server is better candidate if it has address record. */
 	uint8_t *it = pack_head(*addr_set);
 	while (it != pack_tail(*addr_set)) {
@@ -96,8 +132,8 @@ static unsigned eval_addr_set(pack_t *addr_set, kr_nsrep_lru_t *rttcache, unsign
 		}
 		/* Get RTT for this address (if known) */
 		if (is_valid) {
-			unsigned *cached = rttcache ? lru_get(rttcache, val, len) : NULL;
-			unsigned addr_score = (cached) ? *cached : KR_NS_GLUED;
+			struct kr_nsrep_rtt *cached = rttcache ? lru_get(rttcache, val, len) : NULL;
+			unsigned addr_score = (cached) ? kr_nsrep_score(cached, now) : KR_NS_GLUED;
 			if (addr_score < score + favour) {
 				/* Shake down previous contenders */
 				for (size_t i = KR_NSREP_MAXADDR - 1; i > 0; --i)
@@ -117,16 +153,10 @@ static int eval_nsrep(const char *k, void *v, void *baton)
 	struct kr_nsrep *ns = &qry->ns;
 	struct kr_context *ctx = ns->ctx;
 	unsigned score = KR_NS_MAX_SCORE;
-	unsigned reputation = 0;
 	uint8_t *addr_choice[KR_NSREP_MAXADDR] = { NULL, };
 
 	/* Fetch NS reputation */
-	if (ctx->cache_rep) {
-		unsigned *cached = lru_get(ctx->cache_rep, k, knot_dname_size((const uint8_t *)k));
-		if (cached) {
-			reputation = *cached;
-		}
-	}
+	unsigned reputation = rep_get(ctx, (const knot_dname_t *)k);
 
 	/* Favour nameservers with unknown addresses to probe them,
 	 * otherwise discover the current best address for the NS. */
@@ -177,6 +207,8 @@ int kr_nsrep_set(struct kr_query *qry, uint8_t *addr, size_t addr_len)
 	qry->ns.name = (const uint8_t *)"";
 	qry->ns.score = KR_NS_UNKNOWN;
 	qry->ns.reputation = 0;
+	qry->ns.group = NULL;
+	memset(qry->ns.race, 0, sizeof(qry->ns.race));
 	update_nsrep(&qry->ns, 0, addr, addr_len);
 	update_nsrep(&qry->ns, 1, NULL, 0);
 	return kr_ok();
@@ -185,10 +217,100 @@ int kr_nsrep_set(struct kr_query *qry, uint8_t *addr, size_t addr_len)
 #define ELECT_INIT(ns, ctx_) do { \
 	(ns)->ctx = (ctx_); \
 	(ns)->addr[0].ip.sa_family = AF_UNSPEC; \
+	memset((ns)->race, 0, sizeof((ns)->race)); \
 	(ns)->reputation = 0; \
 	(ns)->score = KR_NS_MAX_SCORE + 1; \
 } while (0)
 
+/** @internal Best address of each NS other than the elected one, ordered by score. */
+struct race_baton {
+	struct kr_query *qry;
+	const knot_dname_t *name[KR_NSREP_MAXADDR * 2];
+	uint8_t *addr[KR_NSREP_MAXADDR * 2];
+	unsigned score[KR_NSREP_MAXADDR * 2];
+	size_t count;
+};
+
+static int race_collect(const char *k, void *v, void *baton)
+{
+	struct race_baton *race = baton;
+	struct kr_query *qry = race->qry;
+	struct kr_context *ctx = qry->ns.ctx;
+	pack_t *addr_set = (pack_t *)v;
+	if (addr_set->len == 0 || knot_dname_is_equal((const knot_dname_t *)k, qry->ns.name)) {
+		return kr_ok();
+	}
+	uint8_t *addr_choice[KR_NSREP_MAXADDR] = { NULL, };
+	unsigned score = eval_addr_set(addr_set, ctx->cache_rtt, KR_NS_TIMEOUT, addr_choice, ctx->options);
+	if (!addr_choice[0]) {
+		return kr_ok(); /* No usable address, or all of them timeouted */
+	}
+	/* Skip address shared with the elected NS */
+	const struct kr_nsrep *ns = &qry->ns;
+	if (pack_obj_len(addr_choice[0]) == kr_nsrep_inaddr_len(ns->addr[0]) &&
+	    memcmp(pack_obj_val(addr_choice[0]), kr_nsrep_inaddr(ns->addr[0]), pack_obj_len(addr_choice[0])) == 0) {
+		return kr_ok();
+	}
+	/* Insert into ordered list of candidates */
+	const size_t max = sizeof(race->addr) / sizeof(race->addr[0]);
+	size_t pos = MIN(race->count, max - 1);
+	if (race->count == max && score >= race->score[pos]) {
+		return kr_ok();
+	}
+	while (pos > 0 && race->score[pos - 1] > score) {
+		race->score[pos] = race->score[pos - 1];
+		race->name[pos] = race->name[pos - 1];
+		race->addr[pos] = race->addr[pos - 1];
+		pos -= 1;
+	}
+	race->score[pos] = score;
+	race->name[pos] = (const knot_dname_t *)k;
+	race->addr[pos] = addr_choice[0];
+	race->count = MIN(race->count + 1, max);
+	return kr_ok();
+}
+
+/** @internal Return true if the RTT of the elected address is not known or stale. */
+static bool ns_is_cold(struct kr_nsrep *ns)
+{
+	if (ns->addr[0].ip.sa_family == AF_UNSPEC || !ns->ctx->cache_rtt) {
+		return false;
+	}
+	struct kr_nsrep_rtt *cached = lru_get(ns->ctx->cache_rtt,
+	                                      kr_nsrep_inaddr(ns->addr[0]), kr_nsrep_inaddr_len(ns->addr[0]));
+	const uint32_t now = time(NULL);
+	return !cached || kr_nsrep_score(cached, now) >= KR_NS_LONG || cached->stamp + KR_NS_STALE < now;
+}
+
+/** @internal Fill the address list with the best addresses of other NS, alternating address families.
+ *  Each raced address carries its NS name, so the answer can be attributed to it. */
+static void ns_race(struct kr_query *qry)
+{
+	struct kr_nsrep *ns = &qry->ns;
+	struct race_baton race = { .qry = qry, .count = 0 };
+	map_walk(&qry->zone_cut.nsset, race_collect, &race);
+	int family = ns->addr[0].ip.sa_family;
+	for (size_t pos = 1; pos < KR_NSREP_MAXADDR && race.count > 0; ++pos) {
+		/* Prefer the other address family, then the best score. */
+		size_t pick = 0;
+		for (size_t i = 0; i < race.count; ++i) {
+			const int cand_family = pack_obj_len(race.addr[i]) == sizeof(struct in6_addr) ? AF_INET6 : AF_INET;
+			if (cand_family != family) {
+				pick = i;
+				break;
+			}
+		}
+		uint8_t *addr = race.addr[pick];
+		family = pack_obj_len(addr) == sizeof(struct in6_addr) ? AF_INET6 : AF_INET;
+		update_nsrep(ns, pos, pack_obj_val(addr), pack_obj_len(addr));
+		ns->race[pos] = race.name[pick];
+		memmove(race.name + pick, race.name + pick + 1, (race.count - pick - 1) * sizeof(race.name[0]));
+		memmove(race.addr + pick, race.addr + pick + 1, (race.count - pick - 1) * sizeof(race.addr[0]));
+		memmove(race.score + pick, race.score + pick + 1, (race.count - pick - 1) * sizeof(race.score[0]));
+		race.count -= 1;
+	}
+}
+
 int kr_nsrep_elect(struct kr_query *qry, struct kr_context *ctx)
 {
 	if (!qry || !ctx) {
@@ -197,7 +319,44 @@ int kr_nsrep_elect(struct kr_query *qry, struct kr_context *ctx)
 
 	struct kr_nsrep *ns = &qry->ns;
 	ELECT_INIT(ns, ctx);
-	return map_walk(&qry->zone_cut.nsset, eval_nsrep, qry);
+	int ret = map_walk(&qry->zone_cut.nsset, eval_nsrep, qry);
+	/* Race the addresses of other NS if the elected one isn't known yet. */
+	if ((qry->flags & QUERY_RACE) && ns_is_cold(ns)) {
+		ns_race(qry);
+	}
+	return ret;
+}
+
+int kr_nsrep_answered(struct kr_nsrep *ns, const struct sockaddr *src)
+{
+	if (!ns || !src) {
+		return kr_error(EINVAL);
+	}
+	const char *src_in = kr_inaddr(src);
+	const int src_len = kr_inaddr_len(src);
+	if (!src_in || src_len <= 0) {
+		return kr_error(EINVAL);
+	}
+	for (size_t i = 0; i < KR_NSREP_MAXADDR; ++i) {
+		const int family = ns->addr[i].ip.sa_family;
+		if (family == AF_UNSPEC) {
+			break;
+		}
+		if (family != src->sa_family || memcmp(kr_nsrep_inaddr(ns->addr[i]), src_in, src_len) != 0) {
+			continue;
+		}
+		/* Answered by raced address, its NS takes over the election. */
+		if (i > 0 && ns->race[i]) {
+			ns->name = ns->race[i];
+			ns->reputation = rep_get(ns->ctx, ns->name);
+			/* Addresses of the other NS don't belong to it. */
+			memcpy(&ns->addr[0], &ns->addr[i], sizeof(ns->addr[0]));
+			ns->addr[1].ip.sa_family = AF_UNSPEC;
+			memset(ns->race, 0, sizeof(ns->race));
+		}
+		return kr_ok();
+	}
+	return kr_error(ENOENT);
 }
 
 int kr_nsrep_elect_addr(struct kr_query *qry, struct kr_context *ctx)
@@ -217,33 +376,256 @@ int kr_nsrep_elect_addr(struct kr_query *qry, struct kr_context *ctx)
 	uint8_t *addr_choice[KR_NSREP_MAXADDR] = { NULL, };
 	unsigned score = eval_addr_set(addr_set, ctx->cache_rtt, ns->score, addr_choice, ctx->options);
 	update_nsrep_set(ns, ns->name, addr_choice, score);
+	ns->reputation = rep_get(ctx, ns->name);
 	return kr_ok();
 }
 
 #undef ELECT_INIT
 
+/** @internal Forwarding group address. */
+union group_addr {
+	struct sockaddr ip;
+	struct sockaddr_in ip4;
+	struct sockaddr_in6 ip6;
+};
+
+static int group_addr_parse(union group_addr *sa, const char *addr, uint16_t port)
+{
+	memset(sa, 0, sizeof(*sa));
+	if (!addr) {
+		return kr_error(EINVAL);
+	}
+	if (inet_pton(AF_INET6, addr, &sa->ip6.sin6_addr) == 1) {
+		sa->ip6.sin6_family = AF_INET6;
+		sa->ip6.sin6_port = htons(port);
+	} else if (inet_pton(AF_INET, addr, &sa->ip4.sin_addr) == 1) {
+		sa->ip4.sin_family = AF_INET;
+		sa->ip4.sin_port = htons(port);
+	} else {
+		return kr_error(EINVAL);
+	}
+	return kr_ok();
+}
+
+int kr_nsrep_group_add(struct kr_context *ctx, const char *name, const char *addr, uint16_t port)
+{
+	if (!ctx || !name || !addr) {
+		return kr_error(EINVAL);
+	}
+	/* Parse address */
+	union group_addr sa;
+	if (group_addr_parse(&sa, addr, port) != 0) {
+		return kr_error(EINVAL);
+	}
+	/* Find or create group */
+	struct kr_nsrep_group *group = map_get(&ctx->forwarders, name);
+	if (!group) {
+		group = calloc(1, sizeof(*group));
+		if (!group) {
+			return kr_error(ENOMEM);
+		}
+		if (map_set(&ctx->forwarders, name, group) != 0) {
+			free(group);
+			return kr_error(ENOMEM);
+		}
+	}
+	if (group->count >= KR_NSREP_GROUP_MAX) {
+		return kr_error(ENOSPC);
+	}
+	memcpy(&group->addr[group->count], &sa, sizeof(sa));
+	group->count += 1;
+	return kr_ok();
+}
+
+static void group_free(struct kr_nsrep_group *group)
+{
+	while (group) {
+		struct kr_nsrep_group *retired = group->retired;
+		free(group);
+		group = retired;
+	}
+}
+
+int kr_nsrep_group_set(struct kr_context *ctx, const char *name, const char **addrs, const uint16_t *ports, size_t count)
+{
+	if (!ctx || !name || (count > 0 && (!addrs || !ports))) {
+		return kr_error(EINVAL);
+	}
+	if (count > KR_NSREP_GROUP_MAX) {
+		return kr_error(ENOSPC);
+	}
+	/* Build the new definition aside, the current one is untouched on error. */
+	struct kr_nsrep_group *group = calloc(1, sizeof(*group));
+	if (!group) {
+		return kr_error(ENOMEM);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (group_addr_parse((union group_addr *)&group->addr[i], addrs[i], ports[i]) != 0) {
+			free(group);
+			return kr_error(EINVAL);
+		}
+	}
+	group->count = count;
+	/* Swap it in, queries in flight keep the replaced definition. */
+	struct kr_nsrep_group *current = map_get(&ctx->forwarders, name);
+	if (current) {
+		memcpy(&group->stats, &current->stats, sizeof(group->stats));
+		group->retired = current;
+	}
+	if (map_set(&ctx->forwarders, name, group) != 0) {
+		free(group);
+		return kr_error(ENOMEM);
+	}
+	return kr_ok();
+}
+
+struct kr_nsrep_group *kr_nsrep_group_get(struct kr_context *ctx, const char *name)
+{
+	if (!ctx || !name) {
+		return NULL;
+	}
+	return map_get(&ctx->forwarders, name);
+}
+
+static int del_group(const char *k, void *v, void *baton)
+{
+	group_free(v);
+	return 0;
+}
+
+int kr_nsrep_group_del(struct kr_context *ctx, const char *name)
+{
+	if (!ctx) {
+		return kr_error(EINVAL);
+	}
+	if (!name) {
+		map_walk(&ctx->forwarders, del_group, NULL);
+		map_clear(&ctx->forwarders);
+		return kr_ok();
+	}
+	struct kr_nsrep_group *group = map_get(&ctx->forwarders, name);
+	if (!group) {
+		return kr_error(ENOENT);
+	}
+	map_del(&ctx->forwarders, name);
+	group_free(group);
+	return kr_ok();
+}
+
+int kr_nsrep_forward(struct kr_query *qry, struct kr_context *ctx, const char *name)
+{
+	if (!qry || !ctx) {
+		return kr_error(EINVAL);
+	}
+	struct kr_nsrep_group *group = kr_nsrep_group_get(ctx, name);
+	if (!group || group->count == 0) {
+		return kr_error(ENOENT);
+	}
+	qry->flags |= QUERY_STUB;
+	qry->ns.group = group;
+	group->stats.queries += 1;
+	return kr_nsrep_elect_group(qry, ctx);
+}
+
+/** @internal RTT cache key, forwarding upstreams are distinguished by port as well. */
+#define RTT_KEY_MAXLEN (sizeof(struct in6_addr) + sizeof(uint16_t))
+static size_t rtt_key(char *dst, const struct sockaddr *addr, bool with_port)
+{
+	const char *addr_in = kr_inaddr(addr);
+	int addr_len = kr_inaddr_len(addr);
+	if (!addr_in || addr_len <= 0 || (size_t)addr_len > sizeof(struct in6_addr)) {
+		return 0;
+	}
+	memcpy(dst, addr_in, addr_len);
+	if (with_port) {
+		const uint16_t port = (addr->sa_family == AF_INET6)
+			? ((const struct sockaddr_in6 *)addr)->sin6_port
+			: ((const struct sockaddr_in *)addr)->sin_port;
+		memcpy(dst + addr_len, &port, sizeof(port));
+		addr_len += sizeof(port);
+	}
+	return addr_len;
+}
+
+int kr_nsrep_elect_group(struct kr_query *qry, struct kr_context *ctx)
+{
+	if (!qry || !ctx || !qry->ns.group) {
+		return kr_error(EINVAL);
+	}
+
+	struct kr_nsrep *ns = &qry->ns;
+	struct kr_nsrep_group *group = ns->group;
+	const uint32_t now = time(NULL);
+	unsigned score[KR_NSREP_MAXADDR];
+	size_t choice[KR_NSREP_MAXADDR];
+	size_t count = 0;
+	for (size_t i = 0; i < group->count; ++i) {
+		/* Get RTT for this address (if known) */
+		char key[RTT_KEY_MAXLEN];
+		size_t key_len = rtt_key(key, &group->addr[i].ip, true);
+		struct kr_nsrep_rtt *cached = NULL;
+		if (ctx->cache_rtt && key_len > 0) {
+			cached = lru_get(ctx->cache_rtt, key, key_len);
+		}
+		unsigned addr_score = (cached) ? kr_nsrep_score(cached, now) : KR_NS_GLUED;
+		/* With 10% chance, probe 'bad' upstream with a probability given by its RTT / MAX_RTT */
+		if (addr_score >= KR_NS_TIMEOUT && (kr_rand_uint(100) < 10) &&
+		    (kr_rand_uint(KR_NS_MAX_SCORE) >= addr_score)) {
+			addr_score = 0;
+		}
+		/* Insert into ordered list of best addresses */
+		size_t pos = MIN(count, KR_NSREP_MAXADDR - 1);
+		if (count == KR_NSREP_MAXADDR && addr_score >= score[pos]) {
+			continue;
+		}
+		while (pos > 0 && score[pos - 1] > addr_score) {
+			score[pos] = score[pos - 1];
+			choice[pos] = choice[pos - 1];
+			pos -= 1;
+		}
+		score[pos] = addr_score;
+		choice[pos] = i;
+		count = MIN(count + 1, KR_NSREP_MAXADDR);
+	}
+	/* Set elected addresses */
+	ns->ctx = ctx;
+	ns->name = (const uint8_t *)"";
+	ns->reputation = 0;
+	ns->score = count > 0 ? score[0] : KR_NS_MAX_SCORE + 1;
+	memset(ns->race, 0, sizeof(ns->race));
+	for (size_t i = 0; i < KR_NSREP_MAXADDR; ++i) {
+		if (i < count) {
+			memcpy(&ns->addr[i], &group->addr[choice[i]], sizeof(ns->addr[i]));
+		} else {
+			ns->addr[i].ip.sa_family = AF_UNSPEC;
+		}
+	}
+	return count > 0 ? kr_ok() : kr_error(ENOENT);
+}
+
 int kr_nsrep_update_rtt(struct kr_nsrep *ns, const struct sockaddr *addr,
-			unsigned score, kr_nsrep_lru_t *cache, int umode)
+			unsigned score, kr_nsrep_rtt_lru_t *cache, int umode)
 {
 	if (!ns || !cache || ns->addr[0].ip.sa_family == AF_UNSPEC) {
 		return kr_error(EINVAL);
 	}
 
-	const char *addr_in = kr_nsrep_inaddr(ns->addr[0]);
-	size_t addr_len = kr_nsrep_inaddr_len(ns->addr[0]);
-	if (addr) { /* Caller provided specific address */
-		if (addr->sa_family == AF_INET) {
-			addr_in = (const char *)&((struct sockaddr_in *)addr)->sin_addr;
-			addr_len = sizeof(struct in_addr);
-		} else if (addr->sa_family == AF_INET6) {
-			addr_in = (const char *)&((struct sockaddr_in6 *)addr)->sin6_addr;
-			addr_len = sizeof(struct in6_addr);
-		}
+	/* Caller may provide specific address, upstreams of a forwarding group are keyed with port. */
+	if (!addr || (addr->sa_family != AF_INET && addr->sa_family != AF_INET6)) {
+		addr = &ns->addr[0].ip;
 	}
-	unsigned *cur = lru_set(cache, addr_in, addr_len);
-	if (!cur) {
+	char key[RTT_KEY_MAXLEN];
+	size_t key_len = rtt_key(key, addr, ns->group != NULL);
+	if (key_len == 0) {
+		return kr_error(EINVAL);
+	}
+	struct kr_nsrep_rtt *rtt = lru_set(cache, key, key_len);
+	if (!rtt) {
 		return kr_error(ENOMEM);
 	}
+	/* Materialize the decay before the update. */
+	const uint32_t now = time(NULL);
+	unsigned cur = kr_nsrep_score(rtt, now);
 	/* Score limits */
 	if (score > KR_NS_MAX_SCORE) {
 		score = KR_NS_MAX_SCORE;
@@ -251,17 +633,24 @@ int kr_nsrep_update_rtt(struct kr_nsrep *ns, const struct sockaddr *addr,
 	if (score <= KR_NS_GLUED) {
 		score = KR_NS_GLUED + 1;
 	}
-	/* First update is always set. */
-	if (*cur == 0) {
+	/* First update is always set, a lower bound of a never measured address
+	 * ranks it as unknown, so it's not preferred over the measured ones. */
+	if (cur == 0) {
+		if (umode == KR_NS_MAX) {
+			score = MAX(score, KR_NS_UNKNOWN);
+		}
 		umode = KR_NS_RESET;
 	}
 	/* Update score, by default smooth over last two measurements. */
 	switch (umode) {
-	case KR_NS_UPDATE: *cur = (*cur + score) / 2; break;
-	case KR_NS_RESET:  *cur = score; break;
-	case KR_NS_ADD:    *cur = MIN(KR_NS_MAX_SCORE - 1, *cur + score); break;
+	case KR_NS_UPDATE: cur = (cur + score) / 2; break;
+	case KR_NS_RESET:  cur = score; break;
+	case KR_NS_ADD:    cur = MIN(KR_NS_MAX_SCORE - 1, cur + score); break;
+	case KR_NS_MAX:    cur = MAX(cur, score); break;
 	default: break;
 	}
+	rtt->score = cur;
+	rtt->stamp = now;
 	return kr_ok();
 }
 
@@ -274,10 +663,42 @@ int kr_nsrep_update_rep(struct kr_nsrep *ns, unsigned reputation, kr_nsrep_lru_t
 	/* Store in the struct */
 	ns->reputation = reputation;
 	/* Store reputation in the LRU cache */
-	unsigned *cur = lru_set(cache, (const char *)ns->name, knot_dname_size(ns->name));
+	struct kr_nsrep_rep *cur = lru_set(cache, (const char *)ns->name, knot_dname_size(ns->name));
 	if (!cur) {
 		return kr_error(ENOMEM);
 	}
-	*cur = reputation;
+	/* Transport preference expires, start the lifetime only when it's learned. */
+	const uint32_t now = time(NULL);
+	if ((reputation & KR_NS_TCP) && !(rep_flags(cur, now) & KR_NS_TCP)) {
+		cur->expire = now + KR_NS_TCP_TTL;
+	}
+	cur->flags = reputation;
+	return kr_ok();
+}
+
+int kr_nsrep_update_tc(struct kr_nsrep *ns, bool truncated, kr_nsrep_lru_t *cache)
+{
+	if (!ns || !ns->name || !cache) {
+		return kr_error(EINVAL);
+	}
+
+	const char *key = (const char *)ns->name;
+	const size_t key_len = knot_dname_size(ns->name);
+	/* Complete answer, forget previous truncations. */
+	if (!truncated) {
+		struct kr_nsrep_rep *cur = lru_get(cache, key, key_len);
+		if (cur) {
+			cur->truncated = 0;
+		}
+		return kr_ok();
+	}
+	struct kr_nsrep_rep *cur = lru_set(cache, key, key_len);
+	if (!cur) {
+		return kr_error(ENOMEM);
+	}
+	if (++cur->truncated >= KR_NS_TC_LIMIT) {
+		cur->truncated = 0;
+		return kr_nsrep_update_rep(ns, ns->reputation | KR_NS_TCP, cache);
+	}
 	return kr_ok();
 }
@@ -19,6 +19,7 @@
 #include <netinet/in.h>
 #include <libknot/dname.h>
 #include <limits.h>
+#include <stdbool.h>
 
 #include "lib/defines.h"
 #include "lib/generic/map.h"
@@ -45,25 +46,86 @@ enum kr_ns_score {
 enum kr_ns_rep {
 	KR_NS_NOIP4  = 1 << 0, /**< NS has no IPv4 */
 	KR_NS_NOIP6  = 1 << 1, /**< NS has no IPv6 */
-	KR_NS_NOEDNS = 1 << 2  /**< NS has no EDNS support */
+	KR_NS_NOEDNS = 1 << 2, /**< NS has no EDNS support */
+	KR_NS_TCP    = 1 << 3  /**< NS truncates answers over UDP, use TCP (expires) */
 };
 
+/** Number of consecutive truncated UDP answers before NS is flagged KR_NS_TCP. */
+#define KR_NS_TC_LIMIT 2
+/** Lifetime of the KR_NS_TCP flag (seconds), UDP is tried again after it expires. */
+#define KR_NS_TCP_TTL 900
+
 /**
  * NS RTT update modes.
  */
 enum kr_ns_update_mode {
 	KR_NS_UPDATE = 0, /**< Update as smooth over last two measurements */
 	KR_NS_RESET,      /**< Set to given value */
-	KR_NS_ADD         /**< Increment current value */
+	KR_NS_ADD,        /**< Increment current value */
+	KR_NS_MAX         /**< Raise to at least given value (lower bound of RTT), unknown RTT to at least KR_NS_UNKNOWN */
+};
+
+/**
+ * NS reputation with learned transport preference.
+ */
+struct kr_nsrep_rep {
+	unsigned flags;    /**< Reputation flags, see enum kr_ns_rep. */
+	uint32_t expire;   /**< Expiration of the KR_NS_TCP flag. */
+	uint8_t truncated; /**< Number of consecutive truncated UDP answers. */
 };
 
 /**
  * NS reputation/QoS tracking.
  */
-typedef lru_hash(unsigned) kr_nsrep_lru_t;
+typedef lru_hash(struct kr_nsrep_rep) kr_nsrep_lru_t;
+
+/** Half-life of the score excess over KR_NS_UNKNOWN (seconds). */
+#define KR_NS_DECAY 60
+/** Age of the RTT score after which the address is raced with others (seconds), see QUERY_RACE. */
+#define KR_NS_STALE 600
+
+/**
+ * NS RTT score with time of the last update.
+ * Scores worse than KR_NS_UNKNOWN decay exponentially towards it with the time since last update,
+ * so the penalized servers are gradually probed again by the election.
+ */
+struct kr_nsrep_rtt {
+	unsigned score;  /**< Score at the time of the last update. */
+	uint32_t stamp;  /**< Time of the last update (seconds). */
+};
+
+/**
+ * NS RTT tracking.
+ */
+typedef lru_hash(struct kr_nsrep_rtt) kr_nsrep_rtt_lru_t;
 
 /* Maximum count of addresses probed in one go (last is left empty) */
 #define KR_NSREP_MAXADDR 4
+/* Maximum count of addresses in a forwarding group */
+#define KR_NSREP_GROUP_MAX 16
+
+/**
+ * Named group of upstream addresses for forwarding.
+ * The best addresses by RTT score are elected for each query, and probed in the order
+ * of their score, so the failed upstream is skipped by retransmission without waiting for timeout.
+ * @note Statistics are first, the layout is shared with Lua.
+ */
+struct kr_nsrep_group
+{
+	struct {
+		size_t queries;  /**< Number of queries forwarded to the group */
+		size_t answered; /**< Number of answers received */
+		size_t failover; /**< Number of queries elected again after failure or bad answer */
+		size_t servfail; /**< Number of SERVFAIL/REFUSED answers */
+	} stats;
+	size_t count;                    /**< Number of addresses */
+	union {
+		struct sockaddr ip;
+		struct sockaddr_in ip4;
+		struct sockaddr_in6 ip6;
+	} addr[KR_NSREP_GROUP_MAX];      /**< Upstream addresses (with port) */
+	struct kr_nsrep_group *retired;  /**< Replaced definition, kept for resolution in progress */
+};
 
 /**
  * Name server representation.
@@ -76,11 +138,13 @@ struct kr_nsrep
 	unsigned reputation;             /**< NS reputation */
 	const knot_dname_t *name;        /**< NS name */
 	struct kr_context *ctx;          /**< Resolution context */
+	struct kr_nsrep_group *group;    /**< Forwarding group (or NULL) */
 	union {
 		struct sockaddr ip;
 		struct sockaddr_in ip4;
 		struct sockaddr_in6 ip6;
 	} addr[KR_NSREP_MAXADDR];        /**< NS address(es) */
+	const knot_dname_t *race[KR_NSREP_MAXADDR]; /**< NS name of the raced address (or NULL), see QUERY_RACE */
 };
 
 /** @internal Address bytes for given family. */
@@ -102,6 +166,8 @@ int kr_nsrep_set(struct kr_query *qry, uint8_t *addr, size_t addr_len);
 
 /**
  * Elect best nameserver/address pair from the nsset.
+ * @note With QUERY_RACE, if the RTT of the best address is not known (or stale), the rest of the address list
+ *       is filled with the best addresses of other NS, alternating address families.
  * @param  qry          updated query
  * @param  ctx          resolution context
  * @return              0 or an error code
@@ -109,6 +175,16 @@ int kr_nsrep_set(struct kr_query *qry, uint8_t *addr, size_t addr_len);
 KR_EXPORT
 int kr_nsrep_elect(struct kr_query *qry, struct kr_context *ctx);
 
+/**
+ * Make the address the answer came from the elected one.
+ * @note If the address was raced, its NS becomes the elected NS, so the answer is attributed to it.
+ * @param  ns           updated NS representation
+ * @param  src          source address of the answer
+ * @return              0 or an error code
+ */
+KR_EXPORT
+int kr_nsrep_answered(struct kr_nsrep *ns, const struct sockaddr *src);
+
 /**
  * Elect best nameserver/address pair from the nsset.
  * @param  qry          updated query
@@ -118,6 +194,72 @@ int kr_nsrep_elect(struct kr_query *qry, struct kr_context *ctx);
 KR_EXPORT
 int kr_nsrep_elect_addr(struct kr_query *qry, struct kr_context *ctx);
 
+/**
+ * Add address to the named forwarding group, the group is created if it doesn't exist.
+ * @param  ctx          resolution context
+ * @param  name         group name
+ * @param  addr         address string (IPv4 or IPv6)
+ * @param  port         port number
+ * @return              0 or an error code
+ */
+KR_EXPORT
+int kr_nsrep_group_add(struct kr_context *ctx, const char *name, const char *addr, uint16_t port);
+
+/**
+ * Define named forwarding group, the existing group is replaced only if all addresses are valid.
+ * @note The replaced group is kept until the group is deleted, as resolution in progress may reference it.
+ *       Statistics carry over to the new definition.
+ * @param  ctx          resolution context
+ * @param  name         group name
+ * @param  addrs        address strings (IPv4 or IPv6)
+ * @param  ports        port numbers
+ * @param  count        number of addresses
+ * @return              0 or an error code
+ */
+KR_EXPORT
+int kr_nsrep_group_set(struct kr_context *ctx, const char *name, const char **addrs, const uint16_t *ports, size_t count);
+
+/**
+ * Return named forwarding group.
+ * @param  ctx          resolution context
+ * @param  name         group name
+ * @return              group or NULL
+ */
+KR_EXPORT
+struct kr_nsrep_group *kr_nsrep_group_get(struct kr_context *ctx, const char *name);
+
+/**
+ * Delete named forwarding group (or all groups if the name is NULL).
+ * @note Resolution in progress may still reference the group, only delete it when the resolver is idle.
+ * @param  ctx          resolution context
+ * @param  name         group name (or NULL)
+ * @return              0 or an error code
+ */
+KR_EXPORT
+int kr_nsrep_group_del(struct kr_context *ctx, const char *name);
+
+/**
+ * Forward query to the named group in stub mode.
+ * @note The group is looked up for each query, and RTT of its upstreams is tracked per address and port.
+ * @param  qry          updated query
+ * @param  ctx          resolution context
+ * @param  name         group name
+ * @return              0 or an error code
+ */
+KR_EXPORT
+int kr_nsrep_forward(struct kr_query *qry, struct kr_context *ctx, const char *name);
+
+/**
+ * Elect best addresses from the forwarding group of the query.
+ * @note Upstreams flagged as 'bad' are elected first with a low probability, so they're probed
+ *       and brought back once they recover.
+ * @param  qry          updated query
+ * @param  ctx          resolution context
+ * @return              0 or an error code
+ */
+KR_EXPORT
+int kr_nsrep_elect_group(struct kr_query *qry, struct kr_context *ctx);
+
 /**
  * Update NS address RTT information.
  *
@@ -127,12 +269,21 @@ int kr_nsrep_elect_addr(struct kr_query *qry, struct kr_context *ctx);
  * @param  addr         chosen address (NULL for first)
  * @param  score        new score (i.e. RTT), see enum kr_ns_score
  * @param  cache        LRU cache
- * @param  umode        update mode (KR_NS_UPDATE or KR_NS_RESET or KR_NS_ADD)
+ * @param  umode        update mode, see enum kr_ns_update_mode
  * @return              0 on success, error code on failure
  */
 KR_EXPORT
 int kr_nsrep_update_rtt(struct kr_nsrep *ns, const struct sockaddr *addr,
-			unsigned score, kr_nsrep_lru_t *cache, int umode);
+			unsigned score, kr_nsrep_rtt_lru_t *cache, int umode);
+
+/**
+ * Return the current (decayed) RTT score.
+ * @param  rtt          tracked RTT score
+ * @param  now          current time (seconds)
+ * @return              score, see enum kr_ns_score
+ */
+KR_EXPORT KR_PURE
+unsigned kr_nsrep_score(const struct kr_nsrep_rtt *rtt, uint32_t now);
 
 /**
  * Update NSSET reputation information.
@@ -144,3 +295,17 @@ int kr_nsrep_update_rtt(struct kr_nsrep *ns, const struct sockaddr *addr,
  */
 KR_EXPORT
 int kr_nsrep_update_rep(struct kr_nsrep *ns, unsigned reputation, kr_nsrep_lru_t *cache);
+
+/**
+ * Track truncated UDP answers from NS.
+ *
+ * @brief After KR_NS_TC_LIMIT consecutive truncated answers the NS is flagged KR_NS_TCP,
+ *        a complete UDP answer resets the count.
+ *
+ * @param  ns           updated NS representation
+ * @param  truncated    true if the answer had TC=1
+ * @param  cache        LRU cache
+ * @return              0 on success, error code on failure
+ */
+KR_EXPORT
+int kr_nsrep_update_tc(struct kr_nsrep *ns, bool truncated, kr_nsrep_lru_t *cache);
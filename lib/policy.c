@@ -0,0 +1,1349 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <libknot/packet/wire.h>
+
+#include "lib/policy.h"
+#include "lib/utils.h"
+#include "contrib/ucw/lib.h"
+
+/** Pattern item quantifiers ('-' is equivalent to '*' for the match result) */
+enum {
+	Q_ONE = 0,
+	Q_OPT,
+	Q_STAR
+};
+
+/** @internal Pattern item, set of accepted bytes and quantifier. */
+struct pattern_item {
+	uint8_t set[32];
+	uint8_t quant;
+};
+
+/** Compiled pattern, transition table over bytes. */
+struct kr_policy_dfa {
+	size_t count;   /**< Number of states, 0 is the initial state */
+	bool anchored;  /**< Match must end at the end of the name */
+	uint16_t (*next)[256];
+	uint8_t accept[];
+};
+
+/** Memory-mapped compiled RPZ index. */
+struct kr_policy_index {
+	void *base;
+	size_t size;
+	uint32_t count;
+	const uint32_t *offsets; /**< Entry offsets sorted by key */
+	const uint8_t *entries;
+};
+
+/** Map value of the names removed from the index. */
+#define TOMBSTONE ((void *)(intptr_t)-1)
+
+#define set_add(set, c) ((set)[(c) >> 3] |= (1 << ((c) & 7)))
+#define set_has(set, c) ((set)[(c) >> 3] & (1 << ((c) & 7)))
+
+/** @internal Character class as in Lua string library (C locale). */
+static bool class_match(int cl, int c)
+{
+	bool res = false;
+	switch (tolower(cl)) {
+	case 'a': res = isalpha(c); break;
+	case 'c': res = iscntrl(c); break;
+	case 'd': res = isdigit(c); break;
+	case 'g': res = isgraph(c); break;
+	case 'l': res = islower(c); break;
+	case 'p': res = ispunct(c); break;
+	case 's': res = isspace(c); break;
+	case 'u': res = isupper(c); break;
+	case 'w': res = isalnum(c); break;
+	case 'x': res = isxdigit(c); break;
+	case 'z': res = (c == 0); break;
+	default: return (cl == c);
+	}
+	return isupper(cl) ? !res : res;
+}
+
+static void class_fill(uint8_t *set, int cl)
+{
+	for (int c = 0; c < 256; ++c) {
+		if (class_match(cl, c)) {
+			set_add(set, c);
+		}
+	}
+}
+
+/** @internal Parse single character class at *p. */
+static int pattern_class(uint8_t *set, const uint8_t **p, const uint8_t *end)
+{
+	const uint8_t *q = *p;
+	memset(set, 0, 32);
+	switch (*q) {
+	case '.':
+		memset(set, 0xff, 32);
+		*p = q + 1;
+		return kr_ok();
+	case '%':
+		if (q + 1 >= end) {
+			return kr_error(EINVAL);
+		}
+		/* Back references, balance and frontier are not regular */
+		if (isdigit(q[1]) || q[1] == 'b' || q[1] == 'f') {
+			return kr_error(ENOTSUP);
+		}
+		class_fill(set, q[1]);
+		*p = q + 2;
+		return kr_ok();
+	case '[': {
+		bool negate = false;
+		if (++q < end && *q == '^') {
+			negate = true;
+			++q;
+		}
+		/* Find end of the set, first member may be ']' */
+		const uint8_t *ec = q;
+		do {
+			if (ec >= end) {
+				return kr_error(EINVAL);
+			}
+			if (*(ec++) == '%' && ec < end) {
+				++ec;
+			}
+		} while (ec < end && *ec != ']');
+		if (ec >= end) {
+			return kr_error(EINVAL);
+		}
+		while (q < ec) {
+			if (*q == '%') {
+				class_fill(set, q[1]);
+				q += 2;
+			} else if (q + 2 < ec && q[1] == '-') {
+				for (int c = q[0]; c <= q[2]; ++c) {
+					set_add(set, c);
+				}
+				q += 3;
+			} else {
+				set_add(set, *q);
+				q += 1;
+			}
+		}
+		if (negate) {
+			for (int i = 0; i < 32; ++i) {
+				set[i] = ~set[i];
+			}
+		}
+		*p = ec + 1;
+		return kr_ok();
+	}
+	default:
+		set_add(set, *q);
+		*p = q + 1;
+		return kr_ok();
+	}
+}
+
+/** @internal Parse pattern into list of items. */
+static int pattern_parse(struct pattern_item *items, size_t *count, bool *anchor_start, bool *anchor_end,
+                         const uint8_t *p, size_t len)
+{
+	const uint8_t *end = p + len;
+	size_t n = 0;
+	*anchor_start = *anchor_end = false;
+	if (p < end && *p == '^') {
+		*anchor_start = true;
+		++p;
+	}
+	while (p < end) {
+		/* Captures don't change the match result */
+		if (*p == '(' || *p == ')') {
+			++p;
+			continue;
+		}
+		if (*p == '$' && p + 1 == end) {
+			*anchor_end = true;
+			break;
+		}
+		if (n + 2 > KR_POLICY_PATTERN_MAX) {
+			return kr_error(ENOTSUP);
+		}
+		struct pattern_item *item = &items[n++];
+		int ret = pattern_class(item->set, &p, end);
+		if (ret != 0) {
+			return ret;
+		}
+		item->quant = Q_ONE;
+		if (p < end) {
+			switch (*p) {
+			case '?':
+				item->quant = Q_OPT;
+				++p;
+				break;
+			case '*':
+			case '-':
+				item->quant = Q_STAR;
+				++p;
+				break;
+			case '+': /* x+ is xx* */
+				items[n] = *item;
+				items[n++].quant = Q_STAR;
+				++p;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	*count = n;
+	return kr_ok();
+}
+
+/** @internal Add positions reachable without consuming input. */
+static uint64_t nfa_closure(const struct pattern_item *items, size_t n, uint64_t mask)
+{
+	for (size_t i = 0; i < n; ++i) {
+		if ((mask & (1ULL << i)) && items[i].quant != Q_ONE) {
+			mask |= 1ULL << (i + 1);
+		}
+	}
+	return mask;
+}
+
+/** @internal Consume input byte in all positions. */
+static uint64_t nfa_step(const struct pattern_item *items, size_t n, uint64_t mask, int c, uint64_t restart)
+{
+	uint64_t next = restart;
+	for (size_t i = 0; i < n; ++i) {
+		if ((mask & (1ULL << i)) && set_has(items[i].set, c)) {
+			next |= (items[i].quant == Q_STAR) ? (1ULL << i) : (1ULL << (i + 1));
+		}
+	}
+	return nfa_closure(items, n, next);
+}
+
+/** @internal Build DFA by subset construction over pattern positions. */
+static struct kr_policy_dfa *dfa_build(const struct pattern_item *items, size_t n, bool anchor_start, bool anchor_end)
+{
+	uint64_t *states = malloc(KR_POLICY_DFA_MAX * sizeof(*states));
+	uint16_t (*next)[256] = malloc(KR_POLICY_DFA_MAX * sizeof(*next));
+	if (!states || !next) {
+		goto fail;
+	}
+	/* Unanchored pattern may start matching at any position */
+	const uint64_t accept = 1ULL << n;
+	const uint64_t restart = anchor_start ? 0 : 1;
+	states[0] = nfa_closure(items, n, 1);
+	size_t count = 1;
+	for (size_t s = 0; s < count; ++s) {
+		for (int c = 0; c < 256; ++c) {
+			/* Match is decided once accepted, unless anchored at the end */
+			if (!anchor_end && (states[s] & accept)) {
+				next[s][c] = s;
+				continue;
+			}
+			const uint64_t mask = nfa_step(items, n, states[s], c, restart);
+			size_t t = 0;
+			while (t < count && states[t] != mask) {
+				++t;
+			}
+			if (t == count) {
+				if (count >= KR_POLICY_DFA_MAX) {
+					goto fail;
+				}
+				states[count++] = mask;
+			}
+			next[s][c] = t;
+		}
+	}
+	struct kr_policy_dfa *dfa = malloc(sizeof(*dfa) + count);
+	if (!dfa) {
+		goto fail;
+	}
+	dfa->count = count;
+	dfa->anchored = anchor_end;
+	for (size_t s = 0; s < count; ++s) {
+		dfa->accept[s] = (states[s] & accept) ? 1 : 0;
+	}
+	dfa->next = realloc(next, count * sizeof(*next));
+	if (!dfa->next) {
+		dfa->next = next;
+	}
+	free(states);
+	return dfa;
+fail:
+	free(states);
+	free(next);
+	return NULL;
+}
+
+static bool dfa_match(const struct kr_policy_dfa *dfa, const uint8_t *name, size_t len)
+{
+	uint16_t state = 0;
+	if (!dfa->anchored && dfa->accept[state]) {
+		return true;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		state = dfa->next[state][name[i]];
+		if (!dfa->anchored && dfa->accept[state]) {
+			return true;
+		}
+	}
+	return dfa->accept[state];
+}
+
+static void dfa_free(struct kr_policy_dfa *dfa)
+{
+	if (dfa) {
+		free(dfa->next);
+		free(dfa);
+	}
+}
+
+static void index_free(struct kr_policy_index *index)
+{
+	if (index) {
+		munmap(index->base, index->size);
+		free(index);
+	}
+}
+
+struct kr_policy_rule *kr_policy_rule_new(int type, int action)
+{
+	if (type < KR_POLICY_ALL || type > KR_POLICY_FILTER || action <= 0) {
+		return NULL;
+	}
+	struct kr_policy_rule *rule = calloc(1, sizeof(*rule));
+	if (!rule) {
+		return NULL;
+	}
+	rule->type = type;
+	rule->action = action;
+	rule->names = map_make();
+	rule->wildcards = map_make();
+	return rule;
+}
+
+void kr_policy_rule_free(struct kr_policy_rule *rule)
+{
+	if (!rule) {
+		return;
+	}
+	map_clear(&rule->names);
+	map_clear(&rule->wildcards);
+	dfa_free(rule->dfa);
+	index_free(rule->index);
+	array_clear(rule->prog);
+	free(rule->common);
+	free(rule);
+}
+
+/** @internal Convert name to lowercase wire format with terminal label. */
+static int name_normalize(uint8_t *dst, const char *name, size_t len)
+{
+	size_t pos = 0;
+	while (pos < len) {
+		const uint8_t lablen = name[pos];
+		if (lablen == 0) {
+			if (pos + 1 != len) {
+				return kr_error(EILSEQ);
+			}
+			break;
+		}
+		if (lablen > KNOT_DNAME_MAXLABELLEN) {
+			return kr_error(EILSEQ);
+		}
+		pos += lablen + 1;
+	}
+	if (pos > len || pos + 1 > KNOT_DNAME_MAXLEN) {
+		return kr_error(EILSEQ);
+	}
+	memcpy(dst, name, pos);
+	dst[pos] = '\0';
+	knot_dname_to_lower(dst);
+	return kr_ok();
+}
+
+int kr_policy_rule_add(struct kr_policy_rule *rule, const char *name, size_t len, int action)
+{
+	if (!rule || !name || action < 0 || (rule->type != KR_POLICY_SUFFIX && rule->type != KR_POLICY_RPZ)) {
+		return kr_error(EINVAL);
+	}
+	uint8_t key[KNOT_DNAME_MAXLEN];
+	int ret = name_normalize(key, name, len);
+	if (ret != 0) {
+		return ret;
+	}
+	/* Value is the action code, it's never NULL */
+	void *val = (void *)(intptr_t)(action > 0 ? action : rule->action);
+	if (rule->type == KR_POLICY_RPZ && key[0] == 1 && key[1] == '*') {
+		ret = map_set(&rule->wildcards, (const char *)key + 2, val);
+	} else {
+		ret = map_set(&rule->names, (const char *)key, val);
+	}
+	/* Existing name is updated in place */
+	if (ret == 0) {
+		rule->entries += 1;
+	} else if (ret != 1) {
+		return kr_error(ret);
+	}
+	return kr_ok();
+}
+
+int kr_policy_rule_del(struct kr_policy_rule *rule, const char *name, size_t len)
+{
+	if (!rule || !name || (rule->type != KR_POLICY_SUFFIX && rule->type != KR_POLICY_RPZ)) {
+		return kr_error(EINVAL);
+	}
+	uint8_t key[KNOT_DNAME_MAXLEN];
+	int ret = name_normalize(key, name, len);
+	if (ret != 0) {
+		return ret;
+	}
+	map_t *map = &rule->names;
+	const char *str = (const char *)key;
+	if (rule->type == KR_POLICY_RPZ && key[0] == 1 && key[1] == '*') {
+		map = &rule->wildcards;
+		str += 2;
+	}
+	/* Names in the index can't be removed, they're masked by a tombstone */
+	if (rule->index) {
+		ret = map_set(map, str, TOMBSTONE);
+		if (ret != 0 && ret != 1) {
+			return kr_error(ret);
+		}
+	} else if (map_del(map, str) != 0) {
+		return kr_error(ENOENT);
+	}
+	if (rule->entries > 0) {
+		rule->entries -= 1;
+	}
+	return kr_ok();
+}
+
+int kr_policy_rule_common(struct kr_policy_rule *rule, const char *suffix, size_t len)
+{
+	if (!rule || rule->type != KR_POLICY_SUFFIX || (!suffix && len > 0)) {
+		return kr_error(EINVAL);
+	}
+	uint8_t *common = NULL;
+	if (len > 0) {
+		common = malloc(len);
+		if (!common) {
+			return kr_error(ENOMEM);
+		}
+		memcpy(common, suffix, len);
+	}
+	free(rule->common);
+	rule->common = common;
+	rule->common_len = len;
+	return kr_ok();
+}
+
+int kr_policy_rule_pattern(struct kr_policy_rule *rule, const char *pattern, size_t len)
+{
+	if (!rule || !pattern || rule->type != KR_POLICY_PATTERN) {
+		return kr_error(EINVAL);
+	}
+	struct pattern_item items[KR_POLICY_PATTERN_MAX];
+	size_t count = 0;
+	bool anchor_start = false, anchor_end = false;
+	int ret = pattern_parse(items, &count, &anchor_start, &anchor_end, (const uint8_t *)pattern, len);
+	if (ret != 0) {
+		return ret;
+	}
+	struct kr_policy_dfa *dfa = dfa_build(items, count, anchor_start, anchor_end);
+	if (!dfa) {
+		return kr_error(ENOTSUP);
+	}
+	dfa_free(rule->dfa);
+	rule->dfa = dfa;
+	return kr_ok();
+}
+
+/** @internal Find the name or its closest enclosing name in the set. */
+static int suffix_find(map_t *names, const knot_dname_t *qname)
+{
+	while (true) {
+		void *val = map_get(names, (const char *)qname);
+		if (val || *qname == '\0') {
+			return (int)(intptr_t)val;
+		}
+		qname = knot_wire_next_label(qname, NULL);
+	}
+}
+
+/**
+ * @internal Convert wire name to index key, labels are in reverse order and each is followed by zero byte.
+ * @param ends length of the key after each label (from the root)
+ * @return number of labels
+ */
+static int index_key(uint8_t *dst, size_t *len, uint8_t *ends, const knot_dname_t *name)
+{
+	const uint8_t *labels[KNOT_DNAME_MAXLABELS];
+	int count = 0;
+	while (*name != '\0' && count < KNOT_DNAME_MAXLABELS) {
+		labels[count++] = name;
+		name = knot_wire_next_label(name, NULL);
+	}
+	size_t pos = 0;
+	for (int i = 0; i < count; ++i) {
+		const uint8_t *label = labels[count - i - 1];
+		memcpy(dst + pos, label + 1, label[0]);
+		pos += label[0];
+		dst[pos++] = '\0';
+		if (ends) {
+			ends[i] = pos;
+		}
+	}
+	*len = pos;
+	return count;
+}
+
+static int index_cmp(const uint8_t *entry, const uint8_t *key, size_t len)
+{
+	const size_t entry_len = entry[1];
+	int ret = memcmp(entry + 2, key, MIN(entry_len, len));
+	if (ret == 0) {
+		ret = (entry_len > len) - (entry_len < len);
+	}
+	return ret;
+}
+
+/** @internal Binary search for the key, returns action code or 0. */
+static int index_find(const struct kr_policy_index *index, const uint8_t *key, size_t len)
+{
+	uint32_t lo = 0, hi = index->count;
+	while (lo < hi) {
+		const uint32_t mid = lo + (hi - lo) / 2;
+		const uint8_t *entry = index->entries + index->offsets[mid];
+		const int ret = index_cmp(entry, key, len);
+		if (ret == 0) {
+			return entry[0];
+		} else if (ret < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return 0;
+}
+
+/** @internal Find wildcard trigger for the name with given key prefix in the index. */
+static int index_find_wildcard(const struct kr_policy_index *index, const uint8_t *key, size_t len)
+{
+	uint8_t wild[KNOT_DNAME_MAXLEN + 2];
+	memcpy(wild, key, len);
+	wild[len] = '*';
+	wild[len + 1] = '\0';
+	return index_find(index, wild, len + 2);
+}
+
+/**
+ * @internal Look up name in the added names first and then in the index.
+ * @return action code, 0 if not found or removed
+ */
+static int rpz_get(map_t *map, const knot_dname_t *name, const struct kr_policy_index *index,
+                   const uint8_t *key, size_t len, bool wildcard)
+{
+	void *val = map_get(map, (const char *)name);
+	if (val == TOMBSTONE) {
+		return 0;
+	}
+	if (!val && index) {
+		return wildcard ? index_find_wildcard(index, key, len) : index_find(index, key, len);
+	}
+	return (int)(intptr_t)val;
+}
+
+/** @internal Find exact RPZ trigger or the closest wildcard trigger. */
+static int rpz_find(struct kr_policy_rule *rule, const knot_dname_t *qname)
+{
+	const struct kr_policy_index *index = rule->index;
+	uint8_t key[KNOT_DNAME_MAXLEN];
+	uint8_t ends[KNOT_DNAME_MAXLABELS];
+	size_t len = 0;
+	int labels = 0;
+	if (index) {
+		labels = index_key(key, &len, ends, qname);
+	}
+	int val = rpz_get(&rule->names, qname, index, key, len, false);
+	/* Parent names from the closest to the root */
+	while (!val && *qname != '\0') {
+		qname = knot_wire_next_label(qname, NULL);
+		labels -= 1;
+		val = rpz_get(&rule->wildcards, qname, index, key, labels > 0 ? ends[labels - 1] : 0, true);
+	}
+	return val;
+}
+
+int kr_policy_rule_load(struct kr_policy_rule *rule, const char *path)
+{
+	if (!rule || !path || rule->type != KR_POLICY_RPZ) {
+		return kr_error(EINVAL);
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return kr_error(errno);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		int ret = errno;
+		close(fd);
+		return kr_error(ret);
+	}
+	const struct kr_policy_rpz_header *hdr = NULL;
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return kr_error(EILSEQ);
+	}
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return kr_error(errno);
+	}
+	/* Check header and that all entries are within the file */
+	hdr = base;
+	const size_t size = st.st_size;
+	const uint32_t *offsets = (const uint32_t *)(hdr + 1);
+	const uint8_t *entries = (const uint8_t *)(offsets + hdr->count);
+	bool valid = memcmp(hdr->magic, KR_POLICY_RPZ_MAGIC, sizeof(hdr->magic)) == 0 &&
+	             hdr->version == KR_POLICY_RPZ_VERSION &&
+	             sizeof(*hdr) + (uint64_t)hdr->count * sizeof(*offsets) + hdr->size <= size;
+	for (uint32_t i = 0; valid && i < hdr->count; ++i) {
+		const uint32_t off = offsets[i];
+		valid = ((uint64_t)off + 2 <= hdr->size) &&
+		        ((uint64_t)off + 2 + entries[off + 1] <= hdr->size) && entries[off] > 0;
+	}
+	struct kr_policy_index *index = valid ? malloc(sizeof(*index)) : NULL;
+	if (!index) {
+		munmap(base, size);
+		return valid ? kr_error(ENOMEM) : kr_error(EILSEQ);
+	}
+	index->base = base;
+	index->size = size;
+	index->count = hdr->count;
+	index->offsets = offsets;
+	index->entries = entries;
+	if (rule->index) {
+		rule->entries -= MIN(rule->entries, rule->index->count);
+	}
+	index_free(rule->index);
+	rule->index = index;
+	rule->entries += index->count;
+	rule->mapped = size;
+	return kr_ok();
+}
+
+/** @internal Entries of the index being written. */
+struct index_builder {
+	array_t(uint8_t) entries;
+	array_t(uint32_t) offsets;
+	bool wildcard;
+};
+
+static int index_build(const char *name, void *val, void *baton)
+{
+	struct index_builder *builder = baton;
+	uint8_t entry[2 + KNOT_DNAME_MAXLEN + 2];
+	size_t len = 0;
+	if (val == TOMBSTONE) {
+		return 0;
+	}
+	index_key(entry + 2, &len, NULL, (const knot_dname_t *)name);
+	if (builder->wildcard) {
+		entry[2 + len++] = '*';
+		entry[2 + len++] = '\0';
+	}
+	entry[0] = (intptr_t)val;
+	entry[1] = len;
+	/* Grow geometrically, the zone may have millions of entries */
+	const size_t want = builder->entries.len + len + 2;
+	if ((want > builder->entries.cap &&
+	     array_reserve(builder->entries, MAX(want, 2 * builder->entries.cap)) != 0) ||
+	    array_push(builder->offsets, builder->entries.len) < 0) {
+		return kr_error(ENOMEM);
+	}
+	memcpy(builder->entries.at + builder->entries.len, entry, len + 2);
+	builder->entries.len += len + 2;
+	return 0;
+}
+
+/* Sorted by qsort() which has no context argument, so saving is not reentrant. */
+static const uint8_t *index_sort_entries;
+static int index_sort_cmp(const void *a, const void *b)
+{
+	const uint8_t *entry_a = index_sort_entries + *(const uint32_t *)a;
+	const uint8_t *entry_b = index_sort_entries + *(const uint32_t *)b;
+	return index_cmp(entry_a, entry_b + 2, entry_b[1]);
+}
+
+int kr_policy_rule_save(const struct kr_policy_rule *rule, const char *path)
+{
+	if (!rule || !path || rule->type != KR_POLICY_RPZ) {
+		return kr_error(EINVAL);
+	}
+	struct kr_policy_rule *r = (struct kr_policy_rule *)rule;
+	struct index_builder builder;
+	array_init(builder.entries);
+	array_init(builder.offsets);
+	builder.wildcard = false;
+	int ret = map_walk(&r->names, index_build, &builder);
+	if (ret == 0) {
+		builder.wildcard = true;
+		ret = map_walk(&r->wildcards, index_build, &builder);
+	}
+	if (ret != 0) {
+		goto cleanup;
+	}
+	index_sort_entries = builder.entries.at;
+	qsort(builder.offsets.at, builder.offsets.len, sizeof(uint32_t), index_sort_cmp);
+	index_sort_entries = NULL;
+	/* Write new index and replace the old one */
+	struct kr_policy_rpz_header hdr;
+	memcpy(hdr.magic, KR_POLICY_RPZ_MAGIC, sizeof(hdr.magic));
+	hdr.version = KR_POLICY_RPZ_VERSION;
+	hdr.count = builder.offsets.len;
+	hdr.size = builder.entries.len;
+	char tmp[PATH_MAX];
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+		ret = kr_error(ENAMETOOLONG);
+		goto cleanup;
+	}
+	FILE *fp = fopen(tmp, "wb");
+	if (!fp) {
+		ret = kr_error(errno);
+		goto cleanup;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(builder.offsets.at, sizeof(uint32_t), hdr.count, fp) != hdr.count ||
+	    fwrite(builder.entries.at, 1, hdr.size, fp) != hdr.size) {
+		ret = kr_error(EIO);
+	}
+	if (fclose(fp) != 0 && ret == 0) {
+		ret = kr_error(EIO);
+	}
+	if (ret == 0 && rename(tmp, path) != 0) {
+		ret = kr_error(errno);
+	}
+	if (ret != 0) {
+		unlink(tmp);
+	}
+cleanup:
+	array_clear(builder.entries);
+	array_clear(builder.offsets);
+	return ret;
+}
+
+static bool has_suffix(const struct kr_policy_rule *rule, const knot_dname_t *qname, size_t qlen)
+{
+	return qlen >= rule->common_len &&
+	       memcmp(qname + qlen - rule->common_len, rule->common, rule->common_len) == 0;
+}
+
+int kr_policy_rule_swap(struct kr_policy_rule *rule, struct kr_policy_rule *next)
+{
+	if (!rule || !next || rule->type != next->type) {
+		return kr_error(EINVAL);
+	}
+	struct kr_policy_rule tmp = *rule;
+	/* Swap the matchers, keep the counters, state and watched file */
+	rule->common = next->common;
+	rule->common_len = next->common_len;
+	rule->names = next->names;
+	rule->wildcards = next->wildcards;
+	rule->dfa = next->dfa;
+	rule->index = next->index;
+	rule->entries = next->entries;
+	rule->mapped = next->mapped;
+	next->common = tmp.common;
+	next->common_len = tmp.common_len;
+	next->names = tmp.names;
+	next->wildcards = tmp.wildcards;
+	next->dfa = tmp.dfa;
+	next->index = tmp.index;
+	next->entries = tmp.entries;
+	next->mapped = tmp.mapped;
+	return kr_ok();
+}
+
+int kr_policy_rule_changed(struct kr_policy_rule *rule, const char *path)
+{
+	if (!rule || !path) {
+		return kr_error(EINVAL);
+	}
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return kr_error(errno);
+	}
+	/* Replaced file has new inode, rewritten file has new modification time */
+	const uint64_t mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	if (rule->file.ino == st.st_ino && rule->file.mtime == mtime && rule->file.size == (uint64_t)st.st_size) {
+		return 0;
+	}
+	rule->file.ino = st.st_ino;
+	rule->file.mtime = mtime;
+	rule->file.size = st.st_size;
+	return 1;
+}
+
+int kr_policy_rule_match(const struct kr_policy_rule *rule, const knot_dname_t *qname)
+{
+	if (!rule || rule->type == KR_POLICY_EXTERN) {
+		return 0;
+	}
+	if (rule->type == KR_POLICY_ALL) {
+		return rule->action;
+	}
+	if (!qname) {
+		return 0;
+	}
+	/* Maps are not modified in lookup, the cast is safe */
+	struct kr_policy_rule *r = (struct kr_policy_rule *)rule;
+	switch (rule->type) {
+	case KR_POLICY_SUFFIX:
+		if (rule->common && !has_suffix(rule, qname, knot_dname_size(qname))) {
+			return 0;
+		}
+		return suffix_find(&r->names, qname);
+	case KR_POLICY_PATTERN:
+		if (rule->dfa && dfa_match(rule->dfa, qname, knot_dname_size(qname))) {
+			return rule->action;
+		}
+		return 0;
+	case KR_POLICY_RPZ:
+		return rpz_find(r, qname);
+	default:
+		return 0;
+	}
+}
+
+/** @internal Evaluate predicate, the result is cached for the query stamp. */
+static bool pred_eval(struct kr_policy_pred *pred, const struct kr_policy_query *query)
+{
+	if (pred->stamp == query->stamp) {
+		return pred->result;
+	}
+	bool result = false;
+	switch (pred->type) {
+	case KR_POLICY_PRED_QNAME:
+		result = kr_policy_rule_match(pred->rule, query->qname) > 0;
+		break;
+	case KR_POLICY_PRED_QTYPE:
+		result = (query->qtype == pred->qtype);
+		break;
+	case KR_POLICY_PRED_SRC:
+		result = kr_policy_net_match(pred->net, query->src) > 0;
+		break;
+	case KR_POLICY_PRED_DST:
+		result = kr_policy_net_match(pred->net, query->dst) > 0;
+		break;
+	default:
+		break;
+	}
+	pred->count += 1;
+	pred->stamp = query->stamp;
+	pred->result = result;
+	return result;
+}
+
+/** @internal Run filter program. */
+static bool prog_eval(const struct kr_policy_rule *rule, const struct kr_policy_query *query)
+{
+	bool reg = true;
+	for (size_t pc = 0; pc < rule->prog.len; ++pc) {
+		const struct kr_policy_insn *insn = &rule->prog.at[pc];
+		switch (insn->op) {
+		case KR_POLICY_OP_TEST:
+			reg = pred_eval(insn->pred, query);
+			break;
+		case KR_POLICY_OP_AND:
+			if (!reg) {
+				pc += insn->skip;
+			}
+			break;
+		case KR_POLICY_OP_OR:
+			if (reg) {
+				pc += insn->skip;
+			}
+			break;
+		case KR_POLICY_OP_NOT:
+			reg = !reg;
+			break;
+		default:
+			return false;
+		}
+	}
+	return reg;
+}
+
+int kr_policy_rule_eval(const struct kr_policy_rule *rule, const struct kr_policy_query *query)
+{
+	if (!rule || !query) {
+		return 0;
+	}
+	if (rule->type == KR_POLICY_FILTER) {
+		return prog_eval(rule, query) ? rule->action : 0;
+	}
+	return kr_policy_rule_match(rule, query->qname);
+}
+
+int kr_policy_set_push(kr_policy_set_t *set, struct kr_policy_rule *rule)
+{
+	if (!set || !rule) {
+		return kr_error(EINVAL);
+	}
+	if (array_push(*set, rule) < 0) {
+		return kr_error(ENOMEM);
+	}
+	return kr_ok();
+}
+
+void kr_policy_set_clear(kr_policy_set_t *set)
+{
+	if (set) {
+		array_clear(*set);
+	}
+}
+
+int kr_policy_eval(kr_policy_set_t *set, size_t from, const struct kr_policy_query *query, int *action)
+{
+	if (!set || !query || !action) {
+		return -1;
+	}
+	for (size_t i = from; i < set->len; ++i) {
+		struct kr_policy_rule *rule = set->at[i];
+		if (rule->suspended) {
+			continue;
+		}
+		if (rule->type == KR_POLICY_EXTERN) {
+			*action = 0;
+			return i;
+		}
+		const int code = kr_policy_rule_eval(rule, query);
+		if (code > 0) {
+			rule->count += 1;
+			*action = code;
+			return i;
+		}
+	}
+	return -1;
+}
+
+struct kr_policy_net *kr_policy_net_new(void)
+{
+	struct kr_policy_net *net = malloc(sizeof(*net));
+	if (net) {
+		net->v4 = lpm_make();
+		net->v6 = lpm_make();
+	}
+	return net;
+}
+
+void kr_policy_net_free(struct kr_policy_net *net)
+{
+	if (net) {
+		lpm_clear(&net->v4);
+		lpm_clear(&net->v6);
+		free(net);
+	}
+}
+
+/** @internal Parse subnet into key, returns its tree and prefix length. */
+static int net_parse(struct kr_policy_net *net, const char *subnet, uint8_t *key, lpm_t **lpm)
+{
+	memset(key, 0, sizeof(struct in6_addr));
+	const int bits = kr_straddr_subnet(key, subnet);
+	if (bits < 0) {
+		return bits;
+	}
+	*lpm = (kr_straddr_family(subnet) == AF_INET6) ? &net->v6 : &net->v4;
+	return bits;
+}
+
+int kr_policy_net_add(struct kr_policy_net *net, const char *subnet, int value)
+{
+	if (!net || !subnet || value <= 0) {
+		return kr_error(EINVAL);
+	}
+	uint8_t key[sizeof(struct in6_addr)];
+	lpm_t *lpm = NULL;
+	const int bits = net_parse(net, subnet, key, &lpm);
+	if (bits < 0) {
+		return bits;
+	}
+	const int ret = lpm_set(lpm, key, bits, (void *)(intptr_t)value);
+	return (ret == 0 || ret == 1) ? kr_ok() : kr_error(ret);
+}
+
+int kr_policy_net_del(struct kr_policy_net *net, const char *subnet)
+{
+	if (!net || !subnet) {
+		return kr_error(EINVAL);
+	}
+	uint8_t key[sizeof(struct in6_addr)];
+	lpm_t *lpm = NULL;
+	const int bits = net_parse(net, subnet, key, &lpm);
+	if (bits < 0) {
+		return bits;
+	}
+	return lpm_del(lpm, key, bits) == 0 ? kr_ok() : kr_error(ENOENT);
+}
+
+int kr_policy_net_load(struct kr_policy_net *net, const char *path, int value)
+{
+	if (!net || !path || value <= 0) {
+		return kr_error(EINVAL);
+	}
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		return kr_error(errno);
+	}
+	int count = 0;
+	int ret = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		/* Strip comments and whitespace */
+		char *begin = line;
+		line[strcspn(line, "#\r\n")] = '\0';
+		while (isspace((unsigned char)*begin)) {
+			++begin;
+		}
+		begin[strcspn(begin, " \t")] = '\0';
+		if (*begin == '\0') {
+			continue;
+		}
+		ret = kr_policy_net_add(net, begin, value);
+		if (ret != 0) {
+			break;
+		}
+		++count;
+	}
+	fclose(fp);
+	return (ret != 0) ? ret : count;
+}
+
+int kr_policy_net_match(const struct kr_policy_net *net, const struct sockaddr *addr)
+{
+	if (!net || !addr) {
+		return 0;
+	}
+	const lpm_t *lpm = NULL;
+	switch (addr->sa_family) {
+	case AF_INET:  lpm = &net->v4; break;
+	case AF_INET6: lpm = &net->v6; break;
+	default: return 0;
+	}
+	if (lpm->root == NULL) {
+		return 0;
+	}
+	const int bits = kr_inaddr_len(addr) * 8;
+	return (intptr_t)lpm_match(lpm, (const uint8_t *)kr_inaddr(addr), bits, NULL);
+}
+
+struct kr_policy_pred *kr_policy_pred_new(int type, const void *match, uint16_t qtype)
+{
+	if (type < KR_POLICY_PRED_QNAME || type > KR_POLICY_PRED_DST ||
+	    (type != KR_POLICY_PRED_QTYPE && !match)) {
+		return NULL;
+	}
+	struct kr_policy_pred *pred = calloc(1, sizeof(*pred));
+	if (!pred) {
+		return NULL;
+	}
+	pred->type = type;
+	pred->qtype = qtype;
+	if (type == KR_POLICY_PRED_QNAME) {
+		pred->rule = match;
+	} else if (type != KR_POLICY_PRED_QTYPE) {
+		pred->net = match;
+	}
+	return pred;
+}
+
+void kr_policy_pred_free(struct kr_policy_pred *pred)
+{
+	free(pred);
+}
+
+int kr_policy_rule_insn(struct kr_policy_rule *rule, int op, unsigned skip, struct kr_policy_pred *pred)
+{
+	if (!rule || rule->type != KR_POLICY_FILTER || op < KR_POLICY_OP_TEST || op > KR_POLICY_OP_NOT ||
+	    (op == KR_POLICY_OP_TEST && !pred) || skip > UINT16_MAX) {
+		return kr_error(EINVAL);
+	}
+	struct kr_policy_insn insn = { .op = op, .skip = skip, .pred = pred };
+	if (array_push(rule->prog, insn) < 0) {
+		return kr_error(ENOMEM);
+	}
+	return kr_ok();
+}
+
+struct kr_policy_renumber *kr_policy_renumber_new(void)
+{
+	struct kr_policy_renumber *tbl = malloc(sizeof(*tbl));
+	if (tbl) {
+		tbl->v4 = lpm_make();
+		tbl->v6 = lpm_make();
+		tbl->names = map_make();
+	}
+	return tbl;
+}
+
+static int renumber_free_lpm(const uint8_t *key, unsigned bits, void *val, void *baton)
+{
+	free(val);
+	return 0;
+}
+
+static int renumber_free_name(const char *key, void *val, void *baton)
+{
+	free(val);
+	return 0;
+}
+
+void kr_policy_renumber_free(struct kr_policy_renumber *tbl)
+{
+	if (tbl) {
+		lpm_walk(&tbl->v4, renumber_free_lpm, NULL);
+		lpm_walk(&tbl->v6, renumber_free_lpm, NULL);
+		map_walk(&tbl->names, renumber_free_name, NULL);
+		lpm_clear(&tbl->v4);
+		lpm_clear(&tbl->v6);
+		map_clear(&tbl->names);
+		free(tbl);
+	}
+}
+
+/** @internal Parse target address, the value is the address length followed by the address. */
+static uint8_t *renumber_target(const char *target, int family)
+{
+	if (kr_straddr_family(target) != family) {
+		return NULL;
+	}
+	uint8_t *val = calloc(1, 1 + sizeof(struct in6_addr));
+	if (val && inet_pton(family, target, val + 1) <= 0) {
+		free(val);
+		return NULL;
+	}
+	if (val) {
+		val[0] = kr_family_len(family);
+	}
+	return val;
+}
+
+int kr_policy_renumber_add(struct kr_policy_renumber *tbl, const char *subnet, const char *target)
+{
+	if (!tbl || !subnet || !target) {
+		return kr_error(EINVAL);
+	}
+	uint8_t key[sizeof(struct in6_addr)] = { 0 };
+	const int bits = kr_straddr_subnet(key, subnet);
+	if (bits < 0) {
+		return bits;
+	}
+	const int family = kr_straddr_family(subnet);
+	uint8_t *val = renumber_target(target, family);
+	if (!val) {
+		return kr_error(EINVAL);
+	}
+	lpm_t *lpm = (family == AF_INET6) ? &tbl->v6 : &tbl->v4;
+	void *prev = lpm_get(lpm, key, bits);
+	const int ret = lpm_set(lpm, key, bits, val);
+	if (ret != 0 && ret != 1) {
+		free(val);
+		return kr_error(ret);
+	}
+	free(prev);
+	return kr_ok();
+}
+
+int kr_policy_renumber_name(struct kr_policy_renumber *tbl, const knot_dname_t *name, const char *target)
+{
+	if (!tbl || !name || !target) {
+		return kr_error(EINVAL);
+	}
+	const int family = kr_straddr_family(target);
+	uint8_t *val = renumber_target(target, family);
+	if (!val) {
+		return kr_error(EINVAL);
+	}
+	/* Keep the address of each family under its own key */
+	knot_dname_t key[KNOT_DNAME_MAXLEN + 1];
+	knot_dname_to_wire(key + 1, name, KNOT_DNAME_MAXLEN);
+	knot_dname_to_lower(key + 1);
+	key[0] = (family == AF_INET6) ? '6' : '4';
+	void *prev = map_get(&tbl->names, (const char *)key);
+	if (map_set(&tbl->names, (const char *)key, val) != 0) {
+		free(val);
+		return kr_error(ENOMEM);
+	}
+	free(prev);
+	return kr_ok();
+}
+
+/** @internal Rewrite address by the owner or the longest prefix rule. */
+static bool renumber_addr(const struct kr_policy_renumber *tbl, const knot_dname_t *owner, uint8_t *addr, size_t len)
+{
+	const uint8_t *val = NULL;
+	unsigned bits = len * 8;
+	if (tbl->names.root != NULL) {
+		knot_dname_t key[KNOT_DNAME_MAXLEN + 1];
+		knot_dname_to_wire(key + 1, owner, KNOT_DNAME_MAXLEN);
+		knot_dname_to_lower(key + 1);
+		key[0] = (len == sizeof(struct in6_addr)) ? '6' : '4';
+		val = map_get((map_t *)&tbl->names, (const char *)key);
+	}
+	if (!val) {
+		const lpm_t *lpm = (len == sizeof(struct in6_addr)) ? &tbl->v6 : &tbl->v4;
+		if (lpm->root == NULL) {
+			return false;
+		}
+		val = lpm_match(lpm, addr, len * 8, &bits);
+	}
+	if (!val || val[0] != len) {
+		return false;
+	}
+	/* Replace the prefix, keep the rest of the address */
+	const uint8_t *target = val + 1;
+	const unsigned chunk = bits / 8;
+	memcpy(addr, target, chunk);
+	if (bits % 8) {
+		const uint8_t mask = 0xff << (8 - bits % 8);
+		addr[chunk] = (addr[chunk] & ~mask) | (target[chunk] & mask);
+	}
+	return true;
+}
+
+/** @internal Return position after the (possibly compressed) name on the wire. */
+static size_t wire_skip_name(const uint8_t *wire, size_t pos, size_t size)
+{
+	while (pos < size) {
+		const uint8_t len = wire[pos];
+		if (len == 0) {
+			return pos + 1;
+		}
+		if ((len & KNOT_WIRE_PTR) == KNOT_WIRE_PTR) {
+			return pos + 2;
+		}
+		pos += 1 + len;
+	}
+	return size;
+}
+
+/** @internal Rewrite addresses of the RR set written at the wire position. */
+static int renumber_rrset(const struct kr_policy_renumber *tbl, knot_pkt_t *pkt, knot_rrset_t *rr, size_t pos)
+{
+	const size_t len = (rr->type == KNOT_RRTYPE_A) ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+	int count = 0;
+	for (uint16_t i = 0; i < rr->rrs.rr_count; ++i) {
+		/* Owner, type, class, TTL and RDLENGTH precede RDATA */
+		pos = wire_skip_name(pkt->wire, pos, pkt->size) + 3 * sizeof(uint16_t) + sizeof(uint32_t);
+		if (pos + len > pkt->size) {
+			return kr_error(EILSEQ);
+		}
+		const size_t rdlen = (pkt->wire[pos - 2] << 8) | pkt->wire[pos - 1];
+		if (rdlen != len) {
+			return kr_error(EILSEQ);
+		}
+		knot_rdata_t *rd = knot_rdataset_at(&rr->rrs, i);
+		uint8_t *addr = knot_rdata_data(rd);
+		if (knot_rdata_rdlen(rd) == len && renumber_addr(tbl, rr->owner, addr, len)) {
+			memcpy(pkt->wire + pos, addr, len);
+			count += 1;
+		}
+		pos += len;
+	}
+	return count;
+}
+
+/** @internal Write the packet again without signatures. */
+static int strip_signatures(knot_pkt_t *pkt)
+{
+	const uint16_t count = pkt->rrset_count;
+	knot_rrset_t *rrs = mm_alloc(&pkt->mm, count * sizeof(*rrs));
+	if (!rrs) {
+		return kr_error(ENOMEM);
+	}
+	memcpy(rrs, pkt->rr, count * sizeof(*rrs));
+	uint16_t section_end[KNOT_ADDITIONAL + 1];
+	for (int i = KNOT_ANSWER; i <= KNOT_ADDITIONAL; ++i) {
+		const knot_pktsection_t *sec = knot_pkt_section(pkt, i);
+		section_end[i] = sec->pos + sec->count;
+	}
+	/* Header flags are kept, records are owned by the packet memory pool */
+	const uint16_t qclass = knot_pkt_qclass(pkt);
+	const uint16_t qtype = knot_pkt_qtype(pkt);
+	knot_dname_t *qname = knot_dname_copy(knot_pkt_qname(pkt), &pkt->mm);
+	int ret = kr_pkt_recycle(pkt);
+	if (ret == 0 && qname) {
+		ret = knot_pkt_put_question(pkt, qname, qclass, qtype);
+	}
+	for (int i = KNOT_ANSWER, at = 0; i <= KNOT_ADDITIONAL && ret == 0; ++i) {
+		ret = knot_pkt_begin(pkt, i);
+		for (; at < section_end[i] && ret == 0; ++at) {
+			if (rrs[at].type != KNOT_RRTYPE_RRSIG) {
+				ret = knot_pkt_put(pkt, 0, &rrs[at], 0);
+			}
+		}
+	}
+	return ret;
+}
+
+int kr_policy_renumber_apply(const struct kr_policy_renumber *tbl, knot_pkt_t *pkt)
+{
+	if (!tbl || !pkt) {
+		return kr_error(EINVAL);
+	}
+	const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+	int count = 0;
+	bool has_rrsig = false;
+	for (uint16_t i = 0; i < an->count; ++i) {
+		knot_rrset_t *rr = &pkt->rr[an->pos + i];
+		if (rr->type == KNOT_RRTYPE_RRSIG) {
+			has_rrsig = true;
+		}
+		if (rr->type != KNOT_RRTYPE_A && rr->type != KNOT_RRTYPE_AAAA) {
+			continue;
+		}
+		const int ret = renumber_rrset(tbl, pkt, rr, pkt->rr_info[an->pos + i].pos);
+		if (ret < 0) {
+			return ret;
+		}
+		count += ret;
+	}
+	/* Signatures of the rewritten records can't be valid anymore */
+	for (uint16_t i = an->pos + an->count; i < pkt->rrset_count && !has_rrsig; ++i) {
+		has_rrsig = (pkt->rr[i].type == KNOT_RRTYPE_RRSIG);
+	}
+	if (count > 0 && has_rrsig) {
+		const int ret = strip_signatures(pkt);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return count;
+}
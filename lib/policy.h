@@ -0,0 +1,375 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file policy.h
+ * @brief Compiled QNAME matchers for the policy rules.
+ *
+ * The rule matches QNAME and returns an action code, the meaning of the code
+ * is up to the caller (i.e. the policy module maps it to its actions).
+ * Rules are evaluated in order from the rule set, the match counters are kept in the rules.
+ * Address sets match client or destination address to the longest containing subnet.
+ * Filter rules combine QNAME, QTYPE and address predicates in a small program,
+ * predicates may be shared by many rules and are evaluated at most once per query.
+ * Rewrite tables renumber addresses in the written answers, see kr_policy_renumber_apply().
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <libknot/dname.h>
+#include <libknot/packet/pkt.h>
+
+#include "lib/defines.h"
+#include "lib/generic/map.h"
+#include "lib/generic/array.h"
+#include "lib/generic/lpm.h"
+
+/** Maximum number of pattern items (single character classes). */
+#define KR_POLICY_PATTERN_MAX 63
+/** Maximum number of DFA states of compiled pattern. */
+#define KR_POLICY_DFA_MAX 256
+
+/** Type of the rule matcher. */
+enum kr_policy_type {
+	KR_POLICY_ALL = 0, /**< Match all queries */
+	KR_POLICY_SUFFIX,  /**< QNAME is equal to or below any of the names */
+	KR_POLICY_PATTERN, /**< QNAME matches the pattern */
+	KR_POLICY_RPZ,     /**< QNAME matches the RPZ trigger or its wildcard */
+	KR_POLICY_EXTERN,  /**< Rule is evaluated by the caller */
+	KR_POLICY_FILTER   /**< Query matches the filter program */
+};
+
+/** Compiled RPZ index file magic and version. */
+#define KR_POLICY_RPZ_MAGIC "KRPZ"
+#define KR_POLICY_RPZ_VERSION 1
+
+/**
+ * Compiled RPZ index file header.
+ * The header is followed by the index of entry offsets sorted by entry key, and the entries.
+ * Each entry is an action code (1B), key length (1B) and the key,
+ * the key is the name with labels in reverse order, each label is followed by a zero byte.
+ * Values are in host byte order, the file is not portable between architectures.
+ */
+struct kr_policy_rpz_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t count; /**< Number of entries */
+	uint32_t size;  /**< Size of the entries */
+};
+
+struct kr_policy_dfa;
+struct kr_policy_index;
+struct kr_policy_insn;
+
+/** Query attributes matched by the rules. */
+struct kr_policy_query {
+	const knot_dname_t *qname;  /**< Query name (lowercase) */
+	const struct sockaddr *src; /**< Client address (optional) */
+	const struct sockaddr *dst; /**< Destination address (optional) */
+	uint16_t qtype;
+	uint64_t stamp; /**< Evaluation stamp, must change for each evaluated query */
+};
+
+/** Compiled policy rule. */
+struct kr_policy_rule {
+	int type;       /**< Matcher type, see enum kr_policy_type */
+	int action;     /**< Action code for the names without own code */
+	size_t count;   /**< Number of matches */
+	bool suspended; /**< Suspended rule is skipped */
+	size_t entries; /**< Number of names (approximate with removed names) */
+	size_t mapped;  /**< Size of the mapped index */
+	uint8_t *common;   /**< Common suffix of the names (checked first) */
+	size_t common_len;
+	map_t names;       /**< Name set, values are action codes */
+	map_t wildcards;   /**< Wildcard RPZ triggers without the asterisk label */
+	struct kr_policy_dfa *dfa; /**< Compiled pattern */
+	struct kr_policy_index *index; /**< Memory-mapped RPZ index */
+	struct {
+		uint64_t ino;
+		uint64_t mtime;
+		uint64_t size;
+	} file; /**< Watched file stamp */
+	array_t(struct kr_policy_insn) prog; /**< Filter program */
+};
+
+/** Ordered list of rules, the set doesn't own the rules. */
+typedef array_t(struct kr_policy_rule *) kr_policy_set_t;
+
+/**
+ * Create new rule.
+ * @param type   matcher type
+ * @param action action code returned on match (must be positive)
+ * @return rule or NULL
+ */
+KR_EXPORT
+struct kr_policy_rule *kr_policy_rule_new(int type, int action);
+
+/** Free rule and its compiled matcher. */
+KR_EXPORT
+void kr_policy_rule_free(struct kr_policy_rule *rule);
+
+/**
+ * Add name to the suffix or RPZ rule.
+ * The name is in wire format, the terminal label may be omitted.
+ * RPZ wildcard triggers (e.g. "\1*\7example") match only names below the trigger.
+ * @param rule   suffix or RPZ rule
+ * @param name   wire name
+ * @param len    name length
+ * @param action action code for this name, 0 for the rule action
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_add(struct kr_policy_rule *rule, const char *name, size_t len, int action);
+
+/**
+ * Remove name from the suffix or RPZ rule.
+ * Names in the mapped RPZ index are masked, so the deltas can be applied without rebuilding the index.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_del(struct kr_policy_rule *rule, const char *name, size_t len);
+
+/**
+ * Set common suffix of the names in suffix rule.
+ * The QNAME is looked up only if it ends with the common suffix.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_common(struct kr_policy_rule *rule, const char *suffix, size_t len);
+
+/**
+ * Compile Lua pattern into DFA.
+ * Supported are single character classes with quantifiers and anchors,
+ * captures are ignored as they don't change the match.
+ * @return 0, kr_error(ENOTSUP) if the pattern uses unsupported features
+ *         (back references, %b, %f) or the automaton is too large, or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_pattern(struct kr_policy_rule *rule, const char *pattern, size_t len);
+
+/**
+ * Map compiled RPZ index into the rule.
+ * The file is mapped read-only and shared, so the pages are shared by all processes mapping it.
+ * Names added to the rule are matched together with the index.
+ * @return 0, kr_error(EILSEQ) if the file is not a compiled index, or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_load(struct kr_policy_rule *rule, const char *path);
+
+/**
+ * Write names of the RPZ rule into compiled index.
+ * The file is written under temporary name and renamed, so it can replace an index mapped by others.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_save(const struct kr_policy_rule *rule, const char *path);
+
+/**
+ * Swap compiled matchers of the rules, the match counters and suspension are kept.
+ * The new matcher can be built while the old one is in use, and freed with the other rule after the swap.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_swap(struct kr_policy_rule *rule, struct kr_policy_rule *next);
+
+/**
+ * Check if the file changed since the last check (inode, modification time or size).
+ * @return 1 if changed (or first check), 0 if not, or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_changed(struct kr_policy_rule *rule, const char *path);
+
+/**
+ * Match QNAME against rule, the match counter is not updated.
+ * Filter rules need the whole query, see kr_policy_rule_eval().
+ * @return action code or 0 if not matched
+ */
+KR_EXPORT
+int kr_policy_rule_match(const struct kr_policy_rule *rule, const knot_dname_t *qname);
+
+/**
+ * Match query against rule, the match counter is not updated.
+ * @return action code or 0 if not matched
+ */
+KR_EXPORT
+int kr_policy_rule_eval(const struct kr_policy_rule *rule, const struct kr_policy_query *query);
+
+/** Append rule to the set. */
+KR_EXPORT
+int kr_policy_set_push(kr_policy_set_t *set, struct kr_policy_rule *rule);
+
+/** Remove all rules from the set and free it. */
+KR_EXPORT
+void kr_policy_set_clear(kr_policy_set_t *set);
+
+/**
+ * Find first matching rule in the set, starting at given position.
+ * Suspended rules are skipped, matched rule counter is incremented.
+ * External rules are returned with action code 0 and the caller is responsible for their evaluation.
+ * @param set    rule set
+ * @param from   position of the first rule to evaluate
+ * @param query  query attributes
+ * @param action action code of the matched rule
+ * @return position of the matched rule or -1 if none matched
+ */
+KR_EXPORT
+int kr_policy_eval(kr_policy_set_t *set, size_t from, const struct kr_policy_query *query, int *action);
+
+/** Set of IPv4 and IPv6 subnets with values, matched by the longest prefix. */
+struct kr_policy_net {
+	lpm_t v4;
+	lpm_t v6;
+};
+
+/** Create new empty address set. */
+KR_EXPORT
+struct kr_policy_net *kr_policy_net_new(void);
+
+/** Free address set. */
+KR_EXPORT
+void kr_policy_net_free(struct kr_policy_net *net);
+
+/**
+ * Add subnet to the set, or replace its value.
+ * @param net    address set
+ * @param subnet address with optional prefix length, i.e. "10.0.0.0/8" or "2001:db8::/32"
+ * @param value  value returned on match (must be positive)
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_net_add(struct kr_policy_net *net, const char *subnet, int value);
+
+/**
+ * Remove subnet from the set.
+ * @return 0, kr_error(ENOENT) if not in the set, or an error code
+ */
+KR_EXPORT
+int kr_policy_net_del(struct kr_policy_net *net, const char *subnet);
+
+/**
+ * Add subnets from file, one subnet per line, '#' starts a comment.
+ * @return number of added subnets or an error code
+ */
+KR_EXPORT
+int kr_policy_net_load(struct kr_policy_net *net, const char *path, int value);
+
+/**
+ * Match address against the set.
+ * @return value of the longest subnet containing the address, or 0 if none
+ */
+KR_EXPORT
+int kr_policy_net_match(const struct kr_policy_net *net, const struct sockaddr *addr);
+
+/** Type of the filter predicate. */
+enum kr_policy_pred_type {
+	KR_POLICY_PRED_QNAME = 0, /**< QNAME matches the rule */
+	KR_POLICY_PRED_QTYPE,     /**< QTYPE is equal */
+	KR_POLICY_PRED_SRC,       /**< Client address is in the set */
+	KR_POLICY_PRED_DST        /**< Destination address is in the set */
+};
+
+/** Filter predicate, the result is cached for the query stamp. */
+struct kr_policy_pred {
+	int type;      /**< Predicate type, see enum kr_policy_pred_type */
+	size_t count;  /**< Number of evaluations (cache misses) */
+	uint16_t qtype;
+	const struct kr_policy_rule *rule;
+	const struct kr_policy_net *net;
+	uint64_t stamp;
+	bool result;
+};
+
+/** Filter program instructions, the program has a single boolean register. */
+enum kr_policy_op {
+	KR_POLICY_OP_TEST = 0, /**< Set register to the predicate result */
+	KR_POLICY_OP_AND,      /**< Skip following instructions if the register is false */
+	KR_POLICY_OP_OR,       /**< Skip following instructions if the register is true */
+	KR_POLICY_OP_NOT       /**< Negate register */
+};
+
+/** Filter program instruction. */
+struct kr_policy_insn {
+	uint8_t op;
+	uint16_t skip; /**< Number of instructions skipped by AND/OR */
+	struct kr_policy_pred *pred;
+};
+
+/**
+ * Create new filter predicate.
+ * The predicate doesn't own the matched rule or address set, they must outlive it.
+ * @param type  predicate type
+ * @param match rule for QNAME, address set for SRC and DST, unused for QTYPE
+ * @param qtype matched QTYPE
+ * @return predicate or NULL
+ */
+KR_EXPORT
+struct kr_policy_pred *kr_policy_pred_new(int type, const void *match, uint16_t qtype);
+
+/** Free filter predicate. */
+KR_EXPORT
+void kr_policy_pred_free(struct kr_policy_pred *pred);
+
+/**
+ * Append instruction to the filter rule program.
+ * Rule with empty program matches all queries, the predicates must outlive the rule.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_rule_insn(struct kr_policy_rule *rule, int op, unsigned skip, struct kr_policy_pred *pred);
+
+/** Table of address rewrites, addresses are matched by the record owner or by the longest prefix. */
+struct kr_policy_renumber {
+	lpm_t v4;
+	lpm_t v6;
+	map_t names;
+};
+
+/** Create new empty rewrite table. */
+KR_EXPORT
+struct kr_policy_renumber *kr_policy_renumber_new(void);
+
+/** Free rewrite table. */
+KR_EXPORT
+void kr_policy_renumber_free(struct kr_policy_renumber *tbl);
+
+/**
+ * Rewrite addresses in the subnet, the prefix is replaced by the target prefix.
+ * @param tbl    rewrite table
+ * @param subnet renumbered subnet, i.e. "10.10.10.0/24"
+ * @param target target address of the same family, i.e. "192.168.1.0"
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_renumber_add(struct kr_policy_renumber *tbl, const char *subnet, const char *target);
+
+/**
+ * Rewrite addresses of the records owned by the name, the whole address is replaced.
+ * Name rules take precedence over the subnet rules.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_policy_renumber_name(struct kr_policy_renumber *tbl, const knot_dname_t *name, const char *target);
+
+/**
+ * Rewrite A/AAAA records in the answer section of the written packet.
+ * Addresses are rewritten in place both in the records and the packet wire.
+ * If any address is rewritten, signatures are stripped as they can't be valid anymore.
+ * @return number of rewritten addresses or an error code
+ */
+KR_EXPORT
+int kr_policy_renumber_apply(const struct kr_policy_renumber *tbl, knot_pkt_t *pkt);
@@ -190,6 +190,52 @@ static int ns_fetch_cut(struct kr_query *qry, struct kr_request *req, knot_pkt_t
 	return ret;
 }
 
+/** @internal Announce query that the plan will need later, so the driver can start it now. */
+static void sidequery_add(struct kr_request *req, struct kr_query *qry, const knot_dname_t *name, uint16_t type)
+{
+	kr_sidequeries_t *queries = &req->sidequeries;
+	if (queries->len >= KR_SIDEQUERY_MAX || !name) {
+		return;
+	}
+	/* Do not announce queries that are already in the plan. */
+	if (kr_rplan_satisfies(qry, name, KNOT_CLASS_IN, type)) {
+		return;
+	}
+	for (size_t i = 0; i < queries->len; ++i) {
+		if (queries->at[i].qtype == type && knot_dname_is_equal(queries->at[i].qname, name)) {
+			return;
+		}
+	}
+	knot_dname_t *qname = knot_dname_copy(name, &req->pool);
+	if (!qname || array_reserve_mm(*queries, queries->len + 1, kr_memreserve, &req->pool) != 0) {
+		return;
+	}
+	struct kr_sidequery side = {
+		.qname = qname,
+		.qtype = type,
+		.options = qry->flags & QUERY_DNSSEC_WANT,
+	};
+	array_push(*queries, side);
+}
+
+/** @internal Baton for announcing address queries of unresolved nameservers. */
+struct sidequery_ns {
+	struct kr_request *req;
+	struct kr_query *qry;
+	uint16_t type;
+};
+
+static int sidequery_ns(const char *k, void *v, void *baton)
+{
+	struct sidequery_ns *ctx = baton;
+	const knot_dname_t *ns_name = (const knot_dname_t *)k;
+	const pack_t *addrs = v;
+	if (addrs->len == 0 && !knot_dname_is_equal(ns_name, ctx->qry->ns.name)) {
+		sidequery_add(ctx->req, ctx->qry, ns_name, ctx->type);
+	}
+	return ctx->req->sidequeries.len >= KR_SIDEQUERY_MAX;
+}
+
 static int ns_resolve_addr(struct kr_query *qry, struct kr_request *param)
 {
 	struct kr_rplan *rplan = &param->rplan;
@@ -244,6 +290,13 @@ static int ns_resolve_addr(struct kr_query *qry, struct kr_request *param)
 		}
 	} else {
 		next->flags |= QUERY_AWAIT_CUT;
+		/* Addresses of the other family and of the other nameservers are independent,
+		 * announce them so they're resolved concurrently with this one. */
+		if (!(qry->flags & (QUERY_AWAIT_IPV4|QUERY_NO_IPV4))) {
+			sidequery_add(param, qry, qry->ns.name, KNOT_RRTYPE_A);
+		}
+		struct sidequery_ns baton = { param, qry, next_type };
+		map_walk(&qry->zone_cut.nsset, sidequery_ns, &baton);
 	}
 	return ret;
 }
@@ -372,6 +425,8 @@ int kr_resolve_begin(struct kr_request *request, struct kr_context *ctx, knot_pk
 	request->current_query = NULL;
 	array_init(request->authority);
 	array_init(request->additional);
+	array_init(request->sigjobs);
+	array_init(request->sidequeries);
 
 	/* Expect first query */
 	kr_rplan_init(&request->rplan, request, &request->pool);
@@ -435,11 +490,20 @@ int kr_resolve_consume(struct kr_request *request, const struct sockaddr *src, k
 	/* Different processing for network error */
 	struct kr_query *qry = array_tail(rplan->pending);
 	bool tried_tcp = (qry->flags & QUERY_TCP);
+	struct kr_nsrep_group *group = qry->ns.group;
+	/* Attribute the answer to the NS it came from, it may be a raced one. */
+	if (src && !group && (qry->flags & QUERY_RACE)) {
+		kr_nsrep_answered(&qry->ns, src);
+	}
 	if (!packet || packet->size == 0) {
-		if (tried_tcp)
+		if (group && !tried_tcp) {
+			/* Forwarding, fail over to the next best upstream instead of TCP. */
+			group->stats.failover += 1;
+		} else if (tried_tcp) {
 			request->state = KNOT_STATE_FAIL;
-		else
+		} else {
 			qry->flags |= QUERY_TCP;
+		}
 	} else {
 		/* Packet cleared, derandomize QNAME. */
 		knot_dname_t *qname_raw = (knot_dname_t *)knot_pkt_qname(packet);
@@ -483,6 +547,12 @@ int kr_resolve_consume(struct kr_request *request, const struct sockaddr *src, k
 				qry->flags &= ~(QUERY_AWAIT_IPV6|QUERY_AWAIT_IPV4);
 			} else { /* Penalize SERVFAILs. */
 				kr_nsrep_update_rtt(&qry->ns, src, KR_NS_PENALTY, ctx->cache_rtt, KR_NS_ADD);
+				if (group) {
+					group->stats.servfail += 1;
+				}
+			}
+			if (group) {
+				group->stats.answered += 1;
 			}
 		/* Do not penalize validation timeouts. */
 		} else if (!(qry->flags & QUERY_DNSSEC_BOGUS)) {
@@ -494,6 +564,11 @@ int kr_resolve_consume(struct kr_request *request, const struct sockaddr *src, k
 			}
 		}
 	}
+	/* Learn servers that truncate every answer over UDP. */
+	if (src && !tried_tcp && packet && packet->size >= KNOT_WIRE_HEADER_SIZE &&
+	    !(qry->flags & (QUERY_CACHED|QUERY_STUB))) {
+		kr_nsrep_update_tc(&qry->ns, knot_wire_get_tc(packet->wire), ctx->cache_rep);
+	}
 	/* Resolution failed, invalidate current NS. */
 	if (request->state == KNOT_STATE_FAIL) {
 		invalidate_ns(rplan, qry);
@@ -513,8 +588,9 @@ int kr_resolve_consume(struct kr_request *request, const struct sockaddr *src, k
 
 	ITERATE_LAYERS(request, qry, reset);
 
-	/* Do not finish with bogus answer. */
+	/* Do not finish with bogus answer, nor reuse the delegation that led to it. */
 	if (qry->flags & QUERY_DNSSEC_BOGUS)  {
+		kr_zonecut_invalidate(ctx, qry->zone_cut.name);
 		return KNOT_STATE_FAIL;
 	}
 
@@ -579,6 +655,8 @@ static int trust_chain_check(struct kr_request *request, struct kr_query *qry)
 			return KNOT_STATE_FAIL;
 		}
 		next->flags |= QUERY_AWAIT_CUT|QUERY_DNSSEC_WANT;
+		/* DNSKEY of the cut is needed right after the DS, fetch it concurrently. */
+		sidequery_add(request, qry, qry->zone_cut.name, KNOT_RRTYPE_DNSKEY);
 		return KNOT_STATE_DONE;
 	}
 	/* Try to fetch missing DNSKEY (either missing or above current cut).
@@ -727,6 +805,8 @@ ns_election:
 
 	if (qry->flags & (QUERY_AWAIT_IPV4|QUERY_AWAIT_IPV6)) {
 		kr_nsrep_elect_addr(qry, request->ctx);
+	} else if (qry->ns.group) { /* Forwarding, elect best upstreams from the group. */
+		kr_nsrep_elect_group(qry, request->ctx);
 	} else if (!qry->ns.name || !(qry->flags & (QUERY_TCP|QUERY_STUB))) { /* Keep NS when requerying/stub. */
 		/* Root DNSKEY must be fetched from the hints to avoid chicken and egg problem. */
 		if (qry->sname[0] == '\0' && qry->stype == KNOT_RRTYPE_DNSKEY) {
@@ -776,6 +856,11 @@ ns_election:
 	}
 	}
 
+	/* Skip the UDP round trip to servers known to truncate. */
+	if (qry->ns.reputation & KR_NS_TCP) {
+		qry->flags |= QUERY_TCP;
+	}
+
 	gettimeofday(&qry->timestamp, NULL);
 	*dst = &qry->ns.addr[0].ip;
 	*type = (qry->flags & QUERY_TCP) ? SOCK_STREAM : SOCK_DGRAM;
@@ -26,6 +26,7 @@
 #include "lib/rplan.h"
 #include "lib/module.h"
 #include "lib/cache.h"
+#include "lib/dnssec.h"
 
 /**
  * @file resolve.h
@@ -73,6 +74,20 @@
 typedef array_t(struct kr_module *) module_array_t;
 /* @endcond */
 
+/**
+ * Query independent of the current resolution plan.
+ * The driver may resolve it concurrently, the result is then found in cache when the plan gets to it.
+ */
+struct kr_sidequery {
+	knot_dname_t *qname;
+	uint16_t qtype;
+	uint32_t options; /**< Query flags for the resolution. */
+};
+
+/** @cond internal Array of side queries. */
+typedef array_t(struct kr_sidequery) kr_sidequeries_t;
+/* @endcond */
+
 /**
  * Name resolution context.
  *
@@ -89,8 +104,10 @@ struct kr_context
 	map_t negative_anchors;
 	struct kr_zonecut root_hints;
 	struct kr_cache cache;
-	kr_nsrep_lru_t *cache_rtt;
+	kr_nsrep_rtt_lru_t *cache_rtt;
 	kr_nsrep_lru_t *cache_rep;
+	kr_zonecut_lru_t *cache_cut;
+	map_t forwarders;
 	module_array_t *modules;
 	knot_mm_t *pool;
 };
@@ -124,6 +141,8 @@ struct kr_request {
     rr_array_t authority;
     rr_array_t additional;
     struct kr_rplan rplan;
+    kr_sigjobs_t sigjobs;              /**< Signature verifications the validator waits for. */
+    kr_sidequeries_t sidequeries;      /**< Queries that may be resolved concurrently, drained by driver. */
     knot_mm_t pool;
 };
 
@@ -46,7 +46,9 @@
 	X(ALWAYS_CUT,      1 << 18) /**< Always recover zone cut (even if cached). */ \
 	X(DNSSEC_WEXPAND,  1 << 19) /**< Query response has wildcard expansion. */ \
 	X(PERMISSIVE,      1 << 20) /**< Permissive resolver mode. */ \
-	X(STRICT,          1 << 21) /**< Strict resolver mode. */
+	X(STRICT,          1 << 21) /**< Strict resolver mode. */ \
+	X(DNSSEC_ASYNC,    1 << 22) /**< Signature verification may be offloaded (validator yields). */ \
+	X(RACE,            1 << 23) /**< Race addresses of different NS when the best is not known. */
 
 /** Query flags */
 enum kr_query_flag {
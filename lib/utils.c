@@ -299,7 +299,7 @@ int kr_straddr_subnet(void *dst, const char *addr)
 	}
 	/* Parse address */
 	int ret = inet_pton(family, addr_str, dst);
-	if (ret < 0) {
+	if (ret <= 0) {
 		return kr_error(EILSEQ);
 	}
 
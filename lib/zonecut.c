@@ -298,8 +298,21 @@ int kr_zonecut_set_sbelt(struct kr_context *ctx, struct kr_zonecut *cut)
 	return ret;
 }
 
+/** Lower the delegation lifetime to the shortest remaining TTL in the RR set. */
+static void bound_ttl(uint32_t * restrict ttl, const knot_rdataset_t *rrs)
+{
+	knot_rdata_t *rd = rrs->data;
+	for (uint16_t i = 0; i < rrs->rr_count; ++i) {
+		if (knot_rdata_ttl(rd) < *ttl) {
+			*ttl = knot_rdata_ttl(rd);
+		}
+		rd = kr_rdataset_next(rd);
+	}
+}
+
 /** Fetch address for zone cut. */
-static void fetch_addr(struct kr_zonecut *cut, struct kr_cache *cache, const knot_dname_t *ns, uint16_t rrtype, uint32_t timestamp)
+static void fetch_addr(struct kr_zonecut *cut, struct kr_cache *cache, const knot_dname_t *ns, uint16_t rrtype,
+                       uint32_t timestamp, uint32_t * restrict ttl)
 {
 	uint8_t rank = 0;
 	knot_rrset_t cached_rr;
@@ -312,13 +325,34 @@ static void fetch_addr(struct kr_zonecut *cut, struct kr_cache *cache, const kno
 	for (uint16_t i = 0; i < cached_rr.rrs.rr_count; ++i) {
 		if (knot_rdata_ttl(rd) > timestamp) {
 			(void) kr_zonecut_add(cut, ns, rd);
+			if (knot_rdata_ttl(rd) - timestamp < *ttl) {
+				*ttl = knot_rdata_ttl(rd) - timestamp;
+			}
 		}
 		rd = kr_rdataset_next(rd);
 	}
 }
 
-/** Fetch best NS for zone cut. */
-static int fetch_ns(struct kr_context *ctx, struct kr_zonecut *cut, const knot_dname_t *name, uint32_t timestamp, uint8_t * restrict rank)
+/** Return address families of the NS that are not to be used, by resolver options and NS reputation. */
+static unsigned ns_noip(struct kr_context *ctx, const knot_dname_t *ns_name)
+{
+	struct kr_nsrep_rep *cached = NULL;
+	if (ctx->cache_rep) {
+		cached = lru_get(ctx->cache_rep, (const char *)ns_name, knot_dname_size(ns_name));
+	}
+	unsigned noip = (cached) ? cached->flags & (KR_NS_NOIP4|KR_NS_NOIP6) : 0;
+	if (ctx->options & QUERY_NO_IPV4) {
+		noip |= KR_NS_NOIP4;
+	}
+	if (ctx->options & QUERY_NO_IPV6) {
+		noip |= KR_NS_NOIP6;
+	}
+	return noip;
+}
+
+/** Fetch best NS for zone cut, all addresses are fetched if 'all_addr' is set. */
+static int fetch_ns(struct kr_context *ctx, struct kr_zonecut *cut, const knot_dname_t *name, uint32_t timestamp,
+                    bool all_addr, uint8_t * restrict rank, uint32_t * restrict ttl)
 {
 	uint32_t drift = timestamp;
 	knot_rrset_t cached_rr;
@@ -334,6 +368,7 @@ static int fetch_ns(struct kr_context *ctx, struct kr_zonecut *cut, const knot_d
 	if (ret != 0) {
 		return ret;
 	}
+	bound_ttl(ttl, &rr_copy.rrs);
 
 	/* Insert name servers for this zone cut, addresses will be looked up
 	 * on-demand (either from cache or iteratively) */
@@ -341,13 +376,12 @@ static int fetch_ns(struct kr_context *ctx, struct kr_zonecut *cut, const knot_d
 		const knot_dname_t *ns_name = knot_ns_name(&rr_copy.rrs, i);
 		kr_zonecut_add(cut, ns_name, NULL);
 		/* Fetch NS reputation and decide whether to prefetch A/AAAA records. */
-		unsigned *cached = lru_get(ctx->cache_rep, (const char *)ns_name, knot_dname_size(ns_name));
-		unsigned reputation = (cached) ? *cached : 0;
-		if (!(reputation & KR_NS_NOIP4) && !(ctx->options & QUERY_NO_IPV4)) {
-			fetch_addr(cut, &ctx->cache, ns_name, KNOT_RRTYPE_A, timestamp);
+		const unsigned noip = all_addr ? 0 : ns_noip(ctx, ns_name);
+		if (!(noip & KR_NS_NOIP4)) {
+			fetch_addr(cut, &ctx->cache, ns_name, KNOT_RRTYPE_A, timestamp, ttl);
 		}
-		if (!(reputation & KR_NS_NOIP6) && !(ctx->options & QUERY_NO_IPV6)) {
-			fetch_addr(cut,  &ctx->cache, ns_name, KNOT_RRTYPE_AAAA, timestamp);
+		if (!(noip & KR_NS_NOIP6)) {
+			fetch_addr(cut,  &ctx->cache, ns_name, KNOT_RRTYPE_AAAA, timestamp, ttl);
 		}
 	}
 
@@ -359,7 +393,8 @@ static int fetch_ns(struct kr_context *ctx, struct kr_zonecut *cut, const knot_d
  * Fetch RRSet of given type.
  */
 static int fetch_rrset(knot_rrset_t **rr, struct kr_cache *cache,
-                       const knot_dname_t *owner, uint16_t type, knot_mm_t *pool, uint32_t timestamp)
+                       const knot_dname_t *owner, uint16_t type, knot_mm_t *pool, uint32_t timestamp,
+                       uint32_t * restrict ttl)
 {
 	if (!rr) {
 		return kr_error(ENOENT);
@@ -386,6 +421,7 @@ static int fetch_rrset(knot_rrset_t **rr, struct kr_cache *cache,
 		return ret;
 	}
 
+	bound_ttl(ttl, &(*rr)->rrs);
 	return kr_ok();
 }
 
@@ -393,15 +429,211 @@ static int fetch_rrset(knot_rrset_t **rr, struct kr_cache *cache,
  * Fetch trust anchors for zone cut.
  * @note The trust anchor can theoretically be a DNSKEY but for now lets use only DS.
  */
-static int fetch_ta(struct kr_zonecut *cut, struct kr_cache *cache, const knot_dname_t *name, uint32_t timestamp)
+static int fetch_ta(struct kr_zonecut *cut, struct kr_cache *cache, const knot_dname_t *name, uint32_t timestamp,
+                    uint32_t * restrict ttl)
 {
-	return fetch_rrset(&cut->trust_anchor, cache, name, KNOT_RRTYPE_DS, cut->pool, timestamp);
+	return fetch_rrset(&cut->trust_anchor, cache, name, KNOT_RRTYPE_DS, cut->pool, timestamp, ttl);
 }
 
 /** Fetch DNSKEY for zone cut. */
-static int fetch_dnskey(struct kr_zonecut *cut, struct kr_cache *cache, const knot_dname_t *name, uint32_t timestamp)
+static int fetch_dnskey(struct kr_zonecut *cut, struct kr_cache *cache, const knot_dname_t *name, uint32_t timestamp,
+                        uint32_t * restrict ttl)
+{
+	return fetch_rrset(&cut->key, cache, name, KNOT_RRTYPE_DNSKEY, cut->pool, timestamp, ttl);
+}
+
+/** Fetch NS (and DS/DNSKEY if wanted) for given zone cut name. */
+static int fetch_delegation(struct kr_context *ctx, struct kr_zonecut *cut, const knot_dname_t *name,
+                            uint32_t timestamp, bool want_trust, bool all_addr,
+                            uint8_t * restrict rank, uint32_t * restrict ttl)
+{
+	int ret = fetch_ns(ctx, cut, name, timestamp, all_addr, rank, ttl);
+	if (ret != 0) {
+		return ret;
+	}
+	/* Provably insecure delegations don't need DS/DNSKEY (except root) */
+	const bool is_root = (name[0] == '\0');
+	if (want_trust && (is_root || !(*rank & KR_RANK_INSECURE))) {
+		fetch_ta(cut, &ctx->cache, name, timestamp, ttl);
+		fetch_dnskey(cut, &ctx->cache, name, timestamp, ttl);
+	}
+	return kr_ok();
+}
+
+/** Replace RR set with a copy if the source exists, TTLs of the copy are lowered by its age. */
+static int copy_rrset(knot_rrset_t **dst, const knot_rrset_t *src, uint32_t age, knot_mm_t *pool)
+{
+	if (!src) {
+		return kr_ok();
+	}
+	knot_rrset_t *copy = knot_rrset_copy(src, pool);
+	if (!copy) {
+		return kr_error(ENOMEM);
+	}
+	knot_rdata_t *rd = copy->rrs.data;
+	for (uint16_t i = 0; i < copy->rrs.rr_count; ++i) {
+		const uint32_t ttl = knot_rdata_ttl(rd);
+		knot_rdata_set_ttl(rd, (ttl > age) ? ttl - age : 0);
+		rd = kr_rdataset_next(rd);
+	}
+	knot_rrset_free(dst, pool);
+	*dst = copy;
+	return kr_ok();
+}
+
+struct copy_baton {
+	struct kr_context *ctx;
+	struct kr_zonecut *dst;
+};
+
+/** Copy NS with its addresses, except the address families it's not to be contacted over. */
+static int copy_usable_addr(const char *k, void *v, void *baton)
+{
+	struct copy_baton *copy = baton;
+	const knot_dname_t *ns_name = (const knot_dname_t *)k;
+	int ret = kr_zonecut_add(copy->dst, ns_name, NULL);
+	if (ret != 0) {
+		return ret;
+	}
+	const unsigned noip = ns_noip(copy->ctx, ns_name);
+	pack_t *addr_set = v;
+	uint8_t *addr = pack_head(*addr_set);
+	while (addr != pack_tail(*addr_set)) {
+		const size_t len = pack_obj_len(addr);
+		const bool usable = (len == sizeof(struct in_addr)) ? !(noip & KR_NS_NOIP4) : !(noip & KR_NS_NOIP6);
+		if (usable) {
+			knot_rdata_t rdata[sizeof(struct in6_addr) + sizeof(uint64_t)];
+			knot_rdata_init(rdata, len, pack_obj_val(addr), 0);
+			ret = kr_zonecut_add(copy->dst, ns_name, rdata);
+			if (ret != 0) {
+				return ret;
+			}
+		}
+		addr = pack_obj_next(addr);
+	}
+	return kr_ok();
+}
+
+/** Copy materialized delegation into zone cut, the addresses are filtered as if fetched now. */
+static int copy_delegation(struct kr_context *ctx, struct kr_zonecut *dst, const struct kr_zonecut *src,
+                           uint32_t age, bool want_trust)
+{
+	struct copy_baton copy = { .ctx = ctx, .dst = dst };
+	int ret = map_walk((map_t *)&src->nsset, copy_usable_addr, &copy);
+	if (ret == 0 && want_trust) {
+		ret = copy_rrset(&dst->trust_anchor, src->trust_anchor, age, dst->pool);
+		if (ret == 0) {
+			ret = copy_rrset(&dst->key, src->key, age, dst->pool);
+		}
+	}
+	return ret;
+}
+
+static int has_no_addr(const char *k, void *v, void *baton)
+{
+	pack_t *addr_set = v;
+	return addr_set->len == 0;
+}
+
+/**
+ * Check if the delegation is worth remembering, i.e. it doesn't need any more data
+ * that would be fetched into cache only later on (missing NS addresses or DS/DNSKEY).
+ */
+static bool delegation_complete(const struct kr_zonecut *cut, uint8_t rank, bool want_trust)
+{
+	if (map_walk((map_t *)&cut->nsset, has_no_addr, NULL) != 0) {
+		return false;
+	}
+	if (want_trust && !(rank & KR_RANK_INSECURE)) {
+		const bool is_root = (cut->name[0] == '\0');
+		if (!cut->key || (!cut->trust_anchor && !is_root)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Delegation cache key is zone cut name followed by the trust flag.
+ *  The entry holds addresses of all families, copy_delegation() leaves out the unusable ones. */
+static size_t delegation_key(uint8_t *buf, const knot_dname_t *name, bool want_trust)
+{
+	size_t len = knot_dname_size(name);
+	memcpy(buf, name, len);
+	buf[len] = want_trust ? 'S' : 'I';
+	return len + 1;
+}
+
+void kr_zonecut_lru_evict(void *baton, void *data)
 {
-	return fetch_rrset(&cut->key, cache, name, KNOT_RRTYPE_DNSKEY, cut->pool, timestamp);
+	struct kr_zonecut_entry **slot = data;
+	if (*slot) {
+		kr_zonecut_deinit(&(*slot)->cut);
+		free(*slot);
+		*slot = NULL;
+	}
+}
+
+void kr_zonecut_invalidate(struct kr_context *ctx, const knot_dname_t *name)
+{
+	if (!ctx || !ctx->cache_cut || !name) {
+		return;
+	}
+	/* Drop both the secure and the insecure variant. */
+	uint8_t key[KNOT_DNAME_MAXLEN + 1];
+	for (unsigned i = 0; i < 2; ++i) {
+		size_t key_len = delegation_key(key, name, i == 0);
+		struct kr_zonecut_entry **slot = lru_get(ctx->cache_cut, (const char *)key, key_len);
+		if (slot) {
+			kr_zonecut_lru_evict(NULL, slot);
+		}
+	}
+}
+
+/** Find delegation for given name, either from the delegation cache or from the record cache. */
+static int find_delegation(struct kr_context *ctx, struct kr_zonecut *cut, const knot_dname_t *name,
+                           uint32_t timestamp, bool want_trust, uint8_t * restrict rank)
+{
+	uint32_t ttl = KR_CUT_TTL_MAX;
+	if (!ctx->cache_cut) {
+		return fetch_delegation(ctx, cut, name, timestamp, want_trust, false, rank, &ttl);
+	}
+
+	/* Reuse materialized delegation if it's still valid. */
+	uint8_t key[KNOT_DNAME_MAXLEN + 1];
+	size_t key_len = delegation_key(key, name, want_trust);
+	struct kr_zonecut_entry **slot = lru_get(ctx->cache_cut, (const char *)key, key_len);
+	if (slot && *slot && (*slot)->expire > timestamp) {
+		*rank = (*slot)->rank;
+		return copy_delegation(ctx, cut, &(*slot)->cut, timestamp - (*slot)->stamp, want_trust);
+	}
+
+	/* Materialize delegation on heap and copy it to the zone cut. */
+	struct kr_zonecut_entry entry;
+	int ret = kr_zonecut_init(&entry.cut, name, NULL);
+	if (ret != 0) {
+		return ret;
+	}
+	ret = fetch_delegation(ctx, &entry.cut, name, timestamp, want_trust, true, rank, &ttl);
+	if (ret == 0) {
+		ret = copy_delegation(ctx, cut, &entry.cut, 0, want_trust);
+	}
+	/* Remember complete delegations. */
+	if (ret == 0 && ttl > 0 && delegation_complete(&entry.cut, *rank, want_trust)) {
+		entry.stamp = timestamp;
+		entry.expire = timestamp + ttl;
+		entry.rank = *rank;
+		slot = lru_set(ctx->cache_cut, (const char *)key, key_len);
+		if (slot) {
+			kr_zonecut_lru_evict(NULL, slot);
+			*slot = malloc(sizeof(entry));
+			if (*slot) {
+				memcpy(*slot, &entry, sizeof(entry));
+				return ret;
+			}
+		}
+	}
+	kr_zonecut_deinit(&entry.cut);
+	return ret;
 }
 
 int kr_zonecut_find_cached(struct kr_context *ctx, struct kr_zonecut *cut, const knot_dname_t *name,
@@ -418,18 +650,13 @@ int kr_zonecut_find_cached(struct kr_context *ctx, struct kr_zonecut *cut, const
 	/* Start at QNAME parent. */
 	const knot_dname_t *label = qname;
 	while (true) {
-		/* Fetch NS first and see if it's insecure. */
+		/* Fetch NS first and see if it's insecure, fetch DS if caller wants secure zone cut. */
 		uint8_t rank = 0;
 		const bool is_root = (label[0] == '\0');
-		if (fetch_ns(ctx, cut, label, timestamp, &rank) == 0) {
+		if (find_delegation(ctx, cut, label, timestamp, *secured || is_root, &rank) == 0) {
 			/* Flag as insecure if cached as this */
 			if (rank & KR_RANK_INSECURE)
 				*secured = false;
-			/* Fetch DS if caller wants secure zone cut */
-			if (*secured || is_root) {
-				fetch_ta(cut, &ctx->cache, label, timestamp);
-				fetch_dnskey(cut, &ctx->cache, label, timestamp);
-			}
 			update_cut_name(cut, label);
 			mm_free(cut->pool, qname);
 			return kr_ok();
@@ -18,6 +18,7 @@
 
 #include "lib/generic/map.h"
 #include "lib/generic/pack.h"
+#include "lib/generic/lru.h"
 #include "lib/defines.h"
 #include "lib/cache.h"
 
@@ -36,6 +37,20 @@ struct kr_zonecut {
 	knot_mm_t *pool;     /**< Memory pool. */
 };
 
+/**
+ * Materialized delegation (NS names with addresses, DS and DNSKEY).
+ * @note The entries are read-only, resolver copies them into the query zone cut.
+ */
+struct kr_zonecut_entry {
+	struct kr_zonecut cut; /**< Zone cut allocated on heap. */
+	uint32_t stamp;        /**< Time of insertion, the record TTLs are relative to it. */
+	uint32_t expire;       /**< Absolute expiration time. */
+	uint8_t rank;          /**< Rank of the cached NS record. */
+};
+
+/** Delegation cache, keyed by the zone cut name and trust flag. */
+typedef lru_hash(struct kr_zonecut_entry *) kr_zonecut_lru_t;
+
 /**
  * Populate root zone cut with SBELT.
  * @param cut zone cut
@@ -127,9 +142,32 @@ pack_t *kr_zonecut_find(struct kr_zonecut *cut, const knot_dname_t *ns);
 KR_EXPORT
 int kr_zonecut_set_sbelt(struct kr_context *ctx, struct kr_zonecut *cut);
 
+/**
+ * Delegation cache eviction callback, frees the materialized delegation.
+ * @note Set as the 'evict' callback of the kr_zonecut_lru_t after initialization.
+ * @param baton unused
+ * @param data  pointer to the delegation cache slot
+ */
+KR_EXPORT
+void kr_zonecut_lru_evict(void *baton, void *data);
+
+/**
+ * Drop materialized delegation for given zone cut name.
+ * @note Called when the zone keys change or the delegation leads to a bogus answer,
+ *       so the next lookup rebuilds it from the record cache.
+ * @param ctx  resolution context
+ * @param name zone cut name
+ */
+KR_EXPORT
+void kr_zonecut_invalidate(struct kr_context *ctx, const knot_dname_t *name);
+
 /**
  * Populate zone cut address set from cache.
  *
+ * @note If the delegation cache is present in resolution context, the materialized
+ *       delegation is reused until the shortest TTL of its records expires.
+ *       Its addresses are filtered by the resolver options and NS reputation on each use.
+ *
  * @param ctx       resolution context (to fetch data from LRU caches)
  * @param cut       zone cut to be populated
  * @param name      QNAME to start finding zone cut for
@@ -1,6 +1,7 @@
 -- Load dependent modules
 if not view then modules.load('view') end
 if not policy then modules.load('policy') end
+local kres = require('kres')
 
 -- Actions
 local actions = {
@@ -35,26 +36,42 @@ local actions = {
 	end,
 }
 
--- Filter rules per column
+-- Filter rules per column, each returns native predicate (or nil) and closure constructor
 local filters = {
 	-- Filter on QNAME (either pattern or suffix match)
 	qname = function (g)
 		local op, val = g(), todname(g())
-		if     op == '~' then return policy.pattern(true, val:sub(2)) -- Skip leading label length
-		elseif op == '=' then return policy.suffix(true, {val})
+		local m
+		if     op == '~' then m = policy.pattern(true, val:sub(2)) -- Skip leading label length
+		elseif op == '=' then m = policy.suffix(true, {val})
 		else error(string.format('invalid operator "%s" on qname', op)) end
+		return policy.predicate('qname'..op..val, 'qname', m), function () return m end
+	end,
+	-- Filter on QTYPE
+	qtype = function (g)
+		local op, val = g(), g()
+		if op ~= '=' then error('qtype supports only "=" operator') end
+		local ok, qtype = pcall(function () return kres.type[val:upper()] end)
+		if not ok or not qtype then error(string.format('invalid qtype "%s"', val)) end
+		return policy.predicate('qtype='..qtype, 'qtype', qtype), function ()
+			return function (req, qry) return qry.type == qtype end
+		end
 	end,
 	-- Filter on source address
 	src = function (g)
-		local op = g()
+		local op, subnet = g(), g()
 		if op ~= '=' then error('address supports only "=" operator') end
-		return view.rule_src(true, g())
+		local key = 'src='..subnet
+		return policy.predicate(key) or policy.predicate(key, 'src', view.subnet(subnet)),
+		       function () return view.rule_src(true, subnet) end
 	end,
 	-- Filter on destination address
 	dst = function (g)
-		local op = g()
+		local op, subnet = g(), g()
 		if op ~= '=' then error('address supports only "=" operator') end
-		return view.rule_dst(true, g())
+		local key = 'dst='..subnet
+		return policy.predicate(key) or policy.predicate(key, 'dst', view.subnet(subnet)),
+		       function () return view.rule_dst(true, subnet) end
 	end,
 }
 
@@ -62,7 +79,8 @@ local function parse_filter(tok, g, prev)
 	if not tok then error(string.format('expected filter after "%s"', prev)) end
 	local filter = filters[tok:lower()]
 	if not filter then error(string.format('invalid filter "%s"', tok)) end
-	return filter(g)
+	local pred, fn = filter(g)
+	return {pred=pred, fn=fn}
 end
 
 local function parse_rule(g)
@@ -71,27 +89,56 @@ local function parse_rule(g)
 	if not filters[tok:lower()] then
 		return tok, nil
 	end
-	local f = parse_filter(tok, g)
-	-- Compose filter functions on conjunctions
-	-- or terminate filter chain and return
+	-- Chain of filters and conjunctions, e.g. {f1, 'and', f2, 'or', f3}
+	local chain = {parse_filter(tok, g)}
 	tok = g()
 	while tok do
-		if tok:lower() == 'and' then
-			local fa, fb = f, parse_filter(g(), g, tok)
-			f = function (req, qry) return fa(req, qry) and fb(req, qry) end
-		elseif tok:lower() == 'or' then
-			local fa, fb = f, parse_filter(g(), g, tok)
-			f = function (req, qry) return fa(req, qry) or fb(req, qry) end
+		local conj = tok:lower()
+		if conj == 'and' or conj == 'or' then
+			table.insert(chain, conj)
+			table.insert(chain, parse_filter(g(), g, tok))
 		else
 			break
 		end
 		tok = g()
 	end
-	return tok, f
+	return tok, chain
+end
+
+-- Compose filter closures on conjunctions (for filters without native predicates)
+local function chain_closure(chain)
+	local f = chain[1].fn()
+	for i = 2, #chain, 2 do
+		local fa, fb = f, chain[i + 1].fn()
+		if chain[i] == 'and' then
+			f = function (req, qry) return fa(req, qry) and fb(req, qry) end
+		else
+			f = function (req, qry) return fa(req, qry) or fb(req, qry) end
+		end
+	end
+	return f
+end
+
+-- Compile filter chain into native filter program, or a closure
+local function chain_policy(chain, action)
+	local program = {}
+	for i, item in ipairs(chain or {}) do
+		if i % 2 == 0 then
+			program[i] = item
+		elseif item.pred then
+			program[i] = item.pred
+		else
+			local filter = chain_closure(chain)
+			return function (req, qry)
+				return filter(req, qry) and action
+			end
+		end
+	end
+	return policy.filter(action, program)
 end
 
 local function parse_query(g)
-	local ok, actid, filter = pcall(parse_rule, g)
+	local ok, actid, chain = pcall(parse_rule, g)
 	if not ok then return nil, actid end
 	actid = actid:lower()
 	if not actions[actid] then return nil, string.format('invalid action "%s"', actid) end
@@ -100,7 +147,7 @@ local function parse_query(g)
 	if type(action) == 'function' then
 		action = action(g)
 	end
-	return actid, action, filter 
+	return actid, action, chain
 end
 
 -- Compile a rule described by query language
@@ -143,19 +190,10 @@ function M.add(rule)
 	for _, r in ipairs(M.rules) do
 		if r.info == rule then return r end
 	end
-	local id, action, filter = compile(rule)
+	local id, action, chain = compile(rule)
 	if not id then error(action) end
 	-- Combine filter and action into policy
-	local p
-	if filter then
-		p = function (req, qry)
-			return filter(req, qry) and action
-		end
-	else
-		p = function (req, qry)
-			return action
-		end
-	end
+	local p = chain_policy(chain, action)
 	local desc = {info=rule, policy=p}
 	-- Enforce in policy module, special actions are postrules
 	if id == 'reroute' or id == 'rewrite' then
@@ -172,7 +210,7 @@ function M.del(id)
 	for i, r in ipairs(M.rules) do
 		if r.rule.id == id then
 			policy.del(id)
-			table.remove(M.rules, id)
+			table.remove(M.rules, i)
 			return true
 		end
 	end
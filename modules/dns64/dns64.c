@@ -0,0 +1,434 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file dns64.c
+ * @brief DNS64 AAAA-from-A record synthesis, see RFC 6147.
+ *
+ * The module observes AAAA NODATA answers of the final query, resolves
+ * the A records and synthesizes AAAA records from them using RFC 6052
+ * address embedding. Synthesized answers are cached, so repeated queries
+ * are answered without the A sub-query.
+ */
+
+#include <arpa/inet.h>
+#include <libknot/packet/pkt.h>
+#include <libknot/descriptor.h>
+#include <libknot/rrtype/soa.h>
+#include <ccan/json/json.h>
+#include <contrib/ucw/lib.h>
+
+#include "lib/policy.h"
+#include "lib/module.h"
+#include "lib/layer.h"
+#include "lib/resolve.h"
+#include "lib/generic/lru.h"
+
+/* Defaults */
+#define DEBUG_MSG(qry, fmt...) QRDEBUG(qry, "dns64",  fmt)
+#define MARK_DNS64 (1U << 31) /* Query flag of the A sub-query */
+#define DNS64_PREFIXES 8      /* Maximum number of prefixes */
+#define DNS64_ADDRS 16        /* Maximum number of cached A addresses per name */
+#ifndef DNS64_CACHE_SIZE
+ #define DNS64_CACHE_SIZE 4096 /* Size of the synthesized answer cache */
+#endif
+
+/** Cached A addresses of the name with AAAA NODATA answer. */
+struct dns64_entry {
+	uint32_t nodata; /**< Expiration of the AAAA NODATA answer */
+	uint32_t expire; /**< Expiration of the synthesized answer */
+	uint8_t count;   /**< Number of addresses, 0 if not resolved yet */
+	uint8_t addr[DNS64_ADDRS][4];
+};
+
+typedef lru_hash(struct dns64_entry) dns64_lru_t;
+
+/** Prefixes, excluded IPv4 subnets and the answer cache. */
+struct dns64_data {
+	uint8_t prefix[DNS64_PREFIXES][16];
+	uint8_t prefix_len[DNS64_PREFIXES];
+	unsigned count;
+	struct kr_policy_net *exclude;
+	dns64_lru_t *cache;
+};
+
+/** Embed IPv4 address into the prefix, see RFC 6052 section 2.2. */
+static void synth_addr(uint8_t *dst, const uint8_t *prefix, unsigned bits, const uint8_t *v4)
+{
+	unsigned pos = bits / 8;
+	memcpy(dst, prefix, pos);
+	memset(dst + pos, 0, 16 - pos);
+	for (unsigned i = 0; i < 4; ++i, ++pos) {
+		if (pos == 8) { /* Skip bits 64-71 */
+			++pos;
+		}
+		dst[pos] = v4[i];
+	}
+}
+
+static bool is_excluded(struct dns64_data *data, const uint8_t *v4)
+{
+	if (!data->exclude) {
+		return false;
+	}
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	memcpy(&sin.sin_addr, v4, sizeof(sin.sin_addr));
+	return kr_policy_net_match(data->exclude, (struct sockaddr *)&sin) > 0;
+}
+
+/** Append AAAA records synthesized from the A addresses to the RR set. */
+static int synth_rdata(struct dns64_data *data, knot_rrset_t *rr, const uint8_t *v4, uint32_t ttl, knot_mm_t *pool)
+{
+	uint8_t addr[16];
+	for (unsigned i = 0; i < data->count; ++i) {
+		synth_addr(addr, data->prefix[i], data->prefix_len[i], v4);
+		int ret = knot_rrset_add_rdata(rr, addr, sizeof(addr), ttl, pool);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return kr_ok();
+}
+
+/** Return negative TTL of the NODATA answer. */
+static uint32_t nodata_ttl(knot_pkt_t *pkt)
+{
+	const knot_pktsection_t *ns = knot_pkt_section(pkt, KNOT_AUTHORITY);
+	for (unsigned i = 0; i < ns->count; ++i) {
+		const knot_rrset_t *rr = knot_pkt_rr(ns, i);
+		if (rr->type == KNOT_RRTYPE_SOA) {
+			return MIN(knot_rrset_ttl(rr), knot_soa_minimum(&rr->rrs));
+		}
+	}
+	return 0;
+}
+
+static int begin(knot_layer_t *ctx, void *module_param)
+{
+	ctx->data = module_param;
+	return ctx->state;
+}
+
+/** Return cached addresses of the query name, or NULL if there are none or they expired. */
+static struct dns64_entry *cache_find(struct dns64_data *data, struct kr_query *qry)
+{
+	struct dns64_entry *entry = lru_get(data->cache, (const char *)qry->sname, knot_dname_size(qry->sname));
+	if (!entry || entry->count == 0 || entry->expire <= qry->timestamp.tv_sec) {
+		return NULL;
+	}
+	return entry;
+}
+
+/** Synthesize AAAA records of the query name from the cached addresses. */
+static int cache_synth(struct dns64_data *data, struct dns64_entry *entry, struct kr_query *qry,
+                       knot_rrset_t *rr, knot_mm_t *pool)
+{
+	knot_rrset_init(rr, knot_dname_copy(qry->sname, pool), KNOT_RRTYPE_AAAA, qry->sclass);
+	const uint32_t ttl = entry->expire - qry->timestamp.tv_sec;
+	for (unsigned i = 0; i < entry->count; ++i) {
+		int ret = synth_rdata(data, rr, entry->addr[i], ttl, pool);
+		if (ret != 0) {
+			knot_rrset_clear(rr, pool);
+			return ret;
+		}
+	}
+	return kr_ok();
+}
+
+/**
+ * Answer the final AAAA query from the cache of synthesized answers.
+ * This only applies when the packet cache didn't answer the query,
+ * a NODATA answer from the packet cache is synthesized in consume().
+ */
+static int query(knot_layer_t *ctx, knot_pkt_t *pkt)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_query *qry = req->current_query;
+	if (!qry || ctx->state & (KNOT_STATE_FAIL|KNOT_STATE_DONE)) {
+		return ctx->state;
+	}
+	struct kr_module *module = ctx->api->data;
+	struct dns64_data *data = module->data;
+	if (!data || data->count == 0 || qry->stype != KNOT_RRTYPE_AAAA || qry->parent || (qry->flags & MARK_DNS64)) {
+		return ctx->state;
+	}
+
+	struct dns64_entry *entry = cache_find(data, qry);
+	knot_rrset_t rr;
+	if (!entry || cache_synth(data, entry, qry, &rr, &pkt->mm) != 0) {
+		return ctx->state;
+	}
+	if (!knot_dname_is_equal(knot_pkt_qname(pkt), rr.owner)) {
+		kr_pkt_recycle(pkt);
+		knot_pkt_put_question(pkt, rr.owner, rr.rclass, rr.type);
+	}
+	if (knot_pkt_put(pkt, KNOT_COMPR_HINT_QNAME, &rr, KNOT_PF_FREE) != 0) {
+		knot_rrset_clear(&rr, &pkt->mm);
+		return ctx->state;
+	}
+
+	DEBUG_MSG(qry, "<= answered from synthesis cache\n");
+	qry->flags &= ~QUERY_DNSSEC_WANT; /* Never authenticated */
+	qry->flags |= QUERY_CACHED|QUERY_NO_MINIMIZE;
+	pkt->parsed = pkt->size;
+	knot_wire_set_qr(pkt->wire);
+	return KNOT_STATE_DONE;
+}
+
+/** Synthesize AAAA records from the A answer of the marked sub-query. */
+static void synth_answer(struct dns64_data *data, struct kr_request *req, struct kr_query *qry, knot_pkt_t *pkt)
+{
+	/* Cache only addresses of the name with observed NODATA */
+	uint32_t now = qry->timestamp.tv_sec;
+	struct dns64_entry *entry = lru_get(data->cache, (const char *)qry->sname, knot_dname_size(qry->sname));
+	if (entry && (entry->count > 0 || entry->nodata <= now)) {
+		entry = NULL;
+	}
+	const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+	for (unsigned i = 0; i < an->count; ++i) {
+		const knot_rrset_t *rr = knot_pkt_rr(an, i);
+		if (rr->type != KNOT_RRTYPE_A) {
+			continue;
+		}
+		bool cached = entry && knot_dname_is_equal(rr->owner, qry->sname);
+		knot_rrset_t synth;
+		knot_rrset_init(&synth, knot_dname_copy(rr->owner, &req->answer->mm), KNOT_RRTYPE_AAAA, rr->rclass);
+		for (uint16_t j = 0; j < rr->rrs.rr_count; ++j) {
+			const knot_rdata_t *rd = knot_rdataset_at(&rr->rrs, j);
+			const uint8_t *v4 = knot_rdata_data(rd);
+			if (knot_rdata_rdlen(rd) != 4 || is_excluded(data, v4)) {
+				continue;
+			}
+			uint32_t ttl = knot_rdata_ttl(rd);
+			synth_rdata(data, &synth, v4, ttl, &req->answer->mm);
+			if (cached && entry->count < DNS64_ADDRS) {
+				memcpy(entry->addr[entry->count++], v4, 4);
+				entry->expire = MIN(entry->expire, now + ttl);
+			}
+		}
+		if (knot_rrset_empty(&synth) || knot_pkt_put(req->answer, 0, &synth, KNOT_PF_FREE) != 0) {
+			knot_rrset_clear(&synth, &req->answer->mm);
+		}
+	}
+}
+
+static int consume(knot_layer_t *ctx, knot_pkt_t *pkt)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_query *qry = req->current_query;
+	if (!qry || ctx->state & (KNOT_STATE_FAIL)) {
+		return ctx->state;
+	}
+	/* Observe only authoritative answers */
+	struct kr_module *module = ctx->api->data;
+	struct dns64_data *data = module->data;
+	if (!data || data->count == 0 || !(qry->flags & QUERY_RESOLVED)) {
+		return ctx->state;
+	}
+
+	if (qry->flags & MARK_DNS64) { /* Marked request */
+		synth_answer(data, req, qry, pkt);
+		return ctx->state;
+	}
+	/* Observe AAAA NODATA responses of the final query */
+	bool is_nodata = knot_wire_get_rcode(pkt->wire) == KNOT_RCODE_NOERROR &&
+	                 knot_pkt_section(pkt, KNOT_ANSWER)->count == 0;
+	if (knot_pkt_qtype(pkt) != KNOT_RRTYPE_AAAA || !is_nodata || qry->parent ||
+	    !knot_dname_is_equal(knot_pkt_qname(pkt), qry->sname)) {
+		return ctx->state;
+	}
+	/* Synthesize from the cached addresses, i.e. the NODATA answer came from the packet cache */
+	struct dns64_entry *entry = cache_find(data, qry);
+	knot_rrset_t rr;
+	if (entry && cache_synth(data, entry, qry, &rr, &req->answer->mm) == 0) {
+		if (knot_pkt_put(req->answer, 0, &rr, KNOT_PF_FREE) == 0) {
+			DEBUG_MSG(qry, "<= synthesized from cache\n");
+			return ctx->state;
+		}
+		knot_rrset_clear(&rr, &req->answer->mm);
+	}
+	struct kr_query *next = kr_rplan_push(&req->rplan, qry, qry->sname, qry->sclass, KNOT_RRTYPE_A);
+	if (!next) {
+		return ctx->state;
+	}
+	next->flags = (qry->flags & QUERY_DNSSEC_WANT) | QUERY_AWAIT_CUT | MARK_DNS64;
+	/* Expect the A answer for as long as the NODATA answer is valid */
+	entry = lru_set(data->cache, (const char *)qry->sname, knot_dname_size(qry->sname));
+	if (entry) {
+		memset(entry, 0, sizeof(*entry));
+		entry->nodata = qry->timestamp.tv_sec + nodata_ttl(pkt);
+		entry->expire = entry->nodata;
+	}
+	return ctx->state;
+}
+
+/*
+ * Module implementation.
+ */
+
+static int add_prefix(struct dns64_data *data, const char *prefix)
+{
+	if (data->count >= DNS64_PREFIXES) {
+		return kr_error(ENOSPC);
+	}
+	uint8_t *addr = data->prefix[data->count];
+	if (kr_straddr_family(prefix) != AF_INET6) {
+		return kr_error(EINVAL);
+	}
+	int bits = kr_straddr_subnet(addr, prefix);
+	if (bits == 128) { /* Address without length is a /96 prefix */
+		bits = 96;
+	}
+	switch (bits) {
+	case 32: case 40: case 48: case 56: case 64: case 96:
+		break;
+	default:
+		return kr_error(EINVAL);
+	}
+	data->prefix_len[data->count] = bits;
+	data->count += 1;
+	return kr_ok();
+}
+
+static int add_exclude(struct dns64_data *data, const char *subnet)
+{
+	if (!data->exclude) {
+		data->exclude = kr_policy_net_new();
+		if (!data->exclude) {
+			return kr_error(ENOMEM);
+		}
+	}
+	return kr_policy_net_add(data->exclude, subnet, 1);
+}
+
+/** Apply the function to a string node or to each string of an array node. */
+static int unpack_list(struct dns64_data *data, JsonNode *node, int (*add)(struct dns64_data *, const char *))
+{
+	if (node->tag == JSON_STRING) {
+		return add(data, node->string_);
+	}
+	if (node->tag != JSON_ARRAY) {
+		return kr_error(EINVAL);
+	}
+	JsonNode *elm = NULL;
+	json_foreach(elm, node) {
+		if (elm->tag != JSON_STRING) {
+			return kr_error(EINVAL);
+		}
+		int ret = add(data, elm->string_);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return kr_ok();
+}
+
+/** Parse prefix string, list of prefixes, or table with 'prefix' and 'exclude' lists. */
+static int parse_config(struct dns64_data *data, const char *conf)
+{
+	if (conf[0] != '{' && conf[0] != '[') {
+		return add_prefix(data, conf);
+	}
+	JsonNode *root_node = json_decode(conf);
+	if (!root_node) {
+		return kr_error(EINVAL);
+	}
+	int ret = kr_error(EINVAL);
+	if (root_node->tag == JSON_ARRAY) {
+		ret = unpack_list(data, root_node, add_prefix);
+	} else {
+		JsonNode *node = json_find_member(root_node, "prefix");
+		if (node) {
+			ret = unpack_list(data, node, add_prefix);
+		}
+		node = json_find_member(root_node, "exclude");
+		if (node && ret == 0) {
+			ret = unpack_list(data, node, add_exclude);
+		}
+	}
+	json_delete(root_node);
+	return ret;
+}
+
+static void clear(struct dns64_data *data)
+{
+	kr_policy_net_free(data->exclude);
+	data->exclude = NULL;
+	data->count = 0;
+	lru_deinit(data->cache);
+	lru_init(data->cache, DNS64_CACHE_SIZE);
+}
+
+KR_EXPORT
+const knot_layer_api_t *dns64_layer(struct kr_module *module)
+{
+	static knot_layer_api_t _layer = {
+		.begin = &begin,
+		.produce = &query,
+		.consume = &consume,
+	};
+	/* Store module reference */
+	_layer.data = module;
+	return &_layer;
+}
+
+KR_EXPORT
+int dns64_init(struct kr_module *module)
+{
+	struct dns64_data *data = calloc(1, sizeof(*data));
+	if (!data) {
+		return kr_error(ENOMEM);
+	}
+	data->cache = malloc(lru_size(dns64_lru_t, DNS64_CACHE_SIZE));
+	if (!data->cache) {
+		free(data);
+		return kr_error(ENOMEM);
+	}
+	lru_init(data->cache, DNS64_CACHE_SIZE);
+	module->data = data;
+	return kr_ok();
+}
+
+KR_EXPORT
+int dns64_config(struct kr_module *module, const char *conf)
+{
+	struct dns64_data *data = module->data;
+	clear(data);
+	if (!conf || strlen(conf) < 1) {
+		return kr_ok();
+	}
+	int ret = parse_config(data, conf);
+	if (ret != 0) {
+		clear(data);
+	}
+	return ret;
+}
+
+KR_EXPORT
+int dns64_deinit(struct kr_module *module)
+{
+	struct dns64_data *data = module->data;
+	if (data) {
+		kr_policy_net_free(data->exclude);
+		lru_deinit(data->cache);
+		free(data->cache);
+		free(data);
+		module->data = NULL;
+	}
+	return kr_ok();
+}
+
+KR_MODULE_EXPORT(dns64);
@@ -32,20 +32,17 @@
 #include "lib/zonecut.h"
 #include "lib/module.h"
 #include "lib/layer.h"
+#include "modules/hints/hints_index.h"
 
 /* Defaults */
 #define DEFAULT_FILE "/etc/hosts"
 #define DEBUG_MSG(qry, fmt...) QRDEBUG(qry, "hint",  fmt)
 
-/* Structure for reverse search (address to domain) */
-struct rev_search_baton {
-	knot_pkt_t *pkt;
-	const knot_dname_t *name;
-	union {
-		struct in_addr ip4;
-		struct in6_addr ip6;
-	} addr;
-	size_t addr_len;
+/** Hints, names with addresses and the reverse index of addresses. */
+struct hints_data {
+	struct kr_zonecut hints;     /**< Hints set at runtime */
+	map_t reverse;               /**< Reverse name (PTR owner) => name */
+	struct hints_index *index;   /**< Hints loaded from file */
 };
 
 static int begin(knot_layer_t *ctx, void *module_param)
@@ -75,108 +72,86 @@ static int put_answer(knot_pkt_t *pkt, knot_rrset_t *rr)
 	return ret;
 }
 
-static int find_reverse(const char *k, void *v, void *baton)
+static int satisfy_reverse(struct hints_data *data, knot_pkt_t *pkt, struct kr_query *qry)
 {
-	const knot_dname_t *domain = (const knot_dname_t *)k;
-	pack_t *addr_set = (pack_t *)v;
-	struct rev_search_baton *search = baton;
-	/* Check if it matches any of the addresses. */
-	bool matches = false;
-	uint8_t *addr = pack_head(*addr_set);
-	while (!matches && addr != pack_tail(*addr_set)) {
-		size_t len = pack_obj_len(addr);
-		void *addr_val = pack_obj_val(addr);
-		matches = (len == search->addr_len && memcmp(addr_val, (void *)&search->addr, len) == 0);
-		addr = pack_obj_next(addr);
+	/* Reverse index is keyed by the PTR owner, QNAME is already lowercase. */
+	const knot_dname_t *domain = map_get(&data->reverse, (const char *)qry->sname);
+	if (!domain) {
+		domain = hints_index_reverse(data->index, qry->sname);
 	}
-	/* Synthesise PTR record */
-	if (!matches) {
-		return 0;
+	if (!domain) {
+		return kr_error(ENOENT);
 	}
-	knot_pkt_t *pkt = search->pkt;
-	knot_dname_t *qname = knot_dname_copy(search->name, &pkt->mm);
+	knot_dname_t *qname = knot_dname_copy(qry->sname, &pkt->mm);
 	knot_rrset_t rr;
 	knot_rrset_init(&rr, qname, KNOT_RRTYPE_PTR, KNOT_CLASS_IN);
 	knot_rrset_add_rdata(&rr, domain, knot_dname_size(domain), 0, &pkt->mm);
-	/* Insert into packet */
-	int ret = put_answer(pkt, &rr);
-	if (ret == 0) {
-		return 1;
-	}
-	return ret;
+	return put_answer(pkt, &rr);
 }
 
-static inline uint8_t label2num(const uint8_t **src, int base)
-{
-	uint8_t ret = strtoul((const char *)(*src + 1), NULL, base) & 0xff; /* ord(0-64) => labels are separators */
-	*src = knot_wire_next_label(*src, NULL);
-	return ret;
-}
+/** @internal Address family flag of the address length. */
+#define HINT_FAMILY(len) ((len) == sizeof(struct in_addr) ? 1 << 0 : 1 << 1)
+
+typedef void (*hint_addr_cb)(const uint8_t *addr, size_t len, void *baton);
 
-static int satisfy_reverse(struct kr_zonecut *hints, knot_pkt_t *pkt, struct kr_query *qry)
+/**
+ * @internal Call the callback for each address of the lowercase name.
+ * Hints set at runtime take precedence for each address family, the other family comes from the file.
+ * @return number of addresses
+ */
+static unsigned hint_addrs(struct hints_data *data, const knot_dname_t *name, hint_addr_cb cb, void *baton)
 {
-	struct rev_search_baton baton = {
-		.pkt = pkt,
-		.name = qry->sname,
-		.addr_len = sizeof(struct in_addr)
-	};
-	/* Check if it is IPv6/IPv4 query. */
-	size_t need_labels = baton.addr_len;
-	if (knot_dname_in((const uint8_t *)"\3ip6\4arpa", qry->sname)) {
-		baton.addr_len = sizeof(struct in6_addr);
-		need_labels = baton.addr_len * 2; /* Each label is a nibble */
-	}
-	/* Make address from QNAME (reverse order). */
-	int labels = knot_dname_labels(qry->sname, NULL);
-	if (labels != need_labels + 2) {
-		return kr_error(EINVAL);
-	}
-	const uint8_t *src = qry->sname;
-	uint8_t *dst = (uint8_t *)&baton.addr.ip4 + baton.addr_len - 1;
-	for (size_t i = 0; i < baton.addr_len; ++i) {
-		if (baton.addr_len == sizeof(struct in_addr)) { /* IPv4, 1 label = 1 octet */
-			*dst = label2num(&src, 10);
-		} else { /* IPv4, 1 label = 1 nibble */
-			*dst = label2num(&src, 16);
-			*dst |= label2num(&src, 16) << 4;
+	unsigned found = 0, families = 0;
+	pack_t *addr_set = kr_zonecut_find(&data->hints, name);
+	if (addr_set) {
+		uint8_t *addr = pack_head(*addr_set);
+		while (addr != pack_tail(*addr_set)) {
+			size_t len = pack_obj_len(addr);
+			cb(pack_obj_val(addr), len, baton);
+			families |= HINT_FAMILY(len);
+			found += 1;
+			addr = pack_obj_next(addr);
 		}
-		dst -= 1;
 	}
-	/* Try to find matching domains. */
-	int ret = map_walk(&hints->nsset, find_reverse, &baton);
-	if (ret > 0) {
-		return kr_ok(); /* Found */
+	const uint8_t *entry = hints_index_find(data->index, name);
+	if (entry) {
+		unsigned count = 0;
+		const uint8_t *addr = hints_entry_addrs(entry, &count);
+		for (unsigned i = 0; i < count; ++i, addr = hints_addr_next(addr)) {
+			if (!(families & HINT_FAMILY(addr[0]))) {
+				cb(addr + 1, addr[0], baton);
+				found += 1;
+			}
+		}
 	}
-	return kr_error(ENOENT);
+	return found;
 }
 
-static int satisfy_forward(struct kr_zonecut *hints, knot_pkt_t *pkt, struct kr_query *qry)
-{
-	/* Find a matching name */
-	pack_t *addr_set = kr_zonecut_find(hints, qry->sname);
-	if (!addr_set || addr_set->len == 0) {
-		return kr_error(ENOENT);
-	}
-	knot_dname_t *qname = knot_dname_copy(qry->sname, &pkt->mm);
+/** @internal Answer RRSet being built from the hints. */
+struct hint_answer {
 	knot_rrset_t rr;
-	knot_rrset_init(&rr, qname, qry->stype, qry->sclass);
-	size_t family_len = sizeof(struct in_addr);
-	if (rr.type == KNOT_RRTYPE_AAAA) {
-		family_len = sizeof(struct in6_addr);
-	}
+	size_t family_len;
+	knot_mm_t *pool;
+};
 
-	/* Append address records from hints */
-	uint8_t *addr = pack_head(*addr_set);
-	while (addr != pack_tail(*addr_set)) {
-		size_t len = pack_obj_len(addr);
-		void *addr_val = pack_obj_val(addr);
-		if (len == family_len) {
-			knot_rrset_add_rdata(&rr, addr_val, len, 0, &pkt->mm);
-		}
-		addr = pack_obj_next(addr);
+static void hint_answer_add(const uint8_t *addr, size_t len, void *baton)
+{
+	struct hint_answer *answer = baton;
+	if (len == answer->family_len) {
+		knot_rrset_add_rdata(&answer->rr, addr, len, 0, answer->pool);
 	}
+}
 
-	return put_answer(pkt, &rr);
+static int satisfy_forward(struct hints_data *data, knot_pkt_t *pkt, struct kr_query *qry)
+{
+	struct hint_answer answer = { .family_len = sizeof(struct in_addr), .pool = &pkt->mm };
+	if (qry->stype == KNOT_RRTYPE_AAAA) {
+		answer.family_len = sizeof(struct in6_addr);
+	}
+	knot_dname_t *qname = knot_dname_copy(qry->sname, &pkt->mm);
+	knot_rrset_init(&answer.rr, qname, qry->stype, qry->sclass);
+	hint_addrs(data, qry->sname, hint_answer_add, &answer);
+	return put_answer(pkt, &answer.rr);
 }
 
 static int query(knot_layer_t *ctx, knot_pkt_t *pkt)
@@ -188,15 +163,18 @@ static int query(knot_layer_t *ctx, knot_pkt_t *pkt)
 	}
 
 	struct kr_module *module = ctx->api->data;
-	struct kr_zonecut *hint_map = module->data;
+	struct hints_data *data = module->data;
+	if (!data) {
+		return ctx->state;
+	}
 	switch(qry->stype) {
 	case KNOT_RRTYPE_A:
 	case KNOT_RRTYPE_AAAA: /* Find forward record hints */
-		if (satisfy_forward(hint_map, pkt, qry) != 0)
+		if (satisfy_forward(data, pkt, qry) != 0)
 			return ctx->state;
 		break;
 	case KNOT_RRTYPE_PTR: /* Find PTR record */
-		if (satisfy_reverse(hint_map, pkt, qry) != 0)
+		if (satisfy_reverse(data, pkt, qry) != 0)
 			return ctx->state;
 		break;
 	default:
@@ -223,13 +201,29 @@ static int parse_addr_str(struct sockaddr_storage *sa, const char *addr)
 	return 0;
 }
 
-static int add_pair(struct kr_zonecut *hints, const char *name, const char *addr)
+/** @internal Add address to the reverse index, the first name for the address is kept. */
+static int add_reverse(map_t *reverse, const knot_dname_t *name, const uint8_t *addr, size_t addr_len)
+{
+	knot_dname_t key[KNOT_DNAME_MAXLEN];
+	hints_reverse_name(key, addr, addr_len);
+	if (map_contains(reverse, (const char *)key)) {
+		return kr_ok();
+	}
+	knot_dname_t *val = knot_dname_copy(name, reverse->baton);
+	if (!val) {
+		return kr_error(ENOMEM);
+	}
+	return map_set(reverse, (const char *)key, val) == 0 ? kr_ok() : kr_error(ENOMEM);
+}
+
+static int add_pair(struct kr_zonecut *hints, map_t *reverse, const char *name, const char *addr)
 {
 	/* Build key */
 	knot_dname_t key[KNOT_DNAME_MAXLEN];
 	if (!knot_dname_from_str(key, name, sizeof(key))) {
 		return kr_error(EINVAL);
 	}
+	knot_dname_to_lower(key);
 
 	/* Parse address string */
 	struct sockaddr_storage ss;
@@ -243,42 +237,30 @@ static int add_pair(struct kr_zonecut *hints, const char *name, const char *addr
 	/* @warning _NOT_ thread-safe */
 	static knot_rdata_t rdata_arr[RDATA_ARR_MAX];
 	knot_rdata_init(rdata_arr, addr_len, raw_addr, 0);
-	return kr_zonecut_add(hints, key, rdata_arr);
-}
-
-static int load_map(struct kr_zonecut *hints, FILE *fp)
-{
-	size_t line_len = 0;
-	size_t count = 0;
-	auto_free char *line = NULL;
-
-	while(getline(&line, &line_len, fp) > 0) {
-		char *saveptr = NULL;
-		char *tok = strtok_r(line, " \t\r", &saveptr);
-		if (tok == NULL || strchr(tok, '#') || strlen(tok) == 0) {
-			continue;
-		}
-		char *name_tok = strtok_r(NULL, " \t\n", &saveptr);
-		while (name_tok != NULL) {
-			if (add_pair(hints, name_tok, tok) == 0) {
-				count += 1;
-			}
-			name_tok = strtok_r(NULL, " \t\n", &saveptr);
-		}
+	int ret = kr_zonecut_add(hints, key, rdata_arr);
+	if (ret == 0 && reverse) {
+		ret = add_reverse(reverse, key, raw_addr, addr_len);
 	}
-
-	DEBUG_MSG(NULL, "loaded %zu hints\n", count);
-	return kr_ok();
+	return ret;
 }
 
 static int load(struct kr_module *module, const char *path)
 {
-	auto_fclose FILE *fp = fopen(path, "r");
-	if (fp == NULL) {
-		DEBUG_MSG(NULL, "reading '%s' failed: %s\n", path, strerror(errno));
-		return kr_error(errno);
+	/* Map compiled hints, or build the index from hosts file */
+	struct hints_index *index = NULL;
+	size_t count = 0;
+	int ret = hints_index_open(&index, path);
+	if (ret == kr_error(EILSEQ)) {
+		ret = hints_index_build(&index, path, &count);
+	}
+	if (ret != 0) {
+		DEBUG_MSG(NULL, "reading '%s' failed: %s\n", path, strerror(abs(ret)));
+		return ret;
+	}
+	if (index->mapped) {
+		DEBUG_MSG(NULL, "mapped '%s', %u names\n", path, index->count);
 	} else {
-		DEBUG_MSG(NULL, "reading '%s'\n", path);
+		DEBUG_MSG(NULL, "loaded %zu hints from '%s'\n", count, path);
 	}
 
 	/* Create pool and copy itself */
@@ -288,23 +270,36 @@ static int load(struct kr_module *module, const char *path)
 	};
 	knot_mm_t *pool = mm_alloc(&_pool, sizeof(*pool));
 	if (!pool) {
+		hints_index_free(index);
 		return kr_error(ENOMEM);
 	}
 	memcpy(pool, &_pool, sizeof(*pool));
 
-	/* Load file to map */
-	struct kr_zonecut *hints = mm_alloc(pool, sizeof(*hints));
-	kr_zonecut_init(hints, (const uint8_t *)(""), pool);
-	module->data = hints;
-	return load_map(hints, fp);
+	/* Runtime hints are kept in the zone cut */
+	struct hints_data *data = mm_alloc(pool, sizeof(*data));
+	if (!data) {
+		hints_index_free(index);
+		mp_delete(pool->ctx);
+		return kr_error(ENOMEM);
+	}
+	kr_zonecut_init(&data->hints, (const uint8_t *)(""), pool);
+	data->reverse = map_make();
+	data->reverse.malloc = (map_alloc_f) mm_alloc;
+	data->reverse.free = (map_free_f) mm_free;
+	data->reverse.baton = pool;
+	data->index = index;
+	module->data = data;
+	return kr_ok();
 }
 
 static void unload(struct kr_module *module)
 {
-	struct kr_zonecut *hints = module->data;
-	if (hints) {
-		kr_zonecut_deinit(hints);
-		mp_delete(hints->pool->ctx);
+	struct hints_data *data = module->data;
+	if (data) {
+		/* Reverse index is allocated in the pool as well */
+		hints_index_free(data->index);
+		kr_zonecut_deinit(&data->hints);
+		mp_delete(data->hints.pool->ctx);
 		module->data = NULL;
 	}
 }
@@ -318,14 +313,14 @@ static void unload(struct kr_module *module)
  */
 static char* hint_set(void *env, struct kr_module *module, const char *args)
 {
-	struct kr_zonecut *hints = module->data;
+	struct hints_data *data = module->data;
 	auto_free char *args_copy = strdup(args);
 
 	int ret = -1;
 	char *addr = strchr(args_copy, ' ');
-	if (addr) {
+	if (data && addr) {
 		*addr = '\0';
-		ret = add_pair(hints, args_copy, addr + 1);
+		ret = add_pair(&data->hints, &data->reverse, args_copy, addr + 1);
 	}
 
 	char *result = NULL;
@@ -352,6 +347,16 @@ static JsonNode *pack_addrs(pack_t *pack)
 	return root;
 }
 
+/** @internal Append address to JSON array. */
+static void hint_json_add(const uint8_t *addr, size_t len, void *baton)
+{
+	char buf[INET6_ADDRSTRLEN];
+	int family = len == sizeof(struct in_addr) ? AF_INET : AF_INET6;
+	if (inet_ntop(family, addr, buf, sizeof(buf))) {
+		json_append_element(baton, json_mkstring(buf));
+	}
+}
+
 /**
  * Retrieve address hint for given name.
  *
@@ -360,22 +365,49 @@ static JsonNode *pack_addrs(pack_t *pack)
  */
 static char* hint_get(void *env, struct kr_module *module, const char *args)
 {
-	struct kr_zonecut *hints = module->data;
+	struct hints_data *data = module->data;
 	knot_dname_t key[KNOT_DNAME_MAXLEN];
-	pack_t *pack = NULL;
-	if (knot_dname_from_str(key, args, sizeof(key))) {
-		pack = kr_zonecut_find(hints, key);
+	if (!data || !knot_dname_from_str(key, args, sizeof(key))) {
+		return NULL;
 	}
-	if (!pack || pack->len == 0) {
+	knot_dname_to_lower(key);
+	JsonNode *root = json_mkarray();
+	if (!root) {
 		return NULL;
 	}
-
 	char *result = NULL;
-	JsonNode *root = pack_addrs(pack);
-	if (root) {
+	if (hint_addrs(data, key, hint_json_add, root) > 0) {
 		result = json_encode(root);
-		json_delete(root);
 	}
+	json_delete(root);
+	return result;
+}
+
+/**
+ * Compile hosts file into index that is mapped instead of parsed on load.
+ *
+ * Input:  source output
+ * Output: { result: bool }
+ *
+ */
+static char* hint_compile(void *env, struct kr_module *module, const char *args)
+{
+	auto_free char *args_copy = strdup(args);
+	int ret = kr_error(EINVAL);
+	char *output = args_copy ? strchr(args_copy, ' ') : NULL;
+	if (output) {
+		*output = '\0';
+		struct hints_index *index = NULL;
+		ret = hints_index_build(&index, args_copy, NULL);
+		if (ret == 0) {
+			ret = hints_index_save(index, output + 1);
+			hints_index_free(index);
+		}
+	}
+
+	char *result = NULL;
+	if (-1 == asprintf(&result, "{ \"result\": %s }", ret == 0 ? "true" : "false"))
+		result = NULL;
 	return result;
 }
 
@@ -398,7 +430,7 @@ static void unpack_hint(struct kr_zonecut *root_hints, JsonNode *table, const ch
 	JsonNode *node = NULL;
 	json_foreach(node, table) {
 		switch(node->tag) {
-		case JSON_STRING: add_pair(root_hints, name ? name : node->key, node->string_); break;
+		case JSON_STRING: add_pair(root_hints, NULL, name ? name : node->key, node->string_); break;
 		case JSON_ARRAY: unpack_hint(root_hints, node, name ? name : node->key); break;
 		default: continue;
 		}
@@ -481,6 +513,7 @@ struct kr_prop *hints_props(void)
 	    { &hint_set,    "set", "Set {name, address} hint.", },
 	    { &hint_get,    "get", "Retrieve hint for given name.", },
 	    { &hint_root,   "root", "Replace root hints set (empty value to return current list).", },
+	    { &hint_compile, "compile", "Compile hosts file into mapped index {source, output}.", },
 	    { NULL, NULL, NULL }
 	};
 	return prop_list;
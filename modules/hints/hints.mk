@@ -1,5 +1,5 @@
 hints_CFLAGS := -fvisibility=hidden -fPIC
-hints_SOURCES := modules/hints/hints.c
+hints_SOURCES := modules/hints/hints.c modules/hints/hints_index.c
 hints_DEPEND := $(libkres)
 hints_LIBS := $(contrib_TARGET) $(libkres_TARGET) $(libkres_LIBS)
 $(call make_c_module,hints)
\ No newline at end of file
@@ -0,0 +1,545 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <contrib/ucw/lib.h>
+
+#include "lib/defines.h"
+#include "lib/generic/array.h"
+#include "modules/hints/hints_index.h"
+
+/** Reserve space for 'n' more elements, the arrays grow geometrically. */
+#define array_grow(array, n) \
+	((array).len + (n) <= (array).cap ? 0 : array_reserve((array), MAX((array).len + (n), 2 * (array).cap)))
+
+/** @internal Name-address pair parsed from the hosts file. */
+struct hints_pair {
+	uint32_t name;  /**< Name offset in the name buffer */
+	uint32_t seq;   /**< Order in the file */
+	uint32_t entry; /**< Offset of the name entry */
+	uint8_t name_len;
+	uint8_t addr_len;
+	uint8_t addr[16];
+};
+
+/** @internal Index being built. */
+struct hints_builder {
+	array_t(struct hints_pair) pairs;
+	array_t(uint8_t) names;
+	array_t(uint8_t) entries;
+	array_t(uint32_t) offsets;
+	array_t(uint32_t) roffsets;
+};
+
+void hints_reverse_name(knot_dname_t *dst, const uint8_t *addr, size_t addr_len)
+{
+	static const char hex[] = "0123456789abcdef";
+	for (int i = addr_len - 1; i >= 0; --i) {
+		if (addr_len == sizeof(struct in_addr)) { /* IPv4, 1 label = 1 octet */
+			dst[0] = sprintf((char *)dst + 1, "%u", addr[i]);
+			dst += dst[0] + 1;
+		} else { /* IPv6, 1 label = 1 nibble */
+			dst[0] = 1;
+			dst[1] = hex[addr[i] & 0x0f];
+			dst[2] = 1;
+			dst[3] = hex[addr[i] >> 4];
+			dst += 4;
+		}
+	}
+	if (addr_len == sizeof(struct in_addr)) {
+		memcpy(dst, "\7in-addr\4arpa", sizeof("\7in-addr\4arpa"));
+	} else {
+		memcpy(dst, "\3ip6\4arpa", sizeof("\3ip6\4arpa"));
+	}
+}
+
+/** @internal Compare length-prefixed key with given key. */
+static int key_cmp(const uint8_t *entry, const uint8_t *key, size_t len)
+{
+	int ret = memcmp(entry + 1, key, MIN(entry[0], len));
+	if (ret == 0) {
+		ret = (int)entry[0] - (int)len;
+	}
+	return ret;
+}
+
+/** @internal Binary search of the key in sorted entry offsets. */
+static const uint8_t *key_find(const uint8_t *entries, const uint32_t *offsets, uint32_t count,
+                               const uint8_t *key, size_t len)
+{
+	uint32_t lo = 0, hi = count;
+	while (lo < hi) {
+		const uint32_t mid = lo + (hi - lo) / 2;
+		const uint8_t *entry = entries + offsets[mid];
+		const int ret = key_cmp(entry, key, len);
+		if (ret == 0) {
+			return entry;
+		} else if (ret < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return NULL;
+}
+
+/* Sorted by qsort() which has no context argument, so building is not reentrant. */
+static const uint8_t *sort_base;
+
+static int pair_name_cmp(const void *a, const void *b)
+{
+	const struct hints_pair *pa = a, *pb = b;
+	int ret = memcmp(sort_base + pa->name, sort_base + pb->name, MIN(pa->name_len, pb->name_len));
+	if (ret == 0) {
+		ret = (int)pa->name_len - (int)pb->name_len;
+	}
+	return ret != 0 ? ret : (pa->seq > pb->seq) - (pa->seq < pb->seq);
+}
+
+static int pair_addr_cmp(const void *a, const void *b)
+{
+	const struct hints_pair *pa = a, *pb = b;
+	int ret = (int)pa->addr_len - (int)pb->addr_len;
+	if (ret == 0) {
+		ret = memcmp(pa->addr, pb->addr, pa->addr_len);
+	}
+	return ret != 0 ? ret : (pa->seq > pb->seq) - (pa->seq < pb->seq);
+}
+
+static bool same_name(const struct hints_builder *builder, const struct hints_pair *a, const struct hints_pair *b)
+{
+	return a->name_len == b->name_len &&
+	       memcmp(builder->names.at + a->name, builder->names.at + b->name, a->name_len) == 0;
+}
+
+static bool same_addr(const struct hints_pair *a, const struct hints_pair *b)
+{
+	return a->addr_len == b->addr_len && memcmp(a->addr, b->addr, a->addr_len) == 0;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const uint8_t *entry_b = sort_base + *(const uint32_t *)b;
+	return key_cmp(sort_base + *(const uint32_t *)a, entry_b + 1, entry_b[0]);
+}
+
+/** @internal Parse a line of the hosts file into name-address pairs. */
+static int parse_line(struct hints_builder *builder, const char *line, size_t len)
+{
+	const char *comment = memchr(line, '#', len);
+	if (comment) {
+		len = comment - line;
+	}
+	uint8_t addr[16];
+	int addr_len = 0;
+	const char *end = line + len;
+	while (line < end) {
+		/* Next token */
+		while (line < end && (*line == ' ' || *line == '\t' || *line == '\r')) {
+			++line;
+		}
+		const char *tok = line;
+		while (line < end && *line != ' ' && *line != '\t' && *line != '\r') {
+			++line;
+		}
+		char buf[KNOT_DNAME_MAXLEN + 1];
+		const size_t tok_len = line - tok;
+		if (tok_len == 0 || tok_len >= sizeof(buf)) {
+			continue;
+		}
+		memcpy(buf, tok, tok_len);
+		buf[tok_len] = '\0';
+		/* First token is the address */
+		if (addr_len == 0) {
+			const int family = strchr(buf, ':') ? AF_INET6 : AF_INET;
+			if (inet_pton(family, buf, addr) != 1) {
+				return 0;
+			}
+			addr_len = (family == AF_INET6) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+			continue;
+		}
+		knot_dname_t name[KNOT_DNAME_MAXLEN];
+		if (!knot_dname_from_str(name, buf, sizeof(name))) {
+			continue;
+		}
+		knot_dname_to_lower(name);
+		const int name_len = knot_dname_size(name);
+		if (array_grow(builder->names, name_len) != 0 || array_grow(builder->pairs, 1) != 0) {
+			return kr_error(ENOMEM);
+		}
+		struct hints_pair *pair = &builder->pairs.at[builder->pairs.len];
+		pair->name = builder->names.len;
+		pair->name_len = name_len;
+		pair->seq = builder->pairs.len;
+		pair->addr_len = addr_len;
+		memcpy(pair->addr, addr, addr_len);
+		memcpy(builder->names.at + builder->names.len, name, name_len);
+		builder->names.len += name_len;
+		builder->pairs.len += 1;
+	}
+	return 0;
+}
+
+/** @internal Write name entries, pairs must be sorted by name. */
+static int build_names(struct hints_builder *builder)
+{
+	size_t i = 0;
+	while (i < builder->pairs.len) {
+		struct hints_pair *first = &builder->pairs.at[i];
+		const uint32_t entry = builder->entries.len;
+		const size_t max_len = 2 + first->name_len + HINTS_INDEX_ADDRS * (1 + 16);
+		if (array_grow(builder->entries, max_len) != 0 || array_grow(builder->offsets, 1) != 0) {
+			return kr_error(ENOMEM);
+		}
+		array_push(builder->offsets, entry);
+		uint8_t *p = builder->entries.at + entry;
+		*p++ = first->name_len;
+		memcpy(p, builder->names.at + first->name, first->name_len);
+		p += first->name_len;
+		uint8_t *addr_count = p++;
+		const uint8_t *addrs = p;
+		*addr_count = 0;
+		/* Append unique addresses of the name */
+		for (; i < builder->pairs.len && same_name(builder, first, &builder->pairs.at[i]); ++i) {
+			struct hints_pair *pair = &builder->pairs.at[i];
+			pair->entry = entry;
+			bool found = false;
+			for (const uint8_t *a = addrs; !found && a < p; a = hints_addr_next(a)) {
+				found = (a[0] == pair->addr_len && memcmp(a + 1, pair->addr, pair->addr_len) == 0);
+			}
+			if (!found && *addr_count < HINTS_INDEX_ADDRS) {
+				*p++ = pair->addr_len;
+				memcpy(p, pair->addr, pair->addr_len);
+				p += pair->addr_len;
+				*addr_count += 1;
+			}
+		}
+		builder->entries.len = p - builder->entries.at;
+	}
+	return 0;
+}
+
+/** @internal Write reverse entries, pairs must be sorted by address. */
+static int build_reverse(struct hints_builder *builder)
+{
+	for (size_t i = 0; i < builder->pairs.len; ++i) {
+		const struct hints_pair *pair = &builder->pairs.at[i];
+		/* First name of the address wins */
+		if (i > 0 && same_addr(&builder->pairs.at[i - 1], pair)) {
+			continue;
+		}
+		knot_dname_t rname[KNOT_DNAME_MAXLEN];
+		hints_reverse_name(rname, pair->addr, pair->addr_len);
+		const int rname_len = knot_dname_size(rname);
+		const uint32_t entry = builder->entries.len;
+		if (array_grow(builder->entries, 1 + rname_len + sizeof(uint32_t)) != 0 ||
+		    array_grow(builder->roffsets, 1) != 0) {
+			return kr_error(ENOMEM);
+		}
+		array_push(builder->roffsets, entry);
+		uint8_t *p = builder->entries.at + entry;
+		*p++ = rname_len;
+		memcpy(p, rname, rname_len);
+		memcpy(p + rname_len, &pair->entry, sizeof(uint32_t));
+		builder->entries.len += 1 + rname_len + sizeof(uint32_t);
+	}
+	return 0;
+}
+
+/** @internal Parse the file and build sorted entries. */
+static int build(struct hints_builder *builder, const char *data, size_t size)
+{
+	/* Single pass over the mapped file, there's no copy per line */
+	const char *end = data + size;
+	while (data < end) {
+		const char *eol = memchr(data, '\n', end - data);
+		if (!eol) {
+			eol = end;
+		}
+		int ret = parse_line(builder, data, eol - data);
+		if (ret != 0) {
+			return ret;
+		}
+		data = eol + 1;
+	}
+	/* Sort pairs by name to group the addresses, then by address for the reverse entries */
+	sort_base = builder->names.at;
+	qsort(builder->pairs.at, builder->pairs.len, sizeof(struct hints_pair), pair_name_cmp);
+	int ret = build_names(builder);
+	if (ret == 0) {
+		qsort(builder->pairs.at, builder->pairs.len, sizeof(struct hints_pair), pair_addr_cmp);
+		ret = build_reverse(builder);
+	}
+	if (ret == 0) {
+		sort_base = builder->entries.at;
+		qsort(builder->roffsets.at, builder->roffsets.len, sizeof(uint32_t), entry_cmp);
+	}
+	sort_base = NULL;
+	return ret;
+}
+
+/** @internal Set index tables from the compiled image. */
+static void index_init(struct hints_index *index, void *base, size_t size)
+{
+	const struct hints_index_header *hdr = base;
+	index->base = base;
+	index->size = size;
+	index->count = hdr->count;
+	index->rcount = hdr->rcount;
+	index->offsets = (const uint32_t *)(hdr + 1);
+	index->roffsets = index->offsets + hdr->count;
+	index->entries = (const uint8_t *)(index->roffsets + hdr->rcount);
+}
+
+int hints_index_build(struct hints_index **index, const char *path, size_t *pairs)
+{
+	if (!index || !path) {
+		return kr_error(EINVAL);
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return kr_error(errno);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		int ret = errno;
+		close(fd);
+		return kr_error(ret);
+	}
+	void *data = NULL;
+	if (st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (data == MAP_FAILED) {
+		return kr_error(errno);
+	}
+	struct hints_builder builder;
+	memset(&builder, 0, sizeof(builder));
+	int ret = build(&builder, data, st.st_size);
+	if (data) {
+		munmap(data, st.st_size);
+	}
+	/* Lay out the image in the compiled file format */
+	struct hints_index *result = NULL;
+	struct hints_index_header hdr;
+	const size_t tables = (builder.offsets.len + builder.roffsets.len) * sizeof(uint32_t);
+	const size_t size = sizeof(hdr) + tables + builder.entries.len;
+	uint8_t *base = NULL;
+	if (ret == 0 && builder.entries.len > UINT32_MAX) {
+		ret = kr_error(EFBIG);
+	}
+	if (ret == 0) {
+		result = malloc(sizeof(*result));
+		base = malloc(size);
+		if (!result || !base) {
+			free(result);
+			free(base);
+			ret = kr_error(ENOMEM);
+		}
+	}
+	if (ret == 0) {
+		memcpy(hdr.magic, HINTS_INDEX_MAGIC, sizeof(hdr.magic));
+		hdr.version = HINTS_INDEX_VERSION;
+		hdr.count = builder.offsets.len;
+		hdr.rcount = builder.roffsets.len;
+		hdr.size = builder.entries.len;
+		uint8_t *p = base;
+		memcpy(p, &hdr, sizeof(hdr));
+		p += sizeof(hdr);
+		memcpy(p, builder.offsets.at, builder.offsets.len * sizeof(uint32_t));
+		p += builder.offsets.len * sizeof(uint32_t);
+		memcpy(p, builder.roffsets.at, builder.roffsets.len * sizeof(uint32_t));
+		p += builder.roffsets.len * sizeof(uint32_t);
+		memcpy(p, builder.entries.at, builder.entries.len);
+		index_init(result, base, size);
+		result->mapped = false;
+		*index = result;
+		if (pairs) {
+			*pairs = builder.pairs.len;
+		}
+	}
+	array_clear(builder.pairs);
+	array_clear(builder.names);
+	array_clear(builder.entries);
+	array_clear(builder.offsets);
+	array_clear(builder.roffsets);
+	return ret;
+}
+
+/** @internal Check that the name of the entry is a wire name ending at the entry name length. */
+static bool name_valid(const uint8_t *entry)
+{
+	const uint8_t *name = entry + 1;
+	const uint8_t *end = name + entry[0];
+	while (name < end && name[0] != 0) {
+		if (name[0] > KNOT_DNAME_MAXLABELLEN) {
+			return false;
+		}
+		name += 1 + name[0];
+	}
+	return name + 1 == end;
+}
+
+/** @internal Check that all entries and their names are within the image. */
+static bool index_valid(const struct hints_index *index)
+{
+	const struct hints_index_header *hdr = index->base;
+	const uint64_t size = hdr->size;
+	for (uint32_t i = 0; i < index->count; ++i) {
+		const uint64_t off = index->offsets[i];
+		if (off + 2 > size || off + 2 + index->entries[off] > size || !name_valid(index->entries + off)) {
+			return false;
+		}
+		unsigned count = 0;
+		const uint8_t *addr = hints_entry_addrs(index->entries + off, &count);
+		for (unsigned j = 0; j < count; ++j) {
+			if (addr + 1 > index->entries + size || addr + 1 + addr[0] > index->entries + size) {
+				return false;
+			}
+			addr = hints_addr_next(addr);
+		}
+	}
+	for (uint32_t i = 0; i < index->rcount; ++i) {
+		const uint64_t off = index->roffsets[i];
+		uint32_t name = 0;
+		if (off + 1 > size || off + 1 + index->entries[off] + sizeof(name) > size ||
+		    !name_valid(index->entries + off)) {
+			return false;
+		}
+		memcpy(&name, index->entries + off + 1 + index->entries[off], sizeof(name));
+		if ((uint64_t)name + 1 > size || (uint64_t)name + 1 + index->entries[name] > size ||
+		    !name_valid(index->entries + name)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int hints_index_open(struct hints_index **index, const char *path)
+{
+	if (!index || !path) {
+		return kr_error(EINVAL);
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return kr_error(errno);
+	}
+	struct stat st;
+	struct hints_index_header hdr;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(hdr) ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, HINTS_INDEX_MAGIC, sizeof(hdr.magic)) != 0) {
+		close(fd);
+		return kr_error(EILSEQ);
+	}
+	const size_t size = st.st_size;
+	if (hdr.version != HINTS_INDEX_VERSION ||
+	    sizeof(hdr) + ((uint64_t)hdr.count + hdr.rcount) * sizeof(uint32_t) + hdr.size > size) {
+		close(fd);
+		return kr_error(EILSEQ);
+	}
+	void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return kr_error(errno);
+	}
+	struct hints_index *result = malloc(sizeof(*result));
+	if (!result) {
+		munmap(base, size);
+		return kr_error(ENOMEM);
+	}
+	index_init(result, base, size);
+	result->mapped = true;
+	if (!index_valid(result)) {
+		hints_index_free(result);
+		return kr_error(EILSEQ);
+	}
+	*index = result;
+	return kr_ok();
+}
+
+int hints_index_save(const struct hints_index *index, const char *path)
+{
+	if (!index || !path) {
+		return kr_error(EINVAL);
+	}
+	char tmp[PATH_MAX];
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+		return kr_error(ENAMETOOLONG);
+	}
+	FILE *fp = fopen(tmp, "wb");
+	if (!fp) {
+		return kr_error(errno);
+	}
+	int ret = 0;
+	if (fwrite(index->base, 1, index->size, fp) != index->size) {
+		ret = kr_error(EIO);
+	}
+	if (fclose(fp) != 0 && ret == 0) {
+		ret = kr_error(EIO);
+	}
+	if (ret == 0 && rename(tmp, path) != 0) {
+		ret = kr_error(errno);
+	}
+	if (ret != 0) {
+		unlink(tmp);
+	}
+	return ret;
+}
+
+void hints_index_free(struct hints_index *index)
+{
+	if (index) {
+		if (index->mapped) {
+			munmap(index->base, index->size);
+		} else {
+			free(index->base);
+		}
+		free(index);
+	}
+}
+
+const uint8_t *hints_index_find(const struct hints_index *index, const knot_dname_t *name)
+{
+	if (!index || !name) {
+		return NULL;
+	}
+	return key_find(index->entries, index->offsets, index->count, name, knot_dname_size(name));
+}
+
+const knot_dname_t *hints_index_reverse(const struct hints_index *index, const knot_dname_t *rname)
+{
+	if (!index || !rname) {
+		return NULL;
+	}
+	const uint8_t *entry = key_find(index->entries, index->roffsets, index->rcount,
+	                                rname, knot_dname_size(rname));
+	if (!entry) {
+		return NULL;
+	}
+	uint32_t name = 0;
+	memcpy(&name, entry + 1 + entry[0], sizeof(name));
+	return index->entries + name + 1;
+}
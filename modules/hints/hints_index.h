@@ -0,0 +1,100 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libknot/dname.h>
+
+/** Compiled hints file magic and version. */
+#define HINTS_INDEX_MAGIC "KRHI"
+#define HINTS_INDEX_VERSION 1
+/** Maximum number of addresses of a name. */
+#define HINTS_INDEX_ADDRS 255
+
+/**
+ * Compiled hints file header.
+ * The header is followed by the offsets of name entries sorted by name,
+ * the offsets of reverse entries sorted by reverse name, and the entries.
+ * Name entry is the name length (1B), lowercase wire name, number of addresses (1B) and the addresses,
+ * each address is its length (1B) followed by the address bytes.
+ * Reverse entry is the reverse name length (1B), the reverse name and the name entry offset (4B).
+ * Values are in host byte order, the file is not portable between architectures.
+ */
+struct hints_index_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;  /**< Number of names */
+	uint32_t rcount; /**< Number of reverse names */
+	uint32_t size;   /**< Size of the entries */
+};
+
+/** @internal Immutable hints index, built in memory or mapped from compiled file. */
+struct hints_index {
+	void *base;
+	size_t size;
+	bool mapped;
+	uint32_t count;
+	uint32_t rcount;
+	const uint32_t *offsets;
+	const uint32_t *roffsets;
+	const uint8_t *entries;
+};
+
+/**
+ * Build index from hosts-like file.
+ * @param index  built index
+ * @param path   hosts file
+ * @param pairs  number of loaded name-address pairs (optional)
+ * @return 0 or an error code
+ */
+int hints_index_build(struct hints_index **index, const char *path, size_t *pairs);
+
+/**
+ * Map compiled index file, the mapping is read-only and shared by all processes.
+ * @return 0, kr_error(EILSEQ) if the file is not a compiled index, or an error code
+ */
+int hints_index_open(struct hints_index **index, const char *path);
+
+/** Write index into compiled file, the file is replaced atomically. */
+int hints_index_save(const struct hints_index *index, const char *path);
+
+/** Free or unmap the index. */
+void hints_index_free(struct hints_index *index);
+
+/** Find name entry for given lowercase name, or NULL. */
+const uint8_t *hints_index_find(const struct hints_index *index, const knot_dname_t *name);
+
+/** Find name for given reverse name (PTR owner), or NULL. */
+const knot_dname_t *hints_index_reverse(const struct hints_index *index, const knot_dname_t *rname);
+
+/** Make reverse name (PTR owner) of the address, the buffer must hold KNOT_DNAME_MAXLEN bytes. */
+void hints_reverse_name(knot_dname_t *dst, const uint8_t *addr, size_t addr_len);
+
+/** Return the first address of the name entry and the number of addresses. */
+static inline const uint8_t *hints_entry_addrs(const uint8_t *entry, unsigned *count)
+{
+	const uint8_t *p = entry + 1 + entry[0];
+	*count = p[0];
+	return p + 1;
+}
+
+/** Return the address following given address of the name entry. */
+static inline const uint8_t *hints_addr_next(const uint8_t *addr)
+{
+	return addr + 1 + addr[0];
+}
@@ -1,6 +1,7 @@
 # List of built-in modules
 modules_TARGETS := hints \
-                   stats
+                   stats \
+                   dns64
 
 # Memcached
 ifeq ($(HAS_libmemcached),yes)
@@ -18,7 +19,6 @@ modules_TARGETS += ketcd \
                    policy \
                    view \
                    predict \
-                   dns64 \
                    renumber \
                    http \
                    daf
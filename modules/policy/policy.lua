@@ -8,53 +8,52 @@ local function getruleid()
 	return newid
 end
 
--- Support for client sockets from inside policy actions
-local socket_client = function () return error("missing luasocket, can't create socket client") end
-local has_socket, socket = pcall(require, 'socket')
-if has_socket then
-	socket_client = function (host, port)
-		local s, err, status
-		if host:find(':') then
-			s, err = socket.udp6()
-		else
-			s, err = socket.udp()
-		end
-		if not s then
-			return nil, err
-		end
-		status, err = s:setpeername(host, port)
-		if not status then
-			return nil, err
-		end
-		return s
-	end
-end
 local has_ffi, ffi = pcall(require, 'ffi')
-if not has_ffi then
-	socket_client = function () return error("missing ffi library, required for this policy") end
-end
+local C = has_ffi and ffi.C
 
 -- Mirror request elsewhere, and continue solving
-local function mirror(target)
-	local addr, port = target:match '([^@]*)@?(.*)'
-	if not port or #port == 0 then port = 53 end
-	local sink, err = socket_client(addr, port)
-	if not sink then panic('MIRROR target %s is not a valid: %s', target, err) end
+-- Copies are queued in the worker and sent asynchronously in batches
+local function mirror(targets, opts)
+	if not has_ffi then error('missing ffi library, required for MIRROR') end
+	if type(targets) ~= 'table' then targets = {targets} end
+	local ids = {}
+	for i, target in ipairs(targets) do
+		ids[i] = worker.mirror(target, opts)
+	end
+	local wrk = ffi.cast('struct worker_ctx *', __worker)
 	return function(state, req)
 		if state == kres.FAIL then return state end
 		req = kres.request_t(req)
 		local query = req.qsource.packet
 		if query ~= nil then
-			sink:send(ffi.string(query.wire, query.size))
+			for i = 1, #ids do
+				C.worker_mirror(wrk, ids[i], query.wire, query.size)
+			end
 		end
 		return -- Chain action to next
 	end
 end
 
+-- Forward request to group of upstreams, and solve as stub query
+local function forward_group(name)
+	return function(state, req)
+		req = kres.request_t(req)
+		local qry = req:current()
+		if not qry:forward(name) then
+			return kres.FAIL
+		end
+		return state
+	end
+end
+
 -- Forward request, and solve as stub query
+-- Target that isn't an IP address names a forwarding group, it is looked up for each query
 local function forward(target)
 	local dst_ip = kres.str2ip(target)
-	if dst_ip == nil then error("FORWARD target '"..target..'" is not a valid IP address') end
+	if dst_ip == nil then
+		if not has_ffi then error("FORWARD target '"..target.."' is not a valid IP address") end
+		return forward_group(target)
+	end
 	return function(state, req)
 		req = kres.request_t(req)
 		local qry = req:current()
@@ -82,15 +81,56 @@ local policy = {
 	PASS = 1, DENY = 2, DROP = 3, TC = 4, FORWARD = forward, REROUTE = reroute, MIRROR = mirror,
 	-- Special values
 	ANY = 0,
+	-- RPZ file check interval and number of records parsed in one event loop iteration
+	RPZ_WATCH = 5 * sec,
+	RPZ_SLICE = 10000,
+}
+
+-- Query attributes for native rules, the stamp must change for each evaluation
+local pquery = has_ffi and ffi.new('struct kr_policy_query')
+local pstamp = 0
+local function policy_query(req, query)
+	pstamp = pstamp + 1
+	pquery.stamp = pstamp
+	pquery.qname = query ~= nil and query.sname or nil
+	pquery.qtype = query ~= nil and query.type or 0
+	pquery.src = req.qsource.addr
+	pquery.dst = req.qsource.dst_addr
+	return pquery
+end
+
+-- Compiled rule matcher, callable as a rule closure
+local matcher_mt = {
+	__call = function (m, req, query)
+		local code
+		if m.filter then
+			code = C.kr_policy_rule_eval(m.native, policy_query(req, query))
+		else
+			code = C.kr_policy_rule_match(m.native, query.sname)
+		end
+		if code > 0 then
+			return m.actions[code]
+		end
+	end,
 }
 
+-- Create compiled rule matcher, the action code 1 maps to given action
+local function matcher(rtype, action)
+	local rule = C.kr_policy_rule_new(rtype, 1)
+	if rule == nil then error('failed to create policy rule') end
+	return setmetatable({native=ffi.gc(rule, C.kr_policy_rule_free), actions={action}}, matcher_mt)
+end
+
 -- All requests
 function policy.all(action)
-	return function(req, query) return action end
+	if not has_ffi then
+		return function(req, query) return action end
+	end
+	return matcher(C.KR_POLICY_ALL, action)
 end
 
--- Requests which QNAME matches given zone list (i.e. suffix match)
-function policy.suffix(action, zone_list)
+-- Requests which QNAME contains any of given names (fallback for non-wire names)
+local function suffix_lua(action, zone_list)
 	local AC = require('aho-corasick')
 	local tree = AC.build(zone_list)
 	return function(req, query)
@@ -102,14 +142,36 @@ function policy.suffix(action, zone_list)
 	end
 end
 
+-- Compile list of names into suffix matcher, or return nil
+local function suffix_compile(action, zone_list, common_suffix)
+	if not has_ffi then return nil end
+	local m = matcher(C.KR_POLICY_SUFFIX, action)
+	for _, zone in ipairs(zone_list) do
+		if C.kr_policy_rule_add(m.native, zone, #zone, 0) ~= 0 then
+			return nil
+		end
+	end
+	if common_suffix and C.kr_policy_rule_common(m.native, common_suffix, #common_suffix) ~= 0 then
+		return nil
+	end
+	return m
+end
+
+-- Requests which QNAME matches given zone list (i.e. suffix match)
+function policy.suffix(action, zone_list)
+	return suffix_compile(action, zone_list) or suffix_lua(action, zone_list)
+end
+
 -- Check for common suffix first, then suffix match (specialized version of suffix match)
 function policy.suffix_common(action, suffix_list, common_suffix)
-	local common_len = string.len(common_suffix)
+	local m = suffix_compile(action, suffix_list, common_suffix)
+	if m then return m end
+	local common_len = common_suffix and string.len(common_suffix) or 0
 	local suffix_count = #suffix_list
 	return function(req, query)
 		-- Preliminary check
 		local qname = query:name()
-		if not string.find(qname, common_suffix, -common_len, true) then
+		if common_len > 0 and not string.find(qname, common_suffix, -common_len, true) then
 			return nil
 		end
 		-- String match
@@ -125,6 +187,13 @@ end
 
 -- Filter QNAME pattern
 function policy.pattern(action, pattern)
+	if has_ffi then
+		local m = matcher(C.KR_POLICY_PATTERN, action)
+		if C.kr_policy_rule_pattern(m.native, pattern, #pattern) == 0 then
+			return m
+		end
+	end
+	-- Fall back to Lua patterns that can't be compiled (back references, %b, %f)
 	return function(req, query)
 		if string.find(query:name(), pattern) then
 			return action
@@ -133,64 +202,282 @@ function policy.pattern(action, pattern)
 	end
 end
 
-local function rpz_parse(action, path)
-	local rules = {}
-	local ffi = require('ffi')
+-- Shared filter predicates, kept alive by the filters using them
+local predicates = setmetatable({}, {__mode='v'})
+
+-- Native filter predicate ('qname' matcher, 'qtype' number, 'src' or 'dst' address set), or nil
+-- Predicates with the same key are shared and evaluated once per query
+function policy.predicate(key, kind, arg)
+	if not has_ffi then return nil end
+	local p = predicates[key]
+	if p then return p end
+	local pred
+	if kind == 'qname' then
+		if getmetatable(arg) ~= matcher_mt or arg.filter then return nil end
+		pred = C.kr_policy_pred_new(C.KR_POLICY_PRED_QNAME, arg.native, 0)
+	elseif kind == 'qtype' then
+		pred = C.kr_policy_pred_new(C.KR_POLICY_PRED_QTYPE, nil, arg)
+	elseif kind == 'src' or kind == 'dst' then
+		local ptype = (kind == 'src') and C.KR_POLICY_PRED_SRC or C.KR_POLICY_PRED_DST
+		pred = C.kr_policy_pred_new(ptype, arg, 0)
+	end
+	if pred == nil then return nil end
+	p = {native=ffi.gc(pred, C.kr_policy_pred_free), ref=arg}
+	predicates[key] = p
+	return p
+end
+
+-- Filter on chain of predicates joined by 'and' / 'or' (left to right, without precedence),
+-- e.g. {p1, 'and', p2, 'or', p3}, empty chain matches all queries
+function policy.filter(action, chain)
+	local m = matcher(C.KR_POLICY_FILTER, action)
+	m.filter, m.preds = true, {}
+	local ops = {['and'] = C.KR_POLICY_OP_AND, ['or'] = C.KR_POLICY_OP_OR}
+	for i, item in ipairs(chain) do
+		local ret
+		if i % 2 == 1 then
+			table.insert(m.preds, item)
+			ret = C.kr_policy_rule_insn(m.native, C.KR_POLICY_OP_TEST, 0, item.native)
+		else
+			-- Conjunction skips the next predicate when the result is already known
+			ret = C.kr_policy_rule_insn(m.native, ops[item], 1, nil)
+		end
+		if ret ~= 0 then error('failed to compile filter') end
+	end
+	return m
+end
+
+-- Compile RPZ zone file triggers into the rule, yield after each slice of records if given
+local function rpz_parse(m, path, slice)
 	local action_map = {
 		-- RPZ Policy Actions
-		['\0'] = action,
-		['\1*\0'] = action, -- deviates from RPZ spec
-		['\012rpz-passthru\0'] = policy.PASS, -- the grammar...
-		['\008rpz-drop\0'] = policy.DROP,
-		['\012rpz-tcp-only\0'] = policy.TC,
+		['\0'] = 1,
+		['\1*\0'] = 1, -- deviates from RPZ spec
+		['\012rpz-passthru\0'] = 2, -- the grammar...
+		['\008rpz-drop\0'] = 3,
+		['\012rpz-tcp-only\0'] = 4,
 		-- Policy triggers @NYI@
 	}
 	local parser = require('zonefile').new()
 	if not parser:open(path) then error(string.format('failed to parse "%s"', path)) end
+	local records = 0
 	while parser:parse() do
-		local name = ffi.string(parser.r_owner, parser.r_owner_length)
-		local action = ffi.string(parser.r_data, parser.r_data_length)
-		rules[name] = action_map[action]
-		-- Warn when NYI
-		if #name > 1 and not action_map[action] then
+		local code = action_map[ffi.string(parser.r_data, parser.r_data_length)]
+		if code then
+			C.kr_policy_rule_add(m.native, ffi.cast('const char *', parser.r_owner), parser.r_owner_length, code)
+		elseif parser.r_owner_length > 1 then
+			-- Warn when NYI
 			print(string.format('[ rpz ] %s:%d: unsupported policy action', path, tonumber(parser.line_counter)))
 		end
+		records = records + 1
+		if slice and records % slice == 0 then
+			coroutine.yield()
+		end
 	end
-	return rules
 end
 
--- Create RPZ from zone file
-local function rpz_zonefile(action, path)
-	local rules = rpz_parse(action, path)
-	collectgarbage()
-	return function(req, query)
-		local label = query:name()
-		local action = rules[label]
-		while action == nil and string.len(label) > 0 do
-			label = string.sub(label, string.byte(label) + 2)
-			action = rules['\1*'..label]
+-- Current time in milliseconds
+local function now()
+	local tv = ffi.new('struct timeval')
+	C.gettimeofday(tv, nil)
+	return tonumber(tv.tv_sec) * 1000 + math.floor(tonumber(tv.tv_usec) / 1000)
+end
+
+-- Reload RPZ into a new rule and swap it in when it's complete, queries use the old rule until then
+local function rpz_reload(m, path)
+	local start = now()
+	local next_m = matcher(C.KR_POLICY_RPZ, m.actions[1])
+	local function finish()
+		C.kr_policy_rule_swap(m.native, next_m.native)
+		-- Retire the old matcher right away, queries are not evaluated between event loop iterations
+		C.kr_policy_rule_free(ffi.gc(next_m.native, nil))
+		next_m.native = nil
+		m.loading = nil
+		m.stats.reloads = m.stats.reloads + 1
+		m.stats.duration = now() - start
+	end
+	-- Compiled index is mapped at once
+	if C.kr_policy_rule_load(next_m.native, path) == 0 then
+		return finish()
+	end
+	-- Zone file is parsed in slices so the event loop isn't blocked
+	m.loading = true
+	local parse = coroutine.wrap(function ()
+		rpz_parse(next_m, path, policy.RPZ_SLICE)
+		return true
+	end)
+	local function step()
+		local ok, done = pcall(parse)
+		if not ok then
+			m.loading = nil
+			print(string.format('[ rpz ] %s: reload failed: %s', path, done))
+		elseif done then
+			finish()
+		else
+			event.after(0, step)
 		end
-		return action
 	end
+	step()
+end
+
+-- Create RPZ from compiled index or zone file
+local function rpz_zonefile(action, path, watch)
+	if not has_ffi then error('missing ffi library, required for RPZ') end
+	local m = matcher(C.KR_POLICY_RPZ, action)
+	m.actions = {action, policy.PASS, policy.DROP, policy.TC}
+	m.stats = {reloads = 0, duration = 0}
+	local start = now()
+	C.kr_policy_rule_changed(m.native, path)
+	if C.kr_policy_rule_load(m.native, path) ~= 0 then
+		rpz_parse(m, path)
+	end
+	m.stats.duration = now() - start
+	-- Reload when the file changes
+	if watch then
+		m.watch = event.recurrent(policy.RPZ_WATCH, function ()
+			if not m.loading and C.kr_policy_rule_changed(m.native, path) == 1 then
+				rpz_reload(m, path)
+			end
+		end)
+	end
+	return m
 end
 
 -- RPZ policy set
-function policy.rpz(action, path)
-	return rpz_zonefile(action, path)
+function policy.rpz(action, path, watch)
+	return rpz_zonefile(action, path, watch)
+end
+
+-- Apply changes to RPZ, e.g. {add = {['\3bad\3com'] = policy.DENY}, del = {'\4good\3com'}}
+function policy.rpz_update(m, delta)
+	local codes = {}
+	for code, action in ipairs(m.actions) do
+		if codes[action] == nil then codes[action] = code end
+	end
+	for _, name in ipairs(delta.del or {}) do
+		C.kr_policy_rule_del(m.native, name, #name)
+	end
+	for name, action in pairs(delta.add or {}) do
+		if codes[action] == nil then
+			table.insert(m.actions, action)
+			codes[action] = #m.actions
+		end
+		if C.kr_policy_rule_add(m.native, name, #name, codes[action]) ~= 0 then
+			error(string.format('invalid RPZ trigger "%s"', kres.dname2str(name)))
+		end
+	end
+end
+
+-- Return RPZ statistics
+function policy.rpz_stats(m)
+	return {
+		entries = tonumber(m.native.entries),
+		mapped = tonumber(m.native.mapped),
+		reloads = m.stats.reloads,
+		duration = m.stats.duration,
+		loading = m.loading == true,
+	}
+end
+
+-- Compile RPZ zone file into index that can be mapped by policy.rpz()
+function policy.rpz_compile(path, output)
+	if not has_ffi then error('missing ffi library, required for RPZ') end
+	local m = matcher(C.KR_POLICY_RPZ, policy.DENY)
+	rpz_parse(m, path)
+	local ret = C.kr_policy_rule_save(m.native, output)
+	if ret ~= 0 then
+		error(string.format('failed to write "%s": %s', output, ffi.string(C.strerror(-ret))))
+	end
+	return true
+end
+
+-- Rule description, match counter and suspension are kept in the compiled rule
+local rule_mt = {
+	__index = function (desc, k)
+		if k == 'count' then
+			return tonumber(desc.native.count)
+		elseif k == 'suspended' then
+			return desc.native.suspended
+		end
+	end,
+	__newindex = function (desc, k, v)
+		if k == 'count' then
+			desc.native.count = v
+		elseif k == 'suspended' then
+			desc.native.suspended = (v and true or false)
+		else
+			rawset(desc, k, v)
+		end
+	end,
+}
+
+-- Compiled rule lists, each change of the list bumps its generation and the list is rebuilt on next use
+local compiled = setmetatable({}, {__mode='k'})
+local built = setmetatable({}, {__mode='k'})
+local generation = setmetatable({}, {__mode='k'})
+local function changed(rules)
+	generation[rules] = (generation[rules] or 0) + 1
+end
+local function compile(rules)
+	compiled[rules] = nil
+	built[rules] = generation[rules]
+	if not has_ffi then return nil end
+	local set = ffi.gc(ffi.new('kr_policy_set_t'), C.kr_policy_set_clear)
+	for i = 1, #rules do
+		local native = rawget(rules[i], 'native')
+		if native == nil or C.kr_policy_set_push(set, native) ~= 0 then
+			return nil
+		end
+	end
+	compiled[rules] = set
+	return set
+end
+
+-- Return compiled rule list (or nil if it can't be compiled), rebuilt if the list has changed
+function policy.compiled(rules)
+	if built[rules] ~= generation[rules] then
+		return compile(rules)
+	end
+	return compiled[rules]
+end
+
+-- Evaluate rule and enforce its action, returns next state if it's not a chain rule
+local function apply(rule, action, req, state)
+	if action ~= nil then
+		rule.count = rule.count + 1
+		return policy.enforce(state, req, action)
+	end
 end
 
 -- Evaluate packet in given rules to determine policy action
+local code = has_ffi and ffi.new('int[1]')
 function policy.evaluate(rules, req, query, state)
+	local set = policy.compiled(rules)
+	-- Compiled rules are matched natively, only external rules are called
+	if set ~= nil then
+		local q = policy_query(req, query)
+		local i = C.kr_policy_eval(set, 0, q, code)
+		while i >= 0 do
+			local rule = rules[i + 1]
+			local next_state
+			if code[0] == 0 then
+				next_state = apply(rule, rule.cb(req, query), req, state)
+			else
+				next_state = policy.enforce(state, req, rule.cb.actions[code[0]])
+			end
+			if next_state then    -- Not a chain rule,
+				return next_state -- stop on first match
+			end
+			i = C.kr_policy_eval(set, i + 1, q, code)
+		end
+		return state
+	end
 	for i = 1, #rules do
 		local rule = rules[i]
 		if not rule.suspended then
-			local action = rule.cb(req, query)
-			if action ~= nil then
-				rule.count = rule.count + 1
-				local next_state = policy.enforce(state, req, action)
-				if next_state then    -- Not a chain rule,
-					return next_state -- stop on first match
-				end
+			local next_state = apply(rule, rule.cb(req, query), req, state)
+			if next_state then    -- Not a chain rule,
+				return next_state -- stop on first match
 			end
 		end
 	end
@@ -237,6 +524,23 @@ policy.layer = {
 	end
 }
 
+-- Create rule description
+local function newrule(rule)
+	local desc = {id=getruleid(), cb=rule, count=0}
+	if has_ffi then
+		desc.count = nil
+		if getmetatable(rule) == matcher_mt then
+			desc.native = rule.native
+		else
+			local native = C.kr_policy_rule_new(C.KR_POLICY_EXTERN, 1)
+			if native == nil then error('failed to create policy rule') end
+			desc.native = ffi.gc(native, C.kr_policy_rule_free)
+		end
+		setmetatable(desc, rule_mt)
+	end
+	return desc
+end
+
 -- Add rule to policy list
 function policy.add(rule, postrule)
 	-- Compatibility with 1.0.0 API
@@ -246,20 +550,38 @@ function policy.add(rule, postrule)
 		postrule = nil
 	end
 	-- End of compatibility shim
-	local desc = {id=getruleid(), cb=rule, count=0}
-	table.insert(postrule and policy.postrules or policy.rules, desc)
+	local desc = newrule(rule)
+	local rules = postrule and policy.postrules or policy.rules
+	table.insert(rules, desc)
+	changed(rules)
 	return desc
 end
 
--- Remove rule from a list
-local function delrule(rules, id)
+-- Find rule in a list
+local function findrule(rules, id)
 	for i, r in ipairs(rules) do
 		if r.id == id then
-			table.remove(rules, i)
-			return true
+			return i
 		end
 	end
-	return false
+end
+
+-- Remove rule from a list
+local function delrule(rules, id)
+	local i = findrule(rules, id)
+	if i == nil then return false end
+	table.remove(rules, i)
+	changed(rules)
+	return true
+end
+
+-- Replace rule in a list, the new rule takes its place
+local function replacerule(rules, id, rule)
+	local i = findrule(rules, id)
+	if i == nil then return nil end
+	rules[i] = newrule(rule)
+	changed(rules)
+	return rules[i]
 end
 
 -- Delete rule from policy list
@@ -272,6 +594,49 @@ function policy.del(id)
 	return true
 end
 
+-- Replace rule in policy list, keeping its position
+function policy.replace(id, rule)
+	return replacerule(policy.rules, id, rule) or replacerule(policy.postrules, id, rule)
+end
+
+-- Define group of upstreams for FORWARD, e.g. {'192.0.2.1', '2001:db8::1@5353'}
+function policy.forward_group(name, targets)
+	if not has_ffi then error('missing ffi library, required for forwarding groups') end
+	local addrs = ffi.new('const char *[?]', #targets)
+	local ports = ffi.new('uint16_t[?]', #targets)
+	local strings = {} -- Anchor strings until the group is built
+	for i, target in ipairs(targets) do
+		local addr, port = target:match '([^@]*)@?(.*)'
+		if not port or #port == 0 then port = 53 end
+		if kres.str2ip(addr) == nil or not tonumber(port) then
+			error(string.format('FORWARD group "%s" target "%s" is not valid', name, target))
+		end
+		strings[i] = addr
+		addrs[i - 1] = addr
+		ports[i - 1] = tonumber(port)
+	end
+	-- Replace whole group at once, queries in flight keep the previous definition
+	local ret = ffi.C.kr_nsrep_group_set(kres.context(), name, addrs, ports, #targets)
+	if ret ~= 0 then
+		error(string.format('FORWARD group "%s" can\'t be defined (error %d)', name, ret))
+	end
+	return name
+end
+
+-- Return forwarding group statistics
+function policy.forward_stats(name)
+	if not has_ffi then return nil end
+	local group = ffi.C.kr_nsrep_group_get(kres.context(), name)
+	if group == nil then return nil end
+	return {
+		upstreams = tonumber(group.count),
+		queries = tonumber(group.stats.queries),
+		answered = tonumber(group.stats.answered),
+		failover = tonumber(group.stats.failover),
+		servfail = tonumber(group.stats.servfail),
+	}
+end
+
 -- Convert list of string names to domain names
 function policy.todnames(names)
 	for i, v in ipairs(names) do
@@ -15,19 +15,53 @@ function view.tsig(view, tsig, policy)
 	view.key[tsig] = policy
 end
 
--- @function View based on source IP subnet.
+-- @function Create native subnet set
+local function net_new()
+	return ffi.gc(C.kr_policy_net_new(), C.kr_policy_net_free)
+end
+
+-- @function Add subnet, list of subnets or comma-separated subnets to the set
+local function net_add(net, subnet, value)
+	if type(subnet) == 'string' then
+		local list = {}
+		for s in subnet:gmatch('[^,%s]+') do table.insert(list, s) end
+		subnet = list
+	end
+	for _, s in ipairs(subnet) do
+		local ret = C.kr_policy_net_add(net, s, value)
+		if ret ~= 0 then
+			error(string.format('invalid subnet "%s": %s', s, ffi.string(C.strerror(-ret))))
+		end
+	end
+end
+
+-- @function Return subnet set and policy list for source or destination
+local function view_net(view, dst)
+	local key = dst and 'dst_net' or 'src_net'
+	if view[key] == nil then
+		view[key] = net_new()
+	end
+	return view[key], dst and view.dst or view.src
+end
+
+-- @function View based on source IP subnet (or a list of subnets).
+-- The most specific subnet containing the address wins.
 function view.addr(view, subnet, policy, dst)
-	local subnet_cd = ffi.new('char[16]')
-	local family = C.kr_straddr_family(subnet)
-	local bitlen = C.kr_straddr_subnet(subnet_cd, subnet)
-	local t = {family, subnet_cd, bitlen, policy}
-	table.insert(dst and view.dst or view.src, t)
-	return t
+	local net, list = view_net(view, dst)
+	table.insert(list, policy)
+	net_add(net, subnet, #list)
+	return #list
 end
 
--- @function Match IP against given subnet
-local function match_subnet(family, subnet, bitlen, addr)
-	return (family == addr:family()) and (C.kr_bitcmp(subnet, addr:ip(), bitlen) == 0)
+-- @function View based on subnets from file, one subnet per line.
+function view.addr_load(view, path, policy, dst)
+	local net, list = view_net(view, dst)
+	table.insert(list, policy)
+	local ret = C.kr_policy_net_load(net, path, #list)
+	if ret < 0 then
+		error(string.format('failed to load "%s": %s', path, ffi.string(C.strerror(-ret))))
+	end
+	return #list
 end
 
 -- @function Find view for given request
@@ -37,34 +71,31 @@ local function evaluate(view, req)
 	-- Search subnets otherwise
 	if match_cb == nil then
 		if req.qsource.addr ~= nil then
-			for i = 1, #view.src do
-				local pair = view.src[i]
-				if match_subnet(pair[1], pair[2], pair[3], req.qsource.addr) then
-					match_cb = pair[4]
-					break
-				end
+			if view.src_net ~= nil then
+				match_cb = view.src[C.kr_policy_net_match(view.src_net, req.qsource.addr)]
 			end
 		elseif req.qsource.dst_addr ~= nil then
-			for i = 1, #view.dst do
-				local pair = view.dst[i]
-				if match_subnet(pair[1], pair[2], pair[3], req.qsource.dst_addr) then
-					match_cb = pair[4]
-					break
-				end
+			if view.dst_net ~= nil then
+				match_cb = view.dst[C.kr_policy_net_match(view.dst_net, req.qsource.dst_addr)]
 			end
 		end
 	end
 	return match_cb
 end
 
+-- @function Return native set of given subnets
+function view.subnet(subnet)
+	local net = net_new()
+	net_add(net, subnet, 1)
+	return net
+end
+
 -- @function Return policy based on source address
 function view.rule_src(action, subnet)
-	local subnet_cd = ffi.new('char[16]')
-	local family = C.kr_straddr_family(subnet)
-	local bitlen = C.kr_straddr_subnet(subnet_cd, subnet)
+	local net = view.subnet(subnet)
 	return function(req, _)
 		local addr = req.qsource.addr
-		if addr ~= nil and match_subnet(family, subnet_cd, bitlen, addr) then
+		if addr ~= nil and C.kr_policy_net_match(net, addr) ~= 0 then
 			return action
 		end
 	end
@@ -72,12 +103,10 @@ end
 
 -- @function Return policy based on destination address
 function view.rule_dst(action, subnet)
-	local subnet_cd = ffi.new('char[16]')
-	local family = C.kr_straddr_family(subnet)
-	local bitlen = C.kr_straddr_subnet(subnet_cd, subnet)
+	local net = view.subnet(subnet)
 	return function(req, _)
 		local addr = req.qsource.dst_addr
-		if addr ~= nil and match_subnet(family, subnet_cd, bitlen, addr) then
+		if addr ~= nil and C.kr_policy_net_match(net, addr) ~= 0 then
 			return action
 		end
 	end
@@ -0,0 +1,30 @@
+#!/usr/bin/env luajit
+cli_bin = 'kresd -q -c -'
+-- Work around OS X stripping dyld variables
+libdir = os.getenv('DYLD_LIBRARY_PATH')
+if libdir then
+	cli_bin = string.format('DYLD_LIBRARY_PATH="%s" %s', libdir, cli_bin)
+end
+cli_cmd = [[echo '
+if not policy then modules.load("policy") end
+local ok, err = pcall(policy.rpz_compile, "%s", "%s")
+if not ok then
+	print(err)
+	os.exit(1)
+end
+quit()']]
+-- Parse CLI arguments
+local function help()
+	name = 'kresd-rpz.lua'
+	print(string.format('Usage: %s <zonefile> <output>', name))
+	print('Compile RPZ zone file into index for policy.rpz().')
+	print('The index is replaced atomically, so it can be updated while resolvers are running.')
+	print('')
+	print('Options:')
+	print('\t-h,--help        ... print this help')
+	print('Examples:')
+	print('\t'..name..' blocklist.rpz blocklist.krpz')
+end
+if #arg < 2 or arg[1] == '-h' or arg[1] == '--help' then help() return 1 end
+cli_cmd = string.format(cli_cmd, arg[1], arg[2])
+return os.execute(cli_cmd..' | '..cli_bin)
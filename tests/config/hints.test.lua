@@ -0,0 +1,36 @@
+-- Hints set at runtime take precedence over the hosts file for each address family
+-- Executed by 'make check-config', exits with non-zero status on failure
+local failed = 0
+local function ok(cond, desc)
+	print((cond and 'ok - ' or 'not ok - ')..desc)
+	if not cond then failed = failed + 1 end
+end
+local function has(list, addr)
+	for _, v in ipairs(list or {}) do
+		if v == addr then return true end
+	end
+	return false
+end
+
+local path = os.tmpname()
+local hosts = io.open(path, 'w')
+hosts:write('127.0.0.1 localhost\n192.0.2.1 example.com\n')
+hosts:close()
+
+modules.load('hints')
+hints.config(path)
+os.remove(path)
+local addrs = hints.get('localhost')
+ok(has(addrs, '127.0.0.1'), 'hosts file is loaded')
+
+-- IPv6 hint leaves the IPv4 address from the file in place
+ok(hints.set('localhost ::1').result, 'runtime hint is set')
+addrs = hints.get('localhost')
+ok(has(addrs, '::1') and has(addrs, '127.0.0.1'), 'other address family falls back to the file')
+
+-- IPv4 hint replaces the IPv4 addresses from the file
+hints.set('Example.com 192.0.2.2')
+addrs = hints.get('example.com')
+ok(has(addrs, '192.0.2.2') and not has(addrs, '192.0.2.1'), 'runtime hint shadows its address family')
+ok(hints.get('nonexistent.example') == nil, 'missing name has no hints')
+os.exit(failed == 0 and 0 or 1)
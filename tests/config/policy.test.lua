@@ -0,0 +1,32 @@
+-- Compiled policy rule lists follow every change of the list
+-- Executed by 'make check-config', exits with non-zero status on failure
+package.path = os.getenv('SOURCE_PATH')..'/modules/policy/?.lua;'..package.path
+local policy = require('policy')
+
+local failed = 0
+local function ok(cond, desc)
+	print((cond and 'ok - ' or 'not ok - ')..desc)
+	if not cond then failed = failed + 1 end
+end
+
+local rules = policy.rules
+local a = policy.add(policy.suffix(policy.DENY, {'\7example\3com'}))
+local b = policy.add(policy.suffix(policy.PASS, {'\7example\3net'}))
+local set = policy.compiled(rules)
+ok(set ~= nil and tonumber(set.len) == 2, 'rule list is compiled')
+ok(set.at[0] == a.native and set.at[1] == b.native, 'compiled rules are in order')
+ok(policy.compiled(rules) == set, 'unchanged rule list is not rebuilt')
+
+-- Replacement keeps the length of the list
+local c = policy.replace(a.id, policy.suffix(policy.DROP, {'\7example\3org'}))
+set = policy.compiled(rules)
+ok(c ~= nil and tonumber(set.len) == 2 and set.at[0] == c.native, 'replaced rule is compiled in place')
+
+-- Deletion followed by addition keeps the length too
+policy.del(b.id)
+local d = policy.add(policy.pattern(policy.DENY, 'bad'))
+set = policy.compiled(rules)
+ok(tonumber(set.len) == 2 and set.at[0] == c.native and set.at[1] == d.native, 'deleted rule is not compiled')
+
+ok(policy.replace(-1, policy.all(policy.DENY)) == nil, 'unknown rule is not replaced')
+os.exit(failed == 0 and 0 or 1)
@@ -0,0 +1,335 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <ucw/mempool.h>
+#include <libknot/packet/pkt.h>
+#include <libknot/packet/wire.h>
+
+#include "tests/test.h"
+#include "lib/cache.h"
+#include "lib/module.h"
+#include "lib/resolve.h"
+#include "lib/layer.h"
+
+/* Module is linked into the test */
+KR_EXPORT int dns64_init(struct kr_module *module);
+KR_EXPORT int dns64_config(struct kr_module *module, const char *conf);
+KR_EXPORT int dns64_deinit(struct kr_module *module);
+KR_EXPORT const knot_layer_api_t *dns64_layer(struct kr_module *module);
+
+#define NAME (const knot_dname_t *)"\x04""ipv4""\x04""test"
+#define NOW 1000000
+#define A_TTL 30
+#define CONFIG "{\"prefix\": [\"64:ff9b::/96\", \"2001:db8:64::/64\"], \"exclude\": [\"10.0.0.0/8\"]}"
+
+/* SOA with root names, negative TTL 60 */
+static const uint8_t soa_rdata[] = {
+	0, 0,
+	0, 0, 0, 1,  0, 0, 0x0e, 0x10,  0, 0, 0x07, 0x08,  0, 0x12, 0x75, 0,  0, 0, 0, 60,
+};
+
+struct dns64_run {
+	struct kr_module module;
+	const knot_layer_api_t *api;
+	struct kr_request req;
+	struct mempool *mp;
+};
+
+static void dns64_begin(struct dns64_run *run, const char *conf)
+{
+	memset(run, 0, sizeof(*run));
+	assert_int_equal(dns64_init(&run->module), 0);
+	assert_int_equal(dns64_config(&run->module, conf), 0);
+	run->api = dns64_layer(&run->module);
+	assert_non_null(run->api);
+	run->module.layer = dns64_layer;
+
+	run->mp = mp_new(4096);
+	run->req.pool.ctx = run->mp;
+	run->req.pool.alloc = (knot_mm_alloc_t) mp_alloc;
+	kr_rplan_init(&run->req.rplan, &run->req, &run->req.pool);
+	run->req.answer = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, &run->req.pool);
+	assert_non_null(run->req.answer);
+}
+
+static void dns64_end(struct dns64_run *run)
+{
+	kr_rplan_deinit(&run->req.rplan);
+	mp_delete(run->mp);
+	dns64_deinit(&run->module);
+}
+
+static struct kr_query *dns64_query(struct dns64_run *run, uint16_t type, uint32_t now)
+{
+	struct kr_query *qry = kr_rplan_push(&run->req.rplan, NULL, NAME, KNOT_CLASS_IN, type);
+	assert_non_null(qry);
+	qry->timestamp.tv_sec = now;
+	run->req.current_query = qry;
+	return qry;
+}
+
+static knot_pkt_t *dns64_pkt(struct dns64_run *run, uint16_t type)
+{
+	knot_pkt_t *pkt = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, &run->req.pool);
+	assert_non_null(pkt);
+	assert_int_equal(knot_pkt_put_question(pkt, NAME, KNOT_CLASS_IN, type), 0);
+	knot_wire_set_qr(pkt->wire);
+	return pkt;
+}
+
+static void put_rr(knot_pkt_t *pkt, uint16_t type, const uint8_t *rdata, uint16_t rdlen, uint32_t ttl)
+{
+	knot_rrset_t *rr = knot_rrset_new(NAME, type, KNOT_CLASS_IN, &pkt->mm);
+	assert_non_null(rr);
+	assert_int_equal(knot_rrset_add_rdata(rr, rdata, rdlen, ttl, &pkt->mm), 0);
+	assert_int_equal(knot_pkt_put(pkt, 0, rr, KNOT_PF_FREE), 0);
+}
+
+static int dns64_call(struct dns64_run *run, knot_pkt_t *pkt, int state)
+{
+	knot_layer_t layer = { .mm = &run->req.pool, .state = state, .data = &run->req, .api = run->api };
+	if (state == KNOT_STATE_PRODUCE) {
+		return run->api->produce(&layer, pkt);
+	}
+	return run->api->consume(&layer, pkt);
+}
+
+/** Run the layers of all modules in order, like ITERATE_LAYERS() in lib/resolve.c. */
+static int chain_call(struct dns64_run *run, knot_pkt_t *pkt, int state)
+{
+	module_array_t *modules = run->req.ctx->modules;
+	const bool produce = (state == KNOT_STATE_PRODUCE);
+	for (size_t i = 0; i < modules->len; ++i) {
+		struct kr_module *mod = modules->at[i];
+		knot_layer_t layer = { .mm = &run->req.pool, .state = state, .data = &run->req, .api = mod->layer(mod) };
+		int (*func)(knot_layer_t *, knot_pkt_t *) = produce ? layer.api->produce : layer.api->consume;
+		if (func) {
+			state = func(&layer, pkt);
+		}
+	}
+	return state;
+}
+
+/** Check that the answer holds AAAA records synthesized from 192.0.2.1 for both prefixes. */
+static void check_synth(const knot_pkt_t *pkt, uint32_t ttl)
+{
+	const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+	assert_int_equal(an->count, 1);
+	const knot_rrset_t *rr = knot_pkt_rr(an, 0);
+	assert_int_equal(rr->type, KNOT_RRTYPE_AAAA);
+	assert_int_equal(rr->rrs.rr_count, 2);
+
+	static const char *expect[] = { "64:ff9b::c000:201", "2001:db8:64:0:c0:2:100:0" };
+	for (unsigned i = 0; i < 2; ++i) {
+		uint8_t addr[16];
+		assert_int_equal(inet_pton(AF_INET6, expect[i], addr), 1);
+		const knot_rdata_t *rd = knot_rdataset_at(&rr->rrs, i);
+		assert_int_equal(knot_rdata_rdlen(rd), sizeof(addr));
+		assert_memory_equal(knot_rdata_data(rd), addr, sizeof(addr));
+		assert_int_equal(knot_rdata_ttl(rd), ttl);
+	}
+}
+
+static void test_dns64_config(void **state)
+{
+	struct kr_module module;
+	memset(&module, 0, sizeof(module));
+	assert_int_equal(dns64_init(&module), 0);
+
+	assert_int_equal(dns64_config(&module, "64:ff9b::"), 0);
+	assert_int_equal(dns64_config(&module, "64:ff9b::/64"), 0);
+	assert_int_equal(dns64_config(&module, CONFIG), 0);
+	assert_int_equal(dns64_config(&module, ""), 0);
+
+	/* RFC 6052 prefix lengths only */
+	assert_int_equal(dns64_config(&module, "64:ff9b::/33"), kr_error(EINVAL));
+	assert_int_equal(dns64_config(&module, "192.0.2.0/24"), kr_error(EINVAL));
+	assert_int_equal(dns64_config(&module, "{\"exclude\": [\"10.0.0.0/8\"]}"), kr_error(EINVAL));
+
+	/* Limited number of prefixes */
+	static const char *too_many = "[\"64:ff9b::\", \"64:ff9b:1::\", \"64:ff9b:2::\", \"64:ff9b:3::\","
+	                              " \"64:ff9b:4::\", \"64:ff9b:5::\", \"64:ff9b:6::\", \"64:ff9b:7::\", \"64:ff9b:8::\"]";
+	assert_int_equal(dns64_config(&module, too_many), kr_error(ENOSPC));
+
+	dns64_deinit(&module);
+}
+
+static void test_dns64_synth(void **state)
+{
+	struct dns64_run run;
+	dns64_begin(&run, CONFIG);
+
+	/* AAAA NODATA answer plans the A sub-query */
+	struct kr_query *qry = dns64_query(&run, KNOT_RRTYPE_AAAA, NOW);
+	qry->flags |= QUERY_RESOLVED;
+	knot_pkt_t *pkt = dns64_pkt(&run, KNOT_RRTYPE_AAAA);
+	assert_int_equal(knot_pkt_begin(pkt, KNOT_AUTHORITY), 0);
+	put_rr(pkt, KNOT_RRTYPE_SOA, soa_rdata, sizeof(soa_rdata), 300);
+	assert_int_equal(dns64_call(&run, pkt, KNOT_STATE_DONE), KNOT_STATE_DONE);
+	assert_int_equal(run.req.rplan.pending.len, 2);
+	struct kr_query *sub = array_tail(run.req.rplan.pending);
+	assert_int_equal(sub->stype, KNOT_RRTYPE_A);
+	assert_true(sub->parent == qry);
+
+	/* A answer is synthesized for each prefix, excluded subnet is skipped */
+	static const uint8_t addr[4] = { 192, 0, 2, 1 };
+	static const uint8_t addr_excluded[4] = { 10, 0, 0, 1 };
+	sub->flags |= QUERY_RESOLVED;
+	sub->timestamp.tv_sec = NOW;
+	run.req.current_query = sub;
+	pkt = dns64_pkt(&run, KNOT_RRTYPE_A);
+	assert_int_equal(knot_pkt_begin(pkt, KNOT_ANSWER), 0);
+	put_rr(pkt, KNOT_RRTYPE_A, addr, sizeof(addr), A_TTL);
+	put_rr(pkt, KNOT_RRTYPE_A, addr_excluded, sizeof(addr_excluded), A_TTL);
+	assert_int_equal(dns64_call(&run, pkt, KNOT_STATE_DONE), KNOT_STATE_DONE);
+	check_synth(run.req.answer, A_TTL);
+
+	dns64_end(&run);
+}
+
+static void test_dns64_cache(void **state)
+{
+	struct dns64_run run;
+	dns64_begin(&run, CONFIG);
+
+	/* Nothing is cached before the NODATA answer */
+	dns64_query(&run, KNOT_RRTYPE_AAAA, NOW);
+	knot_pkt_t *pkt = dns64_pkt(&run, KNOT_RRTYPE_AAAA);
+	assert_int_equal(dns64_call(&run, pkt, KNOT_STATE_PRODUCE), KNOT_STATE_PRODUCE);
+
+	/* Resolve the NODATA answer and its A sub-query */
+	struct kr_query *qry = run.req.current_query;
+	qry->flags |= QUERY_RESOLVED;
+	assert_int_equal(knot_pkt_begin(pkt, KNOT_AUTHORITY), 0);
+	put_rr(pkt, KNOT_RRTYPE_SOA, soa_rdata, sizeof(soa_rdata), 300);
+	dns64_call(&run, pkt, KNOT_STATE_DONE);
+	struct kr_query *sub = array_tail(run.req.rplan.pending);
+	sub->flags |= QUERY_RESOLVED;
+	sub->timestamp.tv_sec = NOW;
+	run.req.current_query = sub;
+	static const uint8_t addr[4] = { 192, 0, 2, 1 };
+	pkt = dns64_pkt(&run, KNOT_RRTYPE_A);
+	assert_int_equal(knot_pkt_begin(pkt, KNOT_ANSWER), 0);
+	put_rr(pkt, KNOT_RRTYPE_A, addr, sizeof(addr), A_TTL);
+	dns64_call(&run, pkt, KNOT_STATE_DONE);
+
+	/* Repeated query is answered from the cache with the remaining TTL */
+	qry = dns64_query(&run, KNOT_RRTYPE_AAAA, NOW + 10);
+	pkt = dns64_pkt(&run, KNOT_RRTYPE_AAAA);
+	assert_int_equal(dns64_call(&run, pkt, KNOT_STATE_PRODUCE), KNOT_STATE_DONE);
+	assert_true(qry->flags & QUERY_CACHED);
+	assert_false(qry->flags & QUERY_DNSSEC_WANT);
+	check_synth(pkt, A_TTL - 10);
+
+	/* Expired A records aren't used, the query is resolved again */
+	dns64_query(&run, KNOT_RRTYPE_AAAA, NOW + A_TTL);
+	pkt = dns64_pkt(&run, KNOT_RRTYPE_AAAA);
+	assert_int_equal(dns64_call(&run, pkt, KNOT_STATE_PRODUCE), KNOT_STATE_PRODUCE);
+
+	/* Sub-queries are never answered from the cache */
+	dns64_query(&run, KNOT_RRTYPE_AAAA, NOW + 10)->parent = qry;
+	pkt = dns64_pkt(&run, KNOT_RRTYPE_AAAA);
+	assert_int_equal(dns64_call(&run, pkt, KNOT_STATE_PRODUCE), KNOT_STATE_PRODUCE);
+
+	/* Reconfiguration flushes the cache */
+	assert_int_equal(dns64_config(&run.module, CONFIG), 0);
+	dns64_query(&run, KNOT_RRTYPE_AAAA, NOW + 10);
+	pkt = dns64_pkt(&run, KNOT_RRTYPE_AAAA);
+	assert_int_equal(dns64_call(&run, pkt, KNOT_STATE_PRODUCE), KNOT_STATE_PRODUCE);
+
+	dns64_end(&run);
+}
+
+static void test_dns64_chain(void **state)
+{
+	struct dns64_run run;
+	dns64_begin(&run, CONFIG);
+
+	/* Packet cache is in front of the module, as in the daemon */
+	knot_mm_t mm;
+	test_mm_ctx_init(&mm);
+	const char *path = test_tmpdir_create();
+	assert_non_null(path);
+	struct kr_cdb_opts opts = { path, 1 << 20 };
+	struct kr_context ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	assert_int_equal(kr_cache_open(&ctx.cache, NULL, &opts, &mm), 0);
+	struct kr_module pktcache;
+	memset(&pktcache, 0, sizeof(pktcache));
+	assert_int_equal(kr_module_load(&pktcache, "pktcache", NULL), 0);
+	module_array_t modules;
+	array_init(modules);
+	array_push(modules, &pktcache);
+	array_push(modules, &run.module);
+	ctx.modules = &modules;
+	run.req.ctx = &ctx;
+
+	/* Authoritative NODATA answer is cached and plans the A sub-query, the iterator resolves the query */
+	struct kr_query *qry = dns64_query(&run, KNOT_RRTYPE_AAAA, NOW);
+	knot_pkt_t *pkt = dns64_pkt(&run, KNOT_RRTYPE_AAAA);
+	assert_int_equal(chain_call(&run, pkt, KNOT_STATE_PRODUCE), KNOT_STATE_PRODUCE);
+	knot_wire_set_aa(pkt->wire);
+	assert_int_equal(knot_pkt_begin(pkt, KNOT_AUTHORITY), 0);
+	put_rr(pkt, KNOT_RRTYPE_SOA, soa_rdata, sizeof(soa_rdata), 300);
+	qry->flags |= QUERY_RESOLVED;
+	chain_call(&run, pkt, KNOT_STATE_CONSUME);
+	assert_int_equal(run.req.rplan.pending.len, 2);
+	struct kr_query *sub = array_tail(run.req.rplan.pending);
+	sub->flags |= QUERY_RESOLVED;
+	sub->timestamp.tv_sec = NOW;
+	run.req.current_query = sub;
+	static const uint8_t addr[4] = { 192, 0, 2, 1 };
+	pkt = dns64_pkt(&run, KNOT_RRTYPE_A);
+	assert_int_equal(knot_pkt_begin(pkt, KNOT_ANSWER), 0);
+	put_rr(pkt, KNOT_RRTYPE_A, addr, sizeof(addr), A_TTL);
+	chain_call(&run, pkt, KNOT_STATE_CONSUME);
+	check_synth(run.req.answer, A_TTL);
+
+	/* Repeated query gets the NODATA answer from the packet cache, the module leaves it intact
+	 * and synthesizes the answer without the A sub-query */
+	run.req.answer = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, &run.req.pool);
+	assert_non_null(run.req.answer);
+	qry = dns64_query(&run, KNOT_RRTYPE_AAAA, NOW + 10);
+	pkt = dns64_pkt(&run, KNOT_RRTYPE_AAAA);
+	assert_int_equal(chain_call(&run, pkt, KNOT_STATE_PRODUCE), KNOT_STATE_DONE);
+	assert_true(qry->flags & QUERY_CACHED);
+	assert_int_equal(knot_pkt_section(pkt, KNOT_ANSWER)->count, 0);
+	assert_int_equal(knot_wire_get_ancount(pkt->wire), 0);
+	const size_t pending = run.req.rplan.pending.len;
+	qry->flags |= QUERY_RESOLVED;
+	chain_call(&run, pkt, KNOT_STATE_CONSUME);
+	assert_int_equal(run.req.rplan.pending.len, pending);
+	check_synth(run.req.answer, A_TTL - 10);
+
+	array_clear(modules);
+	kr_module_unload(&pktcache);
+	kr_cache_close(&ctx.cache);
+	test_tmpdir_remove(path);
+	dns64_end(&run);
+}
+
+int main(void)
+{
+	const UnitTest tests[] = {
+		unit_test(test_dns64_config),
+		unit_test(test_dns64_synth),
+		unit_test(test_dns64_cache),
+		unit_test(test_dns64_chain),
+	};
+
+	return run_tests(tests);
+}
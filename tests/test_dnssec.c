@@ -0,0 +1,298 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ucw/mempool.h>
+#include <libknot/packet/pkt.h>
+#include <libknot/packet/wire.h>
+
+#include "tests/test.h"
+#include "lib/dnssec.h"
+#include "lib/dnssec/nsec3.h"
+#include "lib/module.h"
+#include "lib/resolve.h"
+#include "lib/layer.h"
+
+#define ZONE (const knot_dname_t *)"\x04""test"
+
+/* DNSKEY with a private algorithm (not supported) */
+static const uint8_t key_private_alg[] = {
+	0x01, 0x01, 3, 253,
+	0xde, 0xad, 0xbe, 0xef, 0xde, 0xad, 0xbe, 0xef,
+};
+
+/* DNSKEY truncated in the header */
+static const uint8_t key_malformed[] = { 0x01, 0x01, 3 };
+
+/** Validate the zone DNSKEY set consisting of the single key, return the result. */
+static int validate_with_key(const uint8_t *rdata, uint16_t rdlen)
+{
+	knot_pkt_t *pkt = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, NULL);
+	assert_non_null(pkt);
+	knot_rrset_t *keys = knot_rrset_new(ZONE, KNOT_RRTYPE_DNSKEY, KNOT_CLASS_IN, NULL);
+	assert_non_null(keys);
+	assert_int_equal(knot_rrset_add_rdata(keys, rdata, rdlen, 3600, NULL), 0);
+
+	kr_rrset_validation_ctx_t vctx = {
+		.pkt		= pkt,
+		.section_id	= KNOT_ANSWER,
+		.keys		= keys,
+		.zone_name	= ZONE,
+		.timestamp	= 0,
+		.has_nsec3	= false,
+		.flags		= 0,
+		.result		= 0
+	};
+	int ret = kr_rrset_validate_with_key(&vctx, keys, 0, NULL);
+	assert_int_equal(ret, vctx.result);
+
+	knot_rrset_free(&keys, NULL);
+	knot_pkt_free(&pkt);
+	return ret;
+}
+
+static void test_key_error(void **state)
+{
+	/* The error from parsing the key is reported as is, not as a memory error. */
+	const int expect = kr_dnssec_key_tag(KNOT_RRTYPE_DNSKEY, key_private_alg, sizeof(key_private_alg));
+	assert_true(expect < 0);
+	assert_int_not_equal(expect, kr_error(ENOMEM));
+	assert_int_equal(validate_with_key(key_private_alg, sizeof(key_private_alg)), expect);
+}
+
+static void test_key_malformed(void **state)
+{
+	const int expect = kr_dnssec_key_tag(KNOT_RRTYPE_DNSKEY, key_malformed, sizeof(key_malformed));
+	assert_true(expect < 0);
+	assert_int_not_equal(expect, kr_error(ENOMEM));
+	assert_int_equal(validate_with_key(key_malformed, sizeof(key_malformed)), expect);
+}
+
+static void test_key_not_cached(void **state)
+{
+	/* Keys that can't be parsed are never remembered. */
+	const uint32_t key_hit = kr_dnssec_stats()->key_hit;
+	const uint32_t key_miss = kr_dnssec_stats()->key_miss;
+	validate_with_key(key_private_alg, sizeof(key_private_alg));
+	validate_with_key(key_private_alg, sizeof(key_private_alg));
+	assert_int_equal(kr_dnssec_stats()->key_hit, key_hit);
+	assert_int_equal(kr_dnssec_stats()->key_miss, key_miss + 2);
+}
+
+/** Make response with a NSEC3 record with given iterations in the authority section. */
+static knot_pkt_t *nsec3_response(uint16_t iterations)
+{
+	static const knot_dname_t *owner = (const knot_dname_t *)
+		"\x20""0123456789abcdefghijklmnopqrstuv""\x04""test";
+	uint8_t rdata[6 + 20] = { 1, 0, iterations >> 8, iterations & 0xff, 0, 20 };
+	knot_pkt_t *pkt = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, NULL);
+	assert_non_null(pkt);
+	assert_int_equal(knot_pkt_put_question(pkt, ZONE, KNOT_CLASS_IN, KNOT_RRTYPE_A), 0);
+	assert_int_equal(knot_pkt_begin(pkt, KNOT_AUTHORITY), 0);
+	knot_rrset_t *rr = knot_rrset_new(owner, KNOT_RRTYPE_NSEC3, KNOT_CLASS_IN, &pkt->mm);
+	assert_non_null(rr);
+	assert_int_equal(knot_rrset_add_rdata(rr, rdata, sizeof(rdata), 3600, &pkt->mm), 0);
+	assert_int_equal(knot_pkt_put(pkt, 0, rr, KNOT_PF_FREE), 0);
+	return pkt;
+}
+
+static void test_nsec3_limit(void **state)
+{
+	knot_pkt_t *cheap = nsec3_response(10);
+	knot_pkt_t *costly = nsec3_response(KR_NSEC3_MAX_ITERATIONS + 1);
+
+	/* The limit is per record, the result doesn't change with repeated checks. */
+	for (unsigned i = 0; i < 2; ++i) {
+		assert_false(kr_nsec3_over_limit(cheap, KNOT_AUTHORITY));
+		assert_true(kr_nsec3_over_limit(costly, KNOT_AUTHORITY));
+		assert_false(kr_nsec3_over_limit(costly, KNOT_ANSWER));
+	}
+	/* Configured limit */
+	kr_nsec3_iterations_set(KR_NSEC3_MAX_ITERATIONS + 1);
+	assert_false(kr_nsec3_over_limit(costly, KNOT_AUTHORITY));
+	kr_nsec3_iterations_set(5);
+	assert_true(kr_nsec3_over_limit(cheap, KNOT_AUTHORITY));
+	kr_nsec3_iterations_set(KR_NSEC3_MAX_ITERATIONS);
+
+	/* Proof with too many iterations is never computed. */
+	const uint32_t nsec3_miss = kr_dnssec_stats()->nsec3_miss;
+	assert_int_not_equal(kr_nsec3_name_error_response_check(costly, KNOT_AUTHORITY, ZONE), 0);
+	assert_int_equal(kr_dnssec_stats()->nsec3_miss, nsec3_miss);
+
+	knot_pkt_free(&cheap);
+	knot_pkt_free(&costly);
+}
+
+/* Signed zone from RFC 6605 6.1 (ECDSA P-256) */
+#define SIGNED_ZONE (const knot_dname_t *)"\x07""example""\x03""net"
+#define SIGNED_NAME (const knot_dname_t *)"\x03""www""\x07""example""\x03""net"
+#define SIGNED_TIME 0x4c700000 /* between the inception and expiration */
+
+static const uint8_t signed_key[] = {
+	0x01, 0x01, 3, 13,
+	0x1a, 0x88, 0xc8, 0x86, 0x15, 0xd4, 0x37, 0xfb, 0xb8, 0xbf, 0x9e, 0x19, 0x42, 0xa1, 0x92, 0x9f,
+	0x28, 0x56, 0x27, 0x06, 0xae, 0x6c, 0x2b, 0xd3, 0x99, 0xe7, 0xb1, 0xbf, 0xb6, 0xd1, 0xe9, 0xe7,
+	0x5b, 0x92, 0xb4, 0xaa, 0x42, 0x91, 0x7a, 0xe1, 0xc6, 0x1b, 0x70, 0x1e, 0xf0, 0x35, 0xc3, 0xfe,
+	0x7b, 0xe3, 0x00, 0x9c, 0xba, 0xfe, 0x5a, 0x2f, 0x71, 0x31, 0x6c, 0x90, 0x2d, 0xcf, 0x0d, 0x00,
+};
+
+static const uint8_t signed_rrsig[] = {
+	0, KNOT_RRTYPE_A, 13, 3, 0x00, 0x00, 0x0e, 0x10,
+	0x4c, 0x88, 0xb1, 0x37, 0x4c, 0x63, 0xc7, 0x37, 0xd9, 0x60,
+	7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'n', 'e', 't', 0,
+	0xab, 0x1e, 0xb0, 0x2d, 0x8a, 0xa6, 0x87, 0xe9, 0x7d, 0xa0, 0x22, 0x93, 0x37, 0xaa, 0x88, 0x73,
+	0xe6, 0xf0, 0xeb, 0x26, 0xbe, 0x28, 0x9f, 0x28, 0x33, 0x3d, 0x18, 0x3f, 0x5d, 0x3b, 0x7a, 0x95,
+	0xc0, 0xc8, 0x69, 0xad, 0xfb, 0x74, 0x8d, 0xae, 0xe3, 0xc5, 0x28, 0x6e, 0xed, 0x66, 0x82, 0xc1,
+	0x2e, 0x55, 0x33, 0x18, 0x6b, 0xac, 0xed, 0x9c, 0x26, 0xc1, 0x67, 0xa9, 0xeb, 0xae, 0x95, 0x0b,
+};
+
+static void put_rr(knot_pkt_t *pkt, const knot_dname_t *owner, uint16_t type, const uint8_t *rdata, uint16_t rdlen)
+{
+	knot_rrset_t *rr = knot_rrset_new(owner, type, KNOT_CLASS_IN, &pkt->mm);
+	assert_non_null(rr);
+	assert_int_equal(knot_rrset_add_rdata(rr, rdata, rdlen, 3600, &pkt->mm), 0);
+	assert_int_equal(knot_pkt_put(pkt, 0, rr, KNOT_PF_FREE), 0);
+}
+
+/** Validator run over the signed answer. */
+struct validate_run {
+	struct kr_module module;
+	const knot_layer_api_t *api;
+	struct mempool *mp;
+	struct kr_context ctx;
+	struct kr_request req;
+	struct kr_query *qry;
+	knot_pkt_t *pkt;
+};
+
+static void validate_begin(struct validate_run *run)
+{
+	memset(run, 0, sizeof(*run));
+	assert_int_equal(kr_module_load(&run->module, "validate", NULL), 0);
+	run->api = run->module.layer(&run->module);
+	assert_non_null(run->api);
+
+	run->mp = mp_new(4096);
+	run->req.ctx = &run->ctx;
+	run->req.pool.ctx = run->mp;
+	run->req.pool.alloc = (knot_mm_alloc_t) mp_alloc;
+	kr_rplan_init(&run->req.rplan, &run->req, &run->req.pool);
+	run->qry = kr_rplan_push(&run->req.rplan, NULL, SIGNED_NAME, KNOT_CLASS_IN, KNOT_RRTYPE_A);
+	assert_non_null(run->qry);
+	run->qry->flags |= QUERY_DNSSEC_WANT|QUERY_DNSSEC_ASYNC;
+	run->qry->timestamp.tv_sec = SIGNED_TIME;
+	run->req.current_query = run->qry;
+
+	/* Known keys, no trust anchor so the cut isn't tracked */
+	kr_zonecut_set(&run->qry->zone_cut, SIGNED_ZONE);
+	knot_rrset_t *keys = knot_rrset_new(SIGNED_ZONE, KNOT_RRTYPE_DNSKEY, KNOT_CLASS_IN, &run->req.pool);
+	assert_non_null(keys);
+	assert_int_equal(knot_rrset_add_rdata(keys, signed_key, sizeof(signed_key), 3600, &run->req.pool), 0);
+	run->qry->zone_cut.key = keys;
+
+	static const uint8_t addr[4] = { 192, 0, 2, 1 };
+	run->pkt = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, &run->req.pool);
+	assert_non_null(run->pkt);
+	assert_int_equal(knot_pkt_put_question(run->pkt, SIGNED_NAME, KNOT_CLASS_IN, KNOT_RRTYPE_A), 0);
+	knot_wire_set_qr(run->pkt->wire);
+	knot_wire_set_aa(run->pkt->wire);
+	assert_int_equal(knot_pkt_begin(run->pkt, KNOT_ANSWER), 0);
+	put_rr(run->pkt, SIGNED_NAME, KNOT_RRTYPE_A, addr, sizeof(addr));
+	put_rr(run->pkt, SIGNED_NAME, KNOT_RRTYPE_RRSIG, signed_rrsig, sizeof(signed_rrsig));
+}
+
+static int validate_consume(struct validate_run *run, int state)
+{
+	knot_layer_t layer = { .mm = &run->req.pool, .state = state, .data = &run->req, .api = run->api };
+	return run->api->consume(&layer, run->pkt);
+}
+
+static void validate_end(struct validate_run *run)
+{
+	kr_rplan_deinit(&run->req.rplan);
+	mp_delete(run->mp);
+	kr_module_unload(&run->module);
+	/* Forget the verified signatures */
+	kr_crypto_cleanup();
+	kr_crypto_init();
+}
+
+static void test_validate_offload(void **state)
+{
+	struct validate_run run;
+	validate_begin(&run);
+
+	/* Fresh answer, the signature is handed over and the validator yields. */
+	const uint32_t flags = run.qry->flags;
+	assert_int_equal(validate_consume(&run, KNOT_STATE_DONE), KNOT_STATE_YIELD);
+	assert_int_equal(run.req.sigjobs.len, 1);
+	assert_int_equal(run.qry->flags, flags);
+
+	/* Verified outside, resumed validator finds the result.
+	 * The signature is expired by now, the result is valid at the validation time. */
+	const uint32_t sig_offload = kr_dnssec_stats()->sig_offload;
+	const uint32_t sig_hit = kr_dnssec_stats()->sig_hit;
+	struct kr_sigjob *job = run.req.sigjobs.at[0];
+	assert_int_equal(kr_sigjob_verify(job), 0);
+	kr_sigjob_commit(job);
+	assert_int_equal(kr_dnssec_stats()->sig_offload, sig_offload + 1);
+	assert_int_equal(validate_consume(&run, KNOT_STATE_YIELD), KNOT_STATE_DONE);
+	assert_int_equal(kr_dnssec_stats()->sig_hit, sig_hit + 1);
+	assert_false(run.qry->flags & QUERY_DNSSEC_BOGUS);
+
+	validate_end(&run);
+}
+
+static void test_validate_offload_states(void **state)
+{
+	struct validate_run run;
+
+	/* Referrals are offloaded as well. */
+	validate_begin(&run);
+	assert_int_equal(validate_consume(&run, KNOT_STATE_PRODUCE), KNOT_STATE_YIELD);
+	assert_int_equal(run.req.sigjobs.len, 1);
+	validate_end(&run);
+
+	/* Resumed answer (YIELD, same as NOOP) is verified inline and never yields again. */
+	validate_begin(&run);
+	assert_int_equal(validate_consume(&run, KNOT_STATE_YIELD), KNOT_STATE_DONE);
+	assert_int_equal(run.req.sigjobs.len, 0);
+	validate_end(&run);
+
+	/* Unprocessed answers are passed through. */
+	validate_begin(&run);
+	assert_int_equal(validate_consume(&run, KNOT_STATE_CONSUME), KNOT_STATE_CONSUME);
+	assert_int_equal(validate_consume(&run, KNOT_STATE_FAIL), KNOT_STATE_FAIL);
+	assert_int_equal(run.req.sigjobs.len, 0);
+	validate_end(&run);
+}
+
+int main(void)
+{
+	kr_crypto_init();
+
+	const UnitTest tests[] = {
+		unit_test(test_key_error),
+		unit_test(test_key_malformed),
+		unit_test(test_key_not_cached),
+		unit_test(test_nsec3_limit),
+		unit_test(test_validate_offload),
+		unit_test(test_validate_offload_states),
+	};
+
+	int ret = run_tests(tests);
+	kr_crypto_cleanup();
+	return ret;
+}
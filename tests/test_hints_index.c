@@ -0,0 +1,138 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "tests/test.h"
+#include "modules/hints/hints_index.h"
+
+#define HOSTS \
+	"127.0.0.1 localhost # loopback\n" \
+	"::1\tLocalhost\n" \
+	"192.0.2.1 a.example b.example\n"
+
+static char hosts_path[128];
+static char index_path[128];
+
+static void write_file(const char *path, const void *data, size_t len)
+{
+	FILE *fp = fopen(path, "wb");
+	assert_non_null(fp);
+	assert_int_equal(fwrite(data, 1, len, fp), len);
+	assert_int_equal(fclose(fp), 0);
+}
+
+/** Check the names and addresses of the HOSTS file in the index. */
+static void check_index(const struct hints_index *index)
+{
+	unsigned count = 0;
+	const uint8_t *entry = hints_index_find(index, (const uint8_t *)"\x09""localhost");
+	assert_non_null(entry);
+	const uint8_t *addr = hints_entry_addrs(entry, &count);
+	assert_int_equal(count, 2);
+	assert_int_equal(addr[0], sizeof(struct in_addr));
+	addr = hints_addr_next(addr);
+	assert_int_equal(addr[0], sizeof(struct in6_addr));
+	assert_null(hints_index_find(index, (const uint8_t *)"\x07""missing"));
+
+	/* First name of the address is the reverse name */
+	uint8_t ip[4];
+	knot_dname_t rname[KNOT_DNAME_MAXLEN];
+	assert_int_equal(inet_pton(AF_INET, "192.0.2.1", ip), 1);
+	hints_reverse_name(rname, ip, sizeof(ip));
+	const knot_dname_t *name = hints_index_reverse(index, rname);
+	assert_non_null(name);
+	assert_true(knot_dname_is_equal(name, (const uint8_t *)"\x01""a""\x07""example"));
+}
+
+static void test_build(void **state)
+{
+	struct hints_index *index = NULL;
+	size_t pairs = 0;
+	assert_int_equal(hints_index_build(&index, hosts_path, &pairs), 0);
+	assert_int_equal(pairs, 4);
+	check_index(index);
+	hints_index_free(index);
+}
+
+static void test_save_open(void **state)
+{
+	struct hints_index *index = NULL;
+	assert_int_equal(hints_index_build(&index, hosts_path, NULL), 0);
+	assert_int_equal(hints_index_save(index, index_path), 0);
+	hints_index_free(index);
+
+	/* Mapped index has the same content, hosts file is not a compiled index */
+	assert_int_equal(hints_index_open(&index, index_path), 0);
+	check_index(index);
+	hints_index_free(index);
+	assert_int_equal(hints_index_open(&index, hosts_path), kr_error(EILSEQ));
+}
+
+static void test_open_invalid(void **state)
+{
+	struct hints_index *index = NULL;
+	assert_int_equal(hints_index_build(&index, hosts_path, NULL), 0);
+	uint8_t *image = malloc(index->size);
+	assert_non_null(image);
+	const size_t size = index->size;
+	memcpy(image, index->base, size);
+	const size_t entries = (const uint8_t *)index->entries - (const uint8_t *)index->base;
+	const uint32_t first = index->offsets[0];
+	hints_index_free(index);
+
+	/* Truncated image */
+	write_file(index_path, image, size - 1);
+	assert_int_equal(hints_index_open(&index, index_path), kr_error(EILSEQ));
+
+	/* Label of the name reaches over the end of the name */
+	uint8_t *label = image + entries + first + 1;
+	const uint8_t label_len = label[0];
+	label[0] = KNOT_DNAME_MAXLABELLEN;
+	write_file(index_path, image, size);
+	assert_int_equal(hints_index_open(&index, index_path), kr_error(EILSEQ));
+
+	/* Name isn't terminated within its length */
+	label[0] = label_len;
+	uint8_t *entry = image + entries + first;
+	entry[entry[0]] = 1;
+	write_file(index_path, image, size);
+	assert_int_equal(hints_index_open(&index, index_path), kr_error(EILSEQ));
+
+	free(image);
+}
+
+int main(void)
+{
+	const char *tmpdir = test_tmpdir_create();
+	snprintf(hosts_path, sizeof(hosts_path), "%s/hosts", tmpdir);
+	snprintf(index_path, sizeof(index_path), "%s/hosts.idx", tmpdir);
+	write_file(hosts_path, HOSTS, sizeof(HOSTS) - 1);
+
+	const UnitTest tests[] = {
+		unit_test(test_build),
+		unit_test(test_save_open),
+		unit_test(test_open_invalid),
+	};
+
+	int ret = run_tests(tests);
+	test_tmpdir_remove(tmpdir);
+	return ret;
+}
@@ -0,0 +1,153 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests/test.h"
+#include "lib/generic/lpm.h"
+
+/*
+ * Sample subnets
+ */
+static const struct {
+	uint8_t key[4];
+	unsigned bits;
+} nets[] = {
+	{ {   0,   0,   0,   0 },  0 },
+	{ {  10,   0,   0,   0 },  8 },
+	{ {  10,   1,   0,   0 }, 16 },
+	{ {  10,   1,   2,   0 }, 24 },
+	{ {  10,   1,   2, 128 }, 25 },
+	{ { 192, 168,   0,   0 }, 16 },
+	{ { 192, 168,   1,   1 }, 32 },
+	{ { 172,  16,   0,   0 }, 12 },
+};
+
+#define NETS_COUNT (sizeof(nets) / sizeof(nets[0]))
+
+/* Value of the n-th subnet */
+static int values[NETS_COUNT];
+
+static void test_insert(void **state)
+{
+	lpm_t *lpm = *state;
+	for (unsigned i = 0; i < NETS_COUNT; ++i) {
+		assert_int_equal(lpm_set(lpm, nets[i].key, nets[i].bits, &values[i]), 0);
+	}
+	assert_int_equal(lpm->count, NETS_COUNT);
+	/* Replace existing, host bits are ignored */
+	const uint8_t host[4] = { 10, 1, 2, 3 };
+	assert_int_equal(lpm_set(lpm, host, 24, &values[3]), 1);
+	assert_int_equal(lpm->count, NETS_COUNT);
+	assert_int_equal(lpm_set(lpm, host, 24, NULL), EINVAL);
+	assert_int_equal(lpm_set(lpm, host, 33 * 8, &values[3]), EINVAL);
+}
+
+static void test_get(void **state)
+{
+	lpm_t *lpm = *state;
+	for (unsigned i = 0; i < NETS_COUNT; ++i) {
+		assert_true(lpm_get(lpm, nets[i].key, nets[i].bits) == &values[i]);
+	}
+	const uint8_t missing[4] = { 10, 2, 0, 0 };
+	assert_null(lpm_get(lpm, missing, 16));
+}
+
+static void test_match(void **state)
+{
+	lpm_t *lpm = *state;
+	const struct {
+		uint8_t addr[4];
+		unsigned expect;
+		unsigned bits;
+	} tests[] = {
+		{ {  10,   1,   2, 200 }, 4, 25 },
+		{ {  10,   1,   2, 100 }, 3, 24 },
+		{ {  10,   1,   3,   1 }, 2, 16 },
+		{ {  10,   9,   9,   9 }, 1,  8 },
+		{ { 192, 168,   1,   1 }, 6, 32 },
+		{ { 192, 168,   1,   2 }, 5, 16 },
+		{ { 172,  31, 255, 255 }, 7, 12 },
+		{ { 172,  32,   0,   0 }, 0,  0 },
+		{ {   8,   8,   8,   8 }, 0,  0 },
+	};
+	for (unsigned i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+		unsigned matched = 0;
+		void *val = lpm_match(lpm, tests[i].addr, 32, &matched);
+		assert_true(val == &values[tests[i].expect]);
+		assert_int_equal(matched, tests[i].bits);
+	}
+}
+
+static int count_prefix(const uint8_t *key, unsigned bits, void *val, void *baton)
+{
+	unsigned *count = baton;
+	*count += 1;
+	return 0;
+}
+
+static void test_delete(void **state)
+{
+	lpm_t *lpm = *state;
+	const uint8_t addr[4] = { 10, 1, 2, 200 };
+	/* Deleting inner prefix falls back to the shorter one */
+	assert_int_equal(lpm_del(lpm, nets[3].key, nets[3].bits), 0);
+	assert_int_equal(lpm_del(lpm, nets[3].key, nets[3].bits), 1);
+	assert_true(lpm_match(lpm, addr, 32, NULL) == &values[4]);
+	assert_int_equal(lpm_del(lpm, nets[4].key, nets[4].bits), 0);
+	assert_true(lpm_match(lpm, addr, 32, NULL) == &values[2]);
+	assert_int_equal(lpm->count, NETS_COUNT - 2);
+	unsigned count = 0;
+	assert_int_equal(lpm_walk(lpm, count_prefix, &count), 0);
+	assert_int_equal(count, lpm->count);
+	/* Remaining prefixes are still reachable */
+	assert_true(lpm_get(lpm, nets[5].key, nets[5].bits) == &values[5]);
+	assert_true(lpm_get(lpm, nets[6].key, nets[6].bits) == &values[6]);
+}
+
+static void test_init(void **state)
+{
+	static lpm_t lpm;
+	lpm = lpm_make();
+	*state = &lpm;
+	assert_non_null(*state);
+}
+
+static void test_deinit(void **state)
+{
+	lpm_t *lpm = *state;
+	lpm_clear(lpm);
+	assert_null(lpm->root);
+	assert_int_equal(lpm->count, 0);
+}
+
+/* Program entry point */
+int main(int argc, char **argv)
+{
+	const UnitTest tests[] = {
+	        group_test_setup(test_init),
+	        unit_test(test_insert),
+		unit_test(test_get),
+		unit_test(test_match),
+		unit_test(test_delete),
+	        group_test_teardown(test_deinit)
+	};
+
+	return run_group_tests(tests);
+}
@@ -75,6 +75,22 @@ static void test_missing(void **state)
 	assert_true(lru_get(lru, notin, KEY_LEN(notin)) == NULL);
 }
 
+static void test_peek(void **state)
+{
+	lru_int_t *lru = *state;
+	/* Stored key is found in its own slot. */
+	int *data = lru_peek(lru, dict[0], KEY_LEN(dict[0]));
+	assert_true(data == lru_get(lru, dict[0], KEY_LEN(dict[0])));
+	/* Missing key maps to a slot held by some other key, or an empty one. */
+	const char *notin = "not in lru";
+	data = lru_peek(lru, notin, KEY_LEN(notin));
+	assert_true(lru_get(lru, notin, KEY_LEN(notin)) == NULL);
+	if (data) {
+		int *replaced = lru_set(lru, notin, KEY_LEN(notin));
+		assert_true(replaced == data);
+	}
+}
+
 static void test_eviction(void **state)
 {
 	lru_int_t *lru = *state;
@@ -115,6 +131,7 @@ int main(int argc, char **argv)
 	        group_test_setup(test_init),
 	        unit_test(test_insert),
 		unit_test(test_missing),
+		unit_test(test_peek),
 		unit_test(test_eviction),
 	        group_test_teardown(test_deinit)
 	};
@@ -0,0 +1,227 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "tests/test.h"
+#include "daemon/mirror.h"
+
+static uv_loop_t loop;
+
+/** Bind socket to a free loopback port, the address is returned. */
+static int bind_local(int type, struct sockaddr_in *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int fd = socket(AF_INET, type, 0);
+	assert_true(fd >= 0);
+	assert_int_equal(bind(fd, (struct sockaddr *)addr, sizeof(*addr)), 0);
+	socklen_t len = sizeof(*addr);
+	assert_int_equal(getsockname(fd, (struct sockaddr *)addr, &len), 0);
+	return fd;
+}
+
+/** Run one loop iteration, the flush doesn't keep the loop alive by itself. */
+static void run_flush(struct mirror *mirror)
+{
+	uv_ref((uv_handle_t *)&mirror->flush);
+	uv_run(mirror->loop, UV_RUN_NOWAIT);
+	uv_unref((uv_handle_t *)&mirror->flush);
+}
+
+static void mirror_end(struct mirror *mirror)
+{
+	mirror_deinit(mirror);
+	uv_run(&loop, UV_RUN_DEFAULT);
+}
+
+static void test_sample(void **state)
+{
+	struct sockaddr_in addr;
+	const int fd = bind_local(SOCK_DGRAM, &addr);
+	struct mirror mirror;
+	memset(&mirror, 0, sizeof(mirror));
+	const int id = mirror_add(&mirror, &loop, (struct sockaddr *)&addr, 3, false);
+	assert_int_equal(id, 0);
+	struct mirror_target *target = mirror.targets[id];
+
+	/* Mirror 1 in 3 queries, starting with the first one */
+	const uint8_t wire[12] = { 0 };
+	for (unsigned i = 0; i < 9; ++i) {
+		assert_int_equal(mirror_push(&mirror, id, wire, sizeof(wire)), 0);
+	}
+	assert_int_equal(target->stats.queued, 3);
+	assert_int_equal(target->len, 3);
+
+	/* Same target is reused, no sampling mirrors all queries */
+	assert_int_equal(mirror_add(&mirror, &loop, (struct sockaddr *)&addr, 0, false), id);
+	for (unsigned i = 0; i < 3; ++i) {
+		assert_int_equal(mirror_push(&mirror, id, wire, sizeof(wire)), 0);
+	}
+	assert_int_equal(target->stats.queued, 6);
+	assert_int_equal(target->stats.dropped, 0);
+
+	mirror_end(&mirror);
+	close(fd);
+}
+
+static void test_drop(void **state)
+{
+	struct sockaddr_in addr;
+	const int fd = bind_local(SOCK_DGRAM, &addr);
+	struct mirror mirror;
+	memset(&mirror, 0, sizeof(mirror));
+	struct sockaddr unknown = { .sa_family = AF_UNIX };
+	assert_int_equal(mirror_add(&mirror, &loop, NULL, 0, false), kr_error(EINVAL));
+	assert_int_equal(mirror_add(&mirror, &loop, &unknown, 0, false), kr_error(EINVAL));
+	const int id = mirror_add(&mirror, &loop, (struct sockaddr *)&addr, 0, false);
+	assert_int_equal(id, 0);
+	struct mirror_target *target = mirror.targets[id];
+
+	static uint8_t wire[MIRROR_MSG_MAX + 1];
+	assert_int_equal(mirror_push(&mirror, id + 1, wire, 12), kr_error(EINVAL));
+	assert_int_equal(mirror_push(&mirror, -1, wire, 12), kr_error(EINVAL));
+	assert_int_equal(mirror_push(&mirror, id, NULL, 12), kr_error(EINVAL));
+
+	/* Large queries aren't mirrored */
+	assert_int_equal(mirror_push(&mirror, id, wire, sizeof(wire)), kr_error(ENOSPC));
+	assert_int_equal(target->stats.dropped, 1);
+
+	/* Full queue drops copies without waiting */
+	for (unsigned i = 0; i < MIRROR_QUEUE_LEN; ++i) {
+		assert_int_equal(mirror_push(&mirror, id, wire, MIRROR_MSG_MAX), 0);
+	}
+	assert_int_equal(mirror_push(&mirror, id, wire, 12), kr_error(ENOSPC));
+	assert_int_equal(target->stats.queued, MIRROR_QUEUE_LEN);
+	assert_int_equal(target->stats.dropped, 2);
+
+	/* Limited number of targets */
+	for (unsigned i = 1; i < MIRROR_TARGETS; ++i) {
+		addr.sin_port = htons(ntohs(addr.sin_port) + 1);
+		assert_int_equal(mirror_add(&mirror, &loop, (struct sockaddr *)&addr, 0, false), i);
+	}
+	addr.sin_port = htons(ntohs(addr.sin_port) + 1);
+	assert_int_equal(mirror_add(&mirror, &loop, (struct sockaddr *)&addr, 0, false), kr_error(ENOSPC));
+
+	mirror_end(&mirror);
+	close(fd);
+}
+
+static void test_ring(void **state)
+{
+	struct sockaddr_in addr;
+	const int fd = bind_local(SOCK_DGRAM, &addr);
+	struct mirror mirror;
+	memset(&mirror, 0, sizeof(mirror));
+	const int id = mirror_add(&mirror, &loop, (struct sockaddr *)&addr, 0, false);
+	assert_int_equal(id, 0);
+	struct mirror_target *target = mirror.targets[id];
+
+	/* Copies are sent in order while the ring wraps around twice */
+	const unsigned rounds = 2 * MIRROR_QUEUE_LEN / MIRROR_BATCH;
+	for (unsigned round = 0; round < rounds; ++round) {
+		for (unsigned i = 0; i < MIRROR_BATCH; ++i) {
+			const uint32_t seq = htonl(round * MIRROR_BATCH + i);
+			assert_int_equal(mirror_push(&mirror, id, (const uint8_t *)&seq, sizeof(seq)), 0);
+		}
+		run_flush(&mirror);
+		assert_int_equal(target->len, 0);
+		for (unsigned i = 0; i < MIRROR_BATCH; ++i) {
+			uint32_t seq = 0;
+			assert_int_equal(recv(fd, &seq, sizeof(seq), MSG_DONTWAIT), sizeof(seq));
+			assert_int_equal(ntohl(seq), round * MIRROR_BATCH + i);
+		}
+	}
+	assert_int_equal(target->stats.sent, rounds * MIRROR_BATCH);
+	assert_int_equal(target->stats.dropped, 0);
+
+	mirror_end(&mirror);
+	close(fd);
+}
+
+static void test_tcp(void **state)
+{
+	struct sockaddr_in addr;
+	const int fd = bind_local(SOCK_STREAM, &addr);
+	assert_int_equal(listen(fd, 1), 0);
+	struct mirror mirror;
+	memset(&mirror, 0, sizeof(mirror));
+	const int id = mirror_add(&mirror, &loop, (struct sockaddr *)&addr, 0, true);
+	assert_int_equal(id, 0);
+	struct mirror_target *target = mirror.targets[id];
+	for (unsigned i = 0; i < 100 && target->state == MIRROR_TCP_CONNECTING; ++i) {
+		uv_run(&loop, UV_RUN_ONCE);
+	}
+	assert_int_equal(target->state, MIRROR_TCP_CONNECTED);
+	const int conn = accept(fd, NULL, NULL);
+	assert_true(conn >= 0);
+
+	/* Single flush writes at most MIRROR_TCP_WRITE bytes, the rest waits */
+	static uint8_t wire[MIRROR_MSG_MAX];
+	const unsigned per_flush = MIRROR_TCP_WRITE / (sizeof(uint16_t) + MIRROR_MSG_MAX);
+	for (unsigned i = 0; i < 2 * per_flush; ++i) {
+		assert_int_equal(mirror_push(&mirror, id, wire, sizeof(wire)), 0);
+	}
+	run_flush(&mirror);
+	assert_int_equal(target->stats.sent, per_flush);
+	assert_int_equal(target->len, per_flush);
+	run_flush(&mirror);
+	assert_int_equal(target->stats.sent, 2 * per_flush);
+	assert_int_equal(target->len, 0);
+	uint8_t frame[2] = { 0 };
+	assert_int_equal(recv(conn, frame, sizeof(frame), MSG_WAITALL), sizeof(frame));
+	assert_int_equal((frame[0] << 8) | frame[1], MIRROR_MSG_MAX);
+
+	/* Connection closed by the target is noticed */
+	close(conn);
+	for (unsigned i = 0; i < 100 && target->state == MIRROR_TCP_CONNECTED; ++i) {
+		uv_run(&loop, UV_RUN_ONCE);
+	}
+	assert_int_equal(target->state, MIRROR_TCP_CLOSED);
+	assert_null(target->handle);
+
+	/* Copies are dropped until the target is reconnected */
+	assert_int_equal(mirror_push(&mirror, id, wire, sizeof(wire)), 0);
+	run_flush(&mirror);
+	assert_int_equal(target->len, 0);
+	assert_int_equal(target->stats.dropped, 1);
+
+	mirror_end(&mirror);
+	close(fd);
+}
+
+int main(void)
+{
+	/* Writes to the closed connection must not terminate the test */
+	signal(SIGPIPE, SIG_IGN);
+	uv_loop_init(&loop);
+
+	const UnitTest tests[] = {
+		unit_test(test_sample),
+		unit_test(test_drop),
+		unit_test(test_ring),
+		unit_test(test_tcp),
+	};
+
+	int ret = run_tests(tests);
+	uv_loop_close(&loop);
+	return ret;
+}
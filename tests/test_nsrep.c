@@ -0,0 +1,243 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <libknot/rdata.h>
+
+#include "tests/test.h"
+#include "lib/nsrep.h"
+#include "lib/resolve.h"
+#include "lib/rplan.h"
+#include "lib/zonecut.h"
+
+#define RTT_SIZE 1024
+
+static const knot_dname_t *ns1 = (const uint8_t *)"\x03""ns1";
+static const knot_dname_t *ns2 = (const uint8_t *)"\x03""ns2";
+static struct in_addr ns1_addr;
+static struct in6_addr ns2_addr;
+
+static void ctx_init(struct kr_context *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->forwarders = map_make();
+	ctx->cache_rtt = malloc(lru_size(kr_nsrep_rtt_lru_t, RTT_SIZE));
+	assert_non_null(ctx->cache_rtt);
+	lru_init(ctx->cache_rtt, RTT_SIZE);
+}
+
+static void ctx_deinit(struct kr_context *ctx)
+{
+	kr_nsrep_group_del(ctx, NULL);
+	lru_deinit(ctx->cache_rtt);
+	free(ctx->cache_rtt);
+}
+
+static void test_group_set(void **state)
+{
+	struct kr_context ctx;
+	ctx_init(&ctx);
+	const char *addrs[] = { "192.0.2.1", "2001:db8::1" };
+	const uint16_t ports[] = { 53, 5353 };
+	assert_int_equal(kr_nsrep_group_set(&ctx, "office", addrs, ports, 2), 0);
+	struct kr_nsrep_group *group = kr_nsrep_group_get(&ctx, "office");
+	assert_non_null(group);
+	assert_int_equal(group->count, 2);
+	assert_int_equal(group->addr[0].ip.sa_family, AF_INET);
+	assert_int_equal(ntohs(group->addr[1].ip6.sin6_port), 5353);
+	group->stats.queries = 10;
+	/* Redefinition swaps in a new group, the old one stays valid for queries in flight. */
+	assert_int_equal(kr_nsrep_group_set(&ctx, "office", addrs, ports, 1), 0);
+	struct kr_nsrep_group *redefined = kr_nsrep_group_get(&ctx, "office");
+	assert_true(redefined != group);
+	assert_true(redefined->retired == group);
+	assert_int_equal(redefined->count, 1);
+	assert_int_equal(redefined->stats.queries, 10);
+	assert_int_equal(group->count, 2);
+	/* Invalid address leaves the group untouched. */
+	const char *invalid[] = { "192.0.2.2", "invalid" };
+	assert_int_not_equal(kr_nsrep_group_set(&ctx, "office", invalid, ports, 2), 0);
+	assert_true(kr_nsrep_group_get(&ctx, "office") == redefined);
+	assert_int_equal(redefined->count, 1);
+	/* Too many addresses. */
+	assert_int_equal(kr_nsrep_group_set(&ctx, "office", addrs, ports, KR_NSREP_GROUP_MAX + 1), kr_error(ENOSPC));
+	ctx_deinit(&ctx);
+}
+
+static void test_group_rtt_port(void **state)
+{
+	struct kr_context ctx;
+	ctx_init(&ctx);
+	const char *addrs[] = { "192.0.2.1", "192.0.2.1" };
+	const uint16_t ports[] = { 53, 5353 };
+	assert_int_equal(kr_nsrep_group_set(&ctx, "local", addrs, ports, 2), 0);
+	struct kr_query qry;
+	memset(&qry, 0, sizeof(qry));
+	assert_int_equal(kr_nsrep_forward(&qry, &ctx, "local"), 0);
+	assert_true(qry.flags & QUERY_STUB);
+	/* Same address on a different port is a different upstream. */
+	struct kr_nsrep_group *group = qry.ns.group;
+	assert_int_equal(kr_nsrep_update_rtt(&qry.ns, &group->addr[0].ip, KR_NS_TIMEOUT, ctx.cache_rtt, KR_NS_RESET), 0);
+	assert_int_equal(kr_nsrep_update_rtt(&qry.ns, &group->addr[1].ip, 10, ctx.cache_rtt, KR_NS_RESET), 0);
+	for (unsigned i = 0; i < 10; ++i) {
+		assert_int_equal(kr_nsrep_elect_group(&qry, &ctx), 0);
+		if (qry.ns.score > 0) { /* Not probing the 'bad' upstream. */
+			assert_int_equal(ntohs(qry.ns.addr[0].ip4.sin_port), 5353);
+			assert_int_equal(ntohs(qry.ns.addr[1].ip4.sin_port), 53);
+		}
+	}
+	assert_int_equal(group->stats.queries, 1);
+	ctx_deinit(&ctx);
+}
+
+static void nsset_add(struct kr_zonecut *cut, const knot_dname_t *name, const void *addr, size_t len)
+{
+	uint8_t rdata[64];
+	knot_rdata_init(rdata, len, addr, 0);
+	assert_int_equal(kr_zonecut_add(cut, name, rdata), 0);
+}
+
+static void rtt_set(struct kr_context *ctx, const void *addr, size_t len, unsigned score, uint32_t stamp)
+{
+	struct kr_nsrep_rtt *rtt = lru_set(ctx->cache_rtt, addr, len);
+	assert_non_null(rtt);
+	rtt->score = score;
+	rtt->stamp = stamp;
+}
+
+static void race_init(struct kr_query *qry)
+{
+	memset(qry, 0, sizeof(*qry));
+	qry->flags = QUERY_RACE;
+	assert_int_equal(kr_zonecut_init(&qry->zone_cut, (const uint8_t *)"", NULL), 0);
+	nsset_add(&qry->zone_cut, ns1, &ns1_addr, sizeof(ns1_addr));
+	nsset_add(&qry->zone_cut, ns2, &ns2_addr, sizeof(ns2_addr));
+}
+
+static void test_race(void **state)
+{
+	struct kr_context ctx;
+	ctx_init(&ctx);
+	struct kr_query qry;
+	race_init(&qry);
+	/* Neither address is known, the other NS is raced and carries its name. */
+	assert_int_equal(kr_nsrep_elect(&qry, &ctx), 0);
+	struct kr_nsrep *ns = &qry.ns;
+	const bool ns1_elected = knot_dname_is_equal(ns->name, ns1);
+	const knot_dname_t *raced = ns1_elected ? ns2 : ns1;
+	assert_int_equal(ns->addr[1].ip.sa_family, ns1_elected ? AF_INET6 : AF_INET);
+	assert_null((void *)ns->race[0]);
+	assert_true(knot_dname_is_equal(ns->race[1], raced));
+	/* Answer from the raced address is attributed to its NS. */
+	struct sockaddr_in6 src;
+	memcpy(&src, &ns->addr[1], sizeof(src));
+	assert_int_equal(kr_nsrep_answered(ns, (struct sockaddr *)&src), 0);
+	assert_true(knot_dname_is_equal(ns->name, raced));
+	assert_int_equal(ns->addr[0].ip.sa_family, src.sin6_family);
+	assert_int_equal(ns->addr[1].ip.sa_family, AF_UNSPEC);
+	assert_null((void *)ns->race[1]);
+	/* Address that isn't in the list. */
+	struct sockaddr_in other = { .sin_family = AF_INET };
+	assert_int_equal(kr_nsrep_answered(ns, (struct sockaddr *)&other), kr_error(ENOENT));
+	kr_zonecut_deinit(&qry.zone_cut);
+	ctx_deinit(&ctx);
+}
+
+static void test_race_decay(void **state)
+{
+	struct kr_context ctx;
+	ctx_init(&ctx);
+	struct kr_query qry;
+	race_init(&qry);
+	/* Timeouted long ago, the score has decayed below KR_NS_LONG but is not stale. */
+	const uint32_t stamp = time(NULL) - 9 * KR_NS_DECAY;
+	rtt_set(&ctx, &ns1_addr, sizeof(ns1_addr), KR_NS_TIMEOUT, stamp);
+	rtt_set(&ctx, &ns2_addr, sizeof(ns2_addr), KR_NS_TIMEOUT, stamp);
+	assert_int_equal(kr_nsrep_elect(&qry, &ctx), 0);
+	assert_int_not_equal(qry.ns.addr[0].ip.sa_family, AF_UNSPEC);
+	assert_int_equal(qry.ns.addr[1].ip.sa_family, AF_UNSPEC);
+	kr_zonecut_deinit(&qry.zone_cut);
+	ctx_deinit(&ctx);
+}
+
+static void test_rtt_lower_bound(void **state)
+{
+	struct kr_context ctx;
+	ctx_init(&ctx);
+	struct kr_query qry;
+	memset(&qry, 0, sizeof(qry));
+	assert_int_equal(kr_nsrep_set(&qry, (uint8_t *)&ns1_addr, sizeof(ns1_addr)), 0);
+	/* Lower bound of an unknown RTT is at least unknown, raises shorter RTT and never lowers longer RTT. */
+	assert_int_equal(kr_nsrep_update_rtt(&qry.ns, NULL, 200, ctx.cache_rtt, KR_NS_MAX), 0);
+	struct kr_nsrep_rtt *rtt = lru_get(ctx.cache_rtt, (const char *)&ns1_addr, sizeof(ns1_addr));
+	assert_non_null(rtt);
+	assert_int_equal(rtt->score, KR_NS_UNKNOWN);
+	assert_int_equal(kr_nsrep_update_rtt(&qry.ns, NULL, 100, ctx.cache_rtt, KR_NS_RESET), 0);
+	assert_int_equal(kr_nsrep_update_rtt(&qry.ns, NULL, 300, ctx.cache_rtt, KR_NS_MAX), 0);
+	assert_int_equal(rtt->score, 300);
+	assert_int_equal(kr_nsrep_update_rtt(&qry.ns, NULL, 200, ctx.cache_rtt, KR_NS_MAX), 0);
+	assert_int_equal(rtt->score, 300);
+	ctx_deinit(&ctx);
+}
+
+static void test_race_loser(void **state)
+{
+	struct kr_context ctx;
+	ctx_init(&ctx);
+	struct kr_query qry;
+	race_init(&qry);
+	/* Winner answered in 60ms, the loser without an entry was outstanding for 30ms. */
+	rtt_set(&ctx, &ns1_addr, sizeof(ns1_addr), 60, time(NULL));
+	struct kr_query loser;
+	memset(&loser, 0, sizeof(loser));
+	assert_int_equal(kr_nsrep_set(&loser, (uint8_t *)&ns2_addr, sizeof(ns2_addr)), 0);
+	assert_int_equal(kr_nsrep_update_rtt(&loser.ns, NULL, 30, ctx.cache_rtt, KR_NS_MAX), 0);
+	struct kr_nsrep_rtt *rtt = lru_get(ctx.cache_rtt, (const char *)&ns2_addr, sizeof(ns2_addr));
+	assert_non_null(rtt);
+	assert_int_equal(rtt->score, KR_NS_UNKNOWN);
+	/* Winner stays preferred and it's known, so it isn't raced again. */
+	unsigned winner = 0;
+	for (unsigned i = 0; i < 10; ++i) {
+		qry.flags = QUERY_RACE;
+		assert_int_equal(kr_nsrep_elect(&qry, &ctx), 0);
+		if (knot_dname_is_equal(qry.ns.name, ns1)) {
+			assert_int_equal(qry.ns.addr[1].ip.sa_family, AF_UNSPEC);
+			winner += 1;
+		}
+	}
+	assert_true(winner > 0);
+	kr_zonecut_deinit(&qry.zone_cut);
+	ctx_deinit(&ctx);
+}
+
+int main(void)
+{
+	inet_pton(AF_INET, "192.0.2.1", &ns1_addr);
+	inet_pton(AF_INET6, "2001:db8::2", &ns2_addr);
+
+	const UnitTest tests[] = {
+		unit_test(test_group_set),
+		unit_test(test_group_rtt_port),
+		unit_test(test_race),
+		unit_test(test_race_decay),
+		unit_test(test_rtt_lower_bound),
+		unit_test(test_race_loser),
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,75 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "tests/test.h"
+#include "daemon/overload.h"
+
+static void test_disabled(void **state)
+{
+	struct overload overload;
+	memset(&overload, 0, sizeof(overload));
+	assert_int_equal(overload_level(&overload, 1000000, 1000), 0);
+	assert_true(overload_admit(&overload, 1000000, 1000, false));
+	/* RSS is not sampled without memory watermarks. */
+	assert_int_equal(overload.rss_stamp, 0);
+}
+
+static void test_level(void **state)
+{
+	struct overload overload;
+	memset(&overload, 0, sizeof(overload));
+	overload.soft = 10;
+	overload.hard = 20;
+	assert_int_equal(overload_level(&overload, 9, 1000), 0);
+	assert_int_equal(overload_level(&overload, 10, 1000), 1);
+	assert_int_equal(overload_level(&overload, 20, 1000), 2);
+	/* Resident memory is above one byte, sampled at most every OVERLOAD_RSS_INTERVAL. */
+	memset(&overload, 0, sizeof(overload));
+	overload.memory_soft = 1;
+	assert_int_equal(overload_level(&overload, 0, 1000), 1);
+	assert_int_equal(overload.rss_stamp, 1000);
+	const size_t rss = overload.rss;
+	overload.rss = 0;
+	assert_int_equal(overload_level(&overload, 0, 1000 + OVERLOAD_RSS_INTERVAL - 1), 0);
+	assert_int_equal(overload_level(&overload, 0, 1000 + OVERLOAD_RSS_INTERVAL), 1);
+	assert_true(overload.rss > 0 && rss > 0);
+}
+
+static void test_admit(void **state)
+{
+	struct overload overload;
+	memset(&overload, 0, sizeof(overload));
+	overload.soft = 10;
+	/* New resolution is shed above the soft watermark. */
+	assert_true(overload_admit(&overload, 9, 1000, false));
+	assert_false(overload_admit(&overload, 10, 1000, false));
+	/* Admitted resolution is never shed halfway. */
+	assert_true(overload_admit(&overload, 10, 1000, true));
+	assert_true(overload_admit(&overload, 100, 1000, true));
+}
+
+int main(void)
+{
+	const UnitTest tests[] = {
+		unit_test(test_disabled),
+		unit_test(test_level),
+		unit_test(test_admit),
+	};
+
+	return run_tests(tests);
+}
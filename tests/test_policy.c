@@ -0,0 +1,223 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <libknot/packet/pkt.h>
+#include <libknot/packet/wire.h>
+
+#include "tests/test.h"
+#include "lib/policy.h"
+
+#define NAME (const knot_dname_t *)"\x04""host""\x04""test"
+#define NAME_FIXED (const knot_dname_t *)"\x05""fixed""\x04""test"
+
+/* RRSIG covering A, signed by the root */
+static const uint8_t rrsig_rdata[] = {
+	0, 1, 8, 2,  0, 0, 0x0e, 0x10,  0x60, 0, 0, 0,  0x50, 0, 0, 0,  0x12, 0x34,
+	0,
+	0xde, 0xad, 0xbe, 0xef,
+};
+
+static void put_rr(knot_pkt_t *pkt, const knot_dname_t *owner, uint16_t type, const char **addrs, unsigned count)
+{
+	knot_rrset_t *rr = knot_rrset_new(owner, type, KNOT_CLASS_IN, &pkt->mm);
+	assert_non_null(rr);
+	for (unsigned i = 0; i < count; ++i) {
+		if (type == KNOT_RRTYPE_RRSIG) {
+			assert_int_equal(knot_rrset_add_rdata(rr, rrsig_rdata, sizeof(rrsig_rdata), 3600, &pkt->mm), 0);
+			continue;
+		}
+		uint8_t addr[16];
+		const int family = (type == KNOT_RRTYPE_A) ? AF_INET : AF_INET6;
+		assert_int_equal(inet_pton(family, addrs[i], addr), 1);
+		assert_int_equal(knot_rrset_add_rdata(rr, addr, kr_family_len(family), 3600, &pkt->mm), 0);
+	}
+	assert_int_equal(knot_pkt_put(pkt, 0, rr, KNOT_PF_FREE), 0);
+}
+
+static knot_pkt_t *make_answer(void)
+{
+	knot_pkt_t *pkt = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, NULL);
+	assert_non_null(pkt);
+	assert_int_equal(knot_pkt_put_question(pkt, NAME, KNOT_CLASS_IN, KNOT_RRTYPE_A), 0);
+	knot_wire_set_qr(pkt->wire);
+	assert_int_equal(knot_pkt_begin(pkt, KNOT_ANSWER), 0);
+	return pkt;
+}
+
+/** Parse the written wire of the packet, so the rewrite is checked where clients see it. */
+static knot_pkt_t *reparse(const knot_pkt_t *pkt)
+{
+	knot_pkt_t *copy = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, NULL);
+	assert_non_null(copy);
+	memcpy(copy->wire, pkt->wire, pkt->size);
+	copy->size = pkt->size;
+	assert_int_equal(knot_pkt_parse(copy, 0), 0);
+	return copy;
+}
+
+/** Check addresses of the n-th answer record set, both in the records and in the wire. */
+static void check_addrs(const knot_pkt_t *pkt, unsigned at, const char **expect, unsigned count)
+{
+	knot_pkt_t *copy = reparse(pkt);
+	const knot_pkt_t *both[] = { pkt, copy };
+	for (unsigned k = 0; k < 2; ++k) {
+		const knot_pktsection_t *an = knot_pkt_section(both[k], KNOT_ANSWER);
+		assert_true(at < an->count);
+		const knot_rrset_t *rr = knot_pkt_rr(an, at);
+		assert_int_equal(rr->rrs.rr_count, count);
+		for (unsigned i = 0; i < count; ++i) {
+			const knot_rdata_t *rd = knot_rdataset_at(&rr->rrs, i);
+			const int family = (rr->type == KNOT_RRTYPE_A) ? AF_INET : AF_INET6;
+			char buf[INET6_ADDRSTRLEN];
+			assert_non_null(inet_ntop(family, knot_rdata_data(rd), buf, sizeof(buf)));
+			assert_string_equal(buf, expect[i]);
+		}
+	}
+	knot_pkt_free(&copy);
+}
+
+static void test_renumber_add(void **state)
+{
+	struct kr_policy_renumber *tbl = kr_policy_renumber_new();
+	assert_non_null(tbl);
+
+	assert_int_equal(kr_policy_renumber_add(NULL, "10.0.0.0/8", "192.168.0.0"), kr_error(EINVAL));
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.0.0.0/8", NULL), kr_error(EINVAL));
+	assert_int_equal(kr_policy_renumber_name(tbl, NULL, "192.168.0.1"), kr_error(EINVAL));
+
+	/* Target must be an address of the same family */
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.0.0.0/8", "fd00::"), kr_error(EINVAL));
+	assert_int_equal(kr_policy_renumber_add(tbl, "fd00::/8", "192.168.0.0"), kr_error(EINVAL));
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.0.0.0/8", "bad"), kr_error(EINVAL));
+	assert_true(kr_policy_renumber_add(tbl, "10.0.0.0/40", "192.168.0.0") < 0);
+	assert_int_equal(kr_policy_renumber_name(tbl, NAME, "bad"), kr_error(EINVAL));
+
+	/* Rules may be replaced */
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.0.0.0/8", "192.168.0.0"), 0);
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.0.0.0/8", "172.16.0.0"), 0);
+	assert_int_equal(kr_policy_renumber_add(tbl, "fd00::/8", "2001:db8::"), 0);
+	assert_int_equal(kr_policy_renumber_name(tbl, NAME, "127.0.0.1"), 0);
+	assert_int_equal(kr_policy_renumber_name(tbl, NAME, "127.0.0.2"), 0);
+	assert_int_equal(kr_policy_renumber_name(tbl, NAME, "::1"), 0);
+
+	kr_policy_renumber_free(tbl);
+	kr_policy_renumber_free(NULL);
+}
+
+static void test_renumber_apply(void **state)
+{
+	struct kr_policy_renumber *tbl = kr_policy_renumber_new();
+	assert_non_null(tbl);
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.10.10.0/24", "192.168.1.0"), 0);
+	assert_int_equal(kr_policy_renumber_add(tbl, "172.16.0.0/12", "10.0.0.0"), 0);
+	assert_int_equal(kr_policy_renumber_add(tbl, "fd00::/8", "2001:db8::"), 0);
+	assert_int_equal(kr_policy_renumber_name(tbl, NAME_FIXED, "127.0.0.1"), 0);
+
+	knot_pkt_t *pkt = make_answer();
+	const char *v4[] = { "10.10.10.5", "172.31.1.1", "8.8.8.8" };
+	const char *v6[] = { "fd12::1", "2001:db8::1" };
+	const char *fixed[] = { "10.10.10.6" };
+	put_rr(pkt, NAME, KNOT_RRTYPE_A, v4, 3);
+	put_rr(pkt, NAME, KNOT_RRTYPE_AAAA, v6, 2);
+	put_rr(pkt, NAME_FIXED, KNOT_RRTYPE_A, fixed, 1);
+	assert_int_equal(kr_policy_renumber_apply(tbl, pkt), 4);
+
+	/* Prefix is replaced at bit granularity, the name rule replaces whole address */
+	const char *v4_expect[] = { "192.168.1.5", "10.15.1.1", "8.8.8.8" };
+	const char *v6_expect[] = { "2012::1", "2001:db8::1" };
+	const char *fixed_expect[] = { "127.0.0.1" };
+	check_addrs(pkt, 0, v4_expect, 3);
+	check_addrs(pkt, 1, v6_expect, 2);
+	check_addrs(pkt, 2, fixed_expect, 1);
+
+	/* Rewritten addresses don't match again */
+	assert_int_equal(kr_policy_renumber_apply(tbl, pkt), 1);
+	check_addrs(pkt, 2, fixed_expect, 1);
+
+	knot_pkt_free(&pkt);
+	kr_policy_renumber_free(tbl);
+}
+
+static void test_renumber_rrsig(void **state)
+{
+	struct kr_policy_renumber *tbl = kr_policy_renumber_new();
+	assert_non_null(tbl);
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.10.10.0/24", "192.168.1.0"), 0);
+
+	/* Signatures are kept if nothing is rewritten */
+	knot_pkt_t *pkt = make_answer();
+	const char *unmatched[] = { "8.8.8.8" };
+	put_rr(pkt, NAME, KNOT_RRTYPE_A, unmatched, 1);
+	put_rr(pkt, NAME, KNOT_RRTYPE_RRSIG, NULL, 1);
+	assert_int_equal(kr_policy_renumber_apply(tbl, pkt), 0);
+	assert_int_equal(knot_pkt_section(pkt, KNOT_ANSWER)->count, 2);
+	knot_pkt_free(&pkt);
+
+	/* Signatures of the rewritten records are stripped */
+	pkt = make_answer();
+	const char *matched[] = { "10.10.10.5" };
+	put_rr(pkt, NAME, KNOT_RRTYPE_A, matched, 1);
+	put_rr(pkt, NAME, KNOT_RRTYPE_RRSIG, NULL, 1);
+	assert_int_equal(kr_policy_renumber_apply(tbl, pkt), 1);
+	assert_int_equal(knot_pkt_section(pkt, KNOT_ANSWER)->count, 1);
+	const char *expect[] = { "192.168.1.5" };
+	check_addrs(pkt, 0, expect, 1);
+	knot_pkt_t *copy = reparse(pkt);
+	assert_int_equal(knot_pkt_section(copy, KNOT_ANSWER)->count, 1);
+	assert_int_equal(knot_wire_get_qdcount(copy->wire), 1);
+	assert_true(knot_dname_is_equal(knot_pkt_qname(copy), NAME));
+	knot_pkt_free(&copy);
+	knot_pkt_free(&pkt);
+
+	kr_policy_renumber_free(tbl);
+}
+
+static void test_renumber_longest(void **state)
+{
+	struct kr_policy_renumber *tbl = kr_policy_renumber_new();
+	assert_non_null(tbl);
+	/* Longest prefix wins regardless of the order of the rules */
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.0.0.0/8", "172.16.0.0"), 0);
+	assert_int_equal(kr_policy_renumber_add(tbl, "10.10.10.0/24", "192.168.1.0"), 0);
+
+	knot_pkt_t *pkt = make_answer();
+	const char *addrs[] = { "10.10.10.5", "10.1.1.1" };
+	put_rr(pkt, NAME, KNOT_RRTYPE_A, addrs, 2);
+	assert_int_equal(kr_policy_renumber_apply(tbl, pkt), 2);
+	const char *expect[] = { "192.168.1.5", "172.1.1.1" };
+	check_addrs(pkt, 0, expect, 2);
+
+	/* Record cut off in the wire is refused before its RDLENGTH is read */
+	const size_t pos = pkt->rr_info[knot_pkt_section(pkt, KNOT_ANSWER)->pos].pos;
+	pkt->size = pos + 4;
+	assert_int_equal(kr_policy_renumber_apply(tbl, pkt), kr_error(EILSEQ));
+
+	knot_pkt_free(&pkt);
+	kr_policy_renumber_free(tbl);
+}
+
+int main(void)
+{
+	const UnitTest tests[] = {
+		unit_test(test_renumber_add),
+		unit_test(test_renumber_apply),
+		unit_test(test_renumber_rrsig),
+		unit_test(test_renumber_longest),
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,205 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ucw/mempool.h>
+#include <libknot/packet/pkt.h>
+
+#include "tests/test.h"
+#include "lib/cache.h"
+#include "lib/module.h"
+#include "lib/resolve.h"
+#include "lib/layer.h"
+
+#define CACHE_SIZE (1024 * 1024)
+#define CACHE_TTL 3600
+#define CACHE_TIME 1000
+
+static struct kr_context global_ctx;
+static const char *global_env;
+
+/* Test names */
+#define N_A1 (const knot_dname_t *)"\x02""a1""\x04""test"
+#define N_B1 (const knot_dname_t *)"\x02""b1""\x04""test"
+#define N_C1 (const knot_dname_t *)"\x02""c1""\x04""test"
+#define N_A2 (const knot_dname_t *)"\x02""a2""\x04""test"
+#define N_B2 (const knot_dname_t *)"\x02""b2""\x04""test"
+#define N_C2 (const knot_dname_t *)"\x02""c2""\x04""test"
+#define N_A3 (const knot_dname_t *)"\x02""a3""\x04""test"
+#define N_B3 (const knot_dname_t *)"\x02""b3""\x04""test"
+
+#define RANK_SECURE (KR_RANK_AUTH|KR_RANK_SECURE)
+#define RANK_INSECURE (KR_RANK_AUTH|KR_RANK_INSECURE)
+
+static void insert_rr(const knot_dname_t *owner, uint16_t type, const uint8_t *rdata, uint16_t rdlen, uint8_t rank)
+{
+	knot_rrset_t *rr = knot_rrset_new(owner, type, KNOT_CLASS_IN, NULL);
+	assert_non_null(rr);
+	assert_int_equal(knot_rrset_add_rdata(rr, rdata, rdlen, CACHE_TTL, NULL), 0);
+	assert_int_equal(kr_cache_insert_rr(&global_ctx.cache, rr, rank, 0, CACHE_TIME), 0);
+	knot_rrset_free(&rr, NULL);
+}
+
+/** Insert fake RRSIG covering the given type (only the covered type is checked). */
+static void insert_rrsig(const knot_dname_t *owner, uint16_t covered)
+{
+	uint8_t rdata[18 + 6 + 4] = { covered >> 8, covered & 0xff, 8, 2 };
+	memcpy(rdata + 18, "\x04""test", 6);
+	knot_rrset_t *rr = knot_rrset_new(owner, KNOT_RRTYPE_RRSIG, KNOT_CLASS_IN, NULL);
+	assert_non_null(rr);
+	assert_int_equal(knot_rrset_add_rdata(rr, rdata, sizeof(rdata), CACHE_TTL, NULL), 0);
+	assert_int_equal(kr_cache_insert_rrsig(&global_ctx.cache, rr, RANK_SECURE, 0, CACHE_TIME), 0);
+	knot_rrset_free(&rr, NULL);
+}
+
+static void insert_cname(const knot_dname_t *owner, const knot_dname_t *target, uint8_t rank, bool signed_rr)
+{
+	insert_rr(owner, KNOT_RRTYPE_CNAME, target, knot_dname_size(target), rank);
+	if (signed_rr) {
+		insert_rrsig(owner, KNOT_RRTYPE_CNAME);
+	}
+}
+
+static void insert_a(const knot_dname_t *owner, uint8_t rank, bool signed_rr)
+{
+	static const uint8_t addr[4] = { 192, 0, 2, 1 };
+	insert_rr(owner, KNOT_RRTYPE_A, addr, sizeof(addr), rank);
+	if (signed_rr) {
+		insert_rrsig(owner, KNOT_RRTYPE_A);
+	}
+}
+
+/** Answer A query for the name from cache and return the answer section types. */
+static unsigned resolve_cached(const knot_dname_t *sname, uint16_t *types, unsigned max_types, uint32_t *flags)
+{
+	struct kr_module module;
+	assert_int_equal(kr_module_load(&module, "rrcache", NULL), 0);
+	const knot_layer_api_t *api = module.layer(&module);
+	assert_non_null(api);
+
+	struct mempool *mp = mp_new(4096);
+	struct kr_request req = {
+		.ctx = &global_ctx,
+		.pool = { .ctx = mp, .alloc = (knot_mm_alloc_t) mp_alloc },
+	};
+	kr_rplan_init(&req.rplan, &req, &req.pool);
+	struct kr_query *qry = kr_rplan_push(&req.rplan, NULL, sname, KNOT_CLASS_IN, KNOT_RRTYPE_A);
+	assert_non_null(qry);
+	qry->flags |= QUERY_DNSSEC_WANT;
+	qry->timestamp.tv_sec = CACHE_TIME + 1;
+	req.current_query = qry;
+
+	knot_pkt_t *pkt = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, &req.pool);
+	assert_non_null(pkt);
+	assert_int_equal(knot_pkt_put_question(pkt, sname, KNOT_CLASS_IN, KNOT_RRTYPE_A), 0);
+	knot_layer_t layer = { .mm = &req.pool, .state = KNOT_STATE_PRODUCE, .data = &req, .api = api };
+	assert_int_equal(api->produce(&layer, pkt), KNOT_STATE_DONE);
+
+	const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+	assert_true(an->count <= max_types);
+	for (unsigned i = 0; i < an->count; ++i) {
+		types[i] = knot_pkt_rr(an, i)->type;
+	}
+	*flags = qry->flags;
+	const unsigned count = an->count;
+
+	kr_rplan_deinit(&req.rplan);
+	mp_delete(mp);
+	kr_module_unload(&module);
+	return count;
+}
+
+static void test_chain_insecure_head(void **state)
+{
+	/* a1 (insecure) -> b1 (secure) -> c1 A (secure) */
+	insert_cname(N_A1, N_B1, RANK_INSECURE, false);
+	insert_cname(N_B1, N_C1, RANK_SECURE, true);
+	insert_a(N_C1, RANK_SECURE, true);
+
+	uint16_t types[8];
+	uint32_t flags = 0;
+	const uint16_t expect[] = {
+		KNOT_RRTYPE_CNAME,
+		KNOT_RRTYPE_CNAME, KNOT_RRTYPE_RRSIG,
+		KNOT_RRTYPE_A, KNOT_RRTYPE_RRSIG,
+	};
+	/* Secure steps keep their signatures after an insecure one. */
+	assert_int_equal(resolve_cached(N_A1, types, 8, &flags), 5);
+	assert_memory_equal(types, expect, sizeof(expect));
+	assert_true(flags & QUERY_DNSSEC_INSECURE);
+	assert_false(flags & QUERY_DNSSEC_WANT);
+}
+
+static void test_chain_insecure_middle(void **state)
+{
+	/* a2 (secure) -> b2 (insecure) -> c2 A (secure) */
+	insert_cname(N_A2, N_B2, RANK_SECURE, true);
+	insert_cname(N_B2, N_C2, RANK_INSECURE, false);
+	insert_a(N_C2, RANK_SECURE, true);
+
+	uint16_t types[8];
+	uint32_t flags = 0;
+	const uint16_t expect[] = {
+		KNOT_RRTYPE_CNAME, KNOT_RRTYPE_RRSIG,
+		KNOT_RRTYPE_CNAME,
+		KNOT_RRTYPE_A, KNOT_RRTYPE_RRSIG,
+	};
+	/* The whole answer is insecure, but signed steps are complete. */
+	assert_int_equal(resolve_cached(N_A2, types, 8, &flags), 5);
+	assert_memory_equal(types, expect, sizeof(expect));
+	assert_true(flags & QUERY_DNSSEC_INSECURE);
+}
+
+static void test_chain_missing_rrsig(void **state)
+{
+	/* a3 (secure) -> b3 A (secure, RRSIG missing) */
+	insert_cname(N_A3, N_B3, RANK_SECURE, true);
+	insert_a(N_B3, RANK_SECURE, false);
+
+	uint16_t types[8];
+	uint32_t flags = 0;
+	const uint16_t expect[] = { KNOT_RRTYPE_CNAME, KNOT_RRTYPE_RRSIG };
+	/* The chain ends before the incomplete step, the rest is left to iteration. */
+	assert_int_equal(resolve_cached(N_A3, types, 8, &flags), 2);
+	assert_memory_equal(types, expect, sizeof(expect));
+	assert_false(flags & QUERY_DNSSEC_INSECURE);
+}
+
+static void test_open(void **state)
+{
+	global_env = test_tmpdir_create();
+	assert_non_null(global_env);
+	struct kr_cdb_opts opts = { global_env, CACHE_SIZE };
+	assert_int_equal(kr_cache_open(&global_ctx.cache, NULL, &opts, NULL), 0);
+}
+
+static void test_close(void **state)
+{
+	kr_cache_close(&global_ctx.cache);
+	test_tmpdir_remove(global_env);
+}
+
+int main(void)
+{
+	const UnitTest tests[] = {
+		unit_test(test_open),
+		unit_test(test_chain_insecure_head),
+		unit_test(test_chain_insecure_middle),
+		unit_test(test_chain_missing_rrsig),
+		unit_test(test_close),
+	};
+
+	return run_tests(tests);
+}
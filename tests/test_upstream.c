@@ -0,0 +1,138 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tests/test.h"
+#include "daemon/upstream.h"
+
+static struct sockaddr_in addr_a;
+static struct sockaddr_in addr_b;
+
+#define A ((const struct sockaddr *)&addr_a)
+#define B ((const struct sockaddr *)&addr_b)
+
+static void addr_init(struct sockaddr_in *addr, const char *str)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(53);
+	assert_int_equal(inet_pton(AF_INET, str, &addr->sin_addr), 1);
+}
+
+static void test_disabled(void **state)
+{
+	struct upstreams upstreams;
+	assert_int_equal(upstreams_init(&upstreams, 16), 0);
+	/* Limits are disabled by default. */
+	assert_int_equal(upstreams.inflight_max, 0);
+	assert_int_equal(upstreams.qps_max, 0);
+	for (unsigned i = 0; i < 1000; ++i) {
+		assert_true(upstream_admit(&upstreams, A, 1000));
+	}
+	assert_int_equal(upstream_wait(&upstreams, A), 0);
+	assert_int_equal(upstream_get(&upstreams, A, false)->inflight, 1000);
+	upstream_release(&upstreams, A, 1000);
+	assert_int_equal(upstream_get(&upstreams, A, false)->inflight, 0);
+	upstreams_deinit(&upstreams);
+}
+
+static void test_inflight(void **state)
+{
+	struct upstreams upstreams;
+	assert_int_equal(upstreams_init(&upstreams, 16), 0);
+	upstreams.inflight_max = 2;
+	assert_true(upstream_admit(&upstreams, A, 1000));
+	assert_true(upstream_admit(&upstreams, A, 1000));
+	assert_false(upstream_admit(&upstreams, A, 1000));
+	/* Waits for a released transmission, not for a fixed interval. */
+	assert_true(upstream_wait(&upstreams, A) == UPSTREAM_WAKE);
+	upstream_release(&upstreams, A, 1);
+	assert_int_equal(upstream_wait(&upstreams, A), 0);
+	assert_true(upstream_admit(&upstreams, A, 1000));
+	upstreams_deinit(&upstreams);
+}
+
+static void test_pacing(void **state)
+{
+	struct upstreams upstreams;
+	assert_int_equal(upstreams_init(&upstreams, 16), 0);
+	upstreams.qps_max = 10; /* Burst of a single transmission */
+	assert_true(upstream_admit(&upstreams, A, 1000));
+	assert_false(upstream_admit(&upstreams, A, 1000));
+	/* Next transmission is possible after 1/10s. */
+	assert_int_equal(upstream_wait(&upstreams, A), 100);
+	assert_false(upstream_admit(&upstreams, A, 1050));
+	assert_int_equal(upstream_wait(&upstreams, A), 50);
+	assert_true(upstream_admit(&upstreams, A, 1100));
+	upstreams_deinit(&upstreams);
+}
+
+static void test_no_eviction(void **state)
+{
+	struct upstreams upstreams;
+	assert_int_equal(upstreams_init(&upstreams, 1), 0); /* All addresses collide */
+	upstreams.inflight_max = 1;
+	assert_true(upstream_admit(&upstreams, A, 1000));
+	/* Address in flight is never replaced, the colliding one can't bypass the limits. */
+	assert_false(upstream_admit(&upstreams, B, 1000));
+	assert_int_equal(upstream_wait(&upstreams, B), UPSTREAM_RETRY);
+	assert_non_null(upstream_get(&upstreams, A, false));
+	assert_false(upstream_admit(&upstreams, A, 1000));
+	/* Idle address may be replaced. */
+	upstream_release(&upstreams, A, 1);
+	assert_true(upstream_admit(&upstreams, B, 1000));
+	assert_null(upstream_get(&upstreams, A, false));
+	/* With the limits disabled, untracked address isn't held back. */
+	upstreams.inflight_max = 0;
+	assert_true(upstream_admit(&upstreams, A, 1000));
+	upstreams_deinit(&upstreams);
+}
+
+static void test_rto_deadline(void **state)
+{
+	uint64_t timeout = 0;
+	/* Retransmit interval within the deadline is kept. */
+	assert_true(upstream_rto_next(400, 0, 3000, &timeout));
+	assert_int_equal(timeout, 400);
+	assert_true(upstream_rto_next(1500, 1000, 3000, &timeout));
+	assert_int_equal(timeout, 1500);
+	/* Interval reaching past the deadline is clamped and the query times out. */
+	assert_false(upstream_rto_next(1500, 2000, 3000, &timeout));
+	assert_int_equal(timeout, 1000);
+	assert_false(upstream_rto_next(1000, 2000, 3000, &timeout));
+	assert_int_equal(timeout, 1000);
+	/* Deadline has passed already. */
+	assert_false(upstream_rto_next(400, 3500, 3000, &timeout));
+	assert_int_equal(timeout, 0);
+}
+
+int main(void)
+{
+	addr_init(&addr_a, "192.0.2.1");
+	addr_init(&addr_b, "192.0.2.2");
+
+	const UnitTest tests[] = {
+		unit_test(test_disabled),
+		unit_test(test_inflight),
+		unit_test(test_pacing),
+		unit_test(test_no_eviction),
+		unit_test(test_rto_deadline),
+	};
+
+	return run_tests(tests);
+}
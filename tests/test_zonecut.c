@@ -17,8 +17,18 @@
 #include <netinet/in.h>
 
 #include "tests/test.h"
+#include "lib/cache.h"
+#include "lib/resolve.h"
 #include "lib/zonecut.h"
 
+#define CACHE_SIZE (1024 * 1024)
+#define CACHE_TTL 3600
+#define CACHE_TIME 1000
+#define LRU_SIZE 16
+
+#define ZONE (const knot_dname_t *)"\x04""test"
+#define NS_NAME (const knot_dname_t *)"\x02""ns""\x04""test"
+
 static void test_zonecut_params(void **state)
 {
 	/* NULL args */
@@ -54,11 +64,93 @@ static void test_zonecut_copy(void **state)
 	kr_zonecut_deinit(&cut2);
 }
 
+static void insert_rr(struct kr_cache *cache, const knot_dname_t *owner, uint16_t type,
+                      const uint8_t *rdata, uint16_t rdlen)
+{
+	knot_rrset_t *rr = knot_rrset_new(owner, type, KNOT_CLASS_IN, NULL);
+	assert_non_null(rr);
+	assert_int_equal(knot_rrset_add_rdata(rr, rdata, rdlen, CACHE_TTL, NULL), 0);
+	assert_int_equal(kr_cache_insert_rr(cache, rr, KR_RANK_AUTH|KR_RANK_INSECURE, 0, CACHE_TIME), 0);
+	knot_rrset_free(&rr, NULL);
+}
+
+/** Find cached zone cut for the zone, return number of the NS addresses of given length. */
+static unsigned cached_addr(struct kr_context *ctx, size_t addr_len)
+{
+	struct kr_zonecut cut;
+	assert_int_equal(kr_zonecut_init(&cut, (const uint8_t *)"", NULL), 0);
+	bool secured = false;
+	assert_int_equal(kr_zonecut_find_cached(ctx, &cut, ZONE, CACHE_TIME + 1, &secured), 0);
+	pack_t *addr_set = kr_zonecut_find(&cut, NS_NAME);
+	assert_non_null(addr_set);
+	unsigned count = 0;
+	uint8_t *addr = pack_head(*addr_set);
+	while (addr != pack_tail(*addr_set)) {
+		count += (pack_obj_len(addr) == addr_len);
+		addr = pack_obj_next(addr);
+	}
+	kr_zonecut_deinit(&cut);
+	return count;
+}
+
+static void test_zonecut_cached(void **state)
+{
+	const char *path = test_tmpdir_create();
+	struct kr_cdb_opts opts = { path, CACHE_SIZE };
+	struct kr_context ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	assert_int_equal(kr_cache_open(&ctx.cache, NULL, &opts, NULL), 0);
+	ctx.cache_cut = malloc(lru_size(kr_zonecut_lru_t, LRU_SIZE));
+	ctx.cache_rep = malloc(lru_size(kr_nsrep_lru_t, LRU_SIZE));
+	assert_non_null(ctx.cache_cut);
+	assert_non_null(ctx.cache_rep);
+	lru_init(ctx.cache_cut, LRU_SIZE);
+	ctx.cache_cut->evict = kr_zonecut_lru_evict;
+	lru_init(ctx.cache_rep, LRU_SIZE);
+
+	const uint8_t addr4[4] = { 192, 0, 2, 1 };
+	const uint8_t addr6[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+	insert_rr(&ctx.cache, ZONE, KNOT_RRTYPE_NS, NS_NAME, knot_dname_size(NS_NAME));
+	insert_rr(&ctx.cache, NS_NAME, KNOT_RRTYPE_A, addr4, sizeof(addr4));
+	insert_rr(&ctx.cache, NS_NAME, KNOT_RRTYPE_AAAA, addr6, sizeof(addr6));
+
+	/* Delegation is remembered with addresses of both families, even if IPv6 is off. */
+	ctx.options = QUERY_NO_IPV6;
+	assert_int_equal(cached_addr(&ctx, sizeof(addr4)), 1);
+	assert_int_equal(cached_addr(&ctx, sizeof(addr6)), 0);
+	assert_int_equal(kr_cache_remove(&ctx.cache, KR_CACHE_RR, NS_NAME, KNOT_RRTYPE_A), 0);
+	assert_int_equal(kr_cache_remove(&ctx.cache, KR_CACHE_RR, NS_NAME, KNOT_RRTYPE_AAAA), 0);
+	ctx.options = 0;
+	assert_int_equal(cached_addr(&ctx, sizeof(addr4)), 1);
+	assert_int_equal(cached_addr(&ctx, sizeof(addr6)), 1);
+
+	/* Resolver options and the NS reputation filter the copied addresses. */
+	ctx.options = QUERY_NO_IPV4;
+	assert_int_equal(cached_addr(&ctx, sizeof(addr4)), 0);
+	assert_int_equal(cached_addr(&ctx, sizeof(addr6)), 1);
+	ctx.options = 0;
+	struct kr_nsrep_rep *rep = lru_set(ctx.cache_rep, (const char *)NS_NAME, knot_dname_size(NS_NAME));
+	assert_non_null(rep);
+	rep->flags = KR_NS_NOIP6;
+	assert_int_equal(cached_addr(&ctx, sizeof(addr4)), 1);
+	assert_int_equal(cached_addr(&ctx, sizeof(addr6)), 0);
+	rep->flags = 0;
+	assert_int_equal(cached_addr(&ctx, sizeof(addr6)), 1);
+
+	lru_deinit(ctx.cache_cut);
+	lru_deinit(ctx.cache_rep);
+	free(ctx.cache_cut);
+	free(ctx.cache_rep);
+	kr_cache_close(&ctx.cache);
+	test_tmpdir_remove(path);
+}
+
 int main(void)
 {
 	const UnitTest tests[] = {
 	        unit_test(test_zonecut_params),
-	        unit_test(test_zonecut_copy)
+	        unit_test(test_zonecut_copy),
+	        unit_test(test_zonecut_cached)
 	};
 
 	return run_tests(tests);
@@ -1,3 +1,10 @@
+# Platform-specific library injection
+ifeq ($(PLATFORM),Darwin)
+	preload_syms := DYLD_FORCE_FLAT_NAMESPACE=1 DYLD_LIBRARY_PATH="$(DYLD_LIBRARY_PATH):$(abspath lib)"
+else
+	preload_syms := LD_LIBRARY_PATH="$(LD_LIBRARY_PATH):$(abspath lib)"
+endif
+
 # Unit tests
 ifeq ($(HAS_cmocka), yes)
 include tests/unit.mk
@@ -5,6 +12,18 @@ else
 $(warning cmocka not found, skipping unit tests)
 endif
 
+# Configuration tests, executed by the daemon with C modules from the build tree
+config_TESTS := $(wildcard tests/config/*.test.lua)
+ifeq ($(PLATFORM),Darwin)
+	config_syms := DYLD_FORCE_FLAT_NAMESPACE=1 DYLD_LIBRARY_PATH="$(DYLD_LIBRARY_PATH):$(abspath lib):$(abspath modules/hints)"
+else
+	config_syms := LD_LIBRARY_PATH="$(LD_LIBRARY_PATH):$(abspath lib):$(abspath modules/hints)"
+endif
+check-config: $(kresd) $(hints)
+	@$(foreach test,$(config_TESTS),\
+		echo "[ config ] $(test)" && \
+		$(config_syms) SOURCE_PATH="$(abspath .)" $(abspath daemon/kresd) -c $(abspath $(test)) $$(mktemp -d) < /dev/null || exit 1;)
+
 # Integration tests with Deckard
 deckard_DIR := tests/deckard
 TESTS := sets/resolver
@@ -18,6 +37,9 @@ deckard: check-integration
 
 # Targets
 tests: check-unit
+ifeq ($(HAS_lua)|$(HAS_libuv), yes|yes)
+tests: check-config
+endif
 tests-clean: $(foreach test,$(tests_BIN),$(test)-clean) mock_cmodule-clean
 
-.PHONY: tests tests-clean check-integration deckard
+.PHONY: tests tests-clean check-config check-integration deckard
@@ -8,11 +8,30 @@ tests_BIN := \
 	test_array \
 	test_pack \
 	test_lru \
+	test_lpm \
 	test_utils \
 	test_module \
 	test_cache \
+	test_rrcache \
+	test_dnssec \
 	test_zonecut \
-	test_rplan
+	test_rplan \
+	test_upstream \
+	test_nsrep \
+	test_overload \
+	test_dns64 \
+	test_policy \
+	test_mirror \
+	test_hints_index
+
+# Daemon components and modules linked into the tests
+test_upstream_EXTRA := daemon/upstream.c
+test_overload_EXTRA := daemon/overload.c
+test_overload_EXTRA_LIBS := $(libuv_LIBS)
+test_dns64_EXTRA := modules/dns64/dns64.c
+test_mirror_EXTRA := daemon/mirror.c
+test_mirror_EXTRA_LIBS := $(libuv_LIBS)
+test_hints_index_EXTRA := modules/hints/hints_index.c
 
 mock_cmodule_CFLAGS := -fPIC
 mock_cmodule_SOURCES := tests/mock_cmodule.c
@@ -22,18 +41,11 @@ $(eval $(call make_lib,mock_cmodule,tests))
 tests_DEPEND := $(libkres) $(mock_cmodule) $(mock_gomodule)
 tests_LIBS :=  $(libkres_TARGET) $(libkres_LIBS) $(cmocka_LIBS) $(lmdb_LIBS)
 
-# Platform-specific library injection
-ifeq ($(PLATFORM),Darwin)
-	preload_syms := DYLD_FORCE_FLAT_NAMESPACE=1 DYLD_LIBRARY_PATH="$(DYLD_LIBRARY_PATH):$(abspath lib)"
-else
-	preload_syms := LD_LIBRARY_PATH="$(LD_LIBRARY_PATH):$(abspath lib)"
-endif
-
 # Make test binaries
 define make_test
 $(1)_CFLAGS := -fPIE
-$(1)_SOURCES := tests/$(1).c
-$(1)_LIBS := $(tests_LIBS)
+$(1)_SOURCES := tests/$(1).c $$($(1)_EXTRA)
+$(1)_LIBS := $(tests_LIBS) $$($(1)_EXTRA_LIBS)
 $(1)_DEPEND := $(tests_DEPEND)
 $(call make_bin,$(1),tests)
 $(1): $$($(1))